@@ -1,7 +1,9 @@
 #ifndef BOOT_IMAGE_H
 #define BOOT_IMAGE_H
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -19,6 +21,20 @@ namespace deepeye {
 #define BOOT_ARGS_SIZE 512
 #define BOOT_EXTRA_ARGS_SIZE 1024
 
+#define VENDOR_BOOT_MAGIC "VNDRBOOT"
+#define VENDOR_BOOT_MAGIC_SIZE 8
+#define VENDOR_BOOT_ARGS_SIZE 2048
+#define VENDOR_BOOT_NAME_SIZE 16
+
+#define VENDOR_RAMDISK_TYPE_NONE 0
+#define VENDOR_RAMDISK_TYPE_PLATFORM 1
+#define VENDOR_RAMDISK_TYPE_RECOVERY 2
+#define VENDOR_RAMDISK_TYPE_DLKM 3
+#define VENDOR_RAMDISK_NAME_SIZE 32
+#define VENDOR_RAMDISK_TABLE_ENTRY_BOARD_ID_SIZE 16
+
+// On-disk layouts are packed; v1/v2 append 64-bit fields at 4-byte offsets.
+#pragma pack(push, 1)
 struct boot_img_hdr_v0 {
   uint8_t magic[BOOT_MAGIC_SIZE];
   uint32_t kernel_size;
@@ -64,24 +80,179 @@ struct boot_img_hdr_v4 : public boot_img_hdr_v3 {
   uint32_t signature_size;
 };
 
+struct vendor_boot_img_hdr_v3 {
+  uint8_t magic[VENDOR_BOOT_MAGIC_SIZE];
+  uint32_t header_version;
+  uint32_t page_size;
+  uint32_t kernel_addr;
+  uint32_t ramdisk_addr;
+  uint32_t vendor_ramdisk_size;
+  uint8_t cmdline[VENDOR_BOOT_ARGS_SIZE];
+  uint32_t tags_addr;
+  uint8_t name[VENDOR_BOOT_NAME_SIZE];
+  uint32_t header_size;
+  uint32_t dtb_size;
+  uint64_t dtb_addr;
+};
+
+struct vendor_boot_img_hdr_v4 : public vendor_boot_img_hdr_v3 {
+  uint32_t vendor_ramdisk_table_size;
+  uint32_t vendor_ramdisk_table_entry_num;
+  uint32_t vendor_ramdisk_table_entry_size;
+  uint32_t bootconfig_size;
+};
+
+struct vendor_ramdisk_table_entry_v4 {
+  uint32_t ramdisk_size;
+  uint32_t ramdisk_offset; // relative to the start of the vendor ramdisk
+  uint32_t ramdisk_type;
+  uint8_t ramdisk_name[VENDOR_RAMDISK_NAME_SIZE];
+  uint32_t board_id[VENDOR_RAMDISK_TABLE_ENTRY_BOARD_ID_SIZE];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(boot_img_hdr_v0) == 1632, "v0 header layout");
+static_assert(sizeof(boot_img_hdr_v1) == 1648, "v1 header layout");
+static_assert(sizeof(boot_img_hdr_v2) == 1660, "v2 header layout");
+static_assert(sizeof(boot_img_hdr_v3) == 1580, "v3 header layout");
+static_assert(sizeof(boot_img_hdr_v4) == 1584, "v4 header layout");
+static_assert(sizeof(vendor_boot_img_hdr_v3) == 2112, "vendor v3 layout");
+static_assert(sizeof(vendor_boot_img_hdr_v4) == 2128, "vendor v4 layout");
+static_assert(sizeof(vendor_ramdisk_table_entry_v4) == 108,
+              "vendor ramdisk table entry layout");
+
+/**
+ * Read-only memory map of a whole file. Falls back to reading the file into
+ * memory when mmap is not possible (e.g. pipes).
+ */
+class MappedFile {
+public:
+  static std::shared_ptr<const MappedFile> open(const std::string &path);
+  ~MappedFile();
+
+  const uint8_t *data() const { return _data; }
+  size_t size() const { return _size; }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+private:
+  MappedFile() : _data(nullptr), _size(0), _mapped(false) {}
+  const uint8_t *_data;
+  size_t _size;
+  bool _mapped;
+  std::vector<uint8_t> _fallback;
+};
+
+/**
+ * One boot image component. Either a view into a MappedFile or an owned
+ * buffer; the first mutable access copies mapped bytes out (copy-on-write).
+ */
+class Component {
+public:
+  Component() : _view(nullptr), _view_size(0) {}
+
+  const uint8_t *data() const { return _map ? _view : _owned.data(); }
+  size_t size() const { return _map ? _view_size : _owned.size(); }
+  bool empty() const { return size() == 0; }
+  const uint8_t *begin() const { return data(); }
+  const uint8_t *end() const { return data() + size(); }
+  bool is_mapped() const { return _map != nullptr; }
+
+  std::vector<uint8_t> &mutable_bytes();
+  void assign(const uint8_t *src, size_t n);
+  void clear();
+  void map(std::shared_ptr<const MappedFile> file, size_t offset, size_t n);
+
+private:
+  std::vector<uint8_t> _owned;
+  std::shared_ptr<const MappedFile> _map;
+  const uint8_t *_view;
+  size_t _view_size;
+};
+
+struct VendorRamdisk {
+  std::string name;
+  uint32_t type;
+  uint32_t offset; // within BootImage::ramdisk
+  uint32_t size;
+  uint32_t board_id[VENDOR_RAMDISK_TABLE_ENTRY_BOARD_ID_SIZE];
+};
+
+/**
+ * boot.img (header v0-v4) or vendor_boot.img (v3-v4).
+ *
+ * Sections present per layout, each padded to page_size on disk:
+ *   boot v0-v2:  header | kernel | ramdisk | second | recovery_dtbo (v1+) |
+ *                dtb (v2)
+ *   boot v3-v4:  header | kernel | ramdisk | signature (v4)
+ *   vendor v3-4: header | ramdisk | dtb | ramdisk_table (v4) |
+ *                bootconfig (v4)
+ * followed by `tail` (e.g. an AVB footer), which is preserved verbatim.
+ */
 class BootImage {
 public:
+  enum class LoadMode {
+    Copy,   // components copied into owned buffers; file closed after load
+    Mapped, // components are views into an mmap of the file
+  };
+  enum class Kind { Boot, VendorBoot };
+
+  Kind kind;
   uint32_t version;
-  std::vector<uint8_t> kernel;
-  std::vector<uint8_t> ramdisk;
-  std::vector<uint8_t> dtb;
+  uint32_t page_size;
+  uint32_t os_version; // boot images only
+  // Raw header region as loaded. save() uses it as a template so fields the
+  // model does not interpret (load addresses, name, id) round-trip exactly.
+  Component header;
+  Component kernel;
+  Component ramdisk; // vendor_boot: all vendor ramdisks concatenated
+  Component second;
+  Component recovery_dtbo;
+  Component dtb;
+  Component signature;     // boot v4 boot signature
+  Component ramdisk_table; // vendor v4 vendor_ramdisk_table_entry_v4 array
+  Component bootconfig;    // vendor v4
+  Component tail;
   std::string cmdline;
 
-  BootImage() : version(0) {}
+  BootImage()
+      : kind(Kind::Boot), version(0), page_size(0), os_version(0),
+        _pad_final(true) {}
+
+  // Mapped mode parses the header in place and touches no component pages,
+  // so metadata-only scans cost about one page fault per image.
+  bool load(const std::string &path, LoadMode mode = LoadMode::Copy);
+  // Writes the header and every section with a single gathered write;
+  // padding comes from one shared zero page rather than per-section buffers.
+  // Goes through `path`.tmp and a rename, so saving over the file this
+  // image is mapped from is safe and a failed save leaves `path` intact.
+  bool save(const std::string &path) const;
+
+  // Parsed view of / replacement for ramdisk_table (vendor_boot v4).
+  std::vector<VendorRamdisk> vendor_ramdisks() const;
+  void set_vendor_ramdisks(const std::vector<VendorRamdisk> &entries);
 
-  bool load(const std::string &path);
-  bool save(const std::string &path);
+  // Copies every mapped component into owned storage and drops the mapping.
+  void materialize();
+  bool is_mapped() const;
 
   // Unpack components to directory
   bool unpack(const std::string &out_dir);
 
   // Repack from components
   bool repack(const std::string &in_dir);
+
+private:
+  // Sections after the header, in on-disk order.
+  static std::vector<Component BootImage::*> layout(Kind kind,
+                                                    uint32_t version);
+  uint32_t effective_page_size() const;
+  size_t header_region_size() const;
+  uint32_t ramdisk_table_entry_size() const;
+  std::vector<uint8_t> build_header() const;
+
+  bool _pad_final; // false if the loaded file ended without final padding
 };
 
 } // namespace deepeye
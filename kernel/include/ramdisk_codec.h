@@ -0,0 +1,64 @@
+#ifndef RAMDISK_CODEC_H
+#define RAMDISK_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace deepeye {
+
+/**
+ * Ramdisk compression formats found in boot/vendor_boot images, identified
+ * by their leading magic bytes.
+ */
+enum class RamdiskFormat {
+  Unknown,
+  Cpio,      // uncompressed newc/odc archive ("0707..")
+  Gzip,      // 1f 8b
+  Lz4Legacy, // 02 21 4c 18, independent 8 MiB blocks
+  Lzma,      // legacy .lzma (lzma_alone) header
+  Xz,        // fd 37 7a 58 5a 00
+};
+
+RamdiskFormat detect_ramdisk_format(const uint8_t *data, size_t size);
+const char *ramdisk_format_name(RamdiskFormat format);
+
+// Receives codec output in order. Returning false aborts the stream.
+typedef std::function<bool(const uint8_t *data, size_t size)> ByteSink;
+
+/**
+ * Streaming decoder/encoder. Feed input with update() in chunks of any size,
+ * then call finish() once; output is pushed to the sink as it is produced.
+ *
+ * threads == 0 uses every core. LZ4 legacy blocks and xz blocks are
+ * processed in parallel; gzip and lzma streams are inherently sequential.
+ */
+class RamdiskCodec {
+public:
+  virtual ~RamdiskCodec() {}
+  virtual bool update(const uint8_t *data, size_t size) = 0;
+  virtual bool finish() = 0;
+
+  // Cpio is a pass-through; Unknown yields nullptr.
+  static std::unique_ptr<RamdiskCodec>
+  decoder(RamdiskFormat format, ByteSink sink, unsigned threads = 0);
+  // level < 0 picks the format default (ignored for LZ4 legacy).
+  static std::unique_ptr<RamdiskCodec> encoder(RamdiskFormat format,
+                                               ByteSink sink, int level = -1,
+                                               unsigned threads = 0);
+};
+
+// Whole-buffer helpers. decompress_ramdisk sniffs the format and reports it
+// through `format` when non-null.
+bool decompress_ramdisk(const uint8_t *data, size_t size,
+                        std::vector<uint8_t> &out,
+                        RamdiskFormat *format = nullptr, unsigned threads = 0);
+bool compress_ramdisk(RamdiskFormat format, const uint8_t *data, size_t size,
+                      std::vector<uint8_t> &out, int level = -1,
+                      unsigned threads = 0);
+
+} // namespace deepeye
+
+#endif // RAMDISK_CODEC_H
@@ -1,8 +1,13 @@
 #include "../include/boot_image.h"
 #include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstring>
-#include <fstream>
-#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 namespace deepeye {
 
@@ -10,113 +15,490 @@ static size_t align_to_page(size_t size, uint32_t page_size) {
   return ((size + page_size - 1) / page_size) * page_size;
 }
 
-bool BootImage::load(const std::string &path) {
-  std::ifstream file(path, std::ios::binary);
-  if (!file)
-    return false;
+// --- MappedFile -------------------------------------------------------------
 
-  // Read magic and version first
-  uint8_t magic[8];
-  file.read(reinterpret_cast<char *>(magic), 8);
-  if (memcmp(magic, BOOT_MAGIC, 8) != 0)
-    return false;
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
 
-  // Get header version (offset 40 in v0-v2, offset 36 in v3-v4)
-  file.seekg(40);
-  file.read(reinterpret_cast<char *>(&version), 4);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return nullptr;
+  }
+  off_t size = st.st_size;
+  if (S_ISBLK(st.st_mode))
+    size = lseek(fd, 0, SEEK_END);
 
-  // Safety check for v3/v4 version location
-  if (version > 4) {
-    file.seekg(36);
-    file.read(reinterpret_cast<char *>(&version), 4);
+  std::shared_ptr<MappedFile> file(new MappedFile());
+  if (size > 0) {
+    void *addr = mmap(nullptr, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      file->_data = static_cast<const uint8_t *>(addr);
+      file->_size = (size_t)size;
+      file->_mapped = true;
+    }
   }
 
-  file.seekg(0);
-  if (version <= 2) {
-    boot_img_hdr_v2 hdr;
-    file.read(reinterpret_cast<char *>(&hdr), sizeof(hdr));
-
-    uint32_t page_size = hdr.page_size;
-
-    // Kernel
-    kernel.resize(hdr.kernel_size);
-    file.seekg(page_size);
-    file.read(reinterpret_cast<char *>(kernel.data()), hdr.kernel_size);
-
-    // Ramdisk
-    size_t ramdisk_offset =
-        align_to_page(page_size + hdr.kernel_size, page_size);
-    ramdisk.resize(hdr.ramdisk_size);
-    file.seekg(ramdisk_offset);
-    file.read(reinterpret_cast<char *>(ramdisk.data()), hdr.ramdisk_size);
-
-    // DTB (v2 only)
-    if (version == 2 && hdr.dtb_size > 0) {
-      size_t dtb_offset =
-          align_to_page(ramdisk_offset + hdr.ramdisk_size, page_size);
-      dtb.resize(hdr.dtb_size);
-      file.seekg(dtb_offset);
-      file.read(reinterpret_cast<char *>(dtb.data()), hdr.dtb_size);
+  if (!file->_mapped) {
+    uint8_t buf[64 * 1024];
+    ssize_t n;
+    lseek(fd, 0, SEEK_SET);
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0)
+      file->_fallback.insert(file->_fallback.end(), buf, buf + n);
+    file->_data = file->_fallback.data();
+    file->_size = file->_fallback.size();
+  }
+
+  // The mapping stays valid after the descriptor is closed.
+  ::close(fd);
+  return file;
+}
+
+MappedFile::~MappedFile() {
+  if (_mapped)
+    munmap(const_cast<uint8_t *>(_data), _size);
+}
+
+// --- Component --------------------------------------------------------------
+
+std::vector<uint8_t> &Component::mutable_bytes() {
+  if (_map) {
+    _owned.assign(_view, _view + _view_size);
+    _map.reset();
+    _view = nullptr;
+    _view_size = 0;
+  }
+  return _owned;
+}
+
+void Component::assign(const uint8_t *src, size_t n) {
+  _map.reset();
+  _view = nullptr;
+  _view_size = 0;
+  _owned.assign(src, src + n);
+}
+
+void Component::clear() {
+  _map.reset();
+  _view = nullptr;
+  _view_size = 0;
+  _owned.clear();
+}
+
+void Component::map(std::shared_ptr<const MappedFile> file, size_t offset,
+                    size_t n) {
+  _owned.clear();
+  _owned.shrink_to_fit();
+  _view = file->data() + offset;
+  _view_size = n;
+  _map = std::move(file);
+}
+
+// --- BootImage --------------------------------------------------------------
+
+static std::string read_cstr(const uint8_t *field, size_t cap) {
+  const char *s = reinterpret_cast<const char *>(field);
+  return std::string(s, strnlen(s, cap));
+}
+
+// Zero-fills the field and copies as much of `s` as fits, keeping a NUL.
+static void write_cstr(uint8_t *field, size_t cap, const std::string &s) {
+  memset(field, 0, cap);
+  memcpy(field, s.data(), std::min(s.size(), cap - 1));
+}
+
+// v0-v2 split the command line like mkbootimg: the first BOOT_ARGS_SIZE - 1
+// bytes go to cmdline, the remainder to extra_cmdline.
+static std::string read_boot_cmdline(const boot_img_hdr_v0 &hdr) {
+  return read_cstr(hdr.cmdline, BOOT_ARGS_SIZE) +
+         read_cstr(hdr.extra_cmdline, BOOT_EXTRA_ARGS_SIZE);
+}
+
+static void write_boot_cmdline(boot_img_hdr_v0 &hdr, const std::string &s) {
+  size_t split = std::min(s.size(), (size_t)BOOT_ARGS_SIZE - 1);
+  write_cstr(hdr.cmdline, BOOT_ARGS_SIZE, s.substr(0, split));
+  write_cstr(hdr.extra_cmdline, BOOT_EXTRA_ARGS_SIZE, s.substr(split));
+}
+
+static Component BootImage::*const kAllComponents[] = {
+    &BootImage::header,    &BootImage::kernel,        &BootImage::ramdisk,
+    &BootImage::second,    &BootImage::recovery_dtbo, &BootImage::dtb,
+    &BootImage::signature, &BootImage::ramdisk_table, &BootImage::bootconfig,
+    &BootImage::tail,
+};
+
+static bool valid_page_size(uint32_t pg) {
+  return pg >= 2048 && (pg & (pg - 1)) == 0;
+}
+
+std::vector<Component BootImage::*> BootImage::layout(Kind kind,
+                                                      uint32_t version) {
+  std::vector<Component BootImage::*> order;
+  if (kind == Kind::VendorBoot) {
+    order.push_back(&BootImage::ramdisk);
+    order.push_back(&BootImage::dtb);
+    if (version >= 4) {
+      order.push_back(&BootImage::ramdisk_table);
+      order.push_back(&BootImage::bootconfig);
+    }
+  } else if (version <= 2) {
+    order.push_back(&BootImage::kernel);
+    order.push_back(&BootImage::ramdisk);
+    order.push_back(&BootImage::second);
+    if (version >= 1)
+      order.push_back(&BootImage::recovery_dtbo);
+    if (version == 2)
+      order.push_back(&BootImage::dtb);
+  } else {
+    order.push_back(&BootImage::kernel);
+    order.push_back(&BootImage::ramdisk);
+    if (version >= 4)
+      order.push_back(&BootImage::signature);
+  }
+  return order;
+}
+
+uint32_t BootImage::effective_page_size() const {
+  if (kind == Kind::Boot && version >= 3)
+    return 4096; // Fixed in v3+
+  if (page_size)
+    return page_size;
+  return kind == Kind::Boot ? 2048 : 4096;
+}
+
+size_t BootImage::header_region_size() const {
+  uint32_t pg = effective_page_size();
+  if (kind == Kind::VendorBoot)
+    return align_to_page(version >= 4 ? sizeof(vendor_boot_img_hdr_v4)
+                                      : sizeof(vendor_boot_img_hdr_v3),
+                         pg);
+  return pg;
+}
+
+uint32_t BootImage::ramdisk_table_entry_size() const {
+  if (kind == Kind::VendorBoot && version >= 4 &&
+      header.size() >= sizeof(vendor_boot_img_hdr_v4)) {
+    vendor_boot_img_hdr_v4 hdr;
+    memcpy(&hdr, header.data(), sizeof(hdr));
+    if (hdr.vendor_ramdisk_table_entry_size >=
+        sizeof(vendor_ramdisk_table_entry_v4))
+      return hdr.vendor_ramdisk_table_entry_size;
+  }
+  return sizeof(vendor_ramdisk_table_entry_v4);
+}
+
+bool BootImage::load(const std::string &path, LoadMode mode) {
+  std::shared_ptr<const MappedFile> file = MappedFile::open(path);
+  if (!file || file->size() < sizeof(boot_img_hdr_v3))
+    return false;
+
+  const uint8_t *base = file->data();
+  Kind k;
+  uint32_t ver, pg, osv = 0;
+  std::vector<size_t> sizes;
+  std::string args;
+
+  if (memcmp(base, BOOT_MAGIC, BOOT_MAGIC_SIZE) == 0) {
+    k = Kind::Boot;
+    // header_version sits at offset 40 in every boot layout (v0-v4).
+    memcpy(&ver, base + 40, sizeof(ver));
+    if (ver > 4)
+      return false;
+
+    if (ver <= 2) {
+      boot_img_hdr_v2 hdr;
+      memset(&hdr, 0, sizeof(hdr));
+      memcpy(&hdr, base, std::min(sizeof(hdr), file->size()));
+      pg = hdr.page_size;
+      if (!valid_page_size(pg))
+        return false;
+      osv = hdr.os_version;
+      sizes.push_back(hdr.kernel_size);
+      sizes.push_back(hdr.ramdisk_size);
+      sizes.push_back(hdr.second_size);
+      if (ver >= 1)
+        sizes.push_back(hdr.recovery_dtbo_size);
+      if (ver == 2)
+        sizes.push_back(hdr.dtb_size);
+      args = read_boot_cmdline(hdr);
+    } else {
+      boot_img_hdr_v4 hdr;
+      memset(&hdr, 0, sizeof(hdr));
+      memcpy(&hdr, base, std::min(sizeof(hdr), file->size()));
+      pg = 4096;
+      osv = hdr.os_version;
+      sizes.push_back(hdr.kernel_size);
+      sizes.push_back(hdr.ramdisk_size);
+      if (ver == 4)
+        sizes.push_back(hdr.signature_size);
+      args = read_cstr(hdr.cmdline, sizeof(hdr.cmdline));
     }
+  } else if (memcmp(base, VENDOR_BOOT_MAGIC, VENDOR_BOOT_MAGIC_SIZE) == 0) {
+    k = Kind::VendorBoot;
+    memcpy(&ver, base + VENDOR_BOOT_MAGIC_SIZE, sizeof(ver));
+    if (ver < 3 || ver > 4)
+      return false;
 
-    cmdline = reinterpret_cast<char *>(hdr.cmdline);
+    vendor_boot_img_hdr_v4 hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(&hdr, base, std::min(sizeof(hdr), file->size()));
+    pg = hdr.page_size;
+    if (!valid_page_size(pg))
+      return false;
+    sizes.push_back(hdr.vendor_ramdisk_size);
+    sizes.push_back(hdr.dtb_size);
+    if (ver == 4) {
+      sizes.push_back(hdr.vendor_ramdisk_table_size);
+      sizes.push_back(hdr.bootconfig_size);
+    }
+    args = read_cstr(hdr.cmdline, sizeof(hdr.cmdline));
   } else {
-    // V3/V4 Implementation
-    boot_img_hdr_v4 hdr;
-    file.read(reinterpret_cast<char *>(&hdr), sizeof(hdr));
+    return false;
+  }
 
-    uint32_t page_size = 4096; // Fixed in v3+
+  size_t offset = pg;
+  if (k == Kind::VendorBoot)
+    offset = align_to_page(ver >= 4 ? sizeof(vendor_boot_img_hdr_v4)
+                                    : sizeof(vendor_boot_img_hdr_v3),
+                           pg);
+  const size_t header_len = offset;
+  if (header_len > file->size())
+    return false;
 
-    kernel.resize(hdr.kernel_size);
-    file.seekg(page_size);
-    file.read(reinterpret_cast<char *>(kernel.data()), hdr.kernel_size);
+  std::vector<size_t> offsets;
+  size_t data_end = offset;
+  for (size_t sz : sizes) {
+    if (sz && (offset > file->size() || sz > file->size() - offset))
+      return false;
+    offsets.push_back(offset);
+    if (sz)
+      data_end = offset + sz;
+    offset += align_to_page(sz, pg);
+  }
 
-    size_t ramdisk_offset =
-        align_to_page(page_size + hdr.kernel_size, page_size);
-    ramdisk.resize(hdr.ramdisk_size);
-    file.seekg(ramdisk_offset);
-    file.read(reinterpret_cast<char *>(ramdisk.data()), hdr.ramdisk_size);
+  // Anything past the last section's padding (AVB footer, partition slack)
+  // is kept verbatim. Images whose final padding is truncated keep the
+  // partial padding in the tail instead.
+  size_t aligned_end = align_to_page(data_end, pg);
+  size_t tail_start = aligned_end <= file->size() ? aligned_end : data_end;
+  _pad_final = aligned_end <= file->size();
 
-    cmdline = reinterpret_cast<char *>(hdr.cmdline);
+  kind = k;
+  version = ver;
+  page_size = pg;
+  os_version = osv;
+  cmdline = args;
+
+  for (Component BootImage::*m : kAllComponents)
+    (this->*m).clear();
+
+  header.map(file, 0, header_len);
+  std::vector<Component BootImage::*> order = layout(kind, version);
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (sizes[i])
+      (this->*order[i]).map(file, offsets[i], sizes[i]);
   }
+  if (tail_start < file->size())
+    tail.map(file, tail_start, file->size() - tail_start);
 
+  if (mode == LoadMode::Copy)
+    materialize();
   return true;
 }
 
-bool BootImage::save(const std::string &path) {
-  std::ofstream file(path, std::ios::binary);
-  if (!file)
-    return false;
-
-  uint32_t page_size = (version <= 2) ? 2048 : 4096;
+std::vector<uint8_t> BootImage::build_header() const {
+  std::vector<uint8_t> out(header_region_size(), 0);
+  if (!header.empty())
+    memcpy(out.data(), header.data(), std::min(header.size(), out.size()));
 
-  if (version <= 2) {
+  const uint32_t pg = effective_page_size();
+  if (kind == Kind::VendorBoot) {
+    vendor_boot_img_hdr_v4 hdr;
+    memcpy(&hdr, out.data(), sizeof(hdr));
+    memcpy(hdr.magic, VENDOR_BOOT_MAGIC, VENDOR_BOOT_MAGIC_SIZE);
+    hdr.header_version = version;
+    hdr.page_size = pg;
+    hdr.vendor_ramdisk_size = ramdisk.size();
+    if (read_cstr(hdr.cmdline, sizeof(hdr.cmdline)) != cmdline)
+      write_cstr(hdr.cmdline, sizeof(hdr.cmdline), cmdline);
+    hdr.dtb_size = dtb.size();
+    size_t len = sizeof(vendor_boot_img_hdr_v3);
+    if (version >= 4) {
+      uint32_t entry_size = ramdisk_table_entry_size();
+      hdr.vendor_ramdisk_table_size = ramdisk_table.size();
+      hdr.vendor_ramdisk_table_entry_num = ramdisk_table.size() / entry_size;
+      hdr.vendor_ramdisk_table_entry_size = entry_size;
+      hdr.bootconfig_size = bootconfig.size();
+      len = sizeof(vendor_boot_img_hdr_v4);
+    }
+    hdr.header_size = len;
+    memcpy(out.data(), &hdr, len);
+  } else if (version <= 2) {
     boot_img_hdr_v2 hdr;
-    memset(&hdr, 0, sizeof(hdr));
-    memcpy(hdr.magic, BOOT_MAGIC, 8);
+    memcpy(&hdr, out.data(), sizeof(hdr));
+    memcpy(hdr.magic, BOOT_MAGIC, BOOT_MAGIC_SIZE);
     hdr.kernel_size = kernel.size();
     hdr.ramdisk_size = ramdisk.size();
-    hdr.dtb_size = dtb.size();
-    hdr.page_size = page_size;
+    hdr.second_size = second.size();
+    hdr.page_size = pg;
+    hdr.header_version = version;
+    hdr.os_version = os_version;
+    if (read_boot_cmdline(hdr) != cmdline)
+      write_boot_cmdline(hdr, cmdline);
+    size_t len = sizeof(boot_img_hdr_v0);
+    if (version >= 1) {
+      hdr.recovery_dtbo_size = recovery_dtbo.size();
+      if (!recovery_dtbo.empty())
+        hdr.recovery_dtbo_offset = pg + align_to_page(kernel.size(), pg) +
+                                   align_to_page(ramdisk.size(), pg) +
+                                   align_to_page(second.size(), pg);
+      len = sizeof(boot_img_hdr_v1);
+    }
+    if (version == 2) {
+      hdr.dtb_size = dtb.size();
+      len = sizeof(boot_img_hdr_v2);
+    }
+    if (version >= 1)
+      hdr.header_size = len;
+    memcpy(out.data(), &hdr, len);
+  } else {
+    boot_img_hdr_v4 hdr;
+    memcpy(&hdr, out.data(), sizeof(hdr));
+    memcpy(hdr.magic, BOOT_MAGIC, BOOT_MAGIC_SIZE);
+    hdr.kernel_size = kernel.size();
+    hdr.ramdisk_size = ramdisk.size();
+    hdr.os_version = os_version;
     hdr.header_version = version;
-    strncpy(reinterpret_cast<char *>(hdr.cmdline), cmdline.c_str(),
-            BOOT_ARGS_SIZE - 1);
-
-    file.write(reinterpret_cast<char *>(&hdr),
-               page_size); // Header padded to page
-    file.write(reinterpret_cast<char *>(kernel.data()), kernel.size());
-
-    // Padding
-    size_t k_pad = align_to_page(kernel.size(), page_size) - kernel.size();
-    if (k_pad > 0) {
-      std::vector<uint8_t> pad(k_pad, 0);
-      file.write(reinterpret_cast<char *>(pad.data()), k_pad);
+    if (read_cstr(hdr.cmdline, sizeof(hdr.cmdline)) != cmdline)
+      write_cstr(hdr.cmdline, sizeof(hdr.cmdline), cmdline);
+    size_t len = sizeof(boot_img_hdr_v3);
+    if (version == 4) {
+      hdr.signature_size = signature.size();
+      len = sizeof(boot_img_hdr_v4);
     }
+    hdr.header_size = len;
+    memcpy(out.data(), &hdr, len);
+  }
+  return out;
+}
 
-    file.write(reinterpret_cast<char *>(ramdisk.data()), ramdisk.size());
+bool BootImage::save(const std::string &path) const {
+  if ((kind == Kind::Boot && version > 4) ||
+      (kind == Kind::VendorBoot && (version < 3 || version > 4)) ||
+      !valid_page_size(effective_page_size()))
+    return false;
+
+  const uint32_t pg = effective_page_size();
+  const std::vector<uint8_t> hdr = build_header();
+  const std::vector<uint8_t> zero_page(pg, 0);
+
+  std::vector<const Component *> present;
+  for (Component BootImage::*m : layout(kind, version)) {
+    if (!(this->*m).empty())
+      present.push_back(&(this->*m));
   }
 
-  return true;
+  std::vector<struct iovec> iov;
+  iov.push_back({const_cast<uint8_t *>(hdr.data()), hdr.size()});
+  for (size_t i = 0; i < present.size(); ++i) {
+    const Component *c = present[i];
+    iov.push_back({const_cast<uint8_t *>(c->data()), c->size()});
+    size_t pad = align_to_page(c->size(), pg) - c->size();
+    if (pad && (i + 1 < present.size() || _pad_final))
+      iov.push_back({const_cast<uint8_t *>(zero_page.data()), pad});
+  }
+  if (!tail.empty())
+    iov.push_back({const_cast<uint8_t *>(tail.data()), tail.size()});
+
+  // Components may still be views of `path` itself; truncating it would
+  // pull the data out from under the write. The new image replaces it only
+  // once complete.
+  const std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+
+  size_t idx = 0;
+  bool ok = true;
+  while (idx < iov.size()) {
+    int batch = (int)std::min<size_t>(iov.size() - idx, IOV_MAX);
+    ssize_t n = ::writev(fd, &iov[idx], batch);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      ok = false;
+      break;
+    }
+    // Advance past fully written vectors; trim a partially written one.
+    size_t left = (size_t)n;
+    while (idx < iov.size() && left >= iov[idx].iov_len) {
+      left -= iov[idx].iov_len;
+      ++idx;
+    }
+    if (left) {
+      iov[idx].iov_base = static_cast<uint8_t *>(iov[idx].iov_base) + left;
+      iov[idx].iov_len -= left;
+    }
+  }
+
+  if (ok && ::fsync(fd) != 0)
+    ok = false;
+  if (::close(fd) != 0)
+    ok = false;
+  if (ok && ::rename(tmp.c_str(), path.c_str()) != 0)
+    ok = false;
+  if (!ok)
+    ::unlink(tmp.c_str());
+  return ok;
+}
+
+std::vector<VendorRamdisk> BootImage::vendor_ramdisks() const {
+  std::vector<VendorRamdisk> entries;
+  const uint32_t entry_size = ramdisk_table_entry_size();
+  for (size_t off = 0; off + entry_size <= ramdisk_table.size();
+       off += entry_size) {
+    vendor_ramdisk_table_entry_v4 raw;
+    memcpy(&raw, ramdisk_table.data() + off, sizeof(raw));
+    VendorRamdisk e;
+    e.name = read_cstr(raw.ramdisk_name, VENDOR_RAMDISK_NAME_SIZE);
+    e.type = raw.ramdisk_type;
+    e.offset = raw.ramdisk_offset;
+    e.size = raw.ramdisk_size;
+    memcpy(e.board_id, raw.board_id, sizeof(e.board_id));
+    entries.push_back(e);
+  }
+  return entries;
+}
+
+void BootImage::set_vendor_ramdisks(const std::vector<VendorRamdisk> &entries) {
+  const uint32_t entry_size = ramdisk_table_entry_size();
+  std::vector<uint8_t> &table = ramdisk_table.mutable_bytes();
+  table.assign(entries.size() * entry_size, 0);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    vendor_ramdisk_table_entry_v4 raw;
+    memset(&raw, 0, sizeof(raw));
+    raw.ramdisk_size = entries[i].size;
+    raw.ramdisk_offset = entries[i].offset;
+    raw.ramdisk_type = entries[i].type;
+    write_cstr(raw.ramdisk_name, VENDOR_RAMDISK_NAME_SIZE, entries[i].name);
+    memcpy(raw.board_id, entries[i].board_id, sizeof(raw.board_id));
+    memcpy(table.data() + i * entry_size, &raw, sizeof(raw));
+  }
+}
+
+void BootImage::materialize() {
+  for (Component BootImage::*m : kAllComponents)
+    (this->*m).mutable_bytes();
+}
+
+bool BootImage::is_mapped() const {
+  for (Component BootImage::*m : kAllComponents) {
+    if ((this->*m).is_mapped())
+      return true;
+  }
+  return false;
 }
 
 } // namespace deepeye
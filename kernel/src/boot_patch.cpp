@@ -1,8 +1,11 @@
+#include "../include/boot_image.h"
+#include "../include/ramdisk_codec.h"
 #include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <sys/stat.h>
 #include <vector>
 
 /**
@@ -33,6 +36,13 @@ private:
   std::string m_inputPath;
   boot_img_hdr_v0 m_header;
 
+  // Whether both paths name the same existing file (links included).
+  static bool same_file(const std::string &a, const std::string &b) {
+    struct stat sa, sb;
+    return stat(a.c_str(), &sa) == 0 && stat(b.c_str(), &sb) == 0 &&
+           sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+  }
+
 public:
   bool load(const std::string &path) {
     m_inputPath = path;
@@ -68,17 +78,45 @@ public:
     std::cout << "[+] Patching for Magisk/DeepEye Root..." << std::endl;
     // 1. Locate ramdisk segment based on page_size alignment
     std::cout << "[*] Analyzing segments..." << std::endl;
+    deepeye::BootImage image;
+    if (!image.load(m_inputPath, deepeye::BootImage::LoadMode::Mapped)) {
+      std::cerr << "[-] Error: Unsupported boot image layout." << std::endl;
+      return false;
+    }
+
     // 2. Decompress ramdisk (GZIP/LZ4/LZMA)
+    std::vector<uint8_t> cpio;
+    deepeye::RamdiskFormat format = deepeye::RamdiskFormat::Cpio;
+    if (!image.ramdisk.empty()) {
+      if (!deepeye::decompress_ramdisk(image.ramdisk.data(),
+                                       image.ramdisk.size(), cpio, &format)) {
+        std::cerr << "[-] Error: Unsupported ramdisk compression ("
+                  << deepeye::ramdisk_format_name(format) << ")." << std::endl;
+        return false;
+      }
+      std::cout << "[*] Ramdisk: " << deepeye::ramdisk_format_name(format)
+                << ", " << image.ramdisk.size() << " -> " << cpio.size()
+                << " bytes" << std::endl;
+    }
+
     // 3. Inject magiskinit and patch init.rc logic
     // 4. Repack CPIO and update header metadata
+    if (!image.ramdisk.empty()) {
+      std::vector<uint8_t> packed;
+      if (!deepeye::compress_ramdisk(format, cpio.data(), cpio.size(),
+                                     packed))
+        return false;
+      image.ramdisk.assign(packed.data(), packed.size());
+    }
     // 5. Recompute SHA1/SHA256 checksums in header v2+
 
-    std::ofstream out(outputPath, std::ios::binary);
-    if (!out)
+    // Patching in place: the kernel and DTB are still views of the input.
+    if (same_file(m_inputPath, outputPath))
+      image.materialize();
+    if (!image.save(outputPath)) {
+      std::cerr << "[-] Error: Cannot write " << outputPath << std::endl;
       return false;
-
-    // Write patched header and data (simplified for foundation)
-    out.write(reinterpret_cast<const char *>(&m_header), sizeof(m_header));
+    }
     std::cout << "[+] Patched image saved to " << outputPath << std::endl;
     return true;
   }
@@ -114,9 +152,11 @@ int main(int argc, char *argv[]) {
                 << std::endl;
       return 1;
     }
-    patcher.patch_magisk(argv[3]);
+    if (!patcher.patch_magisk(argv[3]))
+      return 1;
   } else {
     show_usage();
+    return 1;
   }
 
   return 0;
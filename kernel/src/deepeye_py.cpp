@@ -1,34 +1,299 @@
 #include "../include/boot_image.h"
+#include "../include/ramdisk_codec.h"
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
 
 namespace py = pybind11;
 
+namespace {
+
+// BootImage plus the number of live buffer exports. Like bytearray, a
+// component cannot be replaced while a memoryview still points into it.
+struct PyBootImage : public deepeye::BootImage {
+  size_t live_views = 0;
+};
+
+// Read-only buffer-protocol object over one component's native storage
+// (owned buffer or file mapping). Holds a reference to the owning BootImage
+// so the storage outlives it.
+struct ComponentView {
+  py::object owner;
+  const uint8_t *data;
+  size_t size;
+
+  ComponentView(py::object o, const deepeye::Component &v)
+      : owner(std::move(o)), data(v.data()), size(v.size()) {
+    owner.cast<PyBootImage &>().live_views++;
+  }
+  ~ComponentView() { owner.cast<PyBootImage &>().live_views--; }
+  ComponentView(const ComponentView &) = delete;
+  ComponentView &operator=(const ComponentView &) = delete;
+};
+
+typedef deepeye::Component deepeye::BootImage::*Component;
+
+py::memoryview view_component(py::object self, Component member) {
+  auto &img = self.cast<PyBootImage &>();
+  py::object view = py::cast(
+      std::unique_ptr<ComponentView>(new ComponentView(self, img.*member)));
+  return py::memoryview(view);
+}
+
+void assign_component(PyBootImage &self, Component member, py::buffer b) {
+  if (self.live_views)
+    throw py::buffer_error(
+        "BootImage component has live memoryviews; release them first");
+  py::buffer_info info = b.request();
+  const uint8_t *src = static_cast<const uint8_t *>(info.ptr);
+  (self.*member).assign(src, info.size * info.itemsize);
+}
+
+unsigned resolve_threads(unsigned requested, size_t jobs) {
+  unsigned n = requested ? requested : std::thread::hardware_concurrency();
+  n = std::max(1u, n);
+  return (unsigned)std::min<size_t>(n, std::max<size_t>(jobs, 1));
+}
+
+// Runs fn(i) for i in [0, count) across `threads` workers. Callers must not
+// touch Python objects inside fn; the GIL is released for the duration.
+template <typename Fn>
+void parallel_for(size_t count, unsigned threads, Fn fn) {
+  py::gil_scoped_release release;
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < count; i = next++)
+      fn(i);
+  };
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; ++t)
+    pool.emplace_back(worker);
+  worker();
+  for (auto &th : pool)
+    th.join();
+}
+
+} // namespace
+
 PYBIND11_MODULE(deepeye_kernel, m) {
   m.doc() = "DeepEyeUnlocker Kernel Tool Python Bindings";
 
-  py::class_<deepeye::BootImage>(m, "BootImage")
-      .def(py::init<>())
-      .def_readwrite("version", &deepeye::BootImage::version)
-      .def_readwrite("cmdline", &deepeye::BootImage::cmdline)
-      .def("load", &deepeye::BootImage::load, "Load boot image from path")
-      .def("save", &deepeye::BootImage::save, "Save boot image to path")
-      .def_property(
-          "kernel",
-          [](deepeye::BootImage &self) {
-            return py::bytes((char *)self.kernel.data(), self.kernel.size());
+  py::class_<ComponentView, std::unique_ptr<ComponentView>>(
+      m, "ComponentView", py::buffer_protocol())
+      .def_buffer([](ComponentView &v) {
+        return py::buffer_info(const_cast<uint8_t *>(v.data), 1,
+                               py::format_descriptor<uint8_t>::format(), 1,
+                               {(py::ssize_t)v.size}, {(py::ssize_t)1},
+                               /*readonly=*/true);
+      })
+      .def("__len__", [](const ComponentView &v) { return v.size; });
+
+  py::class_<PyBootImage> boot_image(m, "BootImage");
+  boot_image.def(py::init<>())
+      .def_readwrite("version", &PyBootImage::version)
+      .def_readwrite("cmdline", &PyBootImage::cmdline)
+      .def_readonly("page_size", &PyBootImage::page_size)
+      .def_readonly("os_version", &PyBootImage::os_version)
+      .def(
+          "load",
+          [](PyBootImage &self, const std::string &path, bool mmap) {
+            if (self.live_views)
+              throw py::buffer_error(
+                  "BootImage has live memoryviews; release them first");
+            py::gil_scoped_release release;
+            return self.load(path, mmap ? deepeye::BootImage::LoadMode::Mapped
+                                        : deepeye::BootImage::LoadMode::Copy);
           },
-          [](deepeye::BootImage &self, py::bytes b) {
-            std::string s = b;
-            self.kernel.assign(s.begin(), s.end());
-          })
-      .def_property(
-          "ramdisk",
-          [](deepeye::BootImage &self) {
-            return py::bytes((char *)self.ramdisk.data(), self.ramdisk.size());
+          py::arg("path"), py::arg("mmap") = false,
+          "Load boot image from path; mmap=True maps the file and exposes "
+          "components as views into the mapping")
+      .def(
+          "materialize",
+          [](PyBootImage &self) {
+            if (self.live_views)
+              throw py::buffer_error(
+                  "BootImage has live memoryviews; release them first");
+            self.materialize();
           },
-          [](deepeye::BootImage &self, py::bytes b) {
-            std::string s = b;
-            self.ramdisk.assign(s.begin(), s.end());
-          });
+          "Copy mapped components into owned buffers and drop the mapping")
+      .def_property_readonly("is_mapped", &PyBootImage::is_mapped)
+      .def(
+          "save",
+          [](PyBootImage &self, const std::string &path) {
+            py::gil_scoped_release release;
+            return self.save(path);
+          },
+          "Save boot image to path")
+      .def_property_readonly("is_vendor_boot",
+                             [](const PyBootImage &self) {
+                               return self.kind ==
+                                      deepeye::BootImage::Kind::VendorBoot;
+                             });
+
+  // Components are exposed as read-only memoryviews over the native buffers
+  // (or the file mapping); use bytes(img.kernel) for an owned copy.
+  const std::pair<const char *, Component> components[] = {
+      {"kernel", &deepeye::BootImage::kernel},
+      {"ramdisk", &deepeye::BootImage::ramdisk},
+      {"second", &deepeye::BootImage::second},
+      {"recovery_dtbo", &deepeye::BootImage::recovery_dtbo},
+      {"dtb", &deepeye::BootImage::dtb},
+      {"signature", &deepeye::BootImage::signature},
+      {"ramdisk_table", &deepeye::BootImage::ramdisk_table},
+      {"bootconfig", &deepeye::BootImage::bootconfig},
+      {"tail", &deepeye::BootImage::tail},
+  };
+  for (const auto &c : components) {
+    Component member = c.second;
+    boot_image.def_property(
+        c.first,
+        [member](py::object self) { return view_component(self, member); },
+        [member](PyBootImage &self, py::buffer b) {
+          assign_component(self, member, b);
+        });
+  }
+
+  py::enum_<deepeye::RamdiskFormat>(m, "RamdiskFormat")
+      .value("Unknown", deepeye::RamdiskFormat::Unknown)
+      .value("Cpio", deepeye::RamdiskFormat::Cpio)
+      .value("Gzip", deepeye::RamdiskFormat::Gzip)
+      .value("Lz4Legacy", deepeye::RamdiskFormat::Lz4Legacy)
+      .value("Lzma", deepeye::RamdiskFormat::Lzma)
+      .value("Xz", deepeye::RamdiskFormat::Xz);
+
+  m.def(
+      "detect_ramdisk",
+      [](py::buffer b) {
+        py::buffer_info info = b.request();
+        return deepeye::detect_ramdisk_format(
+            static_cast<const uint8_t *>(info.ptr), info.size * info.itemsize);
+      },
+      "Identify the ramdisk compression from its magic bytes");
+  m.def(
+      "decompress_ramdisk",
+      [](py::buffer b, unsigned threads) -> py::object {
+        py::buffer_info info = b.request();
+        std::vector<uint8_t> out;
+        bool ok;
+        {
+          py::gil_scoped_release release;
+          ok = deepeye::decompress_ramdisk(
+              static_cast<const uint8_t *>(info.ptr),
+              info.size * info.itemsize, out, nullptr, threads);
+        }
+        if (!ok)
+          return py::none();
+        return py::bytes(reinterpret_cast<const char *>(out.data()),
+                         out.size());
+      },
+      py::arg("data"), py::arg("threads") = 0,
+      "Decode a compressed ramdisk (format sniffed); None on failure");
+  m.def(
+      "compress_ramdisk",
+      [](deepeye::RamdiskFormat format, py::buffer b, int level,
+         unsigned threads) -> py::object {
+        py::buffer_info info = b.request();
+        std::vector<uint8_t> out;
+        bool ok;
+        {
+          py::gil_scoped_release release;
+          ok = deepeye::compress_ramdisk(
+              format, static_cast<const uint8_t *>(info.ptr),
+              info.size * info.itemsize, out, level, threads);
+        }
+        if (!ok)
+          return py::none();
+        return py::bytes(reinterpret_cast<const char *>(out.data()),
+                         out.size());
+      },
+      py::arg("format"), py::arg("data"), py::arg("level") = -1,
+      py::arg("threads") = 0, "Encode a cpio archive; None on failure");
+
+  m.def(
+      "load_many",
+      [](const std::vector<std::string> &paths, unsigned threads, bool mmap) {
+        auto mode = mmap ? deepeye::BootImage::LoadMode::Mapped
+                         : deepeye::BootImage::LoadMode::Copy;
+        std::vector<std::unique_ptr<PyBootImage>> images(paths.size());
+        std::vector<char> ok(paths.size(), 0);
+        parallel_for(paths.size(), resolve_threads(threads, paths.size()),
+                     [&](size_t i) {
+                       images[i].reset(new PyBootImage());
+                       ok[i] = images[i]->load(paths[i], mode);
+                     });
+
+        py::list result;
+        for (size_t i = 0; i < paths.size(); ++i) {
+          if (ok[i])
+            result.append(py::cast(std::move(images[i])));
+          else
+            result.append(py::none());
+        }
+        return result;
+      },
+      py::arg("paths"), py::arg("threads") = 0, py::arg("mmap") = false,
+      "Load many boot images in parallel with the GIL released. Failed "
+      "loads yield None.");
+
+  m.def(
+      "analyze_many",
+      [](const std::vector<std::string> &paths, unsigned threads) {
+        struct Summary {
+          bool ok = false;
+          bool vendor_boot = false;
+          uint32_t version = 0;
+          uint32_t page_size = 0;
+          uint32_t os_version = 0;
+          size_t kernel_size = 0, ramdisk_size = 0, dtb_size = 0;
+          std::string cmdline;
+        };
+        std::vector<Summary> out(paths.size());
+        parallel_for(paths.size(), resolve_threads(threads, paths.size()),
+                     [&](size_t i) {
+                       deepeye::BootImage img;
+                       Summary &s = out[i];
+                       // Header-only: the mapping is never faulted past
+                       // the first page.
+                       s.ok = img.load(paths[i],
+                                       deepeye::BootImage::LoadMode::Mapped);
+                       if (!s.ok)
+                         return;
+                       s.vendor_boot = img.kind ==
+                                       deepeye::BootImage::Kind::VendorBoot;
+                       s.version = img.version;
+                       s.page_size = img.page_size;
+                       s.os_version = img.os_version;
+                       s.kernel_size = img.kernel.size();
+                       s.ramdisk_size = img.ramdisk.size();
+                       s.dtb_size = img.dtb.size();
+                       s.cmdline = std::move(img.cmdline);
+                     });
+
+        py::list result;
+        for (size_t i = 0; i < paths.size(); ++i) {
+          const Summary &s = out[i];
+          if (!s.ok) {
+            result.append(py::none());
+            continue;
+          }
+          py::dict d;
+          d["path"] = paths[i];
+          d["vendor_boot"] = s.vendor_boot;
+          d["version"] = s.version;
+          d["page_size"] = s.page_size;
+          d["os_version"] = s.os_version;
+          d["kernel_size"] = s.kernel_size;
+          d["ramdisk_size"] = s.ramdisk_size;
+          d["dtb_size"] = s.dtb_size;
+          d["cmdline"] = s.cmdline;
+          result.append(d);
+        }
+        return result;
+      },
+      py::arg("paths"), py::arg("threads") = 0,
+      "Read the headers of many boot images natively across threads; "
+      "returns one dict (or None on failure) per path.");
 }
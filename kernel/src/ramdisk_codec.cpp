@@ -0,0 +1,603 @@
+#include "../include/ramdisk_codec.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <lzma.h>
+#include <thread>
+#include <zlib.h>
+
+namespace deepeye {
+
+namespace {
+
+const size_t kChunk = 256 * 1024;
+
+// LZ4 legacy frame (lz4 -l, as emitted by the kernel build): magic, then
+// blocks of <le32 compressed size><LZ4 block>, each expanding to at most
+// 8 MiB and independent of its neighbours.
+const uint32_t kLz4LegacyMagic = 0x184C2102;
+const size_t kLz4LegacyBlock = 8 << 20;
+const size_t kLz4LegacyBound = kLz4LegacyBlock + kLz4LegacyBlock / 255 + 16;
+
+uint32_t read_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+void write_le32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+unsigned resolve_threads(unsigned requested) {
+  unsigned n = requested ? requested : std::thread::hardware_concurrency();
+  return std::max(1u, n);
+}
+
+template <typename Fn> void parallel_for(size_t count, unsigned threads, Fn fn) {
+  threads = (unsigned)std::min<size_t>(threads, count);
+  if (threads <= 1) {
+    for (size_t i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < count; i = next++)
+      fn(i);
+  };
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; ++t)
+    pool.emplace_back(worker);
+  worker();
+  for (auto &th : pool)
+    th.join();
+}
+
+// --- LZ4 block format -------------------------------------------------------
+
+// Returns the decoded size, or SIZE_MAX on malformed input / overflow.
+size_t lz4_decompress_block(const uint8_t *src, size_t src_size, uint8_t *dst,
+                            size_t dst_cap) {
+  const uint8_t *ip = src, *iend = src + src_size;
+  uint8_t *op = dst, *oend = dst + dst_cap;
+
+  while (ip < iend) {
+    unsigned token = *ip++;
+    size_t lit = token >> 4;
+    if (lit == 15) {
+      uint8_t b;
+      do {
+        if (ip >= iend)
+          return SIZE_MAX;
+        b = *ip++;
+        lit += b;
+      } while (b == 255);
+    }
+    if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+      return SIZE_MAX;
+    memcpy(op, ip, lit);
+    ip += lit;
+    op += lit;
+    if (ip == iend)
+      break; // the last sequence carries literals only
+
+    if (iend - ip < 2)
+      return SIZE_MAX;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst))
+      return SIZE_MAX;
+
+    size_t len = token & 15;
+    if (len == 15) {
+      uint8_t b;
+      do {
+        if (ip >= iend)
+          return SIZE_MAX;
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    len += 4;
+    if (len > (size_t)(oend - op))
+      return SIZE_MAX;
+
+    const uint8_t *match = op - offset;
+    if (offset >= len) {
+      memcpy(op, match, len);
+      op += len;
+    } else {
+      while (len--)
+        *op++ = *match++; // overlapping copy replicates the pattern
+    }
+  }
+  return (size_t)(op - dst);
+}
+
+uint8_t *lz4_write_length(uint8_t *op, size_t len) {
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+uint8_t *lz4_write_sequence(uint8_t *op, const uint8_t *lit, size_t lit_len,
+                            size_t offset, size_t match_len) {
+  uint8_t *token = op++;
+  size_t ml = match_len ? match_len - 4 : 0;
+  *token = (uint8_t)((std::min<size_t>(lit_len, 15) << 4) |
+                     std::min<size_t>(ml, 15));
+  if (lit_len >= 15)
+    op = lz4_write_length(op, lit_len - 15);
+  memcpy(op, lit, lit_len);
+  op += lit_len;
+  if (!match_len)
+    return op;
+  *op++ = (uint8_t)offset;
+  *op++ = (uint8_t)(offset >> 8);
+  if (ml >= 15)
+    op = lz4_write_length(op, ml - 15);
+  return op;
+}
+
+// Greedy single-probe compressor (the LZ4 "fast" strategy). dst must hold
+// kLz4LegacyBound bytes. Honours the format's end-of-block rules: the last
+// 5 bytes are literals and no match starts within the last 12.
+size_t lz4_compress_block(const uint8_t *src, size_t n, uint8_t *dst) {
+  const size_t kMinMatch = 4, kLastLiterals = 5, kMfLimit = 12;
+  const unsigned kHashLog = 16;
+  uint8_t *op = dst;
+  size_t anchor = 0;
+
+  if (n > kMfLimit) {
+    std::vector<uint32_t> table(1u << kHashLog, UINT32_MAX);
+    const size_t limit = n - kMfLimit, match_limit = n - kLastLiterals;
+    size_t i = 0;
+    while (i < limit) {
+      uint32_t seq;
+      memcpy(&seq, src + i, 4);
+      uint32_t h = (seq * 2654435761u) >> (32 - kHashLog);
+      uint32_t ref = table[h];
+      table[h] = (uint32_t)i;
+
+      if (ref == UINT32_MAX || i - ref > 65535 ||
+          memcmp(src + ref, src + i, 4) != 0) {
+        // Skip faster through incompressible runs.
+        i += 1 + ((i - anchor) >> 6);
+        continue;
+      }
+
+      size_t start = i, match = ref;
+      while (start > anchor && match > 0 && src[start - 1] == src[match - 1]) {
+        --start;
+        --match;
+      }
+      size_t len = kMinMatch + (i - start);
+      while (start + len < match_limit && src[match + len] == src[start + len])
+        ++len;
+
+      op = lz4_write_sequence(op, src + anchor, start - anchor, start - match,
+                              len);
+      i = anchor = start + len;
+      if (i - 2 < limit) {
+        memcpy(&seq, src + i - 2, 4);
+        table[(seq * 2654435761u) >> (32 - kHashLog)] = (uint32_t)(i - 2);
+      }
+    }
+  }
+  op = lz4_write_sequence(op, src + anchor, n - anchor, 0, 0);
+  return (size_t)(op - dst);
+}
+
+// --- Codecs -----------------------------------------------------------------
+
+class PassthroughCodec : public RamdiskCodec {
+public:
+  explicit PassthroughCodec(ByteSink sink) : _sink(std::move(sink)) {}
+  bool update(const uint8_t *data, size_t size) override {
+    return !size || _sink(data, size);
+  }
+  bool finish() override { return true; }
+
+private:
+  ByteSink _sink;
+};
+
+class GzipCodec : public RamdiskCodec {
+public:
+  GzipCodec(ByteSink sink, bool encode, int level)
+      : _sink(std::move(sink)), _encode(encode), _ok(true), _ended(false),
+        _out(kChunk) {
+    memset(&_z, 0, sizeof(_z));
+    if (encode)
+      _ok = deflateInit2(&_z, level < 0 ? 6 : std::min(level, 9), Z_DEFLATED,
+                         15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    else
+      _ok = inflateInit2(&_z, 15 + 32) == Z_OK;
+    _init = _ok;
+  }
+  ~GzipCodec() override {
+    if (_init)
+      _encode ? deflateEnd(&_z) : inflateEnd(&_z);
+  }
+
+  bool update(const uint8_t *data, size_t size) override {
+    return run(data, size, false);
+  }
+  bool finish() override {
+    if (!run(nullptr, 0, true))
+      return false;
+    return _encode || _ended;
+  }
+
+private:
+  bool run(const uint8_t *data, size_t size, bool last) {
+    if (!_ok)
+      return false;
+    _z.next_in = const_cast<Bytef *>(data);
+    _z.avail_in = (uInt)size;
+    for (;;) {
+      if (!_encode && _ended) {
+        // Concatenated members continue the stream; anything else (padding
+        // up to the section size) ends it.
+        if (_z.avail_in >= 2 && _z.next_in[0] == 0x1f && _z.next_in[1] == 0x8b)
+          _ended = inflateReset(&_z) != Z_OK;
+        else
+          return true;
+      }
+      _z.next_out = _out.data();
+      _z.avail_out = (uInt)_out.size();
+      int rc = _encode ? deflate(&_z, last ? Z_FINISH : Z_NO_FLUSH)
+                       : inflate(&_z, Z_NO_FLUSH);
+      size_t produced = _out.size() - _z.avail_out;
+      if (produced && !_sink(_out.data(), produced))
+        return _ok = false;
+      if (rc == Z_STREAM_END) {
+        if (_encode)
+          return true;
+        _ended = true;
+        continue;
+      }
+      if (rc == Z_BUF_ERROR && !produced)
+        return true; // needs more input
+      if (rc != Z_OK)
+        return _ok = false;
+      if (_z.avail_in == 0 && _z.avail_out != 0 && !(_encode && last))
+        return true;
+    }
+  }
+
+  ByteSink _sink;
+  bool _encode, _ok, _init, _ended;
+  z_stream _z;
+  std::vector<uint8_t> _out;
+};
+
+class LzmaCodec : public RamdiskCodec {
+public:
+  LzmaCodec(ByteSink sink, RamdiskFormat format, bool encode, int level,
+            unsigned threads)
+      : _sink(std::move(sink)), _out(kChunk) {
+    _s = LZMA_STREAM_INIT;
+    uint32_t preset = level < 0 ? 6 : (uint32_t)std::min(level, 9);
+    lzma_ret rc;
+    if (format == RamdiskFormat::Lzma) {
+      if (encode) {
+        lzma_options_lzma opt;
+        lzma_lzma_preset(&opt, preset);
+        rc = lzma_alone_encoder(&_s, &opt);
+      } else {
+        rc = lzma_alone_decoder(&_s, UINT64_MAX);
+      }
+    } else {
+      lzma_mt mt;
+      memset(&mt, 0, sizeof(mt));
+      mt.threads = threads;
+      if (encode) {
+        // The kernel's xz decoder only verifies CRC32.
+        mt.preset = preset;
+        mt.check = LZMA_CHECK_CRC32;
+        rc = threads > 1 ? lzma_stream_encoder_mt(&_s, &mt)
+                         : lzma_easy_encoder(&_s, preset, LZMA_CHECK_CRC32);
+      } else {
+#if LZMA_VERSION >= 50040002
+        mt.flags = LZMA_CONCATENATED;
+        mt.memlimit_threading = UINT64_MAX;
+        mt.memlimit_stop = UINT64_MAX;
+        rc = threads > 1 ? lzma_stream_decoder_mt(&_s, &mt)
+                         : lzma_stream_decoder(&_s, UINT64_MAX,
+                                               LZMA_CONCATENATED);
+#else
+        rc = lzma_stream_decoder(&_s, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+      }
+    }
+    _ok = rc == LZMA_OK;
+  }
+  ~LzmaCodec() override { lzma_end(&_s); }
+
+  bool update(const uint8_t *data, size_t size) override {
+    return run(data, size, LZMA_RUN);
+  }
+  bool finish() override { return run(nullptr, 0, LZMA_FINISH); }
+
+private:
+  bool run(const uint8_t *data, size_t size, lzma_action action) {
+    if (!_ok)
+      return false;
+    _s.next_in = data;
+    _s.avail_in = size;
+    for (;;) {
+      _s.next_out = _out.data();
+      _s.avail_out = _out.size();
+      lzma_ret rc = lzma_code(&_s, action);
+      size_t produced = _out.size() - _s.avail_out;
+      if (produced && !_sink(_out.data(), produced))
+        return _ok = false;
+      if (rc == LZMA_STREAM_END)
+        return true;
+      if (rc != LZMA_OK)
+        return _ok = false;
+      if (action == LZMA_RUN && _s.avail_in == 0 && _s.avail_out != 0)
+        return true;
+    }
+  }
+
+  ByteSink _sink;
+  bool _ok;
+  lzma_stream _s;
+  std::vector<uint8_t> _out;
+};
+
+// Buffers up to one block per thread, then decodes the batch in parallel and
+// emits it in stream order.
+class Lz4LegacyDecoder : public RamdiskCodec {
+public:
+  Lz4LegacyDecoder(ByteSink sink, unsigned threads)
+      : _sink(std::move(sink)), _threads(threads), _pos(0), _magic(false),
+        _ended(false), _ok(true) {}
+
+  bool update(const uint8_t *data, size_t size) override {
+    if (!_ok || _ended)
+      return _ok;
+    _in.insert(_in.end(), data, data + size);
+    return parse();
+  }
+
+  bool finish() override {
+    if (!_ok || !parse() || !flush())
+      return false;
+    // lz4 -l streams may carry a trailing le32 of the uncompressed size.
+    size_t left = _in.size() - _pos;
+    return _magic && (_ended || left == 0 || left == 4);
+  }
+
+private:
+  bool parse() {
+    for (;;) {
+      if (_in.size() - _pos < 4)
+        break;
+      uint32_t v = read_le32(_in.data() + _pos);
+      if (!_magic) {
+        if (v != kLz4LegacyMagic)
+          return _ok = false;
+        _magic = true;
+        _pos += 4;
+        continue;
+      }
+      if (v == kLz4LegacyMagic) { // concatenated frame
+        _pos += 4;
+        continue;
+      }
+      if (v == 0 || v > kLz4LegacyBound) {
+        _ended = true;
+        break;
+      }
+      if (_in.size() - _pos - 4 < v)
+        break;
+      _blocks.push_back(std::make_pair(_pos + 4, (size_t)v));
+      _pos += 4 + v;
+      if (_blocks.size() >= _threads && !flush())
+        return false;
+    }
+    if (_blocks.empty() && _pos) {
+      _in.erase(_in.begin(), _in.begin() + _pos);
+      _pos = 0;
+    }
+    return true;
+  }
+
+  bool flush() {
+    if (_blocks.empty())
+      return true;
+    if (_out.size() < _blocks.size())
+      _out.resize(_blocks.size());
+    std::atomic<bool> failed(false);
+    parallel_for(_blocks.size(), _threads, [&](size_t i) {
+      std::vector<uint8_t> &out = _out[i];
+      out.resize(kLz4LegacyBlock);
+      size_t n = lz4_decompress_block(_in.data() + _blocks[i].first,
+                                      _blocks[i].second, out.data(),
+                                      out.size());
+      if (n == SIZE_MAX)
+        failed = true;
+      else
+        out.resize(n);
+    });
+    if (failed)
+      return _ok = false;
+    for (size_t i = 0; i < _blocks.size(); ++i)
+      if (!_out[i].empty() && !_sink(_out[i].data(), _out[i].size()))
+        return _ok = false;
+    _blocks.clear();
+    return true;
+  }
+
+  ByteSink _sink;
+  unsigned _threads;
+  std::vector<uint8_t> _in;
+  size_t _pos;
+  bool _magic, _ended, _ok;
+  std::vector<std::pair<size_t, size_t>> _blocks; // offset/size in _in
+  std::vector<std::vector<uint8_t>> _out;
+};
+
+class Lz4LegacyEncoder : public RamdiskCodec {
+public:
+  Lz4LegacyEncoder(ByteSink sink, unsigned threads)
+      : _sink(std::move(sink)), _threads(threads), _ok(true) {
+    uint8_t magic[4];
+    write_le32(magic, kLz4LegacyMagic);
+    _ok = _sink(magic, sizeof(magic));
+  }
+
+  bool update(const uint8_t *data, size_t size) override {
+    if (!_ok)
+      return false;
+    _in.insert(_in.end(), data, data + size);
+    size_t full = _in.size() / kLz4LegacyBlock;
+    return full < _threads || flush(full * kLz4LegacyBlock);
+  }
+
+  bool finish() override { return _ok && flush(_in.size()); }
+
+private:
+  bool flush(size_t bytes) {
+    size_t count = (bytes + kLz4LegacyBlock - 1) / kLz4LegacyBlock;
+    if (_out.size() < count)
+      _out.resize(count);
+    parallel_for(count, _threads, [&](size_t i) {
+      size_t off = i * kLz4LegacyBlock;
+      size_t n = std::min(kLz4LegacyBlock, bytes - off);
+      std::vector<uint8_t> &out = _out[i];
+      out.resize(4 + kLz4LegacyBound);
+      size_t c = lz4_compress_block(_in.data() + off, n, out.data() + 4);
+      write_le32(out.data(), (uint32_t)c);
+      out.resize(4 + c);
+    });
+    for (size_t i = 0; i < count; ++i)
+      if (!_sink(_out[i].data(), _out[i].size()))
+        return _ok = false;
+    _in.erase(_in.begin(), _in.begin() + bytes);
+    return true;
+  }
+
+  ByteSink _sink;
+  unsigned _threads;
+  bool _ok;
+  std::vector<uint8_t> _in;
+  std::vector<std::vector<uint8_t>> _out;
+};
+
+} // namespace
+
+RamdiskFormat detect_ramdisk_format(const uint8_t *data, size_t size) {
+  if (size >= 6 && memcmp(data, "\xfd" "7zXZ\0", 6) == 0)
+    return RamdiskFormat::Xz;
+  if (size >= 4 && read_le32(data) == kLz4LegacyMagic)
+    return RamdiskFormat::Lz4Legacy;
+  if (size >= 2 && data[0] == 0x1f && (data[1] == 0x8b || data[1] == 0x9e))
+    return RamdiskFormat::Gzip;
+  if (size >= 3 && memcmp(data, "\x5d\x00\x00", 3) == 0)
+    return RamdiskFormat::Lzma;
+  if (size >= 6 && (memcmp(data, "070701", 6) == 0 ||
+                    memcmp(data, "070702", 6) == 0 ||
+                    memcmp(data, "070707", 6) == 0))
+    return RamdiskFormat::Cpio;
+  return RamdiskFormat::Unknown;
+}
+
+const char *ramdisk_format_name(RamdiskFormat format) {
+  switch (format) {
+  case RamdiskFormat::Cpio:
+    return "cpio";
+  case RamdiskFormat::Gzip:
+    return "gzip";
+  case RamdiskFormat::Lz4Legacy:
+    return "lz4_legacy";
+  case RamdiskFormat::Lzma:
+    return "lzma";
+  case RamdiskFormat::Xz:
+    return "xz";
+  default:
+    return "unknown";
+  }
+}
+
+std::unique_ptr<RamdiskCodec>
+RamdiskCodec::decoder(RamdiskFormat format, ByteSink sink, unsigned threads) {
+  threads = resolve_threads(threads);
+  switch (format) {
+  case RamdiskFormat::Cpio:
+    return std::unique_ptr<RamdiskCodec>(new PassthroughCodec(std::move(sink)));
+  case RamdiskFormat::Gzip:
+    return std::unique_ptr<RamdiskCodec>(
+        new GzipCodec(std::move(sink), false, -1));
+  case RamdiskFormat::Lz4Legacy:
+    return std::unique_ptr<RamdiskCodec>(
+        new Lz4LegacyDecoder(std::move(sink), threads));
+  case RamdiskFormat::Lzma:
+  case RamdiskFormat::Xz:
+    return std::unique_ptr<RamdiskCodec>(
+        new LzmaCodec(std::move(sink), format, false, -1, threads));
+  default:
+    return nullptr;
+  }
+}
+
+std::unique_ptr<RamdiskCodec> RamdiskCodec::encoder(RamdiskFormat format,
+                                                    ByteSink sink, int level,
+                                                    unsigned threads) {
+  threads = resolve_threads(threads);
+  switch (format) {
+  case RamdiskFormat::Cpio:
+    return std::unique_ptr<RamdiskCodec>(new PassthroughCodec(std::move(sink)));
+  case RamdiskFormat::Gzip:
+    return std::unique_ptr<RamdiskCodec>(
+        new GzipCodec(std::move(sink), true, level));
+  case RamdiskFormat::Lz4Legacy:
+    return std::unique_ptr<RamdiskCodec>(
+        new Lz4LegacyEncoder(std::move(sink), threads));
+  case RamdiskFormat::Lzma:
+  case RamdiskFormat::Xz:
+    return std::unique_ptr<RamdiskCodec>(
+        new LzmaCodec(std::move(sink), format, true, level, threads));
+  default:
+    return nullptr;
+  }
+}
+
+bool decompress_ramdisk(const uint8_t *data, size_t size,
+                        std::vector<uint8_t> &out, RamdiskFormat *format,
+                        unsigned threads) {
+  RamdiskFormat detected = detect_ramdisk_format(data, size);
+  if (format)
+    *format = detected;
+  out.clear();
+  std::unique_ptr<RamdiskCodec> codec = RamdiskCodec::decoder(
+      detected,
+      [&out](const uint8_t *p, size_t n) {
+        out.insert(out.end(), p, p + n);
+        return true;
+      },
+      threads);
+  return codec && codec->update(data, size) && codec->finish();
+}
+
+bool compress_ramdisk(RamdiskFormat format, const uint8_t *data, size_t size,
+                      std::vector<uint8_t> &out, int level, unsigned threads) {
+  out.clear();
+  std::unique_ptr<RamdiskCodec> codec = RamdiskCodec::encoder(
+      format,
+      [&out](const uint8_t *p, size_t n) {
+        out.insert(out.end(), p, p + n);
+        return true;
+      },
+      level, threads);
+  return codec && codec->update(data, size) && codec->finish();
+}
+
+} // namespace deepeye
@@ -0,0 +1,348 @@
+/**
+ * Byte-exact load/save round trip for every BootImage layout.
+ *
+ * Synthesizes boot v0-v4 and vendor_boot v3/v4 images, then round-trips
+ * each in Copy and Mapped mode. Extra files or directories given on the
+ * command line (e.g. a firmware intake sample set) are round-tripped too.
+ *
+ *   make check SAMPLES=/path/to/images
+ */
+#include "../include/boot_image.h"
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using deepeye::BootImage;
+
+namespace {
+
+int g_failures = 0;
+
+void check(bool cond, const std::string &what) {
+  if (!cond) {
+    std::cerr << "  FAIL: " << what << std::endl;
+    ++g_failures;
+  }
+}
+
+std::vector<uint8_t> read_file(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(in),
+                              std::istreambuf_iterator<char>());
+}
+
+void write_file(const std::string &path, const std::vector<uint8_t> &data) {
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char *>(data.data()), data.size());
+}
+
+std::vector<uint8_t> pattern(size_t n, uint8_t seed) {
+  std::vector<uint8_t> v(n);
+  for (size_t i = 0; i < n; ++i)
+    v[i] = (uint8_t)(seed + i * 31 + (i >> 7));
+  return v;
+}
+
+// Appends `data` and zero padding up to the next page boundary.
+void append_section(std::vector<uint8_t> &img, const std::vector<uint8_t> &data,
+                    uint32_t pg, bool pad = true) {
+  img.insert(img.end(), data.begin(), data.end());
+  if (pad)
+    img.resize((img.size() + pg - 1) / pg * pg, 0);
+}
+
+template <typename Hdr>
+std::vector<uint8_t> header_page(const Hdr &hdr, size_t region) {
+  std::vector<uint8_t> page(region, 0);
+  memcpy(page.data(), &hdr, sizeof(hdr));
+  return page;
+}
+
+std::vector<uint8_t> make_boot_v0_v2(uint32_t version, bool truncate_pad) {
+  const uint32_t pg = 2048;
+  auto kernel = pattern(10000, 1), ramdisk = pattern(3333, 2),
+       second = pattern(100, 3), dtbo = pattern(777, 4), dtb = pattern(4097, 5);
+
+  deepeye::boot_img_hdr_v2 hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, BOOT_MAGIC, BOOT_MAGIC_SIZE);
+  hdr.kernel_size = kernel.size();
+  hdr.kernel_addr = 0x10008000;
+  hdr.ramdisk_size = ramdisk.size();
+  hdr.ramdisk_addr = 0x11000000;
+  hdr.second_size = second.size();
+  hdr.tags_addr = 0x10000100;
+  hdr.page_size = pg;
+  hdr.header_version = version;
+  hdr.os_version = (11u << 25) | (2023u - 2000) << 4 | 6;
+  memcpy(hdr.name, "deepeye", 7);
+  // Long enough to spill into extra_cmdline.
+  std::string args = "console=ttyMSM0 " + std::string(600, 'x');
+  memcpy(hdr.cmdline, args.data(), BOOT_ARGS_SIZE - 1);
+  memcpy(hdr.extra_cmdline, args.data() + BOOT_ARGS_SIZE - 1,
+         args.size() - (BOOT_ARGS_SIZE - 1));
+  hdr.id[0] = 0xdeadbeef;
+  size_t hdr_len = sizeof(deepeye::boot_img_hdr_v0);
+  if (version >= 1) {
+    hdr.recovery_dtbo_size = dtbo.size();
+    hdr.recovery_dtbo_offset = pg + 5 * pg + 2 * pg + pg;
+    hdr.header_size = hdr_len = sizeof(deepeye::boot_img_hdr_v1);
+  }
+  if (version == 2) {
+    hdr.dtb_size = dtb.size();
+    hdr.dtb_addr = 0x11f00000;
+    hdr.header_size = hdr_len = sizeof(deepeye::boot_img_hdr_v2);
+  }
+
+  std::vector<uint8_t> img(pg, 0);
+  memcpy(img.data(), &hdr, hdr_len);
+  append_section(img, kernel, pg);
+  append_section(img, ramdisk, pg);
+  const bool last_is_second = version == 0;
+  append_section(img, second, pg, !(truncate_pad && last_is_second));
+  if (version >= 1)
+    append_section(img, dtbo, pg, !(truncate_pad && version == 1));
+  if (version == 2)
+    append_section(img, dtb, pg, !truncate_pad);
+  return img;
+}
+
+std::vector<uint8_t> make_boot_v3_v4(uint32_t version) {
+  const uint32_t pg = 4096;
+  auto kernel = pattern(20000, 6), ramdisk = pattern(9000, 7),
+       sig = pattern(4096, 8);
+
+  deepeye::boot_img_hdr_v4 hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, BOOT_MAGIC, BOOT_MAGIC_SIZE);
+  hdr.kernel_size = kernel.size();
+  hdr.ramdisk_size = ramdisk.size();
+  hdr.os_version = (12u << 25) | (2024u - 2000) << 4 | 1;
+  hdr.header_version = version;
+  strcpy(reinterpret_cast<char *>(hdr.cmdline), "androidboot.hardware=qcom");
+  if (version == 4) {
+    hdr.signature_size = sig.size();
+    hdr.header_size = sizeof(deepeye::boot_img_hdr_v4);
+  } else {
+    hdr.header_size = sizeof(deepeye::boot_img_hdr_v3);
+  }
+
+  std::vector<uint8_t> img(pg, 0);
+  memcpy(img.data(), &hdr, hdr.header_size);
+  append_section(img, kernel, pg);
+  append_section(img, ramdisk, pg);
+  if (version == 4)
+    append_section(img, sig, pg);
+
+  // Simulated AVB footer at the end of a larger partition.
+  img.resize(img.size() + 3 * pg, 0);
+  memcpy(&img[img.size() - 64], "AVBf", 4);
+  return img;
+}
+
+std::vector<uint8_t> make_vendor_boot(uint32_t version) {
+  const uint32_t pg = 4096;
+  auto rd_a = pattern(5000, 9), rd_b = pattern(1234, 10);
+  std::vector<uint8_t> ramdisk(rd_a);
+  ramdisk.insert(ramdisk.end(), rd_b.begin(), rd_b.end());
+  auto dtb = pattern(3000, 11);
+  std::string bootconfig = "androidboot.serialno=1234\n";
+
+  deepeye::vendor_boot_img_hdr_v4 hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, VENDOR_BOOT_MAGIC, VENDOR_BOOT_MAGIC_SIZE);
+  hdr.header_version = version;
+  hdr.page_size = pg;
+  hdr.kernel_addr = 0x00008000;
+  hdr.ramdisk_addr = 0x01000000;
+  hdr.vendor_ramdisk_size = ramdisk.size();
+  strcpy(reinterpret_cast<char *>(hdr.cmdline), "video=vfb:640x400");
+  hdr.tags_addr = 0x00000100;
+  memcpy(hdr.name, "vendor", 6);
+  hdr.dtb_size = dtb.size();
+  hdr.dtb_addr = 0x01f00000;
+
+  std::vector<uint8_t> table;
+  if (version == 4) {
+    deepeye::vendor_ramdisk_table_entry_v4 e[2];
+    memset(e, 0, sizeof(e));
+    e[0].ramdisk_size = rd_a.size();
+    e[0].ramdisk_type = VENDOR_RAMDISK_TYPE_PLATFORM;
+    strcpy(reinterpret_cast<char *>(e[0].ramdisk_name), "platform");
+    e[1].ramdisk_size = rd_b.size();
+    e[1].ramdisk_offset = rd_a.size();
+    e[1].ramdisk_type = VENDOR_RAMDISK_TYPE_DLKM;
+    strcpy(reinterpret_cast<char *>(e[1].ramdisk_name), "dlkm");
+    e[1].board_id[0] = 42;
+    table.assign(reinterpret_cast<uint8_t *>(e),
+                 reinterpret_cast<uint8_t *>(e) + sizeof(e));
+    hdr.vendor_ramdisk_table_size = table.size();
+    hdr.vendor_ramdisk_table_entry_num = 2;
+    hdr.vendor_ramdisk_table_entry_size = sizeof(e[0]);
+    hdr.bootconfig_size = bootconfig.size();
+    hdr.header_size = sizeof(deepeye::vendor_boot_img_hdr_v4);
+  } else {
+    hdr.header_size = sizeof(deepeye::vendor_boot_img_hdr_v3);
+  }
+
+  std::vector<uint8_t> img(pg, 0);
+  memcpy(img.data(), &hdr, hdr.header_size);
+  append_section(img, ramdisk, pg);
+  append_section(img, dtb, pg);
+  if (version == 4) {
+    append_section(img, table, pg);
+    append_section(img, std::vector<uint8_t>(bootconfig.begin(),
+                                             bootconfig.end()),
+                   pg);
+  }
+  return img;
+}
+
+bool roundtrip_file(const std::string &path, const std::string &out) {
+  const std::vector<uint8_t> original = read_file(path);
+  bool ok = true;
+  const BootImage::LoadMode modes[] = {BootImage::LoadMode::Copy,
+                                       BootImage::LoadMode::Mapped};
+  for (BootImage::LoadMode mode : modes) {
+    const char *label = mode == BootImage::LoadMode::Copy ? "copy" : "mmap";
+    BootImage img;
+    if (!img.load(path, mode)) {
+      check(false, path + ": load (" + label + ")");
+      ok = false;
+      continue;
+    }
+    check(img.is_mapped() == (mode == BootImage::LoadMode::Mapped),
+          path + ": is_mapped (" + label + ")");
+    if (!img.save(out)) {
+      check(false, path + ": save (" + label + ")");
+      ok = false;
+      continue;
+    }
+    bool same = read_file(out) == original;
+    check(same, path + ": byte-exact round trip (" + label + ")");
+    ok = ok && same;
+  }
+  return ok;
+}
+
+void test_synthetic(const std::string &dir) {
+  struct Case {
+    std::string name;
+    std::vector<uint8_t> image;
+  };
+  std::vector<Case> cases;
+  for (uint32_t v = 0; v <= 2; ++v) {
+    cases.push_back({"boot_v" + std::to_string(v), make_boot_v0_v2(v, false)});
+    cases.push_back({"boot_v" + std::to_string(v) + "_unpadded",
+                     make_boot_v0_v2(v, true)});
+  }
+  for (uint32_t v = 3; v <= 4; ++v)
+    cases.push_back({"boot_v" + std::to_string(v), make_boot_v3_v4(v)});
+  for (uint32_t v = 3; v <= 4; ++v)
+    cases.push_back({"vendor_boot_v" + std::to_string(v), make_vendor_boot(v)});
+
+  for (const Case &c : cases) {
+    std::string in = dir + "/" + c.name + ".img";
+    write_file(in, c.image);
+    bool ok = roundtrip_file(in, dir + "/" + c.name + ".out.img");
+    std::cout << (ok ? "  ok   " : "  FAIL ") << c.name << std::endl;
+  }
+}
+
+void test_modify(const std::string &dir) {
+  std::string in = dir + "/boot_v2.img", out = dir + "/boot_v2.mod.img";
+  BootImage img;
+  check(img.load(in, BootImage::LoadMode::Mapped), "modify: load");
+  std::vector<uint8_t> dtb(img.dtb.begin(), img.dtb.end());
+
+  std::vector<uint8_t> &rd = img.ramdisk.mutable_bytes();
+  rd.resize(rd.size() + 5000, 0xAB);
+  check(!img.ramdisk.is_mapped() && img.kernel.is_mapped(),
+        "modify: only the mutated component is materialized");
+  img.cmdline = "console=null";
+  check(img.save(out), "modify: save");
+
+  BootImage back;
+  check(back.load(out), "modify: reload");
+  check(back.ramdisk.size() == 3333 + 5000, "modify: ramdisk size");
+  check(std::vector<uint8_t>(back.dtb.begin(), back.dtb.end()) == dtb,
+        "modify: dtb follows the grown ramdisk");
+  check(back.cmdline == "console=null", "modify: cmdline rewritten");
+
+  BootImage vendor;
+  check(vendor.load(dir + "/vendor_boot_v4.img"), "vendor: load");
+  auto entries = vendor.vendor_ramdisks();
+  check(entries.size() == 2 && entries[1].name == "dlkm" &&
+            entries[1].board_id[0] == 42,
+        "vendor: ramdisk table parsed");
+  vendor.set_vendor_ramdisks(entries);
+  check(vendor.save(out) &&
+            read_file(out) == read_file(dir + "/vendor_boot_v4.img"),
+        "vendor: re-serialized table is byte-exact");
+
+  // Saving over the file the components are still mapped from.
+  const std::vector<uint8_t> original = read_file(in);
+  BootImage same;
+  check(same.load(in, BootImage::LoadMode::Mapped) && same.save(in) &&
+            read_file(in) == original,
+        "in place: mapped save over its own source is byte-exact");
+}
+
+void collect(const std::string &path, std::vector<std::string> &files) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return;
+  if (!S_ISDIR(st.st_mode)) {
+    files.push_back(path);
+    return;
+  }
+  DIR *d = opendir(path.c_str());
+  if (!d)
+    return;
+  while (struct dirent *e = readdir(d)) {
+    if (e->d_name[0] != '.')
+      collect(path + "/" + e->d_name, files);
+  }
+  closedir(d);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  char tmpl[] = "/tmp/deepeye_bootimg_XXXXXX";
+  const char *dir = mkdtemp(tmpl);
+  if (!dir) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  std::cout << "[*] Synthetic images" << std::endl;
+  test_synthetic(dir);
+  test_modify(dir);
+
+  std::vector<std::string> samples;
+  for (int i = 1; i < argc; ++i)
+    collect(argv[i], samples);
+  if (!samples.empty())
+    std::cout << "[*] Sample images (" << samples.size() << ")" << std::endl;
+  for (const std::string &s : samples) {
+    bool ok = roundtrip_file(s, std::string(dir) + "/sample.out.img");
+    std::cout << (ok ? "  ok   " : "  FAIL ") << s << std::endl;
+  }
+
+  std::string cleanup = std::string("rm -rf ") + dir;
+  if (system(cleanup.c_str()) != 0)
+    std::cerr << "[-] Could not remove " << dir << std::endl;
+
+  if (g_failures) {
+    std::cerr << "[-] " << g_failures << " check(s) failed" << std::endl;
+    return 1;
+  }
+  std::cout << "[+] All round trips byte-exact" << std::endl;
+  return 0;
+}
@@ -1,96 +1,251 @@
 #include "deepeye_core.h"
+#include "deepeye_exports.h"
 #include "usb_transport.h"
 #include "brom_proto.h"
 #include <jni.h>
 #include <string>
 #include <vector>
 
+namespace {
+
+// One native session per Java handle. The transport, engine (and with it the
+// identified target and cached partition table) live as long as the handle.
+struct NativeSession {
+  DeepEye::Core::LibUsbTransport transport;
+  DeepEye::Core::ProtocolEngine engine{&transport};
+  std::vector<DeepEye_PartitionRecord> records; // backs getPartitionTable()
+  jobject listener = nullptr;                   // global ref
+};
+
+jmethodID g_onProgress = nullptr;
+
+NativeSession *FromHandle(jlong handle) {
+  return reinterpret_cast<NativeSession *>(handle);
+}
+
+std::string ToStdString(JNIEnv *env, jstring str) {
+  const char *chars = env->GetStringUTFChars(str, nullptr);
+  std::string result(chars ? chars : "");
+  if (chars)
+    env->ReleaseStringUTFChars(str, chars);
+  return result;
+}
+
+// Progress is reported on the thread that issued the JNI call, so the env
+// passed into that call stays valid for the duration of the operation.
+class ProgressScope {
+public:
+  ProgressScope(JNIEnv *env, NativeSession *session) : _session(session) {
+    if (!session->listener || !g_onProgress)
+      return;
+    jobject listener = session->listener;
+    session->engine.SetProgressCallback(
+        [env, listener](uint64_t done, uint64_t total) {
+          env->CallVoidMethod(listener, g_onProgress, (jlong)done,
+                              (jlong)total);
+          if (env->ExceptionCheck())
+            env->ExceptionClear();
+        });
+  }
+  ~ProgressScope() { _session->engine.SetProgressCallback(nullptr); }
+
+private:
+  NativeSession *_session;
+};
+
+} // namespace
+
+extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
+  (void)reserved;
+
+  JNIEnv *env = nullptr;
+  if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) != JNI_OK)
+    return JNI_ERR;
+
+  jclass listenerClass =
+      env->FindClass("com/deepeye/otg/NativeBridge$ProgressListener");
+  if (!listenerClass)
+    return JNI_ERR;
+  g_onProgress = env->GetMethodID(listenerClass, "onProgress", "(JJ)V");
+  env->DeleteLocalRef(listenerClass);
+  return g_onProgress ? JNI_VERSION_1_6 : JNI_ERR;
+}
+
 extern "C" JNIEXPORT jlong JNICALL Java_com_deepeye_otg_NativeBridge_initCore(
     JNIEnv *env, jobject thiz, jint fd, jint vid, jint pid) {
   (void)env;
   (void)thiz;
   (void)vid;
   (void)pid;
-  
-  auto transport = new DeepEye::Core::LibUsbTransport();
-  if (transport->Open(fd)) {
-    return reinterpret_cast<jlong>(transport);
+
+  auto session = new NativeSession();
+  if (session->transport.Open(fd)) {
+    return reinterpret_cast<jlong>(session);
   }
-  delete transport;
+  delete session;
   return 0;
 }
 
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_deepeye_otg_NativeBridge_identifyDevice(JNIEnv *env, jobject thiz,
-                                                 jlong transportPtr) {
+                                                 jlong handle) {
   (void)env;
   (void)thiz;
-  
-  auto transport = reinterpret_cast<DeepEye::Core::ITransport *>(transportPtr);
-  if (!transport)
-    return false;
 
-  DeepEye::Core::ProtocolEngine engine(transport);
-  return engine.Identify();
+  auto session = FromHandle(handle);
+  if (!session)
+    return JNI_FALSE;
+
+  return session->engine.Identify() ? JNI_TRUE : JNI_FALSE;
 }
 
-extern "C" JNIEXPORT jobjectArray JNICALL
-Java_com_deepeye_otg_NativeBridge_getPartitions(JNIEnv *env, jobject thiz,
-                                                jlong handle) {
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_deepeye_otg_NativeBridge_getPartitionTable(JNIEnv *env, jobject thiz,
+                                                    jlong handle) {
   (void)thiz;
-  
-  auto transport = reinterpret_cast<DeepEye::Core::ITransport *>(handle);
-  if (!transport)
+
+  auto session = FromHandle(handle);
+  if (!session)
     return nullptr;
 
-  DeepEye::Core::ProtocolEngine engine(transport);
-  auto partitions = engine.GetPartitions();
+  int count = DeepEye_EngineRefreshPartitions(&session->engine);
+  if (count <= 0)
+    return nullptr;
 
-  jclass stringClass = env->FindClass("java/lang/String");
-  jobjectArray result =
-      env->NewObjectArray(partitions.size(), stringClass, nullptr);
+  // Packed DeepEye_PartitionRecord array, valid until the next call on this
+  // handle or closeCore().
+  session->records.resize(count);
+  DeepEye_EngineCopyPartitionRecords(&session->engine, session->records.data(),
+                                     count);
+  return env->NewDirectByteBuffer(session->records.data(),
+                                  (jlong)count *
+                                      (jlong)sizeof(DeepEye_PartitionRecord));
+}
 
-  for (size_t i = 0; i < partitions.size(); ++i) {
-    std::string info = partitions[i].name + " (" +
-                       std::to_string(partitions[i].sizeInBytes / 1024 / 1024) +
-                       " MB)";
-    env->SetObjectArrayElement(result, i, env->NewStringUTF(info.c_str()));
-  }
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_deepeye_otg_NativeBridge_injectDa(JNIEnv *env, jobject thiz,
+                                           jlong handle, jobject daBuffer,
+                                           jint length) {
+  (void)thiz;
 
-  return result;
+  auto session = FromHandle(handle);
+  if (!session)
+    return JNI_FALSE;
+
+  auto data = static_cast<uint8_t *>(env->GetDirectBufferAddress(daBuffer));
+  jlong capacity = env->GetDirectBufferCapacity(daBuffer);
+  if (!data || length < 0 || length > capacity)
+    return JNI_FALSE;
+
+  DeepEye::Protocols::BromManager brom(&session->transport);
+  return brom.SendDA(data, (size_t)length) ? JNI_TRUE : JNI_FALSE;
 }
 
 extern "C" JNIEXPORT jboolean JNICALL
-Java_com_deepeye_otg_NativeBridge_injectDa(JNIEnv *env, jobject thiz,
-                                           jlong handle, jbyteArray da_data) {
+Java_com_deepeye_otg_NativeBridge_readPartition(JNIEnv *env, jobject thiz,
+                                                jlong handle, jstring name,
+                                                jlong sectorOffset,
+                                                jobject dst) {
   (void)thiz;
-  
-  auto transport = reinterpret_cast<DeepEye::Core::ITransport *>(handle);
-  if (!transport)
+
+  auto session = FromHandle(handle);
+  if (!session)
+    return JNI_FALSE;
+
+  auto data = static_cast<uint8_t *>(env->GetDirectBufferAddress(dst));
+  jlong capacity = env->GetDirectBufferCapacity(dst);
+  if (!data || capacity < 512 || sectorOffset < 0)
     return JNI_FALSE;
 
-  jsize len = env->GetArrayLength(da_data);
-  jbyte *body = env->GetByteArrayElements(da_data, 0);
+  return session->engine.ReadPartition(ToStdString(env, name),
+                                       (uint64_t)sectorOffset,
+                                       (uint64_t)capacity / 512, data)
+             ? JNI_TRUE
+             : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_deepeye_otg_NativeBridge_writePartition(JNIEnv *env, jobject thiz,
+                                                 jlong handle, jstring name,
+                                                 jlong sectorOffset,
+                                                 jobject src, jint length) {
+  (void)thiz;
 
-  std::vector<uint8_t> buffer(reinterpret_cast<uint8_t *>(body),
-                              reinterpret_cast<uint8_t *>(body) + len);
+  auto session = FromHandle(handle);
+  if (!session)
+    return JNI_FALSE;
 
-  DeepEye::Protocols::BromManager brom(transport);
-  bool success = brom.SendDA(buffer);
+  auto data = static_cast<uint8_t *>(env->GetDirectBufferAddress(src));
+  jlong capacity = env->GetDirectBufferCapacity(src);
+  if (!data || length < 0 || length > capacity || sectorOffset < 0)
+    return JNI_FALSE;
 
-  env->ReleaseByteArrayElements(da_data, body, JNI_ABORT);
-  return success ? JNI_TRUE : JNI_FALSE;
+  return session->engine.WritePartition(ToStdString(env, name),
+                                        (uint64_t)sectorOffset, data,
+                                        (size_t)length)
+             ? JNI_TRUE
+             : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_deepeye_otg_NativeBridge_dumpPartition(JNIEnv *env, jobject thiz,
+                                                jlong handle, jstring name,
+                                                jstring outPath) {
+  (void)thiz;
+
+  auto session = FromHandle(handle);
+  if (!session)
+    return JNI_FALSE;
+
+  ProgressScope progress(env, session);
+  return session->engine.DumpPartition(ToStdString(env, name),
+                                       ToStdString(env, outPath))
+             ? JNI_TRUE
+             : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_deepeye_otg_NativeBridge_flashPartition(JNIEnv *env, jobject thiz,
+                                                 jlong handle, jstring name,
+                                                 jstring inPath) {
+  (void)thiz;
+
+  auto session = FromHandle(handle);
+  if (!session)
+    return JNI_FALSE;
+
+  ProgressScope progress(env, session);
+  return session->engine.FlashPartition(ToStdString(env, name),
+                                        ToStdString(env, inPath))
+             ? JNI_TRUE
+             : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_deepeye_otg_NativeBridge_setProgressListener(JNIEnv *env,
+                                                      jobject thiz,
+                                                      jlong handle,
+                                                      jobject listener) {
+  (void)thiz;
+
+  auto session = FromHandle(handle);
+  if (!session)
+    return;
+
+  if (session->listener)
+    env->DeleteGlobalRef(session->listener);
+  session->listener = listener ? env->NewGlobalRef(listener) : nullptr;
 }
 
 extern "C" JNIEXPORT void JNICALL Java_com_deepeye_otg_NativeBridge_closeCore(
-    JNIEnv *env, jobject thiz, jlong transportPtr) {
-  (void)env;
+    JNIEnv *env, jobject thiz, jlong handle) {
   (void)thiz;
-  
-  auto transport =
-      reinterpret_cast<DeepEye::Core::LibUsbTransport *>(transportPtr);
-  if (transport) {
-    transport->Close();
-    delete transport;
+
+  auto session = FromHandle(handle);
+  if (session) {
+    if (session->listener)
+      env->DeleteGlobalRef(session->listener);
+    session->transport.Close();
+    delete session;
   }
 }
@@ -1,13 +1,57 @@
 package com.deepeye.otg
 
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
 object NativeBridge {
     init {
         System.loadLibrary("deepeye_core")
     }
 
+    /** Size of DeepEye_PartitionRecord in deepeye_exports.h. */
+    const val PARTITION_RECORD_SIZE = 184
+    private const val PARTITION_NAME_SIZE = 112
+
+    /** Invoked from native code on the calling thread after every chunk. */
+    fun interface ProgressListener {
+        fun onProgress(bytesDone: Long, bytesTotal: Long)
+    }
+
+    // All handles refer to one persistent native session (transport + engine).
     external fun initCore(fd: Int, vid: Int, pid: Int): Long
     external fun identifyDevice(handle: Long): Boolean
-    external fun injectDa(handle: Long, daData: ByteArray): Boolean
-    external fun getPartitions(handle: Long): Array<String>
     external fun closeCore(handle: Long)
+    external fun setProgressListener(handle: Long, listener: ProgressListener?)
+
+    /** [daData] must be a direct buffer. */
+    external fun injectDa(handle: Long, daData: ByteBuffer, length: Int): Boolean
+
+    /** Packed partition records owned by the session; valid until the next call. */
+    external fun getPartitionTable(handle: Long): ByteBuffer?
+
+    /** Reads `dst.capacity() / 512` sectors straight into a direct buffer. */
+    external fun readPartition(handle: Long, name: String, sectorOffset: Long, dst: ByteBuffer): Boolean
+    external fun writePartition(handle: Long, name: String, sectorOffset: Long, src: ByteBuffer, length: Int): Boolean
+
+    external fun dumpPartition(handle: Long, name: String, outPath: String): Boolean
+    external fun flashPartition(handle: Long, name: String, inPath: String): Boolean
+
+    fun getPartitions(handle: Long): List<PartitionInfo> {
+        val table = getPartitionTable(handle)?.order(ByteOrder.LITTLE_ENDIAN) ?: return emptyList()
+        val nameBytes = ByteArray(PARTITION_NAME_SIZE)
+
+        return (0 until table.capacity() / PARTITION_RECORD_SIZE).map { i ->
+            val base = i * PARTITION_RECORD_SIZE
+            table.position(base)
+            table.get(nameBytes)
+            val nameLen = nameBytes.indexOf(0).let { if (it < 0) PARTITION_NAME_SIZE else it }
+            val sizeInBytes = table.getLong(base + PARTITION_NAME_SIZE + 24)
+
+            PartitionInfo(
+                name = String(nameBytes, 0, nameLen, Charsets.UTF_8),
+                size = "${sizeInBytes / 1024 / 1024} MB",
+                type = "LUN ${table.getInt(base + PARTITION_NAME_SIZE)}"
+            )
+        }
+    }
 }
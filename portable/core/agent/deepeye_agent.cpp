@@ -0,0 +1,82 @@
+/**
+ * DeepEye device agent: serves one USB device to NetTransport clients, so
+ * a hub machine with the phone attached can stay small while the engine
+ * runs elsewhere.
+ *
+ *   deepeye_agent --device /dev/bus/usb/BBB/DDD [--port N] [--token T]
+ *                 [--listen-all]
+ *
+ * Only local clients can connect unless --listen-all is given, which also
+ * requires a token: anyone who can reach the port can otherwise drive the
+ * device. The token may come from DEEPEYE_AGENT_TOKEN instead, keeping it
+ * out of the process list. Connections are served one after another until
+ * the process is stopped.
+ */
+#include "../include/net_transport.h"
+#include "../include/usb_transport.h"
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+using namespace DeepEye;
+
+int main(int argc, char *argv[]) {
+  std::string devicePath;
+  uint16_t port = 5555;
+  bool allInterfaces = false;
+  const char *envToken = getenv("DEEPEYE_AGENT_TOKEN");
+  std::string token = envToken ? envToken : "";
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--device" && hasValue)
+      devicePath = argv[++i];
+    else if (arg == "--port" && hasValue)
+      port = (uint16_t)strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--token" && hasValue)
+      token = argv[++i];
+    else if (arg == "--listen-all")
+      allInterfaces = true;
+    else {
+      devicePath.clear();
+      break;
+    }
+  }
+  if (devicePath.empty()) {
+    std::cerr << "Usage: deepeye_agent --device /dev/bus/usb/BBB/DDD "
+                 "[--port N] [--token T] [--listen-all]"
+              << std::endl;
+    return 1;
+  }
+  if (allInterfaces && token.empty()) {
+    std::cerr << "[AGENT] --listen-all needs a --token (or "
+                 "DEEPEYE_AGENT_TOKEN)."
+              << std::endl;
+    return 1;
+  }
+  if (token.size() > Core::NetFrame::kMaxToken) {
+    std::cerr << "[AGENT] Token over " << Core::NetFrame::kMaxToken
+              << " bytes." << std::endl;
+    return 1;
+  }
+
+  int fd = open(devicePath.c_str(), O_RDWR);
+  Core::LibUsbTransport usb;
+  if (fd < 0 || !usb.Open(fd)) {
+    std::cerr << "[AGENT] Cannot open " << devicePath << std::endl;
+    return 1;
+  }
+
+  Core::NetTransportAgent agent(&usb);
+  agent.SetToken(token);
+  if (!agent.Listen(port, allInterfaces))
+    return 1;
+  std::cerr << "[AGENT] Serving " << devicePath << " on port " << agent.Port()
+            << std::endl;
+  agent.Serve();
+  usb.Close();
+  close(fd);
+  return 0;
+}
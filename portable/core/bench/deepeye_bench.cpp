@@ -0,0 +1,1442 @@
+/**
+ * DeepEye core benchmark suite.
+ *
+ *   deepeye_bench [--json out.json] [--filter substr] [--min-time sec]
+ *                 [--partition-mb N] [--tmp-dir dir] [--trace trace.json]
+ *
+ * Micro benchmarks cover the protocol helpers; the engine.* cases run the
+ * full ProtocolEngine dump/flash pipeline against MockFirehoseDevice. A
+ * summary goes to stderr and the results to stdout (or --json) as JSON.
+ * --trace records spans for the whole run, prints per-span latency to
+ * stderr and writes a Chrome trace.
+ */
+#include "../include/backup_archive.h"
+#include "../include/checksum.h"
+#include "../include/chunk_store.h"
+#include "../include/da_handler.h"
+#include "../include/deepeye_core.h"
+#include "../include/deepeye_exports.h"
+#include "../include/dump_writer.h"
+#include "../include/firehose.h"
+#include "../include/firehose_pipeline.h"
+#include "../include/fs_allocation.h"
+#include "../include/gpt_parser.h"
+#include "../include/lp_metadata.h"
+#include "../include/net_transport.h"
+#include "../include/sparse_handler.h"
+#include "../include/trace.h"
+#include "mock_firehose_device.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace DeepEye;
+
+namespace {
+
+struct Options {
+  std::string jsonPath;
+  std::string filter;
+  std::string tmpDir = "/tmp";
+  std::string tracePath;
+  double minTime = 0.5;
+  uint64_t partitionMb = 256;
+};
+
+struct Result {
+  std::string name;
+  uint64_t iterations;
+  double seconds;
+  uint64_t bytesPerIteration; // 0 for pure op-rate cases
+};
+
+Options g_opts;
+std::vector<Result> g_results;
+std::vector<std::string> g_failures; // makes main() exit nonzero
+volatile uint64_t g_sink; // keeps results observable to the optimizer
+
+using Clock = std::chrono::steady_clock;
+
+bool Selected(const std::string &name) {
+  return g_opts.filter.empty() || name.find(g_opts.filter) != std::string::npos;
+}
+
+// A correctness check did not hold; reported again at exit.
+void Fail(const std::string &what) {
+  std::cerr << "[BENCH] FAIL: " << what << std::endl;
+  g_failures.push_back(what);
+}
+
+// Runs fn in doubling batches until --min-time has elapsed.
+void Measure(const std::string &name, uint64_t bytesPerIteration,
+             const std::function<void()> &fn) {
+  if (!Selected(name))
+    return;
+  fn(); // warm-up
+
+  uint64_t iterations = 0, batch = 1;
+  double elapsed = 0;
+  while (elapsed < g_opts.minTime) {
+    auto t0 = Clock::now();
+    for (uint64_t i = 0; i < batch; ++i)
+      fn();
+    elapsed += std::chrono::duration<double>(Clock::now() - t0).count();
+    iterations += batch;
+    batch *= 2;
+  }
+  g_results.push_back({name, iterations, elapsed, bytesPerIteration});
+}
+
+// Single timed run, for cases too large to repeat.
+void MeasureOnce(const std::string &name, uint64_t bytes,
+                 const std::function<bool()> &fn) {
+  if (!Selected(name))
+    return;
+  auto t0 = Clock::now();
+  bool ok = fn();
+  double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+  if (!ok) {
+    Fail(name);
+    return;
+  }
+  g_results.push_back({name, 1, elapsed, bytes});
+}
+
+std::vector<uint8_t> MixedImage(size_t size) {
+  // 50% zero blocks, 25% fill-pattern blocks, 25% noise, in 64 KiB runs.
+  std::vector<uint8_t> img(size, 0);
+  uint32_t x = 0x12345678;
+  for (size_t off = 0; off < size; off += 65536) {
+    size_t n = std::min<size_t>(65536, size - off);
+    switch ((off / 65536) % 4) {
+    case 1:
+      memset(&img[off], 0xFF, n);
+      break;
+    case 3:
+      for (size_t i = 0; i < n; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        img[off + i] = (uint8_t)x;
+      }
+      break;
+    }
+  }
+  return img;
+}
+
+void BenchFirehose() {
+  Measure("firehose.create_read_xml", 0, [] {
+    g_sink += Protocols::FirehoseClient::CreateReadXml("userdata", 123456, 2048)
+                  .size();
+  });
+  Measure("firehose.create_configure_xml", 0, [] {
+    g_sink += Protocols::FirehoseClient::CreateConfigureXml().size();
+  });
+
+  const std::string ack =
+      "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n<data>\n  <response "
+      "value=\"ACK\" rawmode=\"false\" MaxPayloadSizeToTargetInBytes=\"1048576\""
+      " MemoryName=\"ufs\" />\n</data>";
+  Measure("firehose.parse_response", ack.size(), [&] {
+    g_sink += Protocols::FirehoseClient::ParseResponse(ack).attributes.size();
+  });
+}
+
+void BenchGpt() {
+  const uint32_t kEntries = 128;
+  std::vector<uint8_t> entries(kEntries * sizeof(Protocols::GptEntry), 0);
+  for (uint32_t i = 0; i < kEntries; ++i) {
+    Protocols::GptEntry e = {};
+    e.partitionTypeGuid[0] = 1;
+    e.startingLba = 2048 + i * 4096;
+    e.endingLba = e.startingLba + 4095;
+    std::string name = "partition_" + std::to_string(i);
+    for (size_t c = 0; c < name.size(); ++c)
+      e.partitionName[c] = (uint16_t)name[c];
+    memcpy(&entries[i * sizeof(e)], &e, sizeof(e));
+  }
+  Measure("gpt.parse_entries_128", entries.size(), [&] {
+    g_sink += Protocols::GptParser::ParseEntries(
+                  entries.data(), kEntries, sizeof(Protocols::GptEntry), 512)
+                  .size();
+  });
+  Protocols::GptName name;
+  Measure("gpt.view_entries_128", entries.size(), [&] {
+    Protocols::GptEntryTable table(entries.data(), kEntries,
+                                   sizeof(Protocols::GptEntry));
+    for (Protocols::GptEntryView e : table) {
+      e.Name(name);
+      g_sink += name.length + e.SizeInBytes(512);
+    }
+  });
+
+  // UFS layout: six LUNs, 4 KiB sectors, 128-entry tables, some names
+  // outside ASCII (CJK and a surrogate pair) to exercise the decoder.
+  const uint32_t kSector = 4096, kLuns = 6;
+  const uint32_t tableBytes = kEntries * sizeof(Protocols::GptEntry);
+  std::vector<std::vector<uint8_t>> luns(kLuns);
+  for (uint32_t lun = 0; lun < kLuns; ++lun) {
+    std::vector<uint8_t> &disk = luns[lun];
+    disk.assign(2 * kSector + tableBytes, 0);
+    Protocols::GptHeader hdr = {};
+    hdr.signature = 0x5452415020494645;
+    hdr.headerSize = 92;
+    hdr.currentLba = 1;
+    hdr.partitionEntryLba = 2;
+    hdr.numPartitionEntries = kEntries;
+    hdr.partitionEntrySize = sizeof(Protocols::GptEntry);
+    memcpy(&disk[kSector], &hdr, sizeof(hdr));
+    for (uint32_t i = 0; i < kEntries - lun * 16; ++i) {
+      Protocols::GptEntry e = {};
+      e.partitionTypeGuid[0] = 1;
+      e.startingLba = 6 + i * 256;
+      e.endingLba = e.startingLba + 255;
+      std::string ascii = "lun" + std::to_string(lun) + "_p" +
+                          std::to_string(i);
+      size_t c = 0;
+      for (; c < ascii.size(); ++c)
+        e.partitionName[c] = (uint16_t)ascii[c];
+      if (i % 4 == 0) {
+        e.partitionName[c++] = 0x5206; // CJK
+        e.partitionName[c++] = 0xD83D; // U+1F4F1 as a surrogate pair
+        e.partitionName[c++] = 0xDCF1;
+      }
+      memcpy(&disk[2 * kSector + i * sizeof(e)], &e, sizeof(e));
+    }
+  }
+  std::vector<Protocols::PartitionInfo> parts;
+  Measure("gpt.parse_multilun_4k", (uint64_t)kLuns * tableBytes, [&] {
+    parts.clear(); // keeps capacity across runs
+    for (uint32_t lun = 0; lun < kLuns; ++lun) {
+      Protocols::GptHeader hdr;
+      uint32_t sector = Protocols::GptParser::FindHeader(
+          luns[lun].data(), luns[lun].size(), hdr);
+      Protocols::GptParser::ParseEntries(
+          &luns[lun][hdr.partitionEntryLba * sector], hdr.numPartitionEntries,
+          hdr.partitionEntrySize, sector, lun, parts);
+    }
+    g_sink += parts.size();
+  });
+}
+
+void BenchSparse() {
+  const size_t kSize = 64 << 20;
+  std::vector<uint8_t> raw = MixedImage(kSize);
+  std::vector<uint8_t> sparse = Protocols::SparseImageHandler::Sparsify(
+      raw.data(), raw.size());
+  std::vector<uint8_t> out;
+
+  Measure("sparse.encode_64m", kSize, [&] {
+    g_sink +=
+        Protocols::SparseImageHandler::Sparsify(raw.data(), raw.size()).size();
+  });
+  Measure("sparse.decode_64m", kSize, [&] {
+    g_sink += Protocols::SparseImageHandler::Unsparse(sparse.data(),
+                                                      sparse.size(), out);
+  });
+  if (Selected("sparse.") &&
+      (!Protocols::SparseImageHandler::Unsparse(sparse.data(), sparse.size(),
+                                                out) ||
+       out != raw))
+    Fail("sparse round trip mismatch");
+}
+
+void BenchChecksums() {
+  const size_t kSize = 16 << 20;
+  std::vector<uint8_t> buf = MixedImage(kSize);
+  Measure("crc32.16m", kSize, [&] {
+    g_sink += Protocols::Crc32::Compute(buf.data(), buf.size());
+  });
+  Measure("sha256.16m", kSize, [&] {
+    uint8_t digest[Protocols::Sha256::kDigestSize];
+    Protocols::Sha256::Compute(buf.data(), buf.size(), digest);
+    g_sink += digest[0];
+  });
+}
+
+void BenchDa() {
+  const uint32_t kSections = 16;
+  std::vector<uint8_t> da(sizeof(Protocols::DaHeader) +
+                          kSections * sizeof(Protocols::DaSection));
+  Protocols::DaHeader hdr = {0x4D544B5F, 4, kSections};
+  memcpy(da.data(), &hdr, sizeof(hdr));
+  for (uint32_t i = 0; i < kSections; ++i) {
+    Protocols::DaSection sec = {i, 0x1000 * i, 0x1000, 0x40000000, 0, 0};
+    memcpy(&da[sizeof(hdr) + i * sizeof(sec)], &sec, sizeof(sec));
+  }
+  Measure("da.parse_sections_16", da.size(), [&] {
+    g_sink += Protocols::DaHandler::ParseSections(da.data(), da.size()).size();
+  });
+}
+
+void BenchTrace() {
+  bool wasEnabled = Core::Tracer::Enabled();
+  Core::Tracer::SetEnabled(false);
+  Measure("trace.span_disabled", 0, [] {
+    Core::TraceSpan span("bench.span", Core::TraceCategory::Pipeline, 512);
+  });
+  Core::Tracer::SetEnabled(true);
+  Measure("trace.span_enabled", 0, [] {
+    Core::TraceSpan span("bench.span", Core::TraceCategory::Pipeline, 512);
+  });
+
+  // Short-lived threads hand their buffer on instead of growing the
+  // registry, and the spans of exited threads stay in the statistics.
+  Core::Tracer::Reset();
+  const int threads = 32;
+  for (int i = 0; i < threads; ++i)
+    std::thread([] {
+      Core::TraceSpan span("bench.thread_span", Core::TraceCategory::Pipeline);
+    }).join();
+  uint64_t spans = 0;
+  for (const Core::TraceStat &s : Core::Tracer::Snapshot())
+    if (s.name == "bench.thread_span")
+      spans = s.count;
+  std::string json = Core::Tracer::ChromeTraceJson();
+  size_t lanes = 0;
+  for (size_t at = json.find("thread_name"); at != std::string::npos;
+       at = json.find("thread_name", at + 1))
+    ++lanes;
+  if (spans != (uint64_t)threads || lanes != 1)
+    Fail("trace.thread_buffers reuse");
+
+  Core::Tracer::SetEnabled(wasEnabled);
+  Core::Tracer::Reset();
+}
+
+// Flushes a finished dump so page-cache writers pay for their writeback.
+bool Sync(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  bool ok = fd >= 0 && fsync(fd) == 0;
+  if (fd >= 0)
+    close(fd);
+  return ok;
+}
+
+// Streams --partition-mb through each dump sink, 1 MiB at a time, including
+// the final fsync. The ofstream case is the pre-DumpWriter sink.
+void BenchDumpWriter() {
+  const size_t chunk = Core::ProtocolEngine::kTransferSectors * 512;
+  const uint64_t bytes = g_opts.partitionMb << 20;
+  std::vector<uint8_t> source = MixedImage(chunk);
+  std::string path =
+      g_opts.tmpDir + "/deepeye_bench_" + std::to_string(getpid()) + ".dump";
+
+  MeasureOnce("dump_sink.ofstream", bytes, [&] {
+    std::ofstream out(path, std::ios::binary);
+    for (uint64_t done = 0; done < bytes; done += chunk)
+      out.write(reinterpret_cast<const char *>(source.data()), chunk);
+    out.close();
+    return (bool)out && Sync(path);
+  });
+
+  struct Variant {
+    const char *name;
+    bool direct;
+    bool ioUring;
+    Core::DumpWriter::Backend expect;
+  };
+  const Variant variants[] = {
+      {"dump_sink.pwrite_buffered", false, false,
+       Core::DumpWriter::Backend::Pwrite},
+      {"dump_sink.pwrite_direct", true, false,
+       Core::DumpWriter::Backend::Pwrite},
+      {"dump_sink.io_uring_direct", true, true,
+       Core::DumpWriter::Backend::IoUring},
+  };
+  for (const Variant &v : variants) {
+    Core::DumpWriter::Options options;
+    options.direct = v.direct;
+    options.ioUring = v.ioUring;
+    options.bufferSize = chunk;
+    MeasureOnce(v.name, bytes, [&] {
+      Core::DumpWriter out;
+      if (!out.Open(path, bytes, options))
+        return false;
+      if (out.GetBackend() != v.expect || out.IsDirect() != v.direct)
+        std::cerr << "[BENCH] " << v.name << ": "
+                  << (out.IsDirect() ? "" : "no O_DIRECT ")
+                  << (out.GetBackend() == v.expect ? "" : "no io_uring ")
+                  << "on " << g_opts.tmpDir << std::endl;
+      for (uint64_t done = 0; done < bytes; done += chunk) {
+        uint8_t *buf = out.AcquireBuffer();
+        if (!buf)
+          return false;
+        memcpy(buf, source.data(), chunk);
+        if (!out.Commit(chunk))
+          return false;
+      }
+      return out.Close() && Sync(path);
+    });
+  }
+  unlink(path.c_str());
+}
+
+// Mixed image through the archive writer on all threads, then 4 KiB random
+// reads that each decode one chunk.
+void BenchBackupArchive() {
+  const size_t size = 64 << 20;
+  std::vector<uint8_t> img = MixedImage(size);
+  std::string path =
+      g_opts.tmpDir + "/deepeye_bench_" + std::to_string(getpid()) + ".bak";
+  Protocols::PartitionInfo info;
+  info.name = "userdata";
+
+  std::string name = std::string("backup.write_") +
+                     Core::BackupCodecName(Core::DefaultBackupCodec()) +
+                     "_64m";
+  MeasureOnce(name, size, [&] {
+    Core::BackupArchiveWriter archive;
+    bool ok = archive.Open(path) && archive.BeginPartition(info);
+    for (size_t off = 0; ok && off < size; off += 1 << 20)
+      ok = archive.Append(&img[off], 1 << 20);
+    ok = ok && archive.Close();
+    if (ok)
+      std::cerr << "[BENCH] archive ratio "
+                << (double)archive.StoredBytes() / archive.RawBytes()
+                << std::endl;
+    return ok;
+  });
+
+  Core::BackupArchiveReader reader;
+  if (reader.Open(path)) {
+    uint32_t x = 0x2545F491;
+    uint8_t block[4096];
+    Measure("backup.read_range_4k", sizeof(block), [&] {
+      x = x * 1664525 + 1013904223;
+      uint64_t off = (uint64_t)(x % (size / sizeof(block))) * sizeof(block);
+      g_sink += reader.ReadRange("userdata", off, block, sizeof(block));
+    });
+  }
+  unlink(path.c_str());
+}
+
+void BenchChunkStore() {
+  // Incompressible data so every byte goes through the gear hash.
+  const size_t size = 64 << 20;
+  std::vector<uint8_t> noise(size);
+  uint64_t x = 0x9E3779B97F4A7C15ull;
+  for (size_t i = 0; i < size; i += 8) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    memcpy(&noise[i], &x, 8);
+  }
+  Core::FastCdc cdc(16 * 1024, 64 * 1024, 256 * 1024);
+  uint64_t chunks = 0;
+  Measure("cas.fastcdc_chunking", size, [&] {
+    chunks = 0;
+    for (size_t off = 0; off < size; ++chunks)
+      off += cdc.Cut(&noise[off], size - off);
+  });
+  if (chunks)
+    std::cerr << "[BENCH] fastcdc mean chunk " << size / chunks << " bytes"
+              << std::endl;
+
+  // A fleet of 8 devices sharing one 32 MiB image, each with a few
+  // insertions (shifting everything after them) and byte flips.
+  const size_t imageSize = 32 << 20;
+  const int devices = 8;
+  std::vector<uint8_t> base = MixedImage(imageSize);
+  memcpy(&base[3 * 65536], &noise[0], imageSize / 4); // denser content
+  std::string root = g_opts.tmpDir + "/deepeye_bench_" +
+                     std::to_string(getpid()) + ".store";
+  MeasureOnce("cas.ingest_fleet_8x32m", (uint64_t)imageSize * devices, [&] {
+    Core::ChunkStore store;
+    if (!store.Open(root))
+      return false;
+    for (int d = 0; d < devices; ++d) {
+      std::vector<uint8_t> img = base;
+      for (int k = 0; k < 4; ++k) {
+        size_t at = (size_t)(d * 7919 + k * 5003) * 1021 % imageSize;
+        img.insert(img.begin() + at, 16 + d, (uint8_t)d);
+        img[(at * 3) % img.size()] ^= 0x5A;
+      }
+      if (!store.BeginObject("dev" + std::to_string(d) + "/system"))
+        return false;
+      for (size_t off = 0; off < img.size(); off += 1 << 20)
+        if (!store.Append(&img[off], std::min<size_t>(1 << 20,
+                                                      img.size() - off)))
+          return false;
+      if (!store.EndObject())
+        return false;
+    }
+    Core::ChunkStoreStats stats = store.Stats();
+    std::cerr << "[BENCH] dedup ratio " << stats.DedupRatio() << " ("
+              << stats.logicalBytes << " logical, " << stats.uniqueBytes
+              << " unique, " << stats.storedBytes << " stored)" << std::endl;
+    return store.Close();
+  });
+  std::error_code ec;
+  std::filesystem::remove_all(root, ec);
+}
+
+// LP metadata as written to super by lpmake: a geometry block and one
+// metadata slot. Each partition is a list of (super sector, length) extents,
+// all of `targetType`.
+struct LpImage {
+  std::vector<uint8_t> geometry;
+  std::vector<uint8_t> metadata;
+};
+
+LpImage BuildLpImage(
+    const std::vector<std::pair<std::string,
+                                std::vector<std::pair<uint64_t, uint64_t>>>>
+        &partitions,
+    uint64_t superBytes,
+    uint32_t targetType = Protocols::LpParser::kTargetLinear) {
+  using namespace Protocols;
+  const uint32_t kMaxSize = 65536;
+  LpImage image;
+  LpGeometry geo = {};
+  geo.magic = LpParser::kGeometryMagic;
+  geo.structSize = sizeof(geo);
+  geo.metadataMaxSize = kMaxSize;
+  geo.metadataSlotCount = 2;
+  geo.logicalBlockSize = 4096;
+  Sha256::Compute(reinterpret_cast<const uint8_t *>(&geo), sizeof(geo),
+                  geo.checksum);
+  image.geometry.assign(LpParser::kGeometrySize, 0);
+  memcpy(image.geometry.data(), &geo, sizeof(geo));
+
+  std::vector<LpPartitionEntry> parts;
+  std::vector<LpExtentEntry> extents;
+  for (const auto &p : partitions) {
+    LpPartitionEntry e = {};
+    strncpy(e.name, p.first.c_str(), sizeof(e.name) - 1);
+    e.firstExtentIndex = (uint32_t)extents.size();
+    e.numExtents = (uint32_t)p.second.size();
+    for (const auto &x : p.second)
+      extents.push_back({x.second, targetType, x.first, 0});
+    parts.push_back(e);
+  }
+  LpGroupEntry group = {};
+  strncpy(group.name, "default", sizeof(group.name) - 1);
+  LpBlockDeviceEntry device = {};
+  device.firstLogicalSector = 2048;
+  device.size = superBytes;
+  strncpy(device.partitionName, "super", sizeof(device.partitionName) - 1);
+
+  std::vector<uint8_t> tables;
+  auto append = [&](LpTableDescriptor &d, const void *data, size_t count,
+                    size_t size) {
+    d = {(uint32_t)tables.size(), (uint32_t)count, (uint32_t)size};
+    const uint8_t *b = static_cast<const uint8_t *>(data);
+    tables.insert(tables.end(), b, b + count * size);
+  };
+  LpHeader header = {};
+  header.magic = LpParser::kHeaderMagic;
+  header.majorVersion = 10;
+  header.headerSize = sizeof(header);
+  append(header.partitions, parts.data(), parts.size(), sizeof(parts[0]));
+  append(header.extents, extents.data(), extents.size(), sizeof(extents[0]));
+  append(header.groups, &group, 1, sizeof(group));
+  append(header.blockDevices, &device, 1, sizeof(device));
+  header.tablesSize = (uint32_t)tables.size();
+  Sha256::Compute(tables.data(), tables.size(), header.tablesChecksum);
+  Sha256::Compute(reinterpret_cast<const uint8_t *>(&header), sizeof(header),
+                  header.headerChecksum);
+
+  image.metadata.assign(kMaxSize, 0);
+  memcpy(image.metadata.data(), &header, sizeof(header));
+  memcpy(image.metadata.data() + sizeof(header), tables.data(),
+         tables.size());
+  return image;
+}
+
+void BenchLogical() {
+  // system_a is split around vendor_a, as after an OTA resize.
+  const uint64_t sectors = g_opts.partitionMb * 2048;
+  const uint64_t superSectors = 2048 + 3 * sectors;
+  LpImage lp = BuildLpImage(
+      {{"system_a", {{2048, sectors / 2}, {2048 + sectors, sectors / 2}}},
+       {"vendor_a", {{2048 + sectors / 2, sectors / 2}}},
+       {"product_a", {{2048 + 2 * sectors, sectors}}},
+       {"system_b", {}}},
+      superSectors * 512);
+
+  Measure("lp.parse_metadata", 0, [&] {
+    Protocols::LpGeometry geo;
+    Protocols::LpMetadata md;
+    bool ok =
+        Protocols::LpParser::ParseGeometry(lp.geometry.data(), geo) &&
+        Protocols::LpParser::ParseMetadata(lp.metadata.data(),
+                                           lp.metadata.size(), geo, md);
+    g_sink = ok ? md.partitions.size() : 0;
+  });
+  // The engine maps every extent that is not Zero onto a block device, so
+  // any other target type has to stop at the parser.
+  LpImage unknown =
+      BuildLpImage({{"system_a", {{2048, 8}}}}, superSectors * 512, 2);
+  Protocols::LpGeometry unknownGeo;
+  Protocols::LpMetadata unknownMd;
+  if (!Protocols::LpParser::ParseGeometry(unknown.geometry.data(),
+                                          unknownGeo) ||
+      Protocols::LpParser::ParseMetadata(unknown.metadata.data(),
+                                         unknown.metadata.size(), unknownGeo,
+                                         unknownMd))
+    Fail("lp.parse_metadata unknown extent target");
+  if (!Selected("engine.dump_logical") && !Selected("engine.lp_slot"))
+    return;
+
+  // boot_a carries the Qualcomm "active" attribute: metadata slot 0.
+  Bench::MockFirehoseDevice device({{"boot_a", 65536, 1ull << 50},
+                                    {"boot_b", 65536},
+                                    {"super", superSectors}});
+  Core::ProtocolEngine engine(&device);
+  if (!engine.Identify()) {
+    Fail("mock device did not enumerate");
+    return;
+  }
+  uint64_t superLba = 0;
+  for (const auto &p : engine.GetPartitions())
+    if (p.name == "super")
+      superLba = p.startLba;
+  device.Poke(superLba + Protocols::LpParser::kGeometryOffset / 512,
+              lp.geometry);
+  device.Poke(superLba + Protocols::LpParser::kMetadataOffset / 512,
+              lp.metadata);
+  engine.ClearReadCache(); // the device changed behind the engine
+  if (engine.GetPartitions().size() != 6) {
+    Fail("LP partitions not found");
+    return;
+  }
+
+  // Exported records flag the logical partitions, and writing a table back
+  // as it was read leaves the GPT alone.
+  std::vector<DeepEye_PartitionRecord> records(
+      DeepEye_EngineCopyPartitionRecords(&engine, nullptr, 0));
+  DeepEye_EngineCopyPartitionRecords(&engine, records.data(),
+                                     (int)records.size());
+  size_t logicalRecords = 0;
+  for (const DeepEye_PartitionRecord &r : records)
+    if (r.flags & DEEPEYE_PARTITION_LOGICAL)
+      ++logicalRecords;
+  uint64_t writtenBefore = device.bytesWritten;
+  if (logicalRecords != 3 ||
+      !DeepEye_EngineWritePartitionRecords(&engine, records.data(),
+                                           (int)records.size()) ||
+      device.bytesWritten != writtenBefore)
+    Fail("partition records round trip");
+
+  std::string path =
+      g_opts.tmpDir + "/deepeye_bench_" + std::to_string(getpid()) + ".img";
+  uint64_t readBefore = device.bytesRead;
+  MeasureOnce("engine.dump_logical", sectors * 512, [&] {
+    if (!engine.DumpPartition("system_a", path))
+      return false;
+    std::cerr << "[BENCH] system_a dump read "
+              << device.bytesRead - readBefore << " of "
+              << superSectors * 512 << " super bytes" << std::endl;
+    // The second half comes from the extent past vendor_a.
+    std::ifstream in(path, std::ios::binary);
+    in.seekg((std::streamoff)(sectors / 2) * 512);
+    return in.get() == (int)((superLba + 2048 + sectors) & 0xFF);
+  });
+  unlink(path.c_str());
+
+  // Slot _b's metadata maps system_b where slot _a keeps system_a. Writes
+  // follow the chosen slot and are refused when none can be told.
+  Protocols::LpGeometry geo;
+  Protocols::LpParser::ParseGeometry(lp.geometry.data(), geo);
+  device.Poke(superLba + Protocols::LpParser::SlotOffset(geo, 1, false) / 512,
+              BuildLpImage({{"system_a", {}}, {"system_b", {{2048, sectors}}}},
+                           superSectors * 512)
+                  .metadata);
+  device.Poke(superLba + 2048, std::vector<uint8_t>(512, 0)); // keep writes
+  engine.ClearReadCache();
+  MeasureOnce("engine.lp_slot", 0, [&] {
+    std::vector<uint8_t> sector(512, 0x5B), back(512);
+    engine.SetSlotSuffix("_b");
+    engine.GetPartitions();
+    bool ok = engine.WritePartition("system_b", 0, sector.data(), 512) &&
+              engine.ReadPartition("super", 2048, 1, back.data()) &&
+              back == sector;
+    engine.SetSlotSuffix("_c"); // no such metadata slot
+    engine.GetPartitions();
+    ok = ok && !engine.WritePartition("vendor_a", 0, sector.data(), 512);
+    engine.SetSlotSuffix("");
+    engine.GetPartitions();
+    return ok && engine.WritePartition("vendor_a", 0, sector.data(), 512);
+  });
+}
+
+// ext4 metadata for a 4 KiB-block filesystem of `blocks` blocks: each group
+// is `fill` full from its start, odd groups are BLOCK_UNINIT. Returns
+// (byte offset, bytes) pieces to place on the partition.
+std::vector<std::pair<uint64_t, std::vector<uint8_t>>>
+BuildExt4Metadata(uint64_t blocks, double fill) {
+  const uint32_t kBlock = 4096, kPerGroup = 32768, kItable = 512;
+  const uint32_t groups = (uint32_t)((blocks + kPerGroup - 1) / kPerGroup);
+  auto put32 = [](std::vector<uint8_t> &v, size_t off, uint32_t x) {
+    memcpy(&v[off], &x, 4);
+  };
+  std::vector<uint8_t> sb(1024, 0);
+  put32(sb, 4, (uint32_t)blocks);
+  put32(sb, 24, 2); // 1024 << 2
+  put32(sb, 32, kPerGroup);
+  put32(sb, 40, 8192); // inodes per group: 8192 * 256 = kItable blocks
+  sb[56] = 0x53, sb[57] = 0xEF;
+  put32(sb, 76, 1);
+  sb[88] = 0; // inode size 256
+  sb[89] = 1;
+  put32(sb, 100, 1); // sparse_super
+
+  std::vector<std::pair<uint64_t, std::vector<uint8_t>>> pieces;
+  std::vector<uint8_t> gdt(kBlock, 0);
+  const uint64_t metadataEnd = 2 + 2 * groups + (uint64_t)groups * kItable;
+  for (uint32_t g = 0; g < groups; ++g) {
+    uint8_t *d = &gdt[g * 32];
+    uint32_t bitmap = 2 + g;
+    memcpy(d, &bitmap, 4);
+    uint32_t inodeBitmap = 2 + groups + g, itable = 2 + 2 * groups + g * kItable;
+    memcpy(d + 4, &inodeBitmap, 4);
+    memcpy(d + 8, &itable, 4);
+    if (g % 2) {
+      d[18] = 0x2; // BLOCK_UNINIT
+      continue;
+    }
+    uint64_t used = std::max<uint64_t>((uint64_t)(kPerGroup * fill),
+                                       g ? 0 : metadataEnd);
+    std::vector<uint8_t> bits(kBlock, 0);
+    for (uint64_t b = 0; b < used; ++b)
+      bits[b / 8] |= 1 << (b % 8);
+    pieces.push_back({(uint64_t)bitmap * kBlock, bits});
+  }
+  pieces.push_back({1024, sb});
+  pieces.push_back({kBlock, gdt});
+  return pieces;
+}
+
+void BenchAllocated() {
+  if (!Selected("engine.dump_allocated"))
+    return;
+  const uint64_t sectors = g_opts.partitionMb * 2048;
+  const uint64_t bytes = sectors * 512;
+  Bench::MockFirehoseDevice device({{"boot", 131072}, {"userdata", sectors}});
+  Core::ProtocolEngine engine(&device);
+  if (!engine.Identify() || engine.GetPartitions().size() != 2) {
+    Fail("mock device did not enumerate");
+    return;
+  }
+  uint64_t lba = engine.CachedPartitions().back().startLba;
+  for (const auto &piece : BuildExt4Metadata(bytes / 4096, 0.3))
+    device.Poke(lba + piece.first / 512, piece.second);
+  engine.ClearReadCache();
+
+  std::string path =
+      g_opts.tmpDir + "/deepeye_bench_" + std::to_string(getpid()) + ".img";
+  uint64_t readBefore = device.bytesRead;
+  MeasureOnce("engine.dump_allocated", bytes, [&] {
+    if (!engine.DumpAllocated("userdata", path))
+      return false;
+    std::cerr << "[BENCH] allocated dump read "
+              << device.bytesRead - readBefore << " of " << bytes
+              << " bytes" << std::endl;
+    uint8_t header[sizeof(Protocols::SparseHeader)];
+    std::ifstream in(path, std::ios::binary);
+    return in.read(reinterpret_cast<char *>(header), sizeof(header)) &&
+           Protocols::SparseImageHandler::GetUnsparseSize(header) == bytes;
+  });
+  unlink(path.c_str());
+}
+
+// A programmer limited to 64 KiB reads behind a 500 us turnaround, read
+// and flashed with one command at a time and with the default pipeline;
+// then a rejected read in mid-stream must fail alone and leave the session
+// usable.
+void BenchPipeline() {
+  if (!Selected("engine.pipeline"))
+    return;
+  const uint64_t sectors = 32768;
+  const uint64_t chunkSectors = 128;
+  Bench::MockFirehoseDevice device({{"boot", 131072}, {"system", sectors}});
+  Core::ProtocolEngine engine(&device);
+  if (!engine.Identify() || engine.GetPartitions().size() != 2) {
+    Fail("mock device did not enumerate");
+    return;
+  }
+  device.latency = std::chrono::microseconds(500);
+
+  std::string path =
+      g_opts.tmpDir + "/deepeye_bench_" + std::to_string(getpid()) + ".img";
+  {
+    std::vector<uint8_t> img(sectors * 512);
+    uint32_t x = 0x9E3779B9;
+    for (auto &byte : img) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      byte = (uint8_t)(x | 1);
+    }
+    std::ofstream(path, std::ios::binary | std::ios::trunc)
+        .write(reinterpret_cast<const char *>(img.data()), img.size());
+  }
+
+  std::vector<uint8_t> chunk(chunkSectors * 512);
+  auto readAll = [&] {
+    for (uint64_t s = 0; s < sectors; s += chunkSectors)
+      if (!engine.ReadPartition("system", s, chunkSectors, chunk.data()))
+        return false;
+    return true;
+  };
+  for (uint32_t depth : {1u, Protocols::FirehosePipeline::kDefaultDepth}) {
+    engine.SetPipelineDepth(depth);
+    std::string suffix = depth == 1 ? "_serial" : "";
+    MeasureOnce("engine.pipeline_read" + suffix, sectors * 512, readAll);
+    MeasureOnce("engine.pipeline_flash" + suffix, sectors * 512,
+                [&] { return engine.FlashPartition("system", path); });
+  }
+
+  const Protocols::FirehosePipeline::Stats &stats = engine.PipelineStats();
+  std::cerr << "[BENCH] pipeline: " << stats.readAheadUsed << "/"
+            << stats.readAhead << " read-ahead used, " << stats.deferredAcks
+            << " deferred ACKs, up to " << stats.maxInFlight << " in flight"
+            << std::endl;
+
+  device.latency = Bench::MockFirehoseDevice::Clock::duration::zero();
+  device.failLba = engine.CachedPartitions().back().startLba + 40 * 128 + 5;
+  uint64_t failedAt = UINT64_MAX;
+  for (uint64_t s = 0; s < sectors && failedAt == UINT64_MAX;
+       s += chunkSectors)
+    if (!engine.ReadPartition("system", s, chunkSectors, chunk.data()))
+      failedAt = s / chunkSectors;
+  // The rejected write is one of the deferred ACKs.
+  bool flashFailed = !engine.FlashPartition("system", path);
+  device.failLba = UINT64_MAX;
+  bool recovered = readAll() && engine.FlashPartition("system", path);
+  unlink(path.c_str());
+  std::cerr << "[BENCH] NAK unwind: read chunk " << failedAt
+            << " failed (expected 40), flash "
+            << (flashFailed ? "failed" : "succeeded") << ", session "
+            << (recovered ? "recovered" : "lost") << std::endl;
+  if (failedAt != 40 || !flashFailed || !recovered)
+    Fail("engine.pipeline NAK unwind");
+}
+
+// Commands carry their partition's LUN, and read-ahead streamed on one LUN
+// never answers a read of another at the next LBA.
+void BenchLunRouting() {
+  if (!Selected("firehose.lun_routing"))
+    return;
+  Bench::MockFirehoseDevice device({{"boot", 131072}});
+  Core::ProtocolEngine engine(&device);
+  if (!engine.Identify()) {
+    Fail("mock device did not enumerate");
+    return;
+  }
+  Core::TransferTimeouts timeouts;
+  Protocols::FirehosePipeline pipeline(&device, timeouts);
+  const uint64_t count = 16;
+  std::vector<uint8_t> chunk(count * 512);
+  MeasureOnce("firehose.lun_routing", 0, [&] {
+    uint64_t lba = 4096;
+    for (int i = 0; i < 4; ++i, lba += count)
+      if (!pipeline.Read("userdata", 0, lba, count, UINT64_MAX, chunk.data()))
+        return false;
+    const uint64_t used = pipeline.GetStats().readAheadUsed;
+    bool ok = pipeline.Read("ufs_lun2", 2, lba, count, UINT64_MAX,
+                            chunk.data()) &&
+              pipeline.GetStats().readAheadUsed == used &&
+              chunk[0] == (uint8_t)(lba ^ (2 << 6)) &&
+              pipeline.Write("ufs_lun3", 3, lba, chunk.data(), chunk.size(),
+                             false) &&
+              pipeline.Sync();
+    return ok && device.otherLunCommands == 2;
+  });
+}
+
+// Slow storage behind full-size chunks: a flat data timeout shorter than a
+// chunk's transfer fails every attempt, the throughput-derived one does not,
+// and a one-off stall costs one retry of the stalled chunk.
+void BenchTimeouts() {
+  // Back-to-back timeouts (a dead link) stop lengthening the wait at the
+  // floor, and one good sample brings the estimate back.
+  MeasureOnce("timeouts.repeated", 0, [] {
+    Core::TransferTimeouts timeouts;
+    const uint32_t first = timeouts.For(1 << 20);
+    for (int i = 0; i < 100; ++i)
+      timeouts.RecordTimeout();
+    const uint32_t floor = timeouts.For(1 << 20);
+    timeouts.RecordTimeout();
+    const bool held = timeouts.For(1 << 20) == floor;
+    std::cerr << "[BENCH] 1 MiB timeout " << first << " ms, " << floor
+              << " ms after 100 timeouts" << std::endl;
+    timeouts.Record(1 << 20, 10 * 1000 * 1000); // 100 MiB/s
+    return held && floor > first &&
+           floor < Core::TransferTimeouts::Options().maxMs &&
+           timeouts.For(1 << 20) < first;
+  });
+  // Storage measured below the floor: a timeout must not shorten the wait.
+  MeasureOnce("timeouts.below_floor", 0, [] {
+    Core::TransferTimeouts timeouts;
+    timeouts.Record(1 << 20, 32ull * 1000 * 1000 * 1000); // 32 KiB/s
+    const uint32_t slow = timeouts.For(1 << 20);
+    timeouts.RecordTimeout();
+    return timeouts.For(1 << 20) >= slow;
+  });
+  if (!Selected("engine.adaptive_timeouts"))
+    return;
+  const uint64_t chunkSectors = Core::ProtocolEngine::kTransferSectors;
+  const uint64_t sectors = 8 * chunkSectors;
+  Bench::MockFirehoseDevice device({{"boot", 131072}, {"system", sectors}});
+  Core::ProtocolEngine engine(&device);
+  if (!engine.Identify() || engine.GetPartitions().size() != 2) {
+    Fail("mock device did not enumerate");
+    return;
+  }
+  device.bytesPerSecond = 32 << 20; // 31 ms per chunk
+
+  Core::TransferTimeouts::Options options;
+  options.minMs = 20;
+  options.safetyFactor = 0;
+  engine.SetTransferTimeouts(options);
+  std::vector<uint8_t> chunk(chunkSectors * 512);
+  bool flatFailed =
+      !engine.ReadPartition("system", 0, chunkSectors, chunk.data());
+
+  options.safetyFactor = 4;
+  engine.SetTransferTimeouts(options);
+  auto readAll = [&] {
+    for (uint64_t s = 0; s < sectors; s += chunkSectors)
+      if (!engine.ReadPartition("system", s, chunkSectors, chunk.data()))
+        return false;
+    return true;
+  };
+  MeasureOnce("engine.adaptive_timeouts", sectors * 512, readAll);
+
+  const uint64_t start = engine.CachedPartitions().back().startLba;
+  const uint64_t stalled = 5 * chunkSectors;
+  uint64_t timeoutsBefore = engine.PipelineStats().timeouts;
+  device.stallLba = start + stalled + 7;
+  device.stall = std::chrono::milliseconds(200);
+  bool intact = readAll(); // leaves the last chunk in `chunk`
+  for (uint64_t s = 0; intact && s < chunkSectors; ++s)
+    intact = chunk[s * 512] == (uint8_t)(start + 7 * chunkSectors + s);
+  if (intact &&
+      engine.ReadPartition("system", stalled, chunkSectors, chunk.data()))
+    for (uint64_t s = 0; intact && s < chunkSectors; ++s)
+      intact = chunk[s * 512] == (uint8_t)(start + stalled + s);
+  std::cerr << "[BENCH] adaptive timeouts: flat 20 ms "
+            << (flatFailed ? "failed" : "succeeded") << ", estimate "
+            << engine.Timeouts().BytesPerSecond() / (1 << 20)
+            << " MiB/s, stall cost "
+            << engine.PipelineStats().timeouts - timeoutsBefore
+            << " timeout(s), data " << (intact ? "intact" : "CORRUPT")
+            << std::endl;
+  if (!flatFailed || !intact)
+    Fail("engine.adaptive_timeouts stall recovery");
+}
+
+// A NetFrame header as the agent expects it on the wire.
+std::vector<uint8_t> NetFrameBytes(uint8_t type, uint32_t length,
+                                   uint32_t size, int32_t value) {
+  std::vector<uint8_t> out = {type, 0, 0, 0};
+  for (uint32_t field : {length, size, (uint32_t)value})
+    for (int i = 0; i < 4; ++i)
+      out.push_back((uint8_t)(field >> (8 * i)));
+  return out;
+}
+
+// Whether the agent on `port` closes a raw connection after `frames`
+// (once it has sent any replies) within waitMs, rather than waiting for
+// more.
+bool AgentDropsFrame(uint16_t port, const std::vector<uint8_t> &frames,
+                     int waitMs = 2000) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  pollfd p = {fd, POLLIN, 0};
+  bool dropped = false;
+  if (fd >= 0 &&
+      connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 &&
+      send(fd, frames.data(), frames.size(), MSG_NOSIGNAL) ==
+          (ssize_t)frames.size()) {
+    uint8_t reply[64];
+    ssize_t n = 1;
+    while (n > 0 && poll(&p, 1, waitMs) == 1)
+      n = recv(fd, reply, sizeof(reply), 0);
+    dropped = n <= 0; // a reset when frames were left unread
+  }
+  if (fd >= 0)
+    close(fd);
+  return dropped;
+}
+
+// The pipeline cases with the mock behind a NetTransportAgent on loopback:
+// the engine talks TCP, the agent plays the device. _serial turns the
+// window off, so every transfer waits for its round trip.
+void BenchNetTransport() {
+  if (!Selected("net.pipeline") && !Selected("net.frame_limits") &&
+      !Selected("net.handshake"))
+    return;
+  const uint64_t sectors = 32768;
+  const uint64_t chunkSectors = 128;
+  Bench::MockFirehoseDevice device({{"boot", 131072}, {"system", sectors}});
+  Core::NetTransportAgent agent(&device);
+  agent.SetSerialized(true);
+  const std::string token = "bench-token";
+  agent.SetToken(token);
+  if (!agent.Listen(0))
+    return;
+  std::thread server([&] { agent.Serve(); });
+
+  Core::NetTransport net("127.0.0.1", agent.Port());
+  net.SetToken(token);
+  Core::ProtocolEngine engine(&net);
+  if (!net.Open(-1) || !engine.Identify() ||
+      engine.GetPartitions().size() != 2) {
+    Fail("mock device did not enumerate over TCP");
+    agent.Stop();
+    server.join();
+    return;
+  }
+  device.latency = std::chrono::microseconds(500);
+
+  std::string path =
+      g_opts.tmpDir + "/deepeye_bench_" + std::to_string(getpid()) + ".img";
+  std::vector<uint8_t> img(sectors * 512);
+  for (size_t i = 0; i < img.size(); ++i)
+    img[i] = (uint8_t)(i * 131 + (i >> 9));
+  std::ofstream(path, std::ios::binary | std::ios::trunc)
+      .write(reinterpret_cast<const char *>(img.data()), img.size());
+  device.Poke(engine.CachedPartitions().back().startLba, img);
+  engine.ClearReadCache();
+
+  std::vector<uint8_t> back(img.size());
+  auto readAll = [&] {
+    for (uint64_t s = 0; s < sectors; s += chunkSectors)
+      if (!engine.ReadPartition("system", s, chunkSectors,
+                                &back[s * 512]))
+        return false;
+    return back == img;
+  };
+  for (size_t window : {(size_t)0, Core::NetTransport::kDefaultWindow}) {
+    net.SetWindow(window);
+    std::string suffix = window == 0 ? "_serial" : "";
+    MeasureOnce("net.pipeline_read" + suffix, sectors * 512, readAll);
+    MeasureOnce("net.pipeline_flash" + suffix, sectors * 512,
+                [&] { return engine.FlashPartition("system", path); });
+  }
+  unlink(path.c_str());
+
+  const Core::NetTransport::Stats &stats = net.GetStats();
+  std::cerr << "[BENCH] net: " << stats.frames << " frames in "
+            << stats.writes << " writes, " << stats.readAhead
+            << " read-ahead requests (" << stats.emptyReplies
+            << " empty), up to " << stats.maxInFlight / 1024
+            << " KiB in flight" << std::endl;
+
+  // Neither end frames, or allocates for, more than kMaxPayload; the agent
+  // serves only clients that open with a Hello of its version and token.
+  std::vector<uint8_t> big(Core::NetFrame::kMaxPayload + 512);
+  bool clientRefused = net.Send(big.data(), big.size(), 1000) < 0;
+  net.Close();
+  auto helloWith = [](const std::string &t, int32_t version) {
+    std::vector<uint8_t> out = NetFrameBytes(
+        Core::NetFrame::Hello, (uint32_t)t.size(), 0, version);
+    out.insert(out.end(), t.begin(), t.end());
+    return out;
+  };
+  const std::vector<uint8_t> hello = helloWith(token, Core::NetFrame::kVersion);
+  std::vector<uint8_t> oversized = hello;
+  for (uint8_t b : NetFrameBytes(Core::NetFrame::Send, 0xFFFFFFF0, 0, 1000))
+    oversized.push_back(b);
+  MeasureOnce("net.frame_limits", 0, [&] {
+    return clientRefused && AgentDropsFrame(agent.Port(), oversized);
+  });
+  std::vector<uint8_t> wrongToken =
+      helloWith("bench-tokem", Core::NetFrame::kVersion);
+  for (uint8_t b : NetFrameBytes(Core::NetFrame::Receive, 0, 512, 1000))
+    wrongToken.push_back(b);
+  Core::NetTransport stranger("127.0.0.1", agent.Port());
+  MeasureOnce("net.handshake", 0, [&] {
+    return AgentDropsFrame(agent.Port(),
+                           helloWith(token, Core::NetFrame::kVersion + 1)) &&
+           AgentDropsFrame(agent.Port(),
+                           NetFrameBytes(Core::NetFrame::Receive, 0, 512,
+                                         1000)) &&
+           AgentDropsFrame(agent.Port(), wrongToken) &&
+           AgentDropsFrame(agent.Port(),
+                           NetFrameBytes(Core::NetFrame::Hello,
+                                         Core::NetFrame::kMaxToken + 1, 0,
+                                         Core::NetFrame::kVersion)) &&
+           !stranger.Open(-1) && !AgentDropsFrame(agent.Port(), hello, 100);
+  });
+  agent.Stop();
+  server.join();
+}
+
+// A patch list: 4 KiB requests in clusters of eight adjacent ones, every
+// fourth cluster overlapping its predecessor, written and read back as
+// batches and checked against applying the writes one by one.
+void BenchBatch() {
+  std::vector<Core::ProtocolEngine::SectorRequest> batch;
+  std::vector<std::vector<uint8_t>> buffers;
+  uint64_t sector = 0;
+  for (size_t i = 0; i < 1024; ++i) {
+    if (i % 8 == 0)
+      sector += (i / 8) % 4 == 3 ? -12 : 64;
+    buffers.emplace_back(4096, (uint8_t)(i * 37));
+    batch.push_back({"system", sector, 8, buffers.back().data()});
+    sector += 8;
+  }
+
+  Measure("io_queue.plan", 0, [&] {
+    Core::IoQueue queue;
+    for (const auto &r : batch)
+      queue.Add(0, r.sectorOffset, r.sectorCount);
+    g_sink += queue.Plan(true, Core::ProtocolEngine::kTransferSectors).size();
+  });
+  if (!Selected("engine.batch"))
+    return;
+
+  Bench::MockFirehoseDevice device({{"boot", 131072}, {"system", 65536}});
+  Core::ProtocolEngine engine(&device);
+  if (!engine.Identify() || engine.GetPartitions().size() != 2) {
+    Fail("mock device did not enumerate");
+    return;
+  }
+  std::vector<uint8_t> expected(sector * 512);
+  device.Poke(engine.CachedPartitions().back().startLba, expected);
+  for (const auto &r : batch)
+    memcpy(&expected[r.sectorOffset * 512], r.buffer, r.sectorCount * 512);
+
+  uint64_t commandsBefore = device.commands;
+  MeasureOnce("engine.batch_write", batch.size() * 4096,
+              [&] { return engine.WriteBatch(batch); });
+  std::cerr << "[BENCH] batch of " << batch.size() << " writes took "
+            << device.commands - commandsBefore << " device commands"
+            << std::endl;
+  for (auto &buffer : buffers)
+    std::fill(buffer.begin(), buffer.end(), 0);
+  MeasureOnce("engine.batch_read", batch.size() * 4096, [&] {
+    if (!engine.ReadBatch(batch))
+      return false;
+    for (const auto &r : batch)
+      if (memcmp(r.buffer, &expected[r.sectorOffset * 512],
+                 r.sectorCount * 512) != 0)
+        return false;
+    return true;
+  });
+  const Core::IoQueue::Stats &stats = engine.BatchStats();
+  std::cerr << "[BENCH] batch merge rate " << stats.MergeRate() * 100
+            << "% (" << stats.requests << " requests, " << stats.commands
+            << " commands)" << std::endl;
+}
+
+// Re-enumerates and maps an ext4 partition: hundreds of small reads that
+// the read cache should turn into a few extent-sized ones.
+void BenchReadCache() {
+  if (!Selected("engine.metadata_scan"))
+    return;
+  const uint64_t sectors = g_opts.partitionMb * 2048;
+  Bench::MockFirehoseDevice device({{"boot", 131072}, {"userdata", sectors}});
+  Core::ProtocolEngine engine(&device);
+  if (!engine.Identify() || engine.GetPartitions().size() != 2) {
+    Fail("mock device did not enumerate");
+    return;
+  }
+  uint64_t lba = engine.CachedPartitions().back().startLba;
+  for (const auto &piece : BuildExt4Metadata(sectors / 8, 0.3))
+    device.Poke(lba + piece.first / 512, piece.second);
+  engine.ClearReadCache();
+
+  auto scan = [&] {
+    Protocols::FsAllocation map;
+    Protocols::SectorReader reader = [&](uint64_t sector, uint64_t count,
+                                         uint8_t *out) {
+      return engine.ReadPartition("userdata", sector, count, out);
+    };
+    return engine.GetPartitions().size() == 2 &&
+           map.Load(reader, sectors) && map.Filesystem() == "ext4";
+  };
+  for (bool cached : {false, true}) {
+    Core::SectorCache::Options options;
+    if (!cached)
+      options.maxExtents = 0;
+    engine.SetReadCache(options);
+    uint64_t commandsBefore = device.commands;
+    std::string name = cached ? "engine.metadata_scan"
+                              : "engine.metadata_scan_uncached";
+    MeasureOnce(name, 0, [&] { return scan() && scan(); });
+    std::cerr << "[BENCH] metadata scan x2 " << (cached ? "cached" : "uncached")
+              << ": " << device.commands - commandsBefore
+              << " device commands" << std::endl;
+  }
+  const Core::SectorCache::Stats &stats = engine.ReadCacheStats();
+  std::cerr << "[BENCH] read cache: " << stats.hits << " hits, "
+            << stats.misses << " misses" << std::endl;
+}
+
+void BenchEngine() {
+  const uint64_t sectors = g_opts.partitionMb * 2048;
+  const uint64_t bytes = sectors * 512;
+  Bench::MockFirehoseDevice device({{"boot", 131072}, {"system", sectors}});
+  Core::ProtocolEngine engine(&device);
+  if (!engine.Identify() || engine.GetPartitions().size() != 2) {
+    Fail("mock device did not enumerate");
+    return;
+  }
+
+  std::string path =
+      g_opts.tmpDir + "/deepeye_bench_" + std::to_string(getpid()) + ".img";
+  std::vector<uint8_t> chunk(Core::ProtocolEngine::kTransferSectors * 512);
+
+  MeasureOnce("engine.read_partition", bytes, [&] {
+    for (uint64_t s = 0; s < sectors;
+         s += Core::ProtocolEngine::kTransferSectors) {
+      uint64_t n =
+          std::min(Core::ProtocolEngine::kTransferSectors, sectors - s);
+      if (!engine.ReadPartition("system", s, n, chunk.data()))
+        return false;
+    }
+    return true;
+  });
+  MeasureOnce("engine.dump_partition", bytes,
+              [&] { return engine.DumpPartition("system", path); });
+  MeasureOnce("engine.backup_partition", bytes, [&] {
+    Core::BackupArchiveWriter archive;
+    return archive.Open(path + ".bak") &&
+           engine.DumpPartition("system", archive) && archive.Close();
+  });
+  MeasureOnce("engine.restore_partition", bytes, [&] {
+    Core::BackupArchiveReader archive;
+    return archive.Open(path + ".bak") &&
+           engine.FlashPartition("system", archive);
+  });
+  unlink((path + ".bak").c_str());
+  MeasureOnce("engine.store_partition", bytes, [&] {
+    Core::ChunkStore store;
+    return store.Open(path + ".store") &&
+           engine.DumpPartition("system", store, "bench/system") &&
+           store.Close();
+  });
+  std::error_code ec;
+  std::filesystem::remove_all(path + ".store", ec);
+  MeasureOnce("engine.flash_partition", bytes,
+              [&] { return engine.FlashPartition("system", path); });
+
+  // A half-empty filesystem: the free tail goes out as one ranged erase.
+  if (Selected("engine.flash_sparse")) {
+    std::vector<uint8_t> img = MixedImage((size_t)bytes / 2);
+    img.resize((size_t)bytes, 0);
+    std::vector<uint8_t> sparse =
+        Protocols::SparseImageHandler::Sparsify(img.data(), img.size());
+    std::ofstream(path, std::ios::binary | std::ios::trunc)
+        .write(reinterpret_cast<const char *>(sparse.data()), sparse.size());
+  }
+  uint64_t sentBefore = device.bytesWritten;
+  MeasureOnce("engine.flash_sparse", bytes, [&] {
+    bool ok = engine.FlashPartition("system", path);
+    std::cerr << "[BENCH] sparse flash sent "
+              << device.bytesWritten - sentBefore << " of " << bytes
+              << " bytes" << std::endl;
+    return ok;
+  });
+  unlink(path.c_str());
+
+  // Growing the last partition touches one entry sector and both headers.
+  std::vector<Protocols::PartitionInfo> table = engine.GetPartitions();
+  table.back().endLba += 1024;
+  sentBefore = device.bytesWritten;
+  MeasureOnce("engine.write_gpt", 0, [&] {
+    if (!engine.WritePartitionTable(table) ||
+        engine.GetPartitions().back().endLba != table.back().endLba)
+      return false;
+    std::cerr << "[BENCH] GPT update sent "
+              << device.bytesWritten - sentBefore << " bytes" << std::endl;
+    return true;
+  });
+
+  // A backup array that no longer matches its header's CRC is rewritten
+  // whole, not patched sector by sector.
+  device.DamageBackupEntries();
+  engine.ClearReadCache();
+  table.back().endLba += 1024;
+  MeasureOnce("engine.write_gpt_stale_backup", 0, [&] {
+    return engine.WritePartitionTable(table) &&
+           device.BackupEntriesMatchPrimary();
+  });
+
+  // A primary array that fails its CRC is refused before anything is sent.
+  device.DamagePrimaryEntries();
+  engine.ClearReadCache();
+  table = engine.GetPartitions();
+  table.back().endLba -= 1024;
+  sentBefore = device.bytesWritten;
+  MeasureOnce("engine.write_gpt_bad_primary", 0, [&] {
+    return !engine.WritePartitionTable(table) &&
+           device.bytesWritten == sentBefore;
+  });
+}
+
+std::string JsonEscape(const std::string &s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+std::string ToJson() {
+  std::ostringstream js;
+  char stamp[32];
+  time_t now = time(nullptr);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+  js << "{\n  \"suite\": \"deepeye_bench\",\n  \"schema\": 1,\n"
+     << "  \"timestamp\": \"" << stamp << "\",\n"
+#ifdef __VERSION__
+     << "  \"compiler\": \"" << JsonEscape(__VERSION__) << "\",\n"
+#endif
+#ifdef DEEPEYE_BUILD_TYPE
+     << "  \"build_type\": \"" << DEEPEYE_BUILD_TYPE << "\",\n"
+#endif
+     << "  \"partition_mb\": " << g_opts.partitionMb << ",\n"
+     << "  \"results\": [";
+  for (size_t i = 0; i < g_results.size(); ++i) {
+    const Result &r = g_results[i];
+    double perIter = r.seconds / r.iterations;
+    js << (i ? "," : "") << "\n    {\"name\": \"" << r.name
+       << "\", \"iterations\": " << r.iterations
+       << ", \"seconds\": " << r.seconds
+       << ", \"ns_per_op\": " << perIter * 1e9
+       << ", \"ops_per_sec\": " << 1.0 / perIter;
+    if (r.bytesPerIteration)
+      js << ", \"bytes_per_op\": " << r.bytesPerIteration
+         << ", \"mb_per_sec\": " << r.bytesPerIteration / perIter / 1e6;
+    js << "}";
+  }
+  js << "\n  ]\n}\n";
+  return js.str();
+}
+
+void PrintSummary() {
+  for (const Result &r : g_results) {
+    double perIter = r.seconds / r.iterations;
+    char line[160];
+    if (r.bytesPerIteration)
+      snprintf(line, sizeof(line), "%-32s %12.1f ns/op %10.1f MB/s",
+               r.name.c_str(), perIter * 1e9,
+               r.bytesPerIteration / perIter / 1e6);
+    else
+      snprintf(line, sizeof(line), "%-32s %12.1f ns/op", r.name.c_str(),
+               perIter * 1e9);
+    std::cerr << line << std::endl;
+  }
+}
+
+void PrintTraceStats() {
+  std::cerr << std::endl
+            << "span                         count      p50 us      p99 us"
+               "      max us     MB/s"
+            << std::endl;
+  for (const Core::TraceStat &s : Core::Tracer::Snapshot()) {
+    char line[160];
+    snprintf(line, sizeof(line), "%-24s %9llu %11.1f %11.1f %11.1f %8.1f",
+             s.name.c_str(), (unsigned long long)s.count, s.p50Ns / 1e3,
+             s.p99Ns / 1e3, s.maxNs / 1e3,
+             s.totalNs ? s.bytes * 1e3 / s.totalNs : 0.0);
+    std::cerr << line << std::endl;
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--json" && hasValue)
+      g_opts.jsonPath = argv[++i];
+    else if (arg == "--filter" && hasValue)
+      g_opts.filter = argv[++i];
+    else if (arg == "--min-time" && hasValue)
+      g_opts.minTime = atof(argv[++i]);
+    else if (arg == "--partition-mb" && hasValue)
+      g_opts.partitionMb = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "--tmp-dir" && hasValue)
+      g_opts.tmpDir = argv[++i];
+    else if (arg == "--trace" && hasValue)
+      g_opts.tracePath = argv[++i];
+    else {
+      std::cerr << "Usage: deepeye_bench [--json file] [--filter substr] "
+                   "[--min-time sec] [--partition-mb N] [--tmp-dir dir] "
+                   "[--trace file]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // The engine logs progress to stdout; keep it out of the JSON stream.
+  std::streambuf *stdoutBuf = std::cout.rdbuf(nullptr);
+  BenchTrace();
+  if (!g_opts.tracePath.empty())
+    Core::Tracer::SetEnabled(true);
+  BenchFirehose();
+  BenchGpt();
+  BenchSparse();
+  BenchChecksums();
+  BenchDa();
+  BenchDumpWriter();
+  BenchBackupArchive();
+  BenchChunkStore();
+  BenchEngine();
+  BenchLogical();
+  BenchAllocated();
+  BenchReadCache();
+  BenchBatch();
+  BenchPipeline();
+  BenchLunRouting();
+  BenchTimeouts();
+  BenchNetTransport();
+  std::cout.rdbuf(stdoutBuf);
+  std::cout.clear();
+
+  PrintSummary();
+  if (!g_opts.tracePath.empty()) {
+    PrintTraceStats();
+    if (!Core::Tracer::WriteChromeTrace(g_opts.tracePath))
+      std::cerr << "[BENCH] Cannot write " << g_opts.tracePath << std::endl;
+  }
+  std::string json = ToJson();
+  if (g_opts.jsonPath.empty()) {
+    std::cout << json;
+  } else {
+    std::ofstream out(g_opts.jsonPath);
+    out << json;
+    if (!out) {
+      std::cerr << "[BENCH] Cannot write " << g_opts.jsonPath << std::endl;
+      return 1;
+    }
+  }
+  if (!g_failures.empty()) {
+    std::cerr << "[BENCH] " << g_failures.size() << " check(s) failed:";
+    for (const std::string &f : g_failures)
+      std::cerr << " " << f << ";";
+    std::cerr << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,341 @@
+#ifndef DEEPEYE_BENCH_MOCK_FIREHOSE_DEVICE_H
+#define DEEPEYE_BENCH_MOCK_FIREHOSE_DEVICE_H
+
+#include "../include/deepeye_core.h"
+#include "../include/checksum.h"
+#include "../include/edl_proto.h"
+#include "../include/firehose.h"
+#include "../include/gpt_parser.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace DeepEye {
+namespace Bench {
+
+/**
+ * In-process Qualcomm target: answers the Sahara hello, then serves Firehose
+ * <configure>/<read>/<program>/<erase> against a synthetic disk with a real
+ * GPT (primary and backup). Read data is generated per sector and written
+ * data is discarded except where it lands on a GPT copy or a Poke()d
+ * region, so multi-GiB partitions cost no memory. That disk is LUN 0;
+ * other LUNs read as their own generated data and keep nothing.
+ *
+ * Like a real programmer it executes commands strictly in order: commands
+ * sent while a read is still streaming wait their turn, and each response
+ * is its own transfer. `latency` models the target's turnaround: read data
+ * and ACKs become available that long after their command (or program
+ * data) arrived, so a host that waits for each ACK before sending the next
+ * command pays it per chunk. `bytesPerSecond` models the storage on top of
+ * that, and a Receive() whose data would come after the host's timeout
+ * gives up at the timeout, as a bulk transfer would.
+ */
+class MockFirehoseDevice : public Core::ITransport {
+public:
+  struct Partition {
+    std::string name;
+    uint64_t sectors;
+    uint64_t attributes = 0;
+  };
+
+  explicit MockFirehoseDevice(const std::vector<Partition> &layout) {
+    BuildGpt(layout);
+  }
+
+  bool Open(int) override { return true; }
+  void Close() override {}
+
+  int Send(const uint8_t *data, size_t length, uint32_t) override {
+    if (!_firehose) {
+      // A 1-byte write is the MTK BROM probe; stay silent so it fails.
+      if (length == 1) {
+        _bromProbe = true;
+        return 1;
+      }
+      _firehose = true; // Sahara hello response
+      return (int)length;
+    }
+
+    if (_programLeft) {
+      size_t n = length < _programLeft ? length : (size_t)_programLeft;
+      if (_programLun == 0)
+        Store(_programByte, data, n);
+      _programByte += n;
+      _programLeft -= n;
+      bytesWritten += n;
+      if (!_programLeft) {
+        Respond(_programFails ? kNak : kAck,
+                Clock::now() + latency + StorageTime(_programBytes));
+        Advance();
+      }
+      return (int)length;
+    }
+
+    ++commands;
+    _queued.push_back({std::string(reinterpret_cast<const char *>(data),
+                                   length),
+                       Clock::now()});
+    Advance();
+    return (int)length;
+  }
+
+  int Receive(uint8_t *data, size_t length, uint32_t timeoutMs) override {
+    if (!_firehose) {
+      if (_bromProbe) {
+        _bromProbe = false;
+        return 0;
+      }
+      static const uint32_t hello[12] = {0x01, 0x30, 0x02, 0x01, 0x400};
+      size_t n = std::min(length, sizeof(hello));
+      memcpy(data, hello, n);
+      return (int)n;
+    }
+
+    if (!_responses.empty()) {
+      if (!WaitUntil(_responses.front().second, timeoutMs))
+        return 0;
+      std::string &next = _responses.front().first;
+      size_t n = std::min(length, next.size());
+      memcpy(data, next.data(), n);
+      next.erase(0, n);
+      if (next.empty())
+        _responses.pop_front();
+      return (int)n;
+    }
+
+    if (_readLeft) {
+      if (!WaitUntil(_readReadyAt, timeoutMs))
+        return 0;
+      size_t n = length < _readLeft ? length : (size_t)_readLeft;
+      n -= n % 512;
+      for (size_t off = 0; off < n; off += 512, ++_readSector) {
+        const uint8_t *stored =
+            _readLun == 0 ? StoredSector(_readSector) : nullptr;
+        if (stored)
+          memcpy(data + off, stored, 512);
+        else
+          memset(data + off, (int)((_readSector ^ (_readLun << 6)) & 0xFF),
+                 512);
+      }
+      _readLeft -= n;
+      bytesRead += n;
+      if (!_readLeft) {
+        Respond(kAck, Clock::now());
+        Advance();
+      }
+      return (int)n;
+    }
+    return 0;
+  }
+
+  // Backs `data` (whole sectors) at an absolute LBA; reads return it and
+  // writes to it are kept.
+  void Poke(uint64_t lba, const std::vector<uint8_t> &data) {
+    _regions[lba] = data;
+    _regions[lba].resize((data.size() + 511) / 512 * 512);
+  }
+
+  // Corrupts the backup entry array behind its header's back.
+  void DamageBackupEntries() { _backup[31 * 512] ^= 0xFF; }
+  // Corrupts the name of the last (unused) primary entry, which parsing
+  // ignores but the array CRC does not.
+  void DamagePrimaryEntries() { _gpt[34 * 512 - 1] ^= 0xFF; }
+  bool BackupEntriesMatchPrimary() const {
+    return memcmp(_backup.data(), &_gpt[2 * 512], 32 * 512) == 0;
+  }
+
+  using Clock = std::chrono::steady_clock;
+  Clock::duration latency = Clock::duration::zero();
+  // Reads and programs covering this sector are answered with a NAK (a
+  // rejected read sends no data).
+  uint64_t failLba = UINT64_MAX;
+  // Storage speed for read data and program ACKs; 0 is instant.
+  double bytesPerSecond = 0;
+  // The next read covering this sector is held up by `stall`, like a card
+  // busy with garbage collection.
+  uint64_t stallLba = UINT64_MAX;
+  Clock::duration stall = Clock::duration::zero();
+
+  uint64_t commands = 0;
+  uint64_t otherLunCommands = 0; // addressed to a LUN other than 0
+  uint64_t bytesRead = 0;
+  uint64_t bytesWritten = 0;
+  uint64_t backupLba = 0;
+
+private:
+  static constexpr const char *kAck =
+      "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n<data>\n  <response "
+      "value=\"ACK\" rawmode=\"false\" />\n</data>";
+  static constexpr const char *kNak =
+      "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n<data>\n  <response "
+      "value=\"NAK\" rawmode=\"false\" />\n</data>";
+
+  std::vector<uint8_t> _gpt;    // LBA 0-33
+  std::vector<uint8_t> _backup; // LBA backupLba-32 .. backupLba
+  std::map<uint64_t, std::vector<uint8_t>> _regions; // Poke()d, by LBA
+  // Commands not yet started, with their arrival time.
+  std::deque<std::pair<std::string, Clock::time_point>> _queued;
+  // Responses not yet received, with the time they become available.
+  std::deque<std::pair<std::string, Clock::time_point>> _responses;
+  Clock::time_point _readReadyAt;
+  bool _programFails = false;
+  bool _firehose = false;
+  bool _bromProbe = false;
+  uint32_t _readLun = 0;
+  uint32_t _programLun = 0;
+  uint64_t _readSector = 0;
+  uint64_t _readLeft = 0;
+  uint64_t _programLeft = 0;
+  uint64_t _programByte = 0;
+  uint64_t _programBytes = 0;
+
+  void Respond(const char *xml, Clock::time_point readyAt) {
+    _responses.push_back({xml, readyAt});
+  }
+
+  Clock::duration StorageTime(uint64_t bytes) const {
+    if (bytesPerSecond <= 0)
+      return Clock::duration::zero();
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(bytes / bytesPerSecond));
+  }
+
+  // Sleeps until `at`, or until the host's timeout if that comes first.
+  static bool WaitUntil(Clock::time_point at, uint32_t timeoutMs) {
+    Clock::time_point deadline =
+        Clock::now() + std::chrono::milliseconds(timeoutMs);
+    std::this_thread::sleep_until(std::min(at, deadline));
+    return at <= deadline;
+  }
+
+  // Starts queued commands for as long as the target is idle.
+  void Advance() {
+    while (!_readLeft && !_programLeft && !_queued.empty()) {
+      std::string xml = std::move(_queued.front().first);
+      Clock::time_point arrived = _queued.front().second;
+      _queued.pop_front();
+
+      auto attrs = Protocols::FirehoseClient::ParseResponse(xml).attributes;
+      uint64_t start = strtoull(attrs["start_sector"].c_str(), nullptr, 10);
+      uint64_t count =
+          strtoull(attrs["num_partition_sectors"].c_str(), nullptr, 10);
+      uint32_t lun =
+          (uint32_t)strtoul(attrs["physical_partition_number"].c_str(),
+                            nullptr, 10);
+      if (lun != 0)
+        ++otherLunCommands;
+      const bool fails =
+          lun == 0 && failLba >= start && failLba - start < count;
+      if (fails && xml.find("<read") != std::string::npos) {
+        Respond(kNak, arrived + latency);
+      } else if (xml.find("<read") != std::string::npos) {
+        _readLun = lun;
+        _readSector = start;
+        _readLeft = count * 512;
+        _readReadyAt = std::max(arrived + latency, Clock::now()) +
+                       StorageTime(_readLeft);
+        if (stallLba >= start && stallLba - start < count) {
+          _readReadyAt += stall;
+          stallLba = UINT64_MAX;
+        }
+        if (!_readLeft)
+          Respond(kAck, _readReadyAt);
+      } else if (xml.find("<program") != std::string::npos) {
+        _programLun = lun;
+        _programByte = start * 512;
+        _programLeft = count * 512;
+        _programBytes = _programLeft;
+        _programFails = fails;
+        if (!_programLeft)
+          Respond(kAck, arrived + latency);
+      } else {
+        Respond(kAck, arrived + latency); // configure / erase
+      }
+    }
+  }
+
+  uint8_t *StoredSector(uint64_t lba) {
+    if (lba < 34)
+      return _gpt.data() + lba * 512;
+    if (lba + 32 >= backupLba && lba <= backupLba)
+      return _backup.data() + (lba + 32 - backupLba) * 512;
+    auto it = _regions.upper_bound(lba);
+    if (it != _regions.begin()) {
+      --it;
+      if ((lba - it->first) * 512 < it->second.size())
+        return it->second.data() + (lba - it->first) * 512;
+    }
+    return nullptr;
+  }
+
+  void Store(uint64_t byte, const uint8_t *data, size_t length) {
+    for (size_t off = 0; off < length;) {
+      uint64_t lba = (byte + off) / 512;
+      size_t in = (size_t)((byte + off) % 512);
+      size_t n = std::min(length - off, (size_t)512 - in);
+      if (uint8_t *stored = StoredSector(lba))
+        memcpy(stored + in, data + off, n);
+      off += n;
+    }
+  }
+
+  void BuildGpt(const std::vector<Partition> &layout) {
+    const uint32_t kEntries = 128;
+    _gpt.assign(34 * 512, 0);
+
+    Protocols::GptHeader hdr = {};
+    hdr.signature = 0x5452415020494645; // "EFI PART"
+    hdr.revision = 0x00010000;
+    hdr.headerSize = 92;
+    hdr.currentLba = 1;
+    hdr.firstUsableLba = 34;
+    hdr.partitionEntryLba = 2;
+    hdr.numPartitionEntries = kEntries;
+    hdr.partitionEntrySize = sizeof(Protocols::GptEntry);
+
+    uint64_t lba = 2048;
+    for (size_t i = 0; i < layout.size() && i < kEntries; ++i) {
+      Protocols::GptEntry e = {};
+      e.partitionTypeGuid[0] = 0xA2; // any non-zero type
+      e.uniquePartitionGuid[0] = (uint8_t)(i + 1);
+      e.startingLba = lba;
+      e.endingLba = lba + layout[i].sectors - 1;
+      e.attributes = layout[i].attributes;
+      for (size_t c = 0; c < layout[i].name.size() && c < 35; ++c)
+        e.partitionName[c] = (uint16_t)layout[i].name[c];
+      memcpy(&_gpt[2 * 512 + i * sizeof(e)], &e, sizeof(e));
+      lba = e.endingLba + 1;
+    }
+    // Room to grow the last partition, then the backup GPT at the end.
+    hdr.lastUsableLba = lba + 2048 - 1;
+    hdr.backupLba = hdr.lastUsableLba + 33;
+    backupLba = hdr.backupLba;
+    hdr.partitionEntriesCrc32 =
+        Protocols::Crc32::Compute(&_gpt[2 * 512], 32 * 512);
+    hdr.headerCrc32 = Protocols::Crc32::Compute(
+        reinterpret_cast<const uint8_t *>(&hdr), hdr.headerSize);
+    memcpy(&_gpt[512], &hdr, sizeof(hdr));
+
+    Protocols::GptHeader backup = hdr;
+    backup.currentLba = hdr.backupLba;
+    backup.backupLba = hdr.currentLba;
+    backup.partitionEntryLba = hdr.backupLba - 32;
+    backup.headerCrc32 = 0;
+    backup.headerCrc32 = Protocols::Crc32::Compute(
+        reinterpret_cast<const uint8_t *>(&backup), backup.headerSize);
+    _backup.assign(33 * 512, 0);
+    memcpy(_backup.data(), &_gpt[2 * 512], 32 * 512);
+    memcpy(&_backup[32 * 512], &backup, sizeof(backup));
+  }
+};
+
+} // namespace Bench
+} // namespace DeepEye
+
+#endif // DEEPEYE_BENCH_MOCK_FIREHOSE_DEVICE_H
@@ -0,0 +1,153 @@
+#ifndef DEEPEYE_BACKUP_ARCHIVE_H
+#define DEEPEYE_BACKUP_ARCHIVE_H
+
+#include "checksum.h"
+#include "gpt_parser.h"
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace DeepEye {
+namespace Core {
+
+class ThreadPool;
+
+enum class BackupCodec : uint8_t {
+  Store = 0,
+  Deflate = 1, // zlib, when built with HAS_ZLIB
+  Zstd = 2,    // when built with HAS_ZSTD
+};
+
+const char *BackupCodecName(BackupCodec codec);
+bool BackupCodecAvailable(BackupCodec codec);
+// Zstd if available, else Deflate, else Store.
+BackupCodec DefaultBackupCodec();
+// Returns false if the codec is not built in or fails; `out` left empty
+// means the data does not shrink and should be stored raw.
+bool BackupCompress(BackupCodec codec, int level, const uint8_t *in,
+                    size_t length, std::vector<uint8_t> &out);
+bool BackupDecompress(BackupCodec codec, const uint8_t *in, size_t length,
+                      uint8_t *out, size_t rawSize);
+
+struct BackupChunk {
+  uint64_t fileOffset = 0; // of the stored payload
+  uint32_t storedSize = 0;
+  uint32_t rawSize = 0;
+  BackupCodec codec = BackupCodec::Store;
+  bool zero = false;  // all-zero chunk: nothing stored, digest left zero
+  uint32_t crc32 = 0; // of the stored payload
+  uint8_t sha256[Protocols::Sha256::kDigestSize] = {}; // of the raw data
+};
+
+struct BackupPartition {
+  Protocols::PartitionInfo info;
+  uint64_t size = 0; // bytes dumped
+  uint64_t firstChunk = 0;
+  uint64_t chunkCount = 0;
+};
+
+/**
+ * Seekable backup container ("DEEPBAK1"):
+ *
+ *   header (64 bytes) | chunk payloads ... | index | footer (32 bytes)
+ *
+ * Partitions are cut into fixed-size chunks that are compressed and hashed
+ * on a thread pool and appended in completion order. The index at the end
+ * records every chunk's offset, sizes, codec, CRC-32 and SHA-256, the
+ * partition map and the GPT snapshot, so a reader can seek straight to any
+ * partition or byte range. All integers are little-endian.
+ */
+class BackupArchiveWriter {
+public:
+  struct Options {
+    uint32_t chunkSize = 4 * 1024 * 1024;
+    BackupCodec codec = DefaultBackupCodec();
+    int level = -1;       // codec default
+    unsigned threads = 0; // 0 = hardware threads
+  };
+
+  BackupArchiveWriter();
+  ~BackupArchiveWriter();
+
+  bool Open(const std::string &path, const Options &options);
+  bool Open(const std::string &path) { return Open(path, Options()); }
+  // Raw GPT sectors (header + entry array) stored for restore and audit.
+  void SetGptSnapshot(const std::vector<uint8_t> &sectors) {
+    _gpt = sectors;
+  }
+  bool HasGptSnapshot() const { return !_gpt.empty(); }
+
+  bool BeginPartition(const Protocols::PartitionInfo &info);
+  // Streams partition data; any length, chunked internally.
+  bool Append(const uint8_t *data, size_t length);
+  bool EndPartition();
+  // Flushes the workers and writes the index. The archive is only valid
+  // once this returns true.
+  bool Close();
+
+  const std::string &Error() const { return _error; }
+  uint64_t RawBytes() const { return _rawBytes; }
+  uint64_t StoredBytes() const { return _offset; }
+
+private:
+  Options _options;
+  std::ofstream _file;
+  std::unique_ptr<ThreadPool> _pool;
+  std::mutex _mutex; // _file, _offset, _chunks, _error
+  uint64_t _offset;
+  std::vector<BackupChunk> _chunks;
+  std::vector<BackupPartition> _partitions;
+  std::vector<uint8_t> _gpt;
+  std::vector<uint8_t> _pending; // partial chunk of the open partition
+  bool _inPartition;
+  uint64_t _rawBytes;
+  std::string _error;
+
+  bool Fail(const std::string &message);
+  void SubmitChunk();
+  void ProcessChunk(size_t index, std::vector<uint8_t> raw);
+  bool WriteIndex();
+};
+
+class BackupArchiveReader {
+public:
+  bool Open(const std::string &path);
+  void Close();
+
+  const std::vector<BackupPartition> &Partitions() const {
+    return _partitions;
+  }
+  const BackupPartition *FindPartition(const std::string &name) const;
+  const std::vector<uint8_t> &GptSnapshot() const { return _gpt; }
+  uint32_t ChunkSize() const { return _chunkSize; }
+  size_t ChunkCount() const { return _chunks.size(); }
+  const BackupChunk &Chunk(size_t index) const { return _chunks[index]; }
+
+  // Decompresses one chunk and verifies its CRC-32 and (unless
+  // verifyDigest is false) SHA-256. Safe to call from several threads.
+  bool ReadChunk(size_t index, std::vector<uint8_t> &out,
+                 std::string *error = nullptr, bool verifyDigest = true);
+  // Reads [offset, offset + length) of a partition, touching only the
+  // chunks that cover it. Checks CRC-32 only: hashing a whole chunk would
+  // dominate small reads.
+  bool ReadRange(const std::string &name, uint64_t offset, uint8_t *out,
+                 size_t length, std::string *error = nullptr);
+  // Writes a partition back out as a raw image, decoding on `threads`.
+  bool ExtractPartition(const std::string &name, const std::string &outPath,
+                        unsigned threads = 0, std::string *error = nullptr);
+
+private:
+  std::ifstream _file;
+  std::mutex _mutex; // _file position
+  uint32_t _chunkSize = 0;
+  std::vector<BackupChunk> _chunks;
+  std::vector<BackupPartition> _partitions;
+  std::vector<uint8_t> _gpt;
+};
+
+} // namespace Core
+} // namespace DeepEye
+
+#endif // DEEPEYE_BACKUP_ARCHIVE_H
@@ -1,6 +1,7 @@
 #ifndef DEEPEYE_BOOT_PATCHER_H
 #define DEEPEYE_BOOT_PATCHER_H
 
+#include "boot_image.h"
 #include <string>
 #include <vector>
 
@@ -11,22 +12,32 @@ enum class PatchMethod { Magisk, KernelSU, Custom };
 
 class BootImagePatcher {
 public:
+  /**
+   * workDir holds patch payloads (e.g. magiskinit); no external tools are
+   * executed and no intermediate files are written there.
+   */
   BootImagePatcher(const std::string &workDir);
 
   /**
-   * Patches an Android boot.img using the specified method.
-   * This assumes the patcher binaries (magiskboot/ksu) are present in the
-   * workDir.
+   * Patches an Android boot.img using the specified method. Unpack and
+   * repack run in-process on the shared deepeye::BootImage model.
    */
   bool Patch(const std::string &inputPath, const std::string &outputPath,
              PatchMethod method);
 
+  // Maps the image; components stay views into the mapping until a patch
+  // stage mutates them.
   bool ExtractBoot(const std::string &inputPath);
   bool RepackBoot(const std::string &outputPath);
 
+  deepeye::BootImage &Image() { return _image; }
+  bool IsExtracted() const { return _extracted; }
+
 private:
   std::string _workDir;
-  bool RunCommand(const std::string &cmd);
+  std::string _inputPath;
+  deepeye::BootImage _image;
+  bool _extracted;
 };
 
 } // namespace Core
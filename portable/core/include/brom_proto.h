@@ -14,6 +14,7 @@ public:
 
   bool Handshake();
   bool SendDA(const std::vector<uint8_t> &daData);
+  bool SendDA(const uint8_t *daData, size_t length);
   bool JumpDA(uint32_t addr);
 
   // BROM Commands
@@ -23,9 +24,17 @@ public:
   // DA Protocol (Active after JumpDA)
   bool DaReadPartition(const std::string &name, uint64_t offset, uint64_t count,
                        std::vector<uint8_t> &out);
+  bool DaReadPartition(const std::string &name, uint64_t offset, uint64_t count,
+                       uint8_t *out, uint32_t timeoutMs = 5000);
   bool DaWritePartition(const std::string &name, uint64_t offset,
                         const std::vector<uint8_t> &data);
+  bool DaWritePartition(const std::string &name, uint64_t offset,
+                        const uint8_t *data, size_t length,
+                        uint32_t timeoutMs = 10000);
   bool DaErasePartition(const std::string &name);
+  // Ranged format: same command with sector offset and count, as for
+  // read/write.
+  bool DaEraseRange(const std::string &name, uint64_t offset, uint64_t count);
 
 private:
   Core::ITransport *_transport;
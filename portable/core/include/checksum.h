@@ -0,0 +1,41 @@
+#ifndef DEEPEYE_CHECKSUM_H
+#define DEEPEYE_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DeepEye {
+namespace Protocols {
+
+// CRC-32/ISO-HDLC as used by GPT headers/entry arrays and sparse images.
+class Crc32 {
+public:
+  // Pass the previous result as `crc` to continue a running checksum.
+  static uint32_t Compute(const uint8_t *data, size_t length,
+                          uint32_t crc = 0);
+};
+
+class Sha256 {
+public:
+  static constexpr size_t kDigestSize = 32;
+
+  Sha256();
+  void Update(const uint8_t *data, size_t length);
+  void Final(uint8_t digest[kDigestSize]);
+
+  static void Compute(const uint8_t *data, size_t length,
+                      uint8_t digest[kDigestSize]);
+
+private:
+  uint32_t _state[8];
+  uint64_t _length;
+  uint8_t _block[64];
+  size_t _used;
+
+  void Transform(const uint8_t *block);
+};
+
+} // namespace Protocols
+} // namespace DeepEye
+
+#endif // DEEPEYE_CHECKSUM_H
@@ -0,0 +1,194 @@
+#ifndef DEEPEYE_CHUNK_STORE_H
+#define DEEPEYE_CHUNK_STORE_H
+
+#include "backup_archive.h"
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace DeepEye {
+namespace Core {
+
+class ThreadPool;
+
+/**
+ * FastCDC content-defined chunker: a gear rolling hash over the bytes after
+ * the minimum chunk size, with normalized chunking (a stricter mask before
+ * the average size, a looser one after) so chunk sizes cluster around the
+ * average. Boundaries depend only on content, so an insertion shifts at most
+ * the chunks around it.
+ */
+class FastCdc {
+public:
+  FastCdc(uint32_t minSize, uint32_t avgSize, uint32_t maxSize);
+
+  // Length of the first chunk of data[0, length). Returns min(length,
+  // maxSize) when no boundary is found, so a streaming caller should only
+  // cut while at least maxSize bytes are buffered (or at end of input).
+  size_t Cut(const uint8_t *data, size_t length) const;
+
+  uint32_t MinSize() const { return _minSize; }
+  uint32_t AvgSize() const { return _avgSize; }
+  uint32_t MaxSize() const { return _maxSize; }
+
+  // 256 fixed pseudo-random words; part of the on-disk format of any store
+  // built with this chunker.
+  static const uint64_t *GearTable();
+
+private:
+  uint32_t _minSize;
+  uint32_t _avgSize;
+  uint32_t _maxSize;
+  uint64_t _maskS; // before avgSize: two more bits than log2(avg)
+  uint64_t _maskL; // after avgSize: two fewer
+};
+
+struct ChunkDigest {
+  uint8_t bytes[Protocols::Sha256::kDigestSize];
+
+  bool operator==(const ChunkDigest &o) const {
+    return memcmp(bytes, o.bytes, sizeof(bytes)) == 0;
+  }
+};
+
+struct ChunkDigestHash {
+  size_t operator()(const ChunkDigest &d) const {
+    size_t h;
+    memcpy(&h, d.bytes, sizeof(h)); // already uniformly distributed
+    return h;
+  }
+};
+
+struct ChunkStoreStats {
+  uint64_t objects = 0;
+  uint64_t logicalBytes = 0; // sum of object sizes
+  uint64_t chunks = 0;       // referenced unique chunks
+  uint64_t uniqueBytes = 0;  // raw size of the referenced chunks
+  uint64_t storedBytes = 0;  // their size in the packs
+  uint64_t garbageBytes = 0; // pack bytes of unreferenced chunks
+
+  double DedupRatio() const {
+    return uniqueBytes ? (double)logicalBytes / uniqueBytes : 0.0;
+  }
+};
+
+/**
+ * Content-addressed backup store for fleets of identical devices:
+ *
+ *   <root>/store.journal        chunk index and object list
+ *   <root>/packs/pack-NNNNNN.dat compressed chunk payloads, append-only
+ *   <root>/objects/<name>.rcp   recipe: the object's chunk digests in order
+ *
+ * Objects ("<serial>/system", ...) are cut with FastCdc and every chunk is
+ * keyed by its SHA-256, so a partition that is byte-identical to one already
+ * stored costs only its recipe. Chunks are reference-counted by recipes;
+ * Remove() drops the references and Compact() reclaims the space.
+ *
+ * The journal is a sequence of CRC-framed batches replayed on Open(); a torn
+ * batch at the tail (crash mid-write) is discarded. One writer at a time.
+ */
+class ChunkStore {
+public:
+  struct Options {
+    uint32_t minChunk = 16 * 1024; // chunking parameters apply to new stores
+    uint32_t avgChunk = 64 * 1024; // only; an existing store keeps its own
+    uint32_t maxChunk = 256 * 1024;
+    BackupCodec codec = DefaultBackupCodec();
+    int level = -1;
+    unsigned threads = 0;
+  };
+
+  ChunkStore();
+  ~ChunkStore();
+  ChunkStore(const ChunkStore &) = delete;
+  ChunkStore &operator=(const ChunkStore &) = delete;
+
+  // Opens or creates the store rooted at `root`.
+  bool Open(const std::string &root, const Options &options);
+  bool Open(const std::string &root) { return Open(root, Options()); }
+  bool Close();
+
+  // Streams one object into the store; only new chunks reach the packs.
+  bool BeginObject(const std::string &name);
+  bool Append(const uint8_t *data, size_t length);
+  bool EndObject();
+
+  bool HasObject(const std::string &name) const;
+  std::vector<std::string> Objects() const;
+  // Writes the object back out, verifying every chunk's SHA-256.
+  bool Restore(const std::string &name, const std::string &outPath);
+  // Drops the object and its chunk references.
+  bool Remove(const std::string &name);
+  // Rewrites packs that are mostly unreferenced chunks and snapshots the
+  // journal.
+  bool Compact();
+
+  ChunkStoreStats Stats() const;
+  const FastCdc &Chunker() const { return *_cdc; }
+  const std::string &Error() const { return _error; }
+
+private:
+  struct Entry {
+    uint32_t pack = 0;
+    uint64_t offset = 0;
+    uint32_t storedSize = 0;
+    uint32_t rawSize = 0;
+    BackupCodec codec = BackupCodec::Store;
+    uint32_t crc32 = 0; // of the stored payload
+    uint32_t refs = 0;
+    bool written = false; // false while a worker is still compressing it
+  };
+  struct Object {
+    uint64_t size = 0;
+    uint64_t chunkCount = 0;
+  };
+
+  Options _options;
+  std::string _root;
+  std::unique_ptr<FastCdc> _cdc;
+  std::unique_ptr<ThreadPool> _pool;
+  mutable std::mutex _mutex; // _index, _pack*, _batch, _error
+  std::unordered_map<ChunkDigest, Entry, ChunkDigestHash> _index;
+  std::unordered_map<std::string, Object> _objects;
+  std::ofstream _journal;
+  std::vector<uint8_t> _batch; // journal records not yet framed
+  std::ofstream _pack;
+  uint32_t _packId;
+  uint64_t _packSize;
+
+  // Open object.
+  bool _inObject;
+  std::string _objectName;
+  uint64_t _objectSize;
+  std::vector<uint8_t> _pending;
+  size_t _pendingPos;
+  std::vector<ChunkDigest> _recipe;
+
+  std::string _error;
+
+  bool Fail(const std::string &message);
+  std::string PackPath(uint32_t id) const;
+  std::string RecipePath(const std::string &name) const;
+  bool LoadJournal();
+  bool ReplayBatch(const uint8_t *p, size_t length);
+  bool CommitBatch();
+  bool WriteSnapshot();
+  bool OpenPack(uint32_t id);
+  void SubmitChunk(size_t length);
+  void ProcessChunk(size_t index, std::vector<uint8_t> raw);
+  bool StorePayload(const ChunkDigest &digest, const uint8_t *payload,
+                    Entry entry);
+  bool ReadRecipe(const std::string &name, std::vector<ChunkDigest> &out);
+  bool ReadChunk(const ChunkDigest &digest, std::vector<uint8_t> &out,
+                 std::ifstream &pack, uint32_t &openPack, std::string &error);
+  void AddRefs(const std::vector<ChunkDigest> &recipe, int delta);
+};
+
+} // namespace Core
+} // namespace DeepEye
+
+#endif // DEEPEYE_CHUNK_STORE_H
@@ -1,6 +1,7 @@
 #ifndef DEEPEYE_DA_HANDLER_H
 #define DEEPEYE_DA_HANDLER_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <vector>
 
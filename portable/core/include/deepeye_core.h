@@ -1,7 +1,17 @@
 #ifndef DEEPEYE_CORE_H
 #define DEEPEYE_CORE_H
 
+#include "backup_archive.h"
+#include "chunk_store.h"
+#include "dump_writer.h"
+#include "firehose_pipeline.h"
+#include "io_queue.h"
 #include "gpt_parser.h"
+#include "lp_metadata.h"
+#include "sector_cache.h"
+#include "transfer_timeouts.h"
+#include <fstream>
+#include <functional>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -26,20 +36,228 @@ public:
   virtual void Close() = 0;
   virtual int Send(const uint8_t *data, size_t length, uint32_t timeout_ms) = 0;
   virtual int Receive(uint8_t *data, size_t length, uint32_t timeout_ms) = 0;
+
+  // Firehose ZlpAwareHost mode: end packet-multiple writes with a zero-length
+  // packet and skip the ones the target sends. Transports without packet
+  // framing ignore it.
+  virtual void SetZlpAware(bool enabled) { (void)enabled; }
 };
 
 class ProtocolEngine {
 public:
+  // Called after every transferred chunk with cumulative and total bytes.
+  using ProgressCallback =
+      std::function<void(uint64_t bytesDone, uint64_t bytesTotal)>;
+
   ProtocolEngine(ITransport *transport);
   bool Identify();
+  // GPT partitions, followed by the logical partitions described by the LP
+  // metadata in `super` when there is one. Every sector-level call below
+  // accepts either; logical ranges are mapped onto their extents.
   std::vector<Protocols::PartitionInfo> GetPartitions();
+  // Which slot's LP metadata describes the logical partitions: "_a", "_b",
+  // or empty (the default) for the active slot in the GPT's A/B attributes.
+  // Applies from the next GetPartitions(); logical partitions cannot be
+  // written while the slot is unknown.
+  void SetSlotSuffix(const std::string &suffix) { _slotSuffix = suffix; }
+  // Table from the last successful GetPartitions() call; no device I/O.
+  const std::vector<Protocols::PartitionInfo> &CachedPartitions() const {
+    return _partitions;
+  }
   bool DumpPartition(const std::string &name, const std::string &outPath);
+  // Streams a partition into an open archive (chunked, compressed and
+  // hashed on the archive's workers). Also stores the GPT snapshot.
+  bool DumpPartition(const std::string &name, BackupArchiveWriter &archive);
+  // Streams a partition into a deduplicating store as `object`; only chunks
+  // the store has not seen before are written.
+  bool DumpPartition(const std::string &name, ChunkStore &store,
+                     const std::string &object);
+  // Dumps only the blocks the ext4/f2fs filesystem in `name` has allocated,
+  // as an Android sparse image with Don't-care chunks for free space (all
+  // blocks when neither filesystem is recognized). Flashing the result
+  // leaves free blocks untouched.
+  bool DumpAllocated(const std::string &name, const std::string &outPath);
+  // Raw or Android sparse image. All-zero runs and Don't-care regions are
+  // discarded with a ranged erase rather than written (see SetUseDiscard).
   bool FlashPartition(const std::string &name, const std::string &inPath);
+  // Restores `name` from an archive (its partition of the same name unless
+  // `source` is given) without an intermediate file: chunks are decoded and
+  // verified on worker threads a bounded distance ahead of the device
+  // writes, and all-zero chunks are never decoded or sent as data.
+  bool FlashPartition(const std::string &name, BackupArchiveReader &archive,
+                      const std::string &source = std::string());
   bool ErasePartition(const std::string &name);
+  // Erases (discards) a partition-relative sector range.
+  bool EraseRange(const std::string &name, uint64_t sectorOffset,
+                  uint64_t sectorCount);
+
+  // Partition-relative sector I/O on caller-owned memory. `out` must hold
+  // sectorCount * 512 bytes; `length` must be a multiple of 512.
+  bool ReadPartition(const std::string &name, uint64_t sectorOffset,
+                     uint64_t sectorCount, uint8_t *out);
+  bool WritePartition(const std::string &name, uint64_t sectorOffset,
+                      const uint8_t *data, size_t length);
+  // One request of a batch. `buffer` holds sectorCount * 512 bytes: the
+  // destination of a read, the source of a write.
+  struct SectorRequest {
+    std::string partition;
+    uint64_t sectorOffset;
+    uint64_t sectorCount;
+    uint8_t *buffer;
+  };
+  // Partition-relative I/O for many small requests at once (patch lists,
+  // metadata scans). Requests are mapped to device LBAs and planned by an
+  // IoQueue: adjacent and overlapping ones share commands of up to
+  // kTransferSectors. Writes go out in LBA order, so callers must not
+  // depend on order within a batch; overlapping writes resolve to the
+  // later request.
+  bool ReadBatch(const std::vector<SectorRequest> &requests);
+  bool WriteBatch(const std::vector<SectorRequest> &requests);
+  // Device requests and commands of every batch so far (merge rate).
+  const IoQueue::Stats &BatchStats() const { return _batchStats; }
+  // Rewrites the GPT to describe `partitions` (matched to existing entries
+  // by unique GUID). Only entry sectors that differ from the table read by
+  // GetPartitions() are sent, plus both headers, backup copy first, so an
+  // interrupted update always leaves one valid GPT.
+  bool WritePartitionTable(
+      const std::vector<Protocols::PartitionInfo> &partitions);
+
+  void SetProgressCallback(ProgressCallback callback) {
+    _progress = std::move(callback);
+  }
+  // How DumpPartition writes its output (O_DIRECT/io_uring by default).
+  void SetDumpWriterOptions(const DumpWriter::Options &options) {
+    _dumpOptions = options;
+  }
+  // Flashing replaces zero runs of at least kMinDiscardSectors with one
+  // ranged erase. That relies on erased sectors reading back as zero (the
+  // eMMC/UFS default); turn it off for storage that erases to 0xFF. When off,
+  // zeros are written and Don't-care regions are left untouched.
+  void SetUseDiscard(bool enabled) { _useDiscard = enabled; }
+  // Reads of up to options.extentSectors go through an LRU sector cache and
+  // misses fetch whole extents, so metadata scans cost a few large reads.
+  // Writes and erases through this engine invalidate it; maxExtents = 0
+  // turns it off.
+  void SetReadCache(const SectorCache::Options &options) {
+    _cache.Configure(options);
+  }
+  // For when the device may have changed other than through this engine.
+  void ClearReadCache() { _cache.Clear(); }
+  const SectorCache::Stats &ReadCacheStats() const {
+    return _cache.GetStats();
+  }
+  // Firehose commands kept in flight: sequential reads are requested ahead
+  // and bulk writes collect their ACKs late. 1 turns pipelining off.
+  void SetPipelineDepth(uint32_t depth) { _pipeline.SetDepth(depth); }
+  const Protocols::FirehosePipeline::Stats &PipelineStats() const {
+    return _pipeline.GetStats();
+  }
+  // Data transfers time out after what the device's measured throughput
+  // needs for the chunk, times a safety factor; a chunk that times out is
+  // retried on its own, up to kMaxRetries times. Resets the estimate.
+  void SetTransferTimeouts(const TransferTimeouts::Options &options) {
+    _timeouts.Configure(options);
+  }
+  const TransferTimeouts &Timeouts() const { return _timeouts; }
+
+  // Sectors moved per Firehose/DA command (matches the 1 MiB payload
+  // negotiated in CreateConfigureXml).
+  static constexpr uint64_t kTransferSectors = 2048;
+  // Shorter zero runs are cheaper to send than to erase.
+  static constexpr uint64_t kMinDiscardSectors = kTransferSectors;
+  // Further attempts at a chunk whose transfer timed out.
+  static constexpr uint32_t kMaxRetries = 2;
 
 private:
   ITransport *_transport;
   std::string _targetType;
+  std::vector<Protocols::PartitionInfo> _partitions;
+  std::vector<uint8_t> _gptSnapshot; // header + entry sectors
+  Protocols::LpMetadata _lpMetadata; // empty without dynamic partitions
+  std::string _slotSuffix;
+  bool _lpSlotKnown = false; // _lpMetadata is the slot in use's
+  ProgressCallback _progress;
+  DumpWriter::Options _dumpOptions;
+  bool _firehoseReady = false;
+  bool _useDiscard = true;
+  SectorCache _cache;
+  IoQueue::Stats _batchStats;
+  TransferTimeouts _timeouts; // before _pipeline, which keeps a reference
+  Protocols::FirehosePipeline _pipeline;
+  bool _deferAcks = false; // inside a WriteWindow
+
+  // Scope of a bulk write (flash, zero fill, write batch) whose chunk ACKs
+  // may arrive late. Close() waits for them; a window closed by its
+  // destructor, on an error path, discards the result.
+  class WriteWindow {
+  public:
+    explicit WriteWindow(ProtocolEngine &engine);
+    ~WriteWindow() { Close(); }
+    bool Close();
+
+  private:
+    ProtocolEngine &_engine;
+    bool _outer;
+    bool _closed = false;
+  };
+
+  bool EnsureFirehose();
+  // Zeroes a partition-relative sector range, by discard when allowed.
+  bool ZeroRange(const std::string &name, uint64_t sectorOffset,
+                 uint64_t sectorCount);
+  bool FlashSparse(const std::string &name, std::ifstream &in,
+                   uint64_t fileSize);
+  const Protocols::PartitionInfo *FindPartition(const std::string &name);
+  // Reads the LP metadata from `super` and appends its logical partitions.
+  void LoadLogicalPartitions();
+  // Metadata slot for the slot in use, or -1 when it cannot be told.
+  int MetadataSlot(uint32_t slotCount) const;
+  // Logs and returns false while the metadata slot is unknown.
+  bool LogicalWritable(const std::string &name) const;
+  // Visits the extent pieces covering a logical partition range: the
+  // extent, the sector on its block device, the piece length and how many
+  // sectors of the range precede it.
+  using ExtentVisitor =
+      std::function<bool(const Protocols::LpExtent &extent,
+                         uint64_t deviceSector, uint64_t sectorCount,
+                         uint64_t done)>;
+  bool ForEachExtent(const std::string &name, uint64_t sectorOffset,
+                     uint64_t sectorCount, const ExtentVisitor &visit);
+  // ReadPartition whose read-ahead (cache fill, Firehose pipeline) stops at
+  // partition sector `aheadEnd`.
+  bool ReadPartition(const std::string &name, uint64_t sectorOffset,
+                     uint64_t sectorCount, uint8_t *out, uint64_t aheadEnd);
+  // Maps a partition range, through LP extents, onto device LBAs: the
+  // physical partition (null for a zero extent), the absolute LBA, the
+  // piece length and how many sectors of the range precede it.
+  using PieceVisitor =
+      std::function<bool(const Protocols::PartitionInfo *p, uint64_t lba,
+                         uint64_t sectorCount, uint64_t done)>;
+  bool ForEachPiece(const std::string &name, uint64_t sectorOffset,
+                    uint64_t sectorCount, const PieceVisitor &visit);
+  bool RunBatch(const std::vector<SectorRequest> &requests, bool write);
+  // Device I/O at absolute LBAs of physical partition `lun`; `label` names
+  // the partition for the programmer. Writes invalidate the read cache.
+  // Read-ahead stops at `limit` (exclusive).
+  bool DeviceRead(const std::string &label, uint32_t lun, uint64_t lba,
+                  uint64_t count, uint64_t limit, uint8_t *out);
+  bool DeviceWrite(const std::string &label, uint32_t lun, uint64_t lba,
+                   const uint8_t *data, size_t length);
+  // The MediaTek DA commands address LUN 0 only; logs and returns false
+  // for any other.
+  bool SingleLun(const std::string &label, uint32_t lun) const;
+  // Runs one device transfer, again while it fails by timing out and
+  // retries are left. `attempt` sets `timedOut`.
+  bool WithRetries(const char *what, const std::string &label, uint64_t lba,
+                   const std::function<bool(bool &timedOut)> &attempt);
+  // Serves small reads from _cache, widening misses to whole extents
+  // clipped to [first, last].
+  bool CachedRead(const std::string &label, uint32_t lun, uint64_t lba,
+                  uint64_t count, uint64_t first, uint64_t last,
+                  uint8_t *out);
+  // Absolute-LBA sector I/O, for the GPT itself.
+  bool ReadSectors(uint64_t lba, uint64_t count, std::vector<uint8_t> &out);
+  bool WriteSectors(uint64_t lba, const uint8_t *data, size_t length);
 };
 
 } // namespace Core
@@ -1,6 +1,7 @@
 #ifndef DEEPEYE_EXPORTS_H
 #define DEEPEYE_EXPORTS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef _WIN32
@@ -9,20 +10,161 @@
 #define DEEPEYE_API extern "C" __attribute__((visibility("default")))
 #endif
 
+#define DEEPEYE_PARTITION_NAME_SIZE 112
+
+// DeepEye_PartitionRecord::flags
+#define DEEPEYE_PARTITION_LOGICAL 0x1u // in super's LP metadata, not the GPT
+
+// Fixed-layout partition record for blittable marshalling (184 bytes, no
+// implicit padding). GUIDs are kept in on-disk GPT byte order.
+typedef struct DeepEye_PartitionRecord {
+  char name[DEEPEYE_PARTITION_NAME_SIZE]; // UTF-8, NUL-terminated
+  uint32_t lun;
+  uint32_t flags; // DEEPEYE_PARTITION_*
+  uint64_t startLba;
+  uint64_t endLba;
+  uint64_t sizeInBytes;
+  uint64_t attributes;
+  uint8_t typeGuid[16];
+  uint8_t uniqueGuid[16];
+} DeepEye_PartitionRecord;
+
+#define DEEPEYE_TRACE_NAME_SIZE 48
+#define DEEPEYE_TRACE_CATEGORY_SIZE 16
+
+// Aggregated latency of one span name (136 bytes, no implicit padding).
+typedef struct DeepEye_TraceStat {
+  char name[DEEPEYE_TRACE_NAME_SIZE];         // e.g. "firehose.read"
+  char category[DEEPEYE_TRACE_CATEGORY_SIZE]; // transport, firehose, ...
+  uint64_t count;
+  uint64_t bytes;
+  uint64_t totalNs;
+  uint64_t minNs;
+  uint64_t maxNs;
+  uint64_t p50Ns;
+  uint64_t p90Ns;
+  uint64_t p99Ns;
+  double bytesPerSecond; // bytes / total span time; 0 for control spans
+} DeepEye_TraceStat;
+
 DEEPEYE_API void *DeepEye_CreateTransport();
 DEEPEYE_API void DeepEye_DestroyTransport(void *transport);
 DEEPEYE_API bool DeepEye_TransportOpen(void *transport, int fd);
 DEEPEYE_API void DeepEye_TransportClose(void *transport);
 
+// Replays a scenarios/*.json device instead of opening USB hardware.
+// bytesPerSecond = 0 disables bandwidth pacing. NULL if the file is invalid.
+DEEPEYE_API void *DeepEye_CreateScenarioTransport(const char *scenarioPath,
+                                                  uint64_t bytesPerSecond);
+// A device served by deepeye_agent on another machine; connect with
+// DeepEye_TransportOpen(transport, -1). `token` is the agent's (NULL if it
+// has none).
+DEEPEYE_API void *DeepEye_CreateNetTransport(const char *host, uint16_t port,
+                                             const char *token);
+// True once every scenario step has been played with matching host bytes.
+DEEPEYE_API bool DeepEye_ScenarioTransportCompleted(void *transport);
+// Copies the first mismatch message; returns its length, -1 if too small.
+DEEPEYE_API int DeepEye_ScenarioTransportGetError(void *transport,
+                                                  char *outBuffer,
+                                                  int bufferSize);
+
 DEEPEYE_API void *DeepEye_CreateEngine(void *transport);
 DEEPEYE_API void DeepEye_DestroyEngine(void *engine);
 DEEPEYE_API bool DeepEye_EngineIdentify(void *engine);
 DEEPEYE_API bool DeepEye_EngineDumpPartition(void *engine, const char *name,
                                              const char *outPath);
+// Sparse image of the blocks an ext4/f2fs filesystem has allocated.
+DEEPEYE_API bool DeepEye_EngineDumpAllocated(void *engine, const char *name,
+                                             const char *outPath);
 DEEPEYE_API bool DeepEye_EngineFlashPartition(void *engine, const char *name,
                                               const char *inPath);
 DEEPEYE_API bool DeepEye_EngineErasePartition(void *engine, const char *name);
+// Partition-relative sectors.
+DEEPEYE_API bool DeepEye_EngineEraseRange(void *engine, const char *name,
+                                          uint64_t sectorOffset,
+                                          uint64_t sectorCount);
+// Whether flashing may replace zero runs with ranged erases (default on).
+DEEPEYE_API void DeepEye_EngineSetUseDiscard(void *engine, bool enabled);
+// Batched partition-relative I/O: request i is sectorCounts[i] sectors at
+// sectorOffsets[i] of the i-th line of `names`, and the requests' data lies
+// back to back in `buffer`. Adjacent requests share device commands; see
+// ProtocolEngine::ReadBatch.
+DEEPEYE_API bool DeepEye_EngineReadBatch(void *engine, const char *names,
+                                        const uint64_t *sectorOffsets,
+                                        const uint64_t *sectorCounts,
+                                        int count, uint8_t *buffer);
+DEEPEYE_API bool DeepEye_EngineWriteBatch(void *engine, const char *names,
+                                         const uint64_t *sectorOffsets,
+                                         const uint64_t *sectorCounts,
+                                         int count, const uint8_t *buffer);
+// Device requests and commands of every batch so far.
+DEEPEYE_API void DeepEye_EngineGetBatchStats(void *engine, uint64_t *requests,
+                                            uint64_t *commands);
+// Firehose commands kept in flight (default 4); 1 disables pipelining.
+DEEPEYE_API void DeepEye_EngineSetPipelineDepth(void *engine, uint32_t depth);
+// Measured device throughput in bytes per second, which data timeouts are
+// derived from.
+DEEPEYE_API double DeepEye_EngineGetThroughput(void *engine);
+// Read cache geometry; maxExtents = 0 disables it.
+DEEPEYE_API void DeepEye_EngineSetReadCache(void *engine,
+                                           uint32_t extentSectors,
+                                           uint32_t maxExtents);
+// Dumps the newline-separated partitions into one seekable backup archive.
+DEEPEYE_API bool DeepEye_EngineBackupPartitions(void *engine,
+                                                const char *names,
+                                                const char *archivePath);
+// Flashes the newline-separated partitions straight from an archive.
+DEEPEYE_API bool DeepEye_EngineRestorePartitions(void *engine,
+                                                 const char *names,
+                                                 const char *archivePath);
+// Restores one partition of an archive to a raw image file.
+DEEPEYE_API bool DeepEye_ArchiveExtractPartition(const char *archivePath,
+                                                 const char *name,
+                                                 const char *outPath);
+// Dumps the newline-separated partitions into a deduplicating chunk store
+// as objects "<device>/<partition>".
+DEEPEYE_API bool DeepEye_EngineStorePartitions(void *engine,
+                                               const char *names,
+                                               const char *storeRoot,
+                                               const char *device);
+DEEPEYE_API bool DeepEye_StoreRestoreObject(const char *storeRoot,
+                                            const char *object,
+                                            const char *outPath);
+// Drops an object's chunk references; space is reclaimed by compaction.
+DEEPEYE_API bool DeepEye_StoreRemoveObject(const char *storeRoot,
+                                           const char *object);
 DEEPEYE_API int DeepEye_EngineGetPartitions(void *engine, char *outBuffer,
                                             int bufferSize);
 
+// Structured partition export. RefreshPartitions reads the table from the
+// device and caches it on the engine; the other calls only touch the cache.
+DEEPEYE_API int DeepEye_EngineRefreshPartitions(void *engine);
+// Copies up to `capacity` records into caller-owned memory and returns the
+// total record count. Pass records = NULL / capacity = 0 to query the size.
+DEEPEYE_API int DeepEye_EngineCopyPartitionRecords(
+    void *engine, DeepEye_PartitionRecord *records, int capacity);
+// Library-owned variant; release with DeepEye_FreePartitionRecords.
+DEEPEYE_API DeepEye_PartitionRecord *
+DeepEye_EngineGetPartitionRecords(void *engine, int *outCount);
+DEEPEYE_API void DeepEye_FreePartitionRecords(DeepEye_PartitionRecord *records);
+// Rewrites the GPT to hold exactly `records` (matched to existing entries by
+// uniqueGuid; sizeInBytes and lun are ignored). Records flagged
+// DEEPEYE_PARTITION_LOGICAL are skipped, so a table read back with
+// DeepEye_EngineCopyPartitionRecords can be written as is. Only changed
+// sectors are written; see ProtocolEngine::WritePartitionTable.
+DEEPEYE_API bool
+DeepEye_EngineWritePartitionRecords(void *engine,
+                                    const DeepEye_PartitionRecord *records,
+                                    int count);
+
+// Hot-path tracing (off unless DEEPEYE_TRACE is set in the environment).
+DEEPEYE_API void DeepEye_TraceSetEnabled(bool enabled);
+DEEPEYE_API void DeepEye_TraceReset();
+// Copies up to `capacity` stats, busiest first, and returns the total count.
+// Pass stats = NULL / capacity = 0 to query the size.
+DEEPEYE_API int DeepEye_TraceCopyStats(DeepEye_TraceStat *stats,
+                                       int capacity);
+// Writes the recent spans of every thread as Chrome trace JSON.
+DEEPEYE_API bool DeepEye_TraceWriteChrome(const char *path);
+
 #endif // DEEPEYE_EXPORTS_H
@@ -0,0 +1,96 @@
+#ifndef DEEPEYE_DUMP_WRITER_H
+#define DEEPEYE_DUMP_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DeepEye {
+namespace Core {
+
+/**
+ * Sequential sink for partition dumps. The caller reads device data straight
+ * into AcquireBuffer() and hands it back with Commit(); the write then runs
+ * while the next chunk is read.
+ *
+ * On Linux the file is preallocated with fallocate(), opened O_DIRECT (so a
+ * 100 GB dump does not flush the page cache) and written through an io_uring
+ * with the slot buffers registered. Each feature falls back on its own:
+ * no io_uring (old kernel, seccomp) -> synchronous pwrite(); filesystem
+ * without O_DIRECT (tmpfs) -> buffered writes. Elsewhere the writer is a
+ * plain buffered file.
+ */
+class DumpWriter {
+public:
+  enum class Backend { Buffered, Pwrite, IoUring };
+
+  struct Options {
+    bool direct = true;      // O_DIRECT; implies 4 KiB-aligned writes
+    bool ioUring = true;     // otherwise pwrite()
+    bool preallocate = true; // fallocate(expectedSize) on open
+    unsigned queueDepth = 4; // buffers in flight (io_uring only)
+    size_t bufferSize = 1024 * 1024;
+  };
+
+  static constexpr size_t kAlignment = 4096;
+
+  DumpWriter();
+  ~DumpWriter();
+  DumpWriter(const DumpWriter &) = delete;
+  DumpWriter &operator=(const DumpWriter &) = delete;
+
+  bool Open(const std::string &path, uint64_t expectedSize,
+            const Options &options);
+  bool Open(const std::string &path, uint64_t expectedSize) {
+    return Open(path, expectedSize, Options());
+  }
+  // Next buffer to fill (Options::bufferSize bytes, kAlignment-aligned).
+  // Blocks while every buffer is in flight; nullptr after a write error.
+  uint8_t *AcquireBuffer();
+  // Writes `length` bytes of the acquired buffer at the current end of the
+  // file. Only the final chunk may be shorter than a kAlignment multiple.
+  bool Commit(size_t length);
+  // Waits for pending writes, trims the file to the committed size.
+  bool Close();
+
+  Backend GetBackend() const { return _backend; }
+  bool IsDirect() const { return _direct; }
+  uint64_t BytesWritten() const { return _size; }
+  const std::string &Error() const { return _error; }
+
+private:
+  struct Slot {
+    uint8_t *data = nullptr;
+    bool busy = false;
+    uint64_t offset = 0;
+    size_t length = 0;
+  };
+  struct Ring; // io_uring mappings
+
+  Backend _backend;
+  bool _direct;
+  int _fd;
+  void *_file; // std::ofstream for the portable fallback
+  Ring *_ring;
+  std::vector<Slot> _slots;
+  size_t _bufferSize;
+  int _current;   // slot handed out by AcquireBuffer, -1 if none
+  unsigned _inFlight;
+  uint64_t _size; // committed bytes (file size after Close)
+  bool _padded;   // a short tail was padded; no further commits allowed
+  std::string _error;
+
+  bool Fail(const std::string &message);
+  bool SetupRing(unsigned depth);
+  void DestroyRing();
+  bool SubmitWrite(int slot);
+  bool ReapOne();
+  bool WriteAll(const uint8_t *data, size_t length, uint64_t offset);
+  void FreeSlots();
+};
+
+} // namespace Core
+} // namespace DeepEye
+
+#endif // DEEPEYE_DUMP_WRITER_H
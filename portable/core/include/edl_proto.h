@@ -36,11 +36,22 @@ public:
   bool SendXmlCommand(const std::string &xml);
   std::string ReceiveXmlResponse();
 
-  bool ReadPartition(const std::string &name, uint64_t offset, uint64_t count,
-                     std::vector<uint8_t> &out);
-  bool WritePartition(const std::string &name, uint64_t offset,
+  // Sector I/O at absolute sector `offset` of physical partition `lun`.
+  bool ReadPartition(const std::string &name, uint32_t lun, uint64_t offset,
+                     uint64_t count, std::vector<uint8_t> &out);
+  // Data-phase timeouts; callers moving large chunks should size them from
+  // the device's throughput (see TransferTimeouts).
+  bool ReadPartition(const std::string &name, uint32_t lun, uint64_t offset,
+                     uint64_t count, uint8_t *out, uint32_t timeoutMs = 10000);
+  bool WritePartition(const std::string &name, uint32_t lun, uint64_t offset,
                       const std::vector<uint8_t> &data);
-  bool ErasePartition(const std::string &name);
+  bool WritePartition(const std::string &name, uint32_t lun, uint64_t offset,
+                      const uint8_t *data, size_t length,
+                      uint32_t timeoutMs = 10000);
+  bool ErasePartition(const std::string &name, uint32_t lun = 0);
+  // Erases `count` sectors at absolute sector `offset`.
+  bool EraseRange(const std::string &name, uint32_t lun, uint64_t offset,
+                  uint64_t count);
 
 private:
   Core::ITransport *_transport;
@@ -13,13 +13,21 @@ class FirehoseClient {
 public:
   static std::string
   CreateConfigureXml(uint32_t sectorSize = 512,
-                     const std::string &storageType = "emmc");
+                     const std::string &storageType = "emmc",
+                     bool zlpAwareHost = true);
+  // `lun` is the physical partition (UFS LUN) the sectors are on.
   static std::string CreateReadXml(const std::string &partitionName,
-                                   uint64_t sectorOffset, uint64_t sectorCount);
+                                   uint64_t sectorOffset, uint64_t sectorCount,
+                                   uint32_t lun = 0);
   static std::string CreateWriteXml(const std::string &partitionName,
                                     uint64_t sectorOffset,
-                                    uint64_t sectorCount);
-  static std::string CreateEraseXml(const std::string &partitionName);
+                                    uint64_t sectorCount, uint32_t lun = 0);
+  static std::string CreateEraseXml(const std::string &partitionName,
+                                    uint32_t lun = 0);
+  // Erases (discards) a sector range instead of the whole partition.
+  static std::string CreateEraseXml(const std::string &partitionName,
+                                    uint64_t sectorOffset,
+                                    uint64_t sectorCount, uint32_t lun = 0);
   static std::string CreateGetGptXml();
 
   struct Response {
@@ -0,0 +1,126 @@
+#ifndef DEEPEYE_FIREHOSE_PIPELINE_H
+#define DEEPEYE_FIREHOSE_PIPELINE_H
+
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DeepEye {
+namespace Core {
+class ITransport;
+class TransferTimeouts;
+} // namespace Core
+
+namespace Protocols {
+
+/**
+ * Firehose <read>/<program> with several commands in flight, so the target
+ * never sits idle for a host round trip between chunks.
+ *
+ * Reads: once a read continues the previous one (same size, next sector),
+ * the commands for the following chunks, up to the caller's limit, go out
+ * before this chunk's data is received; the window grows by one command
+ * per sequential read up to `depth`. Firehose executes commands in
+ * order, so the IN pipe then carries data, ACK, data, ACK... and the next
+ * Read() that matches the oldest outstanding command takes its data
+ * straight into the caller's buffer. Any other request first drains the
+ * read-ahead.
+ *
+ * Writes: with deferAck, Write() returns once the data is sent and the ACK
+ * is collected later, by a Write() that finds `depth` commands in flight or
+ * by Sync(). A target that rejects one command goes on with the next, so
+ * callers that need "stop at the first failure" (the GPT writer) must not
+ * defer.
+ *
+ * A NAK unwinds cleanly: it is that command's only response. A timeout
+ * leaves the stream position unknown; everything outstanding is dropped
+ * and late data is drained before the next command.
+ *
+ * Data transfers wait as long as `timeouts` allows for their size, and
+ * every completed one updates its throughput estimate.
+ */
+class FirehosePipeline {
+public:
+  static constexpr uint32_t kDefaultDepth = 4;
+
+  struct Stats {
+    uint64_t commands = 0;      // <read> and <program> sent
+    uint64_t readAhead = 0;     // reads sent before they were asked for
+    uint64_t readAheadUsed = 0; // ... and then asked for
+    uint64_t deferredAcks = 0;  // program ACKs collected after later sends
+    uint32_t maxInFlight = 0;
+    uint64_t timeouts = 0; // transfers that gave up, losing the stream
+  };
+
+  FirehosePipeline(Core::ITransport *transport,
+                   Core::TransferTimeouts &timeouts);
+
+  // Commands allowed in flight; 1 makes every call synchronous.
+  void SetDepth(uint32_t depth) { _depth = depth ? depth : 1; }
+  uint32_t Depth() const { return _depth; }
+
+  // Reads `count` sectors at `lba` of physical partition `lun`; read-ahead
+  // never goes past `limit` (exclusive).
+  bool Read(const std::string &label, uint32_t lun, uint64_t lba,
+            uint64_t count, uint64_t limit, uint8_t *out);
+  bool Write(const std::string &label, uint32_t lun, uint64_t lba,
+             const uint8_t *data, size_t length, bool deferAck);
+  // Collects every outstanding response and drops read-ahead. False if a
+  // write since the last Sync() was rejected or the session was lost.
+  bool Sync();
+  // The session restarted: forget in-flight state without any I/O.
+  void Reset();
+  // The last failed Read() or Write() timed out and took nothing down with
+  // it but its own chunk (no deferred write was dropped), so issuing the
+  // same call again is safe.
+  bool Retryable() const { return _retryable; }
+
+  const Stats &GetStats() const { return _stats; }
+
+private:
+  struct Op {
+    bool read;
+    uint32_t lun;
+    uint64_t lba;
+    uint64_t count;
+    uint64_t sentNs; // Tracer::NowNs() when the command went out
+  };
+
+  Core::ITransport *_transport;
+  Core::TransferTimeouts &_timeouts;
+  uint32_t _depth = kDefaultDepth;
+  std::deque<Op> _inFlight;
+  std::string _xml;              // received, not yet consumed responses
+  std::vector<uint8_t> _scratch; // data of read-ahead nobody wanted
+  uint32_t _streamLun = 0;
+  uint64_t _streamEnd = UINT64_MAX; // sector after the last read served
+  uint64_t _streamCount = 0;
+  uint64_t _streak = 0; // sequential reads in a row
+  uint64_t _lastDataNs = 0; // end of the last read data received
+  bool _lost = false; // a transfer timed out mid-stream
+  bool _retryable = false;
+  Stats _stats;
+
+  bool Send(const std::string &xml);
+  // A transfer gave up: the stream position is unknown from here on.
+  void Lose();
+  // Completes the oldest command; read data goes to `out` (or _scratch).
+  bool Retire(uint8_t *out);
+  bool ReceiveData(uint8_t *out, size_t length);
+  // Next <response>; <log> documents are skipped.
+  bool ReceiveResponse(uint32_t timeoutMs);
+  // Whether _xml holds a complete <response>; drops complete log-only
+  // documents ahead of it.
+  bool ResponsePending();
+  void Track() {
+    if (_inFlight.size() > _stats.maxInFlight)
+      _stats.maxInFlight = (uint32_t)_inFlight.size();
+  }
+};
+
+} // namespace Protocols
+} // namespace DeepEye
+
+#endif // DEEPEYE_FIREHOSE_PIPELINE_H
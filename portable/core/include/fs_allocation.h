@@ -0,0 +1,65 @@
+#ifndef DEEPEYE_FS_ALLOCATION_H
+#define DEEPEYE_FS_ALLOCATION_H
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DeepEye {
+namespace Protocols {
+
+// Reads `count` 512-byte sectors at a partition-relative sector.
+using SectorReader =
+    std::function<bool(uint64_t sector, uint64_t count, uint8_t *out)>;
+
+/**
+ * Which filesystem blocks of a partition hold data, from the allocation
+ * metadata of the filesystem on it:
+ *
+ *   ext4  block group descriptors and block bitmaps (uninitialized groups
+ *         contribute only their superblock backup and GDT copies)
+ *   f2fs  both SIT copies, the SIT journal of the newest checkpoint and
+ *         the current segments
+ *
+ * The map errs towards "used": metadata areas, blocks past the end of the
+ * filesystem and anything either SIT copy marks valid all count as used.
+ */
+class FsAllocation {
+public:
+  // Detects the filesystem and loads its map. On failure (no supported
+  // filesystem, an ext4 journal that needs recovery, inconsistent
+  // metadata) the map marks every block used.
+  bool Load(const SectorReader &read, uint64_t totalSectors,
+            std::string *error = nullptr);
+
+  const std::string &Filesystem() const { return _filesystem; } // or ""
+  uint32_t BlockSize() const { return _blockSize; }
+  uint64_t BlockCount() const { return _blockCount; }
+  bool IsUsed(uint64_t block) const {
+    return (_bits[block / 64] >> (block % 64)) & 1;
+  }
+  uint64_t UsedBlocks() const;
+  // Number of blocks from `block` on that share its state.
+  uint64_t RunLength(uint64_t block) const;
+
+private:
+  std::string _filesystem;
+  uint32_t _blockSize = 512;
+  uint64_t _blockCount = 0;
+  std::vector<uint64_t> _bits;
+
+  void Reset(uint32_t blockSize, uint64_t totalSectors, bool used);
+  void MarkUsed(uint64_t first, uint64_t count);
+  // ORs in `count` LSB-first bits (an ext4 bitmap) starting at `first`.
+  void MarkBits(uint64_t first, const uint8_t *bits, uint64_t count);
+  bool LoadExt4(const SectorReader &read, uint64_t totalSectors,
+                std::string *error);
+  bool LoadF2fs(const SectorReader &read, uint64_t totalSectors,
+                std::string *error);
+};
+
+} // namespace Protocols
+} // namespace DeepEye
+
+#endif // DEEPEYE_FS_ALLOCATION_H
@@ -1,6 +1,7 @@
 #ifndef DEEPEYE_GPT_PARSER_H
 #define DEEPEYE_GPT_PARSER_H
 
+#include <cstring>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -38,17 +39,129 @@ struct GptEntry {
 
 struct PartitionInfo {
   std::string name;
-  uint64_t startLba;
-  uint64_t endLba;
-  uint64_t sizeInBytes;
+  uint32_t lun = 0;
+  uint64_t startLba = 0;
+  uint64_t endLba = 0;
+  uint64_t sizeInBytes = 0;
+  uint64_t attributes = 0;
+  uint8_t typeGuid[16] = {};
+  uint8_t uniqueGuid[16] = {};
+  // Set for dynamic (LP) partitions to the partition holding their
+  // metadata ("super"). Their LBAs are then logical: 0 to size - 1.
+  std::string parent;
+};
+
+// A partition name decoded to UTF-8 in fixed inline storage. 36 UTF-16
+// units need at most 108 bytes (3 per BMP unit, 4 per surrogate pair).
+struct GptName {
+  static constexpr size_t kCapacity = 108;
+  char data[kCapacity + 1] = {};
+  size_t length = 0;
+
+  const char *c_str() const { return data; }
+  std::string ToString() const { return std::string(data, length); }
+  bool operator==(const std::string &s) const {
+    return s.size() == length && memcmp(s.data(), data, length) == 0;
+  }
+};
+
+// Decodes UTF-16LE (stops at NUL or maxUnits) to UTF-8. Surrogate pairs
+// are combined; unpaired surrogates become U+FFFD. Returns bytes written,
+// always NUL-terminating `out` (capacity >= 1).
+size_t Utf16ToUtf8(const uint8_t *utf16le, size_t maxUnits, char *out,
+                   size_t capacity);
+
+// One entry read in place from the raw table; no copies until asked.
+class GptEntryView {
+public:
+  explicit GptEntryView(const uint8_t *raw) : _raw(raw) {}
+
+  bool IsEmpty() const {
+    static const uint8_t kZero[16] = {};
+    return memcmp(_raw, kZero, 16) == 0;
+  }
+  const uint8_t *TypeGuid() const { return _raw; }
+  const uint8_t *UniqueGuid() const { return _raw + 16; }
+  uint64_t StartLba() const { return Load64(32); }
+  uint64_t EndLba() const { return Load64(40); }
+  uint64_t Attributes() const { return Load64(48); }
+  uint64_t SizeInBytes(uint32_t sectorSize) const {
+    return (EndLba() - StartLba() + 1) * sectorSize;
+  }
+  void Name(GptName &out) const {
+    out.length = Utf16ToUtf8(_raw + 56, 36, out.data, sizeof(out.data));
+  }
+
+private:
+  const uint8_t *_raw;
+  uint64_t Load64(size_t offset) const {
+    uint64_t v;
+    memcpy(&v, _raw + offset, 8); // little-endian hosts only, like GptEntry
+    return v;
+  }
+};
+
+// Iterates the used entries of a partition entry array in place.
+class GptEntryTable {
+public:
+  GptEntryTable(const uint8_t *buffer, uint32_t count, uint32_t entrySize)
+      : _buffer(buffer), _count(entrySize >= sizeof(GptEntry) ? count : 0),
+        _entrySize(entrySize) {}
+
+  class Iterator {
+  public:
+    Iterator(const GptEntryTable *table, uint32_t index)
+        : _table(table), _index(index) {
+      SkipEmpty();
+    }
+    GptEntryView operator*() const { return _table->At(_index); }
+    uint32_t Index() const { return _index; }
+    Iterator &operator++() {
+      ++_index;
+      SkipEmpty();
+      return *this;
+    }
+    bool operator!=(const Iterator &o) const { return _index != o._index; }
+
+  private:
+    const GptEntryTable *_table;
+    uint32_t _index;
+    void SkipEmpty() {
+      while (_index < _table->_count && _table->At(_index).IsEmpty())
+        ++_index;
+    }
+  };
+
+  Iterator begin() const { return Iterator(this, 0); }
+  Iterator end() const { return Iterator(this, _count); }
+  GptEntryView At(uint32_t index) const {
+    return GptEntryView(_buffer + (size_t)index * _entrySize);
+  }
+  uint32_t Count() const { return _count; }
+  uint32_t UsedCount() const;
+
+private:
+  const uint8_t *_buffer;
+  uint32_t _count;
+  uint32_t _entrySize;
 };
 
 class GptParser {
 public:
   static bool ParseHeader(const uint8_t *buffer, GptHeader &header);
+  // Looks for the primary header at LBA 1 of a raw disk image, trying 512
+  // and 4096-byte sectors. Returns the sector size, or 0 if none matched.
+  static uint32_t FindHeader(const uint8_t *disk, size_t size,
+                             GptHeader &header);
+  // Appends the used entries to `out` (one reserve, no per-entry growth)
+  // and returns how many were added. sizeInBytes uses `sectorSize`.
+  static size_t ParseEntries(const uint8_t *buffer, uint32_t count,
+                             uint32_t size, uint32_t sectorSize, uint32_t lun,
+                             std::vector<PartitionInfo> &out);
   static std::vector<PartitionInfo> ParseEntries(const uint8_t *buffer,
                                                  uint32_t count, uint32_t size,
-                                                 uint32_t sectorSize = 512);
+                                                 uint32_t sectorSize,
+                                                 uint32_t lun = 0);
 };
 
 } // namespace Protocols
@@ -0,0 +1,65 @@
+#ifndef DEEPEYE_GPT_WRITER_H
+#define DEEPEYE_GPT_WRITER_H
+
+#include "gpt_parser.h"
+#include <string>
+#include <vector>
+
+namespace DeepEye {
+namespace Protocols {
+
+// A run of consecutive sectors to write, at an absolute LBA.
+struct GptWrite {
+  uint64_t lba;
+  std::vector<uint8_t> data;
+};
+
+/**
+ * Builds minimal, power-safe GPT updates. The new entry array is diffed
+ * sector by sector against the one on the device and the plan is ordered
+ *
+ *   backup entries -> backup header -> primary entries -> primary header
+ *
+ * so the primary copy stays valid until the backup is complete, and the
+ * (new) backup stays valid while the primary is rewritten.
+ */
+class GptWriter {
+public:
+  // Encodes `partitions` over the current entry array: a partition keeps
+  // the slot of the entry with the same unique GUID, new partitions take
+  // free slots and slots of dropped partitions are cleared.
+  static bool EncodeEntries(const std::vector<PartitionInfo> &partitions,
+                            const GptHeader &header,
+                            const uint8_t *oldEntries,
+                            std::vector<uint8_t> &out,
+                            std::string *error = nullptr);
+  // Used entries must lie within the usable LBAs, not overlap and have
+  // distinct unique GUIDs.
+  static bool Validate(const GptHeader &header, const uint8_t *entries,
+                       std::string *error = nullptr);
+  // Both arrays are numPartitionEntries * partitionEntrySize bytes.
+  // `backupInSync` says the on-device backup array equals `oldEntries`;
+  // otherwise it is rewritten in full. An unchanged table yields an empty
+  // plan.
+  static bool Plan(const GptHeader &primary, const uint8_t *oldEntries,
+                   const uint8_t *newEntries, uint32_t sectorSize,
+                   bool backupInSync, std::vector<GptWrite> &plan,
+                   std::string *error = nullptr);
+
+  // Fills headerCrc32 (over headerSize bytes, with the field zeroed).
+  static void SealHeader(GptHeader &header);
+  // Backup header for `primary`: LBAs swapped, entries just below it.
+  static GptHeader MakeBackupHeader(const GptHeader &primary,
+                                    uint32_t sectorSize);
+  static uint32_t EntrySectors(const GptHeader &header, uint32_t sectorSize) {
+    return (uint32_t)(((uint64_t)header.numPartitionEntries *
+                           header.partitionEntrySize +
+                       sectorSize - 1) /
+                      sectorSize);
+  }
+};
+
+} // namespace Protocols
+} // namespace DeepEye
+
+#endif // DEEPEYE_GPT_WRITER_H
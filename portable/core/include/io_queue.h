@@ -0,0 +1,69 @@
+#ifndef DEEPEYE_IO_QUEUE_H
+#define DEEPEYE_IO_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace DeepEye {
+namespace Core {
+
+/**
+ * Pending sector requests, planned into as few device commands as possible.
+ * Requests are sorted by LUN and LBA; adjacent and overlapping ones merge
+ * into runs of at most maxSectors, and each run records which slice of
+ * which request it carries. Runs never bridge a gap, so nothing outside the
+ * requests is read or written.
+ *
+ * Overlaps resolve as a sequence of individual commands would: a read hands
+ * the sector to every request covering it, a write takes it from the last
+ * request added. Runs come out in LBA order, not submission order.
+ */
+class IoQueue {
+public:
+  // `count` sectors of request `request`, starting at its `requestSector`,
+  // sit at `runSector` of the run.
+  struct Slice {
+    size_t request;
+    uint64_t requestSector;
+    uint64_t runSector;
+    uint64_t count;
+  };
+
+  struct Run {
+    uint32_t lun;
+    uint64_t lba;
+    uint64_t count;
+    std::vector<Slice> slices; // by runSector
+  };
+
+  struct Stats {
+    uint64_t requests = 0;
+    uint64_t commands = 0;
+    uint64_t sectors = 0;
+    // Share of requests that did not need a command of their own.
+    double MergeRate() const {
+      return requests ? 1.0 - (double)commands / requests : 0.0;
+    }
+  };
+
+  // Returns the request's index, as used by Slice::request.
+  size_t Add(uint32_t lun, uint64_t lba, uint64_t count);
+  size_t Size() const { return _requests.size(); }
+  void Clear() { _requests.clear(); }
+
+  std::vector<Run> Plan(bool write, uint64_t maxSectors) const;
+
+private:
+  struct Request {
+    uint32_t lun;
+    uint64_t lba;
+    uint64_t count;
+  };
+  std::vector<Request> _requests;
+};
+
+} // namespace Core
+} // namespace DeepEye
+
+#endif // DEEPEYE_IO_QUEUE_H
@@ -0,0 +1,134 @@
+#ifndef DEEPEYE_LP_METADATA_H
+#define DEEPEYE_LP_METADATA_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DeepEye {
+namespace Protocols {
+
+// Android dynamic partition (liblp) metadata in the `super` partition:
+//
+//   0      reserved (4 KiB)
+//   4096   geometry, 8192 its backup (4 KiB each)
+//   12288  metadata slots, then their backups
+//
+// Offsets and extents are in 512-byte sectors of the block device.
+
+#pragma pack(push, 1)
+struct LpGeometry {
+  uint32_t magic;
+  uint32_t structSize;
+  uint8_t checksum[32]; // SHA-256 of structSize bytes, this field zeroed
+  uint32_t metadataMaxSize;
+  uint32_t metadataSlotCount;
+  uint32_t logicalBlockSize;
+};
+
+struct LpTableDescriptor {
+  uint32_t offset; // from the end of the header
+  uint32_t numEntries;
+  uint32_t entrySize;
+};
+
+struct LpHeader {
+  uint32_t magic;
+  uint16_t majorVersion;
+  uint16_t minorVersion;
+  uint32_t headerSize; // 128 (v10.0/10.1) or 256 (v10.2)
+  uint8_t headerChecksum[32];
+  uint32_t tablesSize;
+  uint8_t tablesChecksum[32];
+  LpTableDescriptor partitions;
+  LpTableDescriptor extents;
+  LpTableDescriptor groups;
+  LpTableDescriptor blockDevices;
+};
+
+struct LpPartitionEntry {
+  char name[36];
+  uint32_t attributes;
+  uint32_t firstExtentIndex;
+  uint32_t numExtents;
+  uint32_t groupIndex;
+};
+
+struct LpExtentEntry {
+  uint64_t numSectors;
+  uint32_t targetType;   // LpParser::kTargetLinear / kTargetZero
+  uint64_t targetData;   // first sector on the block device
+  uint32_t targetSource; // block device index
+};
+
+struct LpGroupEntry {
+  char name[36];
+  uint32_t flags;
+  uint64_t maximumSize;
+};
+
+struct LpBlockDeviceEntry {
+  uint64_t firstLogicalSector;
+  uint32_t alignment;
+  uint32_t alignmentOffset;
+  uint64_t size;
+  char partitionName[36]; // GPT partition backing this device
+  uint32_t flags;
+};
+#pragma pack(pop)
+
+struct LpExtent {
+  uint64_t sectors;
+  uint32_t targetType;
+  uint64_t targetSector;
+  uint32_t device; // index into LpMetadata::blockDevices
+};
+
+struct LpPartition {
+  std::string name;
+  std::string group;
+  uint32_t attributes = 0;
+  std::vector<LpExtent> extents;
+
+  uint64_t Sectors() const {
+    uint64_t n = 0;
+    for (const LpExtent &e : extents)
+      n += e.sectors;
+    return n;
+  }
+};
+
+struct LpMetadata {
+  LpGeometry geometry = {};
+  std::vector<LpPartition> partitions;
+  std::vector<std::string> blockDevices; // backing GPT partition names
+};
+
+class LpParser {
+public:
+  static constexpr uint32_t kGeometryMagic = 0x616c4467; // "gDla"
+  static constexpr uint32_t kHeaderMagic = 0x414c5030;   // "0PLA"
+  static constexpr uint32_t kGeometryOffset = 4096;
+  static constexpr uint32_t kGeometrySize = 4096;
+  static constexpr uint32_t kMetadataOffset =
+      kGeometryOffset + 2 * kGeometrySize;
+  static constexpr uint32_t kTargetLinear = 0;
+  static constexpr uint32_t kTargetZero = 1;
+
+  // `buffer` holds kGeometrySize bytes. Checks magic and checksum.
+  static bool ParseGeometry(const uint8_t *buffer, LpGeometry &geometry);
+  // Byte offset of a metadata slot inside super (primary copy unless
+  // `backup`).
+  static uint64_t SlotOffset(const LpGeometry &geometry, uint32_t slot,
+                             bool backup = false);
+  // `buffer` holds geometry.metadataMaxSize bytes of one slot. Checks both
+  // checksums and that every extent and index is in range.
+  static bool ParseMetadata(const uint8_t *buffer, size_t size,
+                            const LpGeometry &geometry, LpMetadata &out,
+                            std::string *error = nullptr);
+};
+
+} // namespace Protocols
+} // namespace DeepEye
+
+#endif // DEEPEYE_LP_METADATA_H
@@ -0,0 +1,174 @@
+#ifndef NET_TRANSPORT_H
+#define NET_TRANSPORT_H
+
+#include "deepeye_core.h"
+#include "usb_transport.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+
+namespace DeepEye {
+namespace Core {
+
+/**
+ * A message between NetTransport and NetTransportAgent. On the wire: a
+ * kHeaderSize-byte header (type, three reserved bytes, then length, size
+ * and value, each little-endian whatever the host's order), then `length`
+ * payload bytes. The connection opens with a Hello each way; the client's
+ * carries the agent's shared token, and an agent given a different one
+ * drops the connection without answering. Every Send and Receive request
+ * after it is answered, in order per direction, by one reply carrying the
+ * device's return value.
+ */
+struct NetFrame {
+  enum Type : uint8_t {
+    Hello = 1,       // value: protocol version, both ways; payload: token
+    Send = 2,        // payload: bulk OUT data; value: timeout in ms
+    SendDone = 3,    // size: bytes of the Send; value: device result
+    Receive = 4,     // size: bytes wanted; value: timeout in ms
+    Data = 5,        // payload: bulk IN data; size as requested; value: result
+    SetZlpAware = 6, // value: 0 or 1; no reply
+  };
+  static constexpr int32_t kVersion = 2;
+  static constexpr size_t kHeaderSize = 16;
+  // Longest token, and so the largest frame an agent reads before the
+  // handshake.
+  static constexpr uint32_t kMaxToken = 256;
+  // Largest payload, or Receive size, either end accepts: one USB request.
+  // A peer announcing more is dropped before anything is allocated.
+  static constexpr uint32_t kMaxPayload = LibUsbTransport::kMaxTransfer;
+
+  uint8_t type;
+  uint32_t length;
+  uint32_t size;
+  int32_t value;
+};
+
+/**
+ * A device's bulk endpoints tunnelled over TCP to a NetTransportAgent on
+ * the machine it is plugged into, so the engine (and its hashing,
+ * compression and dedup) can run elsewhere.
+ *
+ * Nothing waits for a round trip while the window has room. Send() posts
+ * its data and returns; a failure the agent reports later fails the next
+ * Send(). A Receive() of at least kReadAheadMin bytes asks the agent for
+ * further transfers of the same size up front, so bulk data streams in
+ * while earlier chunks are consumed; read-ahead that finds the device idle
+ * comes back empty and is dropped. Small frames are batched into one
+ * socket write until a large payload or a call that has to wait.
+ *
+ * Device transfer boundaries survive the tunnel: a Receive() never returns
+ * bytes of two device transfers, just as a short packet ends a USB one.
+ * Sends are limited to NetFrame::kMaxPayload bytes and larger receives
+ * come back short.
+ */
+class NetTransport : public ITransport {
+public:
+  static constexpr size_t kDefaultWindow = 8 * 1024 * 1024;
+  static constexpr size_t kReadAheadMin = 64 * 1024;
+
+  struct Stats {
+    uint64_t frames = 0;        // sent to the agent
+    uint64_t writes = 0;        // socket writes carrying them
+    uint64_t readAhead = 0;     // Receive requests posted ahead
+    uint64_t emptyReplies = 0;  // ... that found no data
+    uint64_t maxInFlight = 0;   // bytes of sends and reads outstanding
+  };
+
+  NetTransport(const std::string &host, uint16_t port);
+  ~NetTransport();
+
+  // Sent in the Hello of the next Open(); must match the agent's.
+  void SetToken(const std::string &token) { _token = token; }
+  // Connects to the agent, or takes over an already connected socket when
+  // fd >= 0.
+  bool Open(int fd) override;
+  void Close() override;
+  int Send(const uint8_t *data, size_t length, uint32_t timeout_ms) override;
+  int Receive(uint8_t *data, size_t length, uint32_t timeout_ms) override;
+  void SetZlpAware(bool enabled) override;
+
+  // Bytes of sends, and separately of read-ahead, allowed in flight; 0
+  // makes every call a round trip, as a local transport would behave.
+  void SetWindow(size_t bytes) { _window = bytes; }
+  const Stats &GetStats() const { return _stats; }
+
+private:
+  std::string _host;
+  uint16_t _port;
+  std::string _token;
+  int _fd = -1;
+  size_t _window = kDefaultWindow;
+  std::vector<uint8_t> _out; // frames not yet written
+  // Receive requests in flight, oldest first: the Receive() call waiting
+  // for each (0 for read-ahead).
+  std::deque<uint64_t> _requests;
+  uint64_t _call = 0;
+  size_t _readBytesInFlight = 0;
+  size_t _sendBytesInFlight = 0;
+  bool _sendFailed = false;
+  int _sendResult = 0; // of the last SendDone
+  // The current Receive() call's own request came back without data.
+  bool _callAnswered = false;
+  int _callResult = 0;
+  std::deque<std::vector<uint8_t>> _in; // device transfers not yet returned
+  size_t _inPos = 0;
+  Stats _stats;
+
+  bool Post(const NetFrame &frame, const uint8_t *payload = nullptr);
+  // Queues a Receive request that no call is waiting for yet.
+  bool PostReceive(size_t length, uint32_t timeoutMs);
+  void ReadAhead(size_t length, uint32_t timeoutMs);
+  bool Flush();
+  // Reads and handles one reply; false on timeout or a dropped link (which
+  // closes the socket).
+  bool Pump(uint32_t timeoutMs);
+  void Drop();
+  void TrackInFlight() {
+    _stats.maxInFlight = std::max<uint64_t>(
+        _stats.maxInFlight, _sendBytesInFlight + _readBytesInFlight);
+  }
+};
+
+/**
+ * Serves one device to NetTransport clients, one connection at a time:
+ * the small process on the machine the phone is plugged into. Bulk OUT and
+ * IN requests run on their own threads, as the endpoints are independent,
+ * and are executed in arrival order per direction.
+ */
+class NetTransportAgent {
+public:
+  explicit NetTransportAgent(ITransport *device) : _device(device) {}
+  ~NetTransportAgent() { Stop(); }
+
+  // Clients must open with this token (empty by default).
+  void SetToken(const std::string &token) { _token = token; }
+  // Port 0 picks a free one (see Port()). Only local clients can connect
+  // unless `allInterfaces` is set.
+  bool Listen(uint16_t port, bool allInterfaces = false);
+  uint16_t Port() const { return _port; }
+  // Serves one connection to its end; false if none could be accepted.
+  bool ServeOne();
+  // Serves connections until Stop().
+  void Serve();
+  void Stop();
+
+  // Runs all device calls on one thread, for transports that are not
+  // thread-safe (the bench mock, scenario replays). Pending reads are then
+  // polled between the other requests rather than blocking them.
+  void SetSerialized(bool serialized) { _serialized = serialized; }
+
+private:
+  ITransport *_device;
+  std::string _token;
+  int _listenFd = -1;
+  std::atomic<int> _clientFd{-1};
+  uint16_t _port = 0;
+  std::atomic<bool> _stopping{false};
+  bool _serialized = false;
+};
+
+} // namespace Core
+} // namespace DeepEye
+
+#endif // NET_TRANSPORT_H
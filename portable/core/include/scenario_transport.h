@@ -0,0 +1,113 @@
+#ifndef SCENARIO_TRANSPORT_H
+#define SCENARIO_TRANSPORT_H
+
+#include "deepeye_core.h"
+#include <chrono>
+
+namespace DeepEye {
+namespace Core {
+
+enum class ScenarioDirection { HostToDevice, DeviceToHost };
+enum class ScenarioAction { Continue, Disconnect, Timeout, HardError };
+
+/**
+ * One exchange from the scenarios/ JSON DSL (see ScenarioModels.cs).
+ *
+ * Two optional fields extend the DSL for bulk traffic: `length` gives the
+ * size of a step without `data_hex` (host bytes are then only counted,
+ * device bytes are zeros), and `repeat` plays the step N times.
+ */
+struct ScenarioStep {
+  ScenarioDirection direction = ScenarioDirection::DeviceToHost;
+  ScenarioAction action = ScenarioAction::Continue;
+  std::string label;
+  std::vector<uint8_t> data;
+  size_t length = 0; // == data.size() unless data_hex was omitted
+  uint32_t delayMs = 0;
+  uint32_t repeat = 1;
+};
+
+struct Scenario {
+  std::string name;
+  std::string protocol;
+  std::string description;
+  std::vector<ScenarioStep> steps;
+  uint32_t maxDurationMs = 5000;
+
+  static bool LoadFile(const std::string &path, Scenario &out,
+                       std::string *error = nullptr);
+  static bool Parse(const std::string &json, Scenario &out,
+                    std::string *error = nullptr);
+};
+
+/**
+ * Plays the device side of a Scenario. Host writes are checked byte for
+ * byte against host_to_device steps; device_to_host steps are returned from
+ * Receive() one step (USB packet burst) at a time after their delay_ms.
+ *
+ * An optional bandwidth model paces every transfer as if it crossed a link
+ * of the given throughput and per-transfer latency, so engine hot paths can
+ * be timed without hardware.
+ */
+class ScenarioTransport : public ITransport {
+public:
+  explicit ScenarioTransport(Scenario scenario);
+
+  bool Open(int fd) override;
+  void Close() override;
+  int Send(const uint8_t *data, size_t length, uint32_t timeout_ms) override;
+  int Receive(uint8_t *data, size_t length, uint32_t timeout_ms) override;
+
+  // 0 disables pacing.
+  void SetBandwidth(uint64_t bytesPerSecond, uint32_t latencyUs = 0) {
+    _bytesPerSecond = bytesPerSecond;
+    _latencyUs = latencyUs;
+  }
+  // Multiplies every delay_ms; 0 skips scenario delays entirely.
+  void SetDelayScale(double scale) { _delayScale = scale; }
+
+  const Scenario &GetScenario() const { return _scenario; }
+  // True once every step has been played without a mismatch.
+  bool Completed() const {
+    return _error.empty() && _step >= _scenario.steps.size();
+  }
+  bool Failed() const { return !_error.empty(); }
+  const std::string &Error() const { return _error; }
+  size_t StepIndex() const { return _step; }
+  uint64_t BytesSent() const { return _bytesSent; }
+  uint64_t BytesReceived() const { return _bytesReceived; }
+  // Wall time since Open().
+  uint32_t ElapsedMs() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  Scenario _scenario;
+  size_t _step;               // current step
+  uint32_t _pass;             // completed repeats of the current step
+  size_t _offset;             // bytes consumed within the current pass
+  Clock::duration _delayLeft; // unslept delay_ms of the current pass
+  bool _disconnected;
+  std::string _error;
+  uint64_t _bytesSent;
+  uint64_t _bytesReceived;
+  uint64_t _bytesPerSecond;
+  uint32_t _latencyUs;
+  double _delayScale;
+  Clock::time_point _opened;
+  Clock::time_point _linkFree;
+
+  const ScenarioStep *Current() const;
+  void EnterPass();
+  void Advance(size_t bytes);
+  bool Fail(const std::string &message);
+  // Sleeps out the current step's remaining delay, bounded by timeout_ms.
+  // Returns false if the timeout expired first.
+  bool WaitForDelay(uint32_t timeout_ms);
+  void Pace(size_t bytes);
+};
+
+} // namespace Core
+} // namespace DeepEye
+
+#endif // SCENARIO_TRANSPORT_H
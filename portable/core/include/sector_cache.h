@@ -0,0 +1,78 @@
+#ifndef DEEPEYE_SECTOR_CACHE_H
+#define DEEPEYE_SECTOR_CACHE_H
+
+#include <list>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace DeepEye {
+namespace Core {
+
+/**
+ * LRU cache of device sectors in fixed, aligned extents. Small reads that
+ * miss are widened to whole extents by the caller, so a metadata scan
+ * (GPT, LP geometry, superblock, bitmaps) costs one device round trip per
+ * extent instead of one per read. Entries are keyed by LUN and absolute
+ * LBA; every write or erase through the owning session must Invalidate()
+ * its range. Not thread-safe.
+ */
+class SectorCache {
+public:
+  struct Options {
+    uint32_t extentSectors = 128; // read-ahead unit (64 KiB)
+    size_t maxExtents = 256;      // 16 MiB; 0 disables the cache
+  };
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t invalidations = 0; // extents dropped by writes/erases
+  };
+
+  SectorCache() : SectorCache(Options()) {}
+  explicit SectorCache(const Options &options);
+
+  // Drops all entries.
+  void Configure(const Options &options);
+  bool Enabled() const { return _options.maxExtents > 0; }
+  uint32_t ExtentSectors() const { return _options.extentSectors; }
+  // First sector of the extent holding `lba`.
+  uint64_t ExtentStart(uint64_t lba) const {
+    return lba - lba % _options.extentSectors;
+  }
+
+  // Copies [lba, lba + count) to `out` if every sector is cached.
+  bool Lookup(uint32_t lun, uint64_t lba, uint64_t count, uint8_t *out);
+  // Records sectors just read from the device.
+  void Insert(uint32_t lun, uint64_t lba, uint64_t count,
+              const uint8_t *data);
+  // Drops every extent overlapping the range.
+  void Invalidate(uint32_t lun, uint64_t lba, uint64_t count);
+  void Clear();
+
+  const Stats &GetStats() const { return _stats; }
+
+private:
+  struct Extent {
+    uint64_t key;
+    std::vector<uint8_t> data;
+    std::vector<bool> valid; // per sector
+  };
+
+  Options _options;
+  Stats _stats;
+  std::list<Extent> _lru; // most recent first
+  std::unordered_map<uint64_t, std::list<Extent>::iterator> _index;
+
+  uint64_t Key(uint32_t lun, uint64_t lba) const {
+    return (uint64_t)lun << 56 | lba / _options.extentSectors;
+  }
+};
+
+} // namespace Core
+} // namespace DeepEye
+
+#endif // DEEPEYE_SECTOR_CACHE_H
@@ -1,6 +1,7 @@
 #ifndef DEEPEYE_SPARSE_HANDLER_H
 #define DEEPEYE_SPARSE_HANDLER_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <vector>
 
@@ -32,6 +33,22 @@ class SparseImageHandler {
 public:
   static bool IsSparse(const uint8_t *buffer);
   static uint64_t GetUnsparseSize(const uint8_t *buffer);
+
+  // Expands a sparse image into `out` (blk_sz * total_blks bytes).
+  // Don't-care regions are zero-filled; CRC32 chunks are skipped.
+  static bool Unsparse(const uint8_t *buffer, size_t size,
+                       std::vector<uint8_t> &out);
+  // Encodes a raw image as RAW and FILL chunks. Blocks that repeat a single
+  // 32-bit value (including all-zero blocks) become FILL chunks; a partial
+  // last block is zero-padded.
+  static std::vector<uint8_t> Sparsify(const uint8_t *data, size_t size,
+                                       uint32_t blockSize = 4096);
+
+  static constexpr uint32_t kMagic = 0xed26ff3a;
+  static constexpr uint16_t kChunkRaw = 0xCAC1;
+  static constexpr uint16_t kChunkFill = 0xCAC2;
+  static constexpr uint16_t kChunkDontCare = 0xCAC3;
+  static constexpr uint16_t kChunkCrc32 = 0xCAC4;
 };
 
 } // namespace Protocols
@@ -0,0 +1,94 @@
+#ifndef DEEPEYE_THREAD_POOL_H
+#define DEEPEYE_THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace DeepEye {
+namespace Core {
+
+/**
+ * Fixed set of worker threads with a bounded queue: Submit() blocks once
+ * `maxQueued` tasks are waiting, which keeps a fast producer (USB, disk)
+ * from buffering a whole partition in memory.
+ */
+class ThreadPool {
+public:
+  // threads = 0 uses every hardware thread; maxQueued = 0 means 2 per worker.
+  explicit ThreadPool(unsigned threads = 0, size_t maxQueued = 0) {
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    _maxQueued = maxQueued ? maxQueued : threads * 2;
+    for (unsigned i = 0; i < threads; ++i)
+      _workers.emplace_back([this] { Run(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _taskReady.notify_all();
+    for (std::thread &t : _workers)
+      t.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t Size() const { return _workers.size(); }
+
+  void Submit(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _slotFree.wait(lock, [this] { return _queue.size() < _maxQueued; });
+    _queue.push_back(std::move(task));
+    ++_pending;
+    _taskReady.notify_one();
+  }
+
+  // Blocks until every submitted task has finished.
+  void Wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this] { return _pending == 0; });
+  }
+
+private:
+  std::vector<std::thread> _workers;
+  std::deque<std::function<void()>> _queue;
+  std::mutex _mutex;
+  std::condition_variable _taskReady;
+  std::condition_variable _slotFree;
+  std::condition_variable _idle;
+  size_t _maxQueued;
+  size_t _pending = 0; // queued + running
+  bool _stopping = false;
+
+  void Run() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _taskReady.wait(lock, [this] { return _stopping || !_queue.empty(); });
+        if (_queue.empty())
+          return;
+        task = std::move(_queue.front());
+        _queue.pop_front();
+      }
+      _slotFree.notify_one();
+      task();
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (--_pending == 0)
+        _idle.notify_all();
+    }
+  }
+};
+
+} // namespace Core
+} // namespace DeepEye
+
+#endif // DEEPEYE_THREAD_POOL_H
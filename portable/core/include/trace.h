@@ -0,0 +1,101 @@
+#ifndef DEEPEYE_TRACE_H
+#define DEEPEYE_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace DeepEye {
+namespace Core {
+
+enum class TraceCategory : uint8_t {
+  Transport, // ITransport::Send/Receive
+  Sahara,
+  Firehose,
+  Da,       // MediaTek BROM / Download Agent
+  Pipeline, // engine stages: dump, flash, disk I/O
+  Count
+};
+
+const char *TraceCategoryName(TraceCategory category);
+
+// Aggregate of every span with the same name, merged across threads.
+struct TraceStat {
+  std::string name;
+  TraceCategory category;
+  uint64_t count;
+  uint64_t bytes;
+  uint64_t totalNs;
+  uint64_t minNs;
+  uint64_t maxNs;
+  // Estimated from the histogram; within 1/8 of the true value.
+  uint64_t p50Ns;
+  uint64_t p90Ns;
+  uint64_t p99Ns;
+};
+
+/**
+ * Process-wide span recorder. Disabled by default (a span then costs one
+ * relaxed load); enable with Tracer::SetEnabled or DEEPEYE_TRACE=1.
+ *
+ * Each thread records into its own buffer: a ring of the most recent events
+ * for the Chrome trace and a per-name log-linear latency histogram. Only the
+ * owning thread writes, so recording takes no locks; readers merge the
+ * buffers with relaxed/acquire loads and may miss spans that are in flight.
+ * Span names must be string literals (the pointer is the key).
+ */
+class Tracer {
+public:
+  static constexpr size_t kRingEvents = 16384; // per thread
+  static constexpr size_t kMaxNamesPerThread = 64;
+
+  static bool Enabled() { return _enabled.load(std::memory_order_relaxed); }
+  static void SetEnabled(bool enabled);
+  // Drops recorded events and statistics of every thread.
+  static void Reset();
+
+  // Monotonic nanoseconds since the tracer was first used.
+  static uint64_t NowNs();
+  static void Record(const char *name, TraceCategory category,
+                     uint64_t startNs, uint64_t durationNs, uint64_t bytes);
+
+  static std::vector<TraceStat> Snapshot();
+  // Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+  static std::string ChromeTraceJson();
+  static bool WriteChromeTrace(const std::string &path);
+
+private:
+  static std::atomic<bool> _enabled;
+};
+
+// Records [construction, destruction) as one complete event.
+class TraceSpan {
+public:
+  TraceSpan(const char *name, TraceCategory category, uint64_t bytes = 0)
+      : _name(name), _category(category), _bytes(bytes),
+        _active(Tracer::Enabled()), _start(_active ? Tracer::NowNs() : 0) {}
+  ~TraceSpan() {
+    if (_active)
+      Tracer::Record(_name, _category, _start, Tracer::NowNs() - _start,
+                     _bytes);
+  }
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+  // Bytes actually moved, when only known once the operation returns.
+  void SetBytes(uint64_t bytes) { _bytes = bytes; }
+
+private:
+  const char *_name;
+  TraceCategory _category;
+  uint64_t _bytes;
+  bool _active; // tracing was on at construction
+  uint64_t _start;
+};
+
+} // namespace Core
+} // namespace DeepEye
+
+#endif // DEEPEYE_TRACE_H
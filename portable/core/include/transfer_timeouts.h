@@ -0,0 +1,86 @@
+#ifndef DEEPEYE_TRANSFER_TIMEOUTS_H
+#define DEEPEYE_TRANSFER_TIMEOUTS_H
+
+#include <algorithm>
+#include <stdint.h>
+
+namespace DeepEye {
+namespace Core {
+
+/**
+ * Data-phase timeouts from a running estimate of the device's throughput:
+ * a chunk gets the time the device has actually needed for that many bytes,
+ * times a safety factor, on top of a fixed allowance for latency. Large
+ * chunks on slow storage no longer hit a flat limit, and fast devices
+ * still give up on a stalled chunk quickly.
+ *
+ * Completed transfers of at least minSampleBytes feed an exponentially
+ * weighted average; a timeout halves it, so a retry of the same chunk waits
+ * about twice as long, but timeouts alone never take it below the initial
+ * estimate over kMinFraction: a dead link keeps failing after a bounded
+ * wait rather than an ever longer one. Not thread-safe; one per device session.
+ */
+class TransferTimeouts {
+public:
+  struct Options {
+    double initialBytesPerSecond = 1 << 20; // until the first sample
+    double safetyFactor = 4;
+    uint32_t minMs = 5000;               // latency and scheduling allowance
+    uint32_t maxMs = 10 * 60 * 1000;
+    uint64_t minSampleBytes = 64 * 1024; // smaller ones measure latency
+  };
+
+  TransferTimeouts() : TransferTimeouts(Options()) {}
+  explicit TransferTimeouts(const Options &options) { Configure(options); }
+
+  // Forgets every sample.
+  void Configure(const Options &options) {
+    _options = options;
+    Reset();
+  }
+  // A new device: back to the initial estimate.
+  void Reset() {
+    _bytesPerSecond = _options.initialBytesPerSecond;
+    _samples = 0;
+  }
+
+  uint32_t For(uint64_t bytes) const {
+    double ms = _options.minMs + _options.safetyFactor * 1000.0 *
+                                     (double)bytes / _bytesPerSecond;
+    return (uint32_t)std::min<double>(ms, _options.maxMs);
+  }
+
+  void Record(uint64_t bytes, uint64_t elapsedNs) {
+    if (bytes < _options.minSampleBytes || elapsedNs == 0)
+      return;
+    double rate = (double)bytes * 1e9 / (double)elapsedNs;
+    if (_samples++ == 0)
+      _bytesPerSecond = rate;
+    else
+      _bytesPerSecond += kWeight * (rate - _bytesPerSecond);
+  }
+  // Never raises the estimate: a device measured below the floor keeps its
+  // (longer) timeouts.
+  void RecordTimeout() {
+    _bytesPerSecond = std::min(
+        _bytesPerSecond,
+        std::max(_bytesPerSecond / 2,
+                 _options.initialBytesPerSecond / kMinFraction));
+  }
+
+  double BytesPerSecond() const { return _bytesPerSecond; }
+  uint64_t Samples() const { return _samples; }
+
+private:
+  static constexpr double kWeight = 0.25; // of the newest sample
+  static constexpr double kMinFraction = 16; // timeouts go no lower
+
+  Options _options;
+  double _bytesPerSecond = 0;
+  uint64_t _samples = 0;
+};
+
+} // namespace Core
+} // namespace DeepEye
+
+#endif // DEEPEYE_TRANSFER_TIMEOUTS_H
@@ -6,8 +6,21 @@
 namespace DeepEye {
 namespace Core {
 
+/**
+ * Bulk transport over libusb. Open() reads the active configuration and
+ * claims the first interface exposing a bulk IN/OUT pair (EDL and DA
+ * interfaces are vendor class; BROM enumerates as CDC data), falling back to
+ * interface 0 with endpoints 0x01/0x81 if no descriptor is available.
+ *
+ * Transfers are issued as whole multiples of wMaxPacketSize, up to
+ * kMaxTransfer per request, so a read completes in one request and only a
+ * short packet ends it early.
+ */
 class LibUsbTransport : public ITransport {
 public:
+  // Matches MaxPayloadSizeToTargetInBytes in the Firehose configure.
+  static constexpr size_t kMaxTransfer = 1024 * 1024;
+
   LibUsbTransport();
   ~LibUsbTransport();
 
@@ -15,11 +28,30 @@ public:
   void Close() override;
   int Send(const uint8_t *data, size_t length, uint32_t timeout_ms) override;
   int Receive(uint8_t *data, size_t length, uint32_t timeout_ms) override;
+  void SetZlpAware(bool enabled) override { _zlpAware = enabled; }
+
+  int Interface() const { return _interface; }
+  uint8_t EndpointIn() const { return _epIn; }
+  uint8_t EndpointOut() const { return _epOut; }
+  uint16_t MaxPacketIn() const { return _maxPacketIn; }
+  uint16_t MaxPacketOut() const { return _maxPacketOut; }
 
 private:
   void *_ctx;
   void *_handle;
   int _fd;
+  int _interface;
+  uint8_t _epIn;
+  uint8_t _epOut;
+  uint16_t _maxPacketIn;
+  uint16_t _maxPacketOut;
+  bool _zlpAware;
+  // Tail of a packet read through the bounce buffer that did not fit the
+  // caller's buffer; returned first by the next Receive().
+  std::vector<uint8_t> _pending;
+  size_t _pendingPos;
+
+  void DiscoverEndpoints();
 };
 
 } // namespace Core
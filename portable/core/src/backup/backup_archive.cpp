@@ -0,0 +1,589 @@
+#include "../../include/backup_archive.h"
+#include "../../include/thread_pool.h"
+#include "byte_io.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAS_ZSTD
+#include <zstd.h>
+#endif
+
+namespace DeepEye {
+namespace Core {
+
+namespace {
+
+using namespace ByteIo;
+
+const char kHeaderMagic[8] = {'D', 'E', 'E', 'P', 'B', 'A', 'K', '1'};
+const char kFooterMagic[8] = {'D', 'E', 'E', 'P', 'I', 'D', 'X', '1'};
+const uint32_t kVersion = 1;
+const size_t kHeaderSize = 64;
+const size_t kFooterSize = 32;
+const uint8_t kChunkZero = 0x01;
+
+bool AllZero(const uint8_t *p, size_t n) {
+  // Word-wise scan; partitions are mostly either empty or dense.
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w;
+    memcpy(&w, p + i, 8);
+    if (w)
+      return false;
+  }
+  for (; i < n; ++i)
+    if (p[i])
+      return false;
+  return true;
+}
+
+void SetError(std::string *error, const std::string &message) {
+  if (error)
+    *error = message;
+}
+
+} // namespace
+
+const char *BackupCodecName(BackupCodec codec) {
+  switch (codec) {
+  case BackupCodec::Store:
+    return "store";
+  case BackupCodec::Deflate:
+    return "deflate";
+  case BackupCodec::Zstd:
+    return "zstd";
+  }
+  return "unknown";
+}
+
+bool BackupCodecAvailable(BackupCodec codec) {
+  switch (codec) {
+  case BackupCodec::Store:
+    return true;
+  case BackupCodec::Deflate:
+#ifdef HAS_ZLIB
+    return true;
+#else
+    return false;
+#endif
+  case BackupCodec::Zstd:
+#ifdef HAS_ZSTD
+    return true;
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+BackupCodec DefaultBackupCodec() {
+  if (BackupCodecAvailable(BackupCodec::Zstd))
+    return BackupCodec::Zstd;
+  if (BackupCodecAvailable(BackupCodec::Deflate))
+    return BackupCodec::Deflate;
+  return BackupCodec::Store;
+}
+
+bool BackupCompress(BackupCodec codec, int level, const uint8_t *in,
+                    size_t len, std::vector<uint8_t> &out) {
+  out.clear();
+  switch (codec) {
+  case BackupCodec::Store:
+    return true;
+#ifdef HAS_ZLIB
+  case BackupCodec::Deflate: {
+    uLongf size = compressBound((uLong)len);
+    out.resize(size);
+    if (compress2(out.data(), &size, in, (uLong)len,
+                  level < 0 ? Z_DEFAULT_COMPRESSION : level) != Z_OK)
+      return false;
+    out.resize(size);
+    break;
+  }
+#endif
+#ifdef HAS_ZSTD
+  case BackupCodec::Zstd: {
+    out.resize(ZSTD_compressBound(len));
+    size_t size = ZSTD_compress(out.data(), out.size(), in, len,
+                                level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+    if (ZSTD_isError(size))
+      return false;
+    out.resize(size);
+    break;
+  }
+#endif
+  default:
+    return false;
+  }
+  if (out.size() >= len)
+    out.clear();
+  return true;
+}
+
+bool BackupDecompress(BackupCodec codec, const uint8_t *in, size_t len,
+                      uint8_t *out, size_t rawSize) {
+  switch (codec) {
+  case BackupCodec::Store:
+    if (len != rawSize)
+      return false;
+    memcpy(out, in, len);
+    return true;
+#ifdef HAS_ZLIB
+  case BackupCodec::Deflate: {
+    uLongf size = (uLongf)rawSize;
+    return uncompress(out, &size, in, (uLong)len) == Z_OK && size == rawSize;
+  }
+#endif
+#ifdef HAS_ZSTD
+  case BackupCodec::Zstd: {
+    size_t size = ZSTD_decompress(out, rawSize, in, len);
+    return !ZSTD_isError(size) && size == rawSize;
+  }
+#endif
+  default:
+    return false;
+  }
+}
+
+// --- Writer ---
+
+BackupArchiveWriter::BackupArchiveWriter()
+    : _offset(0), _inPartition(false), _rawBytes(0) {}
+
+BackupArchiveWriter::~BackupArchiveWriter() {
+  if (_pool)
+    _pool->Wait();
+}
+
+bool BackupArchiveWriter::Fail(const std::string &message) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_error.empty()) {
+    _error = message;
+    std::cerr << "[BACKUP] " << message << std::endl;
+  }
+  return false;
+}
+
+bool BackupArchiveWriter::Open(const std::string &path,
+                               const Options &options) {
+  if (!BackupCodecAvailable(options.codec))
+    return Fail(std::string("codec not built in: ") +
+                BackupCodecName(options.codec));
+  if (options.chunkSize == 0)
+    return Fail("chunk size must be non-zero");
+
+  _options = options;
+  _file.open(path, std::ios::binary | std::ios::trunc);
+  if (!_file)
+    return Fail("cannot create " + path);
+
+  std::vector<uint8_t> header(kHeaderMagic, kHeaderMagic + 8);
+  Put(header, kVersion, 4);
+  Put(header, options.chunkSize, 4);
+  header.resize(kHeaderSize, 0);
+  _file.write(reinterpret_cast<const char *>(header.data()), header.size());
+
+  _offset = kHeaderSize;
+  _chunks.clear();
+  _partitions.clear();
+  _pending.clear();
+  _inPartition = false;
+  _rawBytes = 0;
+  _error.clear();
+  _pool.reset(new ThreadPool(options.threads));
+  return true;
+}
+
+bool BackupArchiveWriter::BeginPartition(const Protocols::PartitionInfo &info) {
+  if (!_pool || _inPartition)
+    return Fail("BeginPartition without Open/EndPartition");
+  BackupPartition part;
+  part.info = info;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    part.firstChunk = _chunks.size();
+  }
+  _partitions.push_back(part);
+  _pending.clear();
+  _pending.reserve(_options.chunkSize);
+  _inPartition = true;
+  return true;
+}
+
+bool BackupArchiveWriter::Append(const uint8_t *data, size_t length) {
+  if (!_inPartition)
+    return Fail("Append outside a partition");
+  _partitions.back().size += length;
+  _rawBytes += length;
+  while (length > 0) {
+    size_t n = std::min(length, _options.chunkSize - _pending.size());
+    _pending.insert(_pending.end(), data, data + n);
+    data += n;
+    length -= n;
+    if (_pending.size() == _options.chunkSize)
+      SubmitChunk();
+  }
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _error.empty();
+}
+
+bool BackupArchiveWriter::EndPartition() {
+  if (!_inPartition)
+    return Fail("EndPartition without BeginPartition");
+  if (!_pending.empty())
+    SubmitChunk();
+  _inPartition = false;
+  BackupPartition &part = _partitions.back();
+  std::lock_guard<std::mutex> lock(_mutex);
+  part.chunkCount = _chunks.size() - part.firstChunk;
+  return _error.empty();
+}
+
+void BackupArchiveWriter::SubmitChunk() {
+  size_t index;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    index = _chunks.size();
+    _chunks.emplace_back();
+  }
+  std::vector<uint8_t> raw;
+  raw.swap(_pending);
+  _pending.reserve(_options.chunkSize);
+  // Bounded queue: blocks while the workers are behind.
+  auto task = std::make_shared<std::vector<uint8_t>>(std::move(raw));
+  _pool->Submit([this, index, task] { ProcessChunk(index, std::move(*task)); });
+}
+
+void BackupArchiveWriter::ProcessChunk(size_t index,
+                                       std::vector<uint8_t> raw) {
+  BackupChunk chunk;
+  chunk.rawSize = (uint32_t)raw.size();
+
+  std::vector<uint8_t> packed;
+  const std::vector<uint8_t> *payload = &raw;
+  if (AllZero(raw.data(), raw.size())) {
+    chunk.zero = true; // no payload and no digest to check
+    payload = &packed;
+  } else {
+    Protocols::Sha256::Compute(raw.data(), raw.size(), chunk.sha256);
+    if (!BackupCompress(_options.codec, _options.level, raw.data(),
+                        raw.size(), packed)) {
+      Fail(std::string(BackupCodecName(_options.codec)) +
+           " compression failed");
+      return;
+    }
+    if (!packed.empty()) {
+      chunk.codec = _options.codec;
+      payload = &packed;
+    }
+  }
+  chunk.storedSize = (uint32_t)payload->size();
+  chunk.crc32 = Protocols::Crc32::Compute(payload->data(), payload->size());
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  chunk.fileOffset = _offset;
+  _file.write(reinterpret_cast<const char *>(payload->data()),
+              payload->size());
+  _offset += payload->size();
+  _chunks[index] = chunk;
+  if (!_file && _error.empty()) {
+    _error = "write failed";
+    std::cerr << "[BACKUP] write failed" << std::endl;
+  }
+}
+
+bool BackupArchiveWriter::WriteIndex() {
+  std::vector<uint8_t> index;
+  Put(index, _options.chunkSize, 4);
+  Put(index, _chunks.size(), 8);
+  for (const BackupChunk &c : _chunks) {
+    Put(index, c.fileOffset, 8);
+    Put(index, c.storedSize, 4);
+    Put(index, c.rawSize, 4);
+    Put(index, (uint8_t)c.codec, 1);
+    Put(index, c.zero ? kChunkZero : 0, 1);
+    Put(index, 0, 2);
+    Put(index, c.crc32, 4);
+    PutBytes(index, c.sha256, sizeof(c.sha256));
+  }
+
+  Put(index, _partitions.size(), 4);
+  for (const BackupPartition &p : _partitions) {
+    Put(index, p.info.name.size(), 2);
+    PutBytes(index, reinterpret_cast<const uint8_t *>(p.info.name.data()),
+             p.info.name.size());
+    Put(index, p.info.lun, 4);
+    Put(index, p.info.startLba, 8);
+    Put(index, p.info.endLba, 8);
+    Put(index, p.info.sizeInBytes, 8);
+    Put(index, p.info.attributes, 8);
+    PutBytes(index, p.info.typeGuid, 16);
+    PutBytes(index, p.info.uniqueGuid, 16);
+    Put(index, p.size, 8);
+    Put(index, p.firstChunk, 8);
+    Put(index, p.chunkCount, 8);
+  }
+
+  Put(index, _gpt.size(), 4);
+  PutBytes(index, _gpt.data(), _gpt.size());
+
+  std::vector<uint8_t> footer(kFooterMagic, kFooterMagic + 8);
+  Put(footer, _offset, 8);
+  Put(footer, index.size(), 8);
+  Put(footer, Protocols::Crc32::Compute(index.data(), index.size()), 4);
+  footer.resize(kFooterSize, 0);
+
+  _file.write(reinterpret_cast<const char *>(index.data()), index.size());
+  _file.write(reinterpret_cast<const char *>(footer.data()), footer.size());
+  return (bool)_file;
+}
+
+bool BackupArchiveWriter::Close() {
+  if (!_pool)
+    return false;
+  if (_inPartition)
+    EndPartition();
+  _pool->Wait();
+  _pool.reset();
+
+  bool ok = _error.empty() && WriteIndex();
+  _file.close();
+  if (!ok || !_file)
+    return Fail("cannot finish archive");
+  return true;
+}
+
+// --- Reader ---
+
+bool BackupArchiveReader::Open(const std::string &path) {
+  Close();
+  _file.open(path, std::ios::binary);
+  if (!_file)
+    return false;
+
+  _file.seekg(0, std::ios::end);
+  uint64_t fileSize = (uint64_t)_file.tellg();
+  uint8_t header[kHeaderSize], footer[kFooterSize];
+  if (fileSize < kHeaderSize + kFooterSize)
+    return false;
+  _file.seekg(0);
+  _file.read(reinterpret_cast<char *>(header), kHeaderSize);
+  _file.seekg((std::streamoff)(fileSize - kFooterSize));
+  _file.read(reinterpret_cast<char *>(footer), kFooterSize);
+  if (!_file || memcmp(header, kHeaderMagic, 8) != 0 ||
+      memcmp(footer, kFooterMagic, 8) != 0) {
+    std::cerr << "[BACKUP] Not a finished DeepEye archive: " << path
+              << std::endl;
+    return false;
+  }
+
+  Cursor fc{footer + 8, kFooterSize - 8};
+  uint64_t indexOffset = fc.Get(8), indexSize = fc.Get(8);
+  uint32_t indexCrc = (uint32_t)fc.Get(4);
+  if (indexOffset + indexSize + kFooterSize != fileSize)
+    return false;
+
+  std::vector<uint8_t> index(indexSize);
+  _file.seekg((std::streamoff)indexOffset);
+  _file.read(reinterpret_cast<char *>(index.data()), indexSize);
+  if (!_file || Protocols::Crc32::Compute(index.data(), index.size()) !=
+                    indexCrc) {
+    std::cerr << "[BACKUP] Archive index is corrupt" << std::endl;
+    return false;
+  }
+
+  Cursor c{index.data(), index.size()};
+  _chunkSize = (uint32_t)c.Get(4);
+  uint64_t chunkCount = c.Get(8);
+  if (chunkCount > index.size() / 56)
+    return false;
+  _chunks.resize(chunkCount);
+  for (BackupChunk &ch : _chunks) {
+    ch.fileOffset = c.Get(8);
+    ch.storedSize = (uint32_t)c.Get(4);
+    ch.rawSize = (uint32_t)c.Get(4);
+    ch.codec = (BackupCodec)c.Get(1);
+    ch.zero = (c.Get(1) & kChunkZero) != 0;
+    c.Get(2);
+    ch.crc32 = (uint32_t)c.Get(4);
+    c.GetBytes(ch.sha256, sizeof(ch.sha256));
+    if (ch.fileOffset + ch.storedSize > indexOffset)
+      c.ok = false;
+  }
+
+  uint64_t partitionCount = c.Get(4);
+  for (uint64_t i = 0; c.ok && i < partitionCount; ++i) {
+    BackupPartition p;
+    p.info.name = c.GetString((size_t)c.Get(2));
+    p.info.lun = (uint32_t)c.Get(4);
+    p.info.startLba = c.Get(8);
+    p.info.endLba = c.Get(8);
+    p.info.sizeInBytes = c.Get(8);
+    p.info.attributes = c.Get(8);
+    c.GetBytes(p.info.typeGuid, 16);
+    c.GetBytes(p.info.uniqueGuid, 16);
+    p.size = c.Get(8);
+    p.firstChunk = c.Get(8);
+    p.chunkCount = c.Get(8);
+    if (p.firstChunk + p.chunkCount > _chunks.size())
+      c.ok = false;
+    _partitions.push_back(p);
+  }
+
+  size_t gptLen = (size_t)c.Get(4);
+  if (c.ok && gptLen <= c.left) {
+    _gpt.assign(c.p, c.p + gptLen);
+  } else {
+    c.ok = false;
+  }
+
+  if (!c.ok) {
+    std::cerr << "[BACKUP] Archive index is malformed" << std::endl;
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void BackupArchiveReader::Close() {
+  if (_file.is_open())
+    _file.close();
+  _file.clear();
+  _chunkSize = 0;
+  _chunks.clear();
+  _partitions.clear();
+  _gpt.clear();
+}
+
+const BackupPartition *
+BackupArchiveReader::FindPartition(const std::string &name) const {
+  for (const BackupPartition &p : _partitions)
+    if (p.info.name == name)
+      return &p;
+  return nullptr;
+}
+
+bool BackupArchiveReader::ReadChunk(size_t index, std::vector<uint8_t> &out,
+                                    std::string *error, bool verifyDigest) {
+  if (index >= _chunks.size()) {
+    SetError(error, "chunk index out of range");
+    return false;
+  }
+  const BackupChunk &ch = _chunks[index];
+  if (ch.zero) {
+    out.assign(ch.rawSize, 0);
+    return true;
+  }
+
+  std::vector<uint8_t> stored(ch.storedSize);
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _file.clear();
+    _file.seekg((std::streamoff)ch.fileOffset);
+    _file.read(reinterpret_cast<char *>(stored.data()), stored.size());
+    if (!_file) {
+      SetError(error, "short read in chunk " + std::to_string(index));
+      return false;
+    }
+  }
+  if (Protocols::Crc32::Compute(stored.data(), stored.size()) != ch.crc32) {
+    SetError(error, "CRC mismatch in chunk " + std::to_string(index));
+    return false;
+  }
+
+  out.resize(ch.rawSize);
+  if (!BackupDecompress(ch.codec, stored.data(), stored.size(), out.data(),
+                        out.size())) {
+    SetError(error, std::string(BackupCodecName(ch.codec)) +
+                        " decode failed in chunk " + std::to_string(index));
+    return false;
+  }
+  if (!verifyDigest)
+    return true;
+  uint8_t digest[Protocols::Sha256::kDigestSize];
+  Protocols::Sha256::Compute(out.data(), out.size(), digest);
+  if (memcmp(digest, ch.sha256, sizeof(digest)) != 0) {
+    SetError(error, "SHA-256 mismatch in chunk " + std::to_string(index));
+    return false;
+  }
+  return true;
+}
+
+bool BackupArchiveReader::ReadRange(const std::string &name, uint64_t offset,
+                                    uint8_t *out, size_t length,
+                                    std::string *error) {
+  const BackupPartition *p = FindPartition(name);
+  if (!p || offset + length > p->size) {
+    SetError(error, "range outside partition " + name);
+    return false;
+  }
+
+  std::vector<uint8_t> chunk;
+  while (length > 0) {
+    size_t index = (size_t)(p->firstChunk + offset / _chunkSize);
+    size_t within = (size_t)(offset % _chunkSize);
+    if (!ReadChunk(index, chunk, error, false))
+      return false;
+    size_t n = std::min(length, chunk.size() - within);
+    memcpy(out, chunk.data() + within, n);
+    out += n;
+    offset += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool BackupArchiveReader::ExtractPartition(const std::string &name,
+                                           const std::string &outPath,
+                                           unsigned threads,
+                                           std::string *error) {
+  const BackupPartition *p = FindPartition(name);
+  if (!p) {
+    SetError(error, "no partition " + name + " in archive");
+    return false;
+  }
+  std::ofstream out(outPath, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    SetError(error, "cannot create " + outPath);
+    return false;
+  }
+
+  // Decode a window of chunks in parallel, then write it in order.
+  ThreadPool pool(threads);
+  const size_t window = pool.Size() * 2;
+  std::vector<std::vector<uint8_t>> decoded(window);
+  std::vector<std::string> errors(window);
+  for (uint64_t first = 0; first < p->chunkCount; first += window) {
+    size_t n = (size_t)std::min<uint64_t>(window, p->chunkCount - first);
+    for (size_t i = 0; i < n; ++i) {
+      errors[i].clear();
+      pool.Submit([&, i] {
+        if (!ReadChunk((size_t)(p->firstChunk + first + i), decoded[i],
+                       &errors[i]) &&
+            errors[i].empty())
+          errors[i] = "decode failed";
+      });
+    }
+    pool.Wait();
+    for (size_t i = 0; i < n; ++i) {
+      if (!errors[i].empty()) {
+        SetError(error, errors[i]);
+        return false;
+      }
+      out.write(reinterpret_cast<const char *>(decoded[i].data()),
+                decoded[i].size());
+    }
+  }
+  out.close();
+  if (!out) {
+    SetError(error, "write failed: " + outPath);
+    return false;
+  }
+  return true;
+}
+
+} // namespace Core
+} // namespace DeepEye
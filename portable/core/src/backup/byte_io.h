@@ -0,0 +1,67 @@
+#ifndef DEEPEYE_BACKUP_BYTE_IO_H
+#define DEEPEYE_BACKUP_BYTE_IO_H
+
+// Little-endian serialization shared by the backup containers.
+
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DeepEye {
+namespace Core {
+namespace ByteIo {
+
+inline void Put(std::vector<uint8_t> &out, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+inline void PutBytes(std::vector<uint8_t> &out, const uint8_t *p, size_t n) {
+  out.insert(out.end(), p, p + n);
+}
+
+// Bounds-checked cursor; any overrun clears `ok` and reads as zero.
+struct Cursor {
+  const uint8_t *p;
+  size_t left;
+  bool ok = true;
+
+  uint64_t Get(int bytes) {
+    uint64_t v = 0;
+    if (left < (size_t)bytes) {
+      ok = false;
+      return 0;
+    }
+    for (int i = 0; i < bytes; ++i)
+      v |= (uint64_t)p[i] << (8 * i);
+    p += bytes;
+    left -= bytes;
+    return v;
+  }
+  void GetBytes(uint8_t *out, size_t n) {
+    if (left < n) {
+      ok = false;
+      return;
+    }
+    memcpy(out, p, n);
+    p += n;
+    left -= n;
+  }
+  std::string GetString(size_t n) {
+    if (left < n) {
+      ok = false;
+      return std::string();
+    }
+    std::string s(reinterpret_cast<const char *>(p), n);
+    p += n;
+    left -= n;
+    return s;
+  }
+};
+
+} // namespace ByteIo
+} // namespace Core
+} // namespace DeepEye
+
+#endif // DEEPEYE_BACKUP_BYTE_IO_H
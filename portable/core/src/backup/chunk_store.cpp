@@ -0,0 +1,835 @@
+#include "../../include/chunk_store.h"
+#include "../../include/thread_pool.h"
+#include "../../include/trace.h"
+#include "byte_io.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <map>
+
+namespace fs = std::filesystem;
+
+namespace DeepEye {
+namespace Core {
+
+namespace {
+
+using namespace ByteIo;
+
+const char kJournalMagic[8] = {'D', 'E', 'E', 'P', 'C', 'A', 'S', '1'};
+const char kRecipeMagic[8] = {'D', 'E', 'E', 'P', 'R', 'C', 'P', '1'};
+const uint32_t kVersion = 1;
+const size_t kJournalHeaderSize = 32;
+const uint64_t kPackLimit = 1ull << 30;
+
+// Journal record tags.
+const uint8_t kRecChunk = 'C';  // digest, location, sizes, codec, crc, refs
+const uint8_t kRecRefs = 'R';   // digest, signed refcount delta
+const uint8_t kRecObject = 'O'; // name, size, chunk count
+const uint8_t kRecDrop = 'D';   // name
+
+uint64_t TopBits(int n) { return n <= 0 ? 0 : ~0ull << (64 - n); }
+
+void PutName(std::vector<uint8_t> &out, const std::string &name) {
+  Put(out, name.size(), 2);
+  PutBytes(out, reinterpret_cast<const uint8_t *>(name.data()), name.size());
+}
+
+bool ValidName(const std::string &name) {
+  if (name.empty() || name.size() > 1024 || name[0] == '/' ||
+      name.find('\\') != std::string::npos)
+    return false;
+  for (const fs::path &part : fs::path(name))
+    if (part == ".." || part == ".")
+      return false;
+  return true;
+}
+
+bool ReadFile(const std::string &path, std::vector<uint8_t> &out) {
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in)
+    return false;
+  out.resize((size_t)in.tellg());
+  in.seekg(0);
+  in.read(reinterpret_cast<char *>(out.data()), out.size());
+  return (bool)in;
+}
+
+// Writes next to `path` and renames over it, so readers never see a torn
+// file.
+bool WriteFileAtomic(const std::string &path,
+                     const std::vector<uint8_t> &data) {
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(data.data()), data.size());
+    if (!out)
+      return false;
+  }
+  std::error_code ec;
+  fs::rename(tmp, path, ec);
+  return !ec;
+}
+
+} // namespace
+
+// --- FastCdc ---
+
+FastCdc::FastCdc(uint32_t minSize, uint32_t avgSize, uint32_t maxSize) {
+  _minSize = std::max<uint32_t>(minSize, 64);
+  _avgSize = std::max(avgSize, _minSize + 1);
+  _maxSize = std::max(maxSize, _avgSize + 1);
+  int bits = 0;
+  while ((2u << bits) <= _avgSize)
+    ++bits;
+  // Top bits: after the shift-left update they depend on the last 64 bytes.
+  _maskS = TopBits(bits + 2);
+  _maskL = TopBits(bits - 2);
+}
+
+const uint64_t *FastCdc::GearTable() {
+  static const struct Table {
+    uint64_t v[256];
+    Table() {
+      uint64_t x = 0x44454550454945ull; // splitmix64, fixed seed
+      for (uint64_t &g : v) {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        g = z ^ (z >> 31);
+      }
+    }
+  } table;
+  return table.v;
+}
+
+size_t FastCdc::Cut(const uint8_t *data, size_t length) const {
+  const size_t end = std::min<size_t>(length, _maxSize);
+  if (end <= _minSize)
+    return end;
+  const size_t normal = std::min<size_t>(end, _avgSize);
+  const uint64_t *gear = GearTable();
+  uint64_t h = 0;
+  size_t i = _minSize;
+  // The update is a serial dependency chain, so unrolling only removes
+  // loop overhead; the min-size skip is what saves most of the work.
+  for (; i + 4 <= normal; i += 4) {
+    h = (h << 1) + gear[data[i]];
+    if (!(h & _maskS))
+      return i + 1;
+    h = (h << 1) + gear[data[i + 1]];
+    if (!(h & _maskS))
+      return i + 2;
+    h = (h << 1) + gear[data[i + 2]];
+    if (!(h & _maskS))
+      return i + 3;
+    h = (h << 1) + gear[data[i + 3]];
+    if (!(h & _maskS))
+      return i + 4;
+  }
+  for (; i < normal; ++i) {
+    h = (h << 1) + gear[data[i]];
+    if (!(h & _maskS))
+      return i + 1;
+  }
+  for (; i + 4 <= end; i += 4) {
+    h = (h << 1) + gear[data[i]];
+    if (!(h & _maskL))
+      return i + 1;
+    h = (h << 1) + gear[data[i + 1]];
+    if (!(h & _maskL))
+      return i + 2;
+    h = (h << 1) + gear[data[i + 2]];
+    if (!(h & _maskL))
+      return i + 3;
+    h = (h << 1) + gear[data[i + 3]];
+    if (!(h & _maskL))
+      return i + 4;
+  }
+  for (; i < end; ++i) {
+    h = (h << 1) + gear[data[i]];
+    if (!(h & _maskL))
+      return i + 1;
+  }
+  return end;
+}
+
+// --- ChunkStore ---
+
+ChunkStore::ChunkStore()
+    : _packId(0), _packSize(0), _inObject(false), _objectSize(0),
+      _pendingPos(0) {}
+
+ChunkStore::~ChunkStore() {
+  if (_pool)
+    Close();
+}
+
+bool ChunkStore::Fail(const std::string &message) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_error.empty()) {
+    _error = message;
+    std::cerr << "[BACKUP] " << message << std::endl;
+  }
+  return false;
+}
+
+std::string ChunkStore::PackPath(uint32_t id) const {
+  char name[32];
+  snprintf(name, sizeof(name), "pack-%06u.dat", id);
+  return _root + "/packs/" + name;
+}
+
+std::string ChunkStore::RecipePath(const std::string &name) const {
+  return _root + "/objects/" + name + ".rcp";
+}
+
+bool ChunkStore::Open(const std::string &root, const Options &options) {
+  if (_pool)
+    Close();
+  if (!BackupCodecAvailable(options.codec))
+    return Fail(std::string("codec not built in: ") +
+                BackupCodecName(options.codec));
+
+  _options = options;
+  _root = root;
+  _error.clear();
+  _index.clear();
+  _objects.clear();
+  _batch.clear();
+
+  std::error_code ec;
+  fs::create_directories(_root + "/packs", ec);
+  fs::create_directories(_root + "/objects", ec);
+  if (ec)
+    return Fail("cannot create store at " + root);
+  if (!LoadJournal())
+    return false;
+
+  // Append to a fresh pack: a crash may have left unindexed bytes at the
+  // tail of the last one, and later compactions must not collide with it.
+  uint32_t last = 0;
+  for (const fs::directory_entry &e :
+       fs::directory_iterator(_root + "/packs", ec)) {
+    unsigned id;
+    if (sscanf(e.path().filename().string().c_str(), "pack-%u.dat", &id) ==
+        1)
+      last = std::max<uint32_t>(last, id);
+  }
+  if (!OpenPack(last + 1))
+    return false;
+  _pool.reset(new ThreadPool(_options.threads));
+  return true;
+}
+
+bool ChunkStore::LoadJournal() {
+  const std::string path = _root + "/store.journal";
+  std::vector<uint8_t> data;
+  if (!fs::exists(path)) {
+    _cdc.reset(new FastCdc(_options.minChunk, _options.avgChunk,
+                           _options.maxChunk));
+    std::vector<uint8_t> header(kJournalMagic, kJournalMagic + 8);
+    Put(header, kVersion, 4);
+    Put(header, _cdc->MinSize(), 4);
+    Put(header, _cdc->AvgSize(), 4);
+    Put(header, _cdc->MaxSize(), 4);
+    header.resize(kJournalHeaderSize, 0);
+    if (!WriteFileAtomic(path, header))
+      return Fail("cannot create " + path);
+  } else if (!ReadFile(path, data) || data.size() < kJournalHeaderSize ||
+             memcmp(data.data(), kJournalMagic, 8) != 0) {
+    return Fail("not a chunk store journal: " + path);
+  } else {
+    Cursor h{data.data() + 8, kJournalHeaderSize - 8};
+    if (h.Get(4) != kVersion)
+      return Fail("unsupported chunk store version");
+    uint32_t minSize = (uint32_t)h.Get(4);
+    uint32_t avgSize = (uint32_t)h.Get(4);
+    uint32_t maxSize = (uint32_t)h.Get(4);
+    _cdc.reset(new FastCdc(minSize, avgSize, maxSize));
+
+    // Frames: u32 length, u32 CRC, records. Stop at the first torn frame.
+    size_t pos = kJournalHeaderSize;
+    while (pos + 8 <= data.size()) {
+      Cursor f{data.data() + pos, 8};
+      size_t len = (size_t)f.Get(4);
+      uint32_t crc = (uint32_t)f.Get(4);
+      if (len > data.size() - pos - 8 ||
+          Protocols::Crc32::Compute(&data[pos + 8], len) != crc ||
+          !ReplayBatch(&data[pos + 8], len))
+        break;
+      pos += 8 + len;
+    }
+    if (pos != data.size()) {
+      std::cerr << "[BACKUP] Discarding " << data.size() - pos
+                << " torn journal bytes" << std::endl;
+      std::error_code ec;
+      fs::resize_file(path, pos, ec);
+    }
+  }
+
+  _journal.open(path, std::ios::binary | std::ios::app);
+  if (!_journal)
+    return Fail("cannot open " + path);
+  return true;
+}
+
+bool ChunkStore::ReplayBatch(const uint8_t *p, size_t length) {
+  Cursor c{p, length};
+  while (c.ok && c.left > 0) {
+    uint8_t tag = (uint8_t)c.Get(1);
+    if (tag == kRecChunk || tag == kRecRefs) {
+      ChunkDigest d;
+      c.GetBytes(d.bytes, sizeof(d.bytes));
+      if (tag == kRecRefs) {
+        int32_t delta = (int32_t)(uint32_t)c.Get(4);
+        auto it = _index.find(d);
+        if (it == _index.end() ||
+            (delta < 0 && it->second.refs < (uint32_t)-delta))
+          return false;
+        it->second.refs += delta;
+        continue;
+      }
+      Entry &e = _index[d];
+      e.pack = (uint32_t)c.Get(4);
+      e.offset = c.Get(8);
+      e.storedSize = (uint32_t)c.Get(4);
+      e.rawSize = (uint32_t)c.Get(4);
+      e.codec = (BackupCodec)c.Get(1);
+      e.crc32 = (uint32_t)c.Get(4);
+      e.refs = (uint32_t)c.Get(4);
+      e.written = true;
+    } else if (tag == kRecObject) {
+      std::string name = c.GetString((size_t)c.Get(2));
+      Object &o = _objects[name];
+      o.size = c.Get(8);
+      o.chunkCount = c.Get(8);
+    } else if (tag == kRecDrop) {
+      _objects.erase(c.GetString((size_t)c.Get(2)));
+    } else {
+      return false;
+    }
+  }
+  return c.ok;
+}
+
+bool ChunkStore::CommitBatch() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_batch.empty())
+    return true;
+  // Chunk payloads must be on disk before the records that point at them.
+  _pack.flush();
+  std::vector<uint8_t> frame;
+  Put(frame, _batch.size(), 4);
+  Put(frame, Protocols::Crc32::Compute(_batch.data(), _batch.size()), 4);
+  _journal.write(reinterpret_cast<const char *>(frame.data()), frame.size());
+  _journal.write(reinterpret_cast<const char *>(_batch.data()),
+                 _batch.size());
+  _journal.flush();
+  _batch.clear();
+  if (!_pack || !_journal) {
+    _error = "journal write failed";
+    std::cerr << "[BACKUP] journal write failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool ChunkStore::OpenPack(uint32_t id) {
+  if (_pack.is_open())
+    _pack.close();
+  _pack.clear();
+  _pack.open(PackPath(id), std::ios::binary | std::ios::app);
+  if (!_pack) {
+    _error = "cannot open " + PackPath(id);
+    std::cerr << "[BACKUP] " << _error << std::endl;
+    return false;
+  }
+  _packId = id;
+  std::error_code ec;
+  _packSize = fs::file_size(PackPath(id), ec);
+  return true;
+}
+
+bool ChunkStore::Close() {
+  if (!_pool)
+    return false;
+  if (_inObject)
+    EndObject();
+  _pool->Wait();
+  _pool.reset();
+  bool ok = CommitBatch() && _error.empty();
+  _pack.close();
+  _journal.close();
+  // An empty trailing pack is just noise in the directory.
+  std::error_code ec;
+  if (_packSize == 0)
+    fs::remove(PackPath(_packId), ec);
+  return ok;
+}
+
+bool ChunkStore::BeginObject(const std::string &name) {
+  if (!_pool || _inObject)
+    return Fail("BeginObject without Open/EndObject");
+  if (!ValidName(name))
+    return Fail("invalid object name: " + name);
+  _inObject = true;
+  _objectName = name;
+  _objectSize = 0;
+  _pending.clear();
+  _pendingPos = 0;
+  std::lock_guard<std::mutex> lock(_mutex);
+  _recipe.clear();
+  return _error.empty();
+}
+
+bool ChunkStore::Append(const uint8_t *data, size_t length) {
+  if (!_inObject)
+    return Fail("Append outside an object");
+  _objectSize += length;
+  const size_t maxSize = _cdc->MaxSize();
+  while (length > 0) {
+    size_t n = std::min(length, maxSize * 4);
+    _pending.insert(_pending.end(), data, data + n);
+    data += n;
+    length -= n;
+    // A cut is only final once a full max-size window is buffered.
+    while (_pending.size() - _pendingPos >= maxSize)
+      SubmitChunk(
+          _cdc->Cut(&_pending[_pendingPos], _pending.size() - _pendingPos));
+    _pending.erase(_pending.begin(), _pending.begin() + _pendingPos);
+    _pendingPos = 0;
+  }
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _error.empty();
+}
+
+void ChunkStore::SubmitChunk(size_t length) {
+  size_t index;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    index = _recipe.size();
+    _recipe.emplace_back();
+  }
+  auto raw = std::make_shared<std::vector<uint8_t>>(
+      _pending.begin() + _pendingPos,
+      _pending.begin() + _pendingPos + length);
+  _pendingPos += length;
+  _pool->Submit([this, index, raw] { ProcessChunk(index, std::move(*raw)); });
+}
+
+void ChunkStore::ProcessChunk(size_t index, std::vector<uint8_t> raw) {
+  ChunkDigest digest;
+  Protocols::Sha256::Compute(raw.data(), raw.size(), digest.bytes);
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _recipe[index] = digest;
+    // Known (or being stored by another worker): nothing to write.
+    if (!_index.emplace(digest, Entry()).second)
+      return;
+  }
+
+  TraceSpan span("cas.store_chunk", TraceCategory::Pipeline, raw.size());
+  std::vector<uint8_t> packed;
+  if (!BackupCompress(_options.codec, _options.level, raw.data(), raw.size(),
+                      packed)) {
+    Fail(std::string(BackupCodecName(_options.codec)) +
+         " compression failed");
+    return;
+  }
+  Entry e;
+  e.rawSize = (uint32_t)raw.size();
+  const std::vector<uint8_t> &payload = packed.empty() ? raw : packed;
+  if (!packed.empty())
+    e.codec = _options.codec;
+  e.storedSize = (uint32_t)payload.size();
+  e.crc32 = Protocols::Crc32::Compute(payload.data(), payload.size());
+  StorePayload(digest, payload.data(), e);
+}
+
+bool ChunkStore::StorePayload(const ChunkDigest &digest,
+                              const uint8_t *payload, Entry e) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_packSize >= kPackLimit && !OpenPack(_packId + 1))
+    return false;
+  e.pack = _packId;
+  e.offset = _packSize;
+  e.written = true;
+  _pack.write(reinterpret_cast<const char *>(payload), e.storedSize);
+  _packSize += e.storedSize;
+  if (!_pack) {
+    if (_error.empty()) {
+      _error = "pack write failed";
+      std::cerr << "[BACKUP] pack write failed" << std::endl;
+    }
+    return false;
+  }
+  Entry &slot = _index[digest];
+  e.refs = slot.refs;
+  slot = e;
+
+  Put(_batch, kRecChunk, 1);
+  PutBytes(_batch, digest.bytes, sizeof(digest.bytes));
+  Put(_batch, e.pack, 4);
+  Put(_batch, e.offset, 8);
+  Put(_batch, e.storedSize, 4);
+  Put(_batch, e.rawSize, 4);
+  Put(_batch, (uint8_t)e.codec, 1);
+  Put(_batch, e.crc32, 4);
+  Put(_batch, e.refs, 4);
+  return true;
+}
+
+void ChunkStore::AddRefs(const std::vector<ChunkDigest> &recipe, int delta) {
+  std::unordered_map<ChunkDigest, int32_t, ChunkDigestHash> counts;
+  for (const ChunkDigest &d : recipe)
+    counts[d] += delta;
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (const auto &kv : counts) {
+    auto it = _index.find(kv.first);
+    if (it == _index.end())
+      continue;
+    it->second.refs += kv.second;
+    Put(_batch, kRecRefs, 1);
+    PutBytes(_batch, kv.first.bytes, sizeof(kv.first.bytes));
+    Put(_batch, (uint32_t)kv.second, 4);
+  }
+}
+
+bool ChunkStore::EndObject() {
+  if (!_inObject)
+    return Fail("EndObject without BeginObject");
+  while (_pendingPos < _pending.size())
+    SubmitChunk(
+        _cdc->Cut(&_pending[_pendingPos], _pending.size() - _pendingPos));
+  _pending.clear();
+  _pendingPos = 0;
+  _inObject = false;
+  _pool->Wait();
+
+  bool failed;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    failed = !_error.empty();
+    if (failed) {
+      // Forget chunks whose payload never made it into a pack.
+      for (auto it = _index.begin(); it != _index.end();)
+        it = it->second.written ? std::next(it) : _index.erase(it);
+    }
+  }
+  if (failed) {
+    CommitBatch(); // chunks that were written stay usable
+    return false;
+  }
+
+  // Recipe: magic, size, count, digests, CRC of all of it.
+  std::vector<uint8_t> recipe(kRecipeMagic, kRecipeMagic + 8);
+  Put(recipe, _objectSize, 8);
+  Put(recipe, _recipe.size(), 8);
+  for (const ChunkDigest &d : _recipe)
+    PutBytes(recipe, d.bytes, sizeof(d.bytes));
+  Put(recipe, Protocols::Crc32::Compute(recipe.data(), recipe.size()), 4);
+
+  // Re-storing an object replaces it: its old chunks lose a reference.
+  std::vector<ChunkDigest> old;
+  if (HasObject(_objectName) && ReadRecipe(_objectName, old))
+    AddRefs(old, -1);
+  AddRefs(_recipe, 1);
+
+  std::error_code ec;
+  fs::create_directories(fs::path(RecipePath(_objectName)).parent_path(), ec);
+  if (!WriteFileAtomic(RecipePath(_objectName), recipe)) {
+    AddRefs(_recipe, -1);
+    if (!old.empty())
+      AddRefs(old, 1);
+    CommitBatch();
+    return Fail("cannot write recipe for " + _objectName);
+  }
+
+  Object &o = _objects[_objectName];
+  o.size = _objectSize;
+  o.chunkCount = _recipe.size();
+  Put(_batch, kRecObject, 1);
+  PutName(_batch, _objectName);
+  Put(_batch, o.size, 8);
+  Put(_batch, o.chunkCount, 8);
+  return CommitBatch();
+}
+
+bool ChunkStore::HasObject(const std::string &name) const {
+  return _objects.count(name) != 0;
+}
+
+std::vector<std::string> ChunkStore::Objects() const {
+  std::vector<std::string> names;
+  for (const auto &kv : _objects)
+    names.push_back(kv.first);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+bool ChunkStore::ReadRecipe(const std::string &name,
+                            std::vector<ChunkDigest> &out) {
+  std::vector<uint8_t> data;
+  if (!ReadFile(RecipePath(name), data) || data.size() < 28 ||
+      memcmp(data.data(), kRecipeMagic, 8) != 0)
+    return Fail("missing recipe for " + name);
+  Cursor tail{&data[data.size() - 4], 4};
+  if (Protocols::Crc32::Compute(data.data(), data.size() - 4) !=
+      (uint32_t)tail.Get(4))
+    return Fail("corrupt recipe for " + name);
+  Cursor c{data.data() + 16, data.size() - 20};
+  uint64_t count = c.Get(8);
+  if (count != c.left / sizeof(ChunkDigest::bytes))
+    return Fail("corrupt recipe for " + name);
+  out.resize((size_t)count);
+  for (ChunkDigest &d : out)
+    c.GetBytes(d.bytes, sizeof(d.bytes));
+  return true;
+}
+
+bool ChunkStore::ReadChunk(const ChunkDigest &digest, std::vector<uint8_t> &out,
+                           std::ifstream &pack, uint32_t &openPack,
+                           std::string &error) {
+  Entry e;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(digest);
+    if (it == _index.end() || !it->second.written) {
+      error = "chunk missing from index";
+      return false;
+    }
+    e = it->second;
+  }
+  if (openPack != e.pack) {
+    pack.close();
+    pack.clear();
+    pack.open(PackPath(e.pack), std::ios::binary);
+    openPack = e.pack;
+  }
+  std::vector<uint8_t> stored(e.storedSize);
+  pack.clear();
+  pack.seekg((std::streamoff)e.offset);
+  pack.read(reinterpret_cast<char *>(stored.data()), stored.size());
+  if (!pack) {
+    error = "short read from " + PackPath(e.pack);
+    return false;
+  }
+  if (Protocols::Crc32::Compute(stored.data(), stored.size()) != e.crc32) {
+    error = "CRC mismatch in " + PackPath(e.pack);
+    return false;
+  }
+  out.resize(e.rawSize);
+  ChunkDigest check;
+  if (!BackupDecompress(e.codec, stored.data(), stored.size(), out.data(),
+                        out.size())) {
+    error = std::string(BackupCodecName(e.codec)) + " decode failed";
+    return false;
+  }
+  Protocols::Sha256::Compute(out.data(), out.size(), check.bytes);
+  if (!(check == digest)) {
+    error = "SHA-256 mismatch in " + PackPath(e.pack);
+    return false;
+  }
+  return true;
+}
+
+bool ChunkStore::Restore(const std::string &name, const std::string &outPath) {
+  if (!_pool || _inObject)
+    return Fail("Restore without Open or during an object");
+  std::vector<ChunkDigest> recipe;
+  if (!HasObject(name))
+    return Fail("no object " + name + " in store");
+  if (!ReadRecipe(name, recipe))
+    return false;
+  std::ofstream out(outPath, std::ios::binary | std::ios::trunc);
+  if (!out)
+    return Fail("cannot create " + outPath);
+
+  // Decode a window of chunks in parallel, each slot with its own pack
+  // stream, then write the window in order.
+  struct Slot {
+    std::ifstream pack;
+    uint32_t packId = 0;
+    std::vector<uint8_t> data;
+    std::string error;
+  };
+  const size_t window = _pool->Size() * 2;
+  std::vector<Slot> slots(window);
+  for (size_t first = 0; first < recipe.size(); first += window) {
+    size_t n = std::min(window, recipe.size() - first);
+    for (size_t i = 0; i < n; ++i) {
+      _pool->Submit([&, i] {
+        Slot &s = slots[i];
+        s.error.clear();
+        ReadChunk(recipe[first + i], s.data, s.pack, s.packId, s.error);
+      });
+    }
+    _pool->Wait();
+    for (size_t i = 0; i < n; ++i) {
+      if (!slots[i].error.empty())
+        return Fail(name + ": " + slots[i].error);
+      out.write(reinterpret_cast<const char *>(slots[i].data.data()),
+                slots[i].data.size());
+    }
+  }
+  out.close();
+  if (!out)
+    return Fail("write failed: " + outPath);
+  return true;
+}
+
+bool ChunkStore::Remove(const std::string &name) {
+  if (!_pool || _inObject)
+    return Fail("Remove without Open or during an object");
+  std::vector<ChunkDigest> recipe;
+  if (!HasObject(name) || !ReadRecipe(name, recipe))
+    return false;
+  AddRefs(recipe, -1);
+  _objects.erase(name);
+  Put(_batch, kRecDrop, 1);
+  PutName(_batch, name);
+  if (!CommitBatch())
+    return false;
+  std::error_code ec;
+  fs::remove(RecipePath(name), ec);
+  // Drop the per-device directory once its last object is gone; remove()
+  // refuses non-empty directories.
+  fs::path dir = fs::path(RecipePath(name)).parent_path();
+  if (dir != fs::path(_root + "/objects"))
+    fs::remove(dir, ec);
+  return true;
+}
+
+bool ChunkStore::WriteSnapshot() {
+  std::vector<uint8_t> data(kJournalMagic, kJournalMagic + 8);
+  Put(data, kVersion, 4);
+  Put(data, _cdc->MinSize(), 4);
+  Put(data, _cdc->AvgSize(), 4);
+  Put(data, _cdc->MaxSize(), 4);
+  data.resize(kJournalHeaderSize, 0);
+
+  std::vector<uint8_t> batch;
+  for (const auto &kv : _index) {
+    const Entry &e = kv.second;
+    Put(batch, kRecChunk, 1);
+    PutBytes(batch, kv.first.bytes, sizeof(kv.first.bytes));
+    Put(batch, e.pack, 4);
+    Put(batch, e.offset, 8);
+    Put(batch, e.storedSize, 4);
+    Put(batch, e.rawSize, 4);
+    Put(batch, (uint8_t)e.codec, 1);
+    Put(batch, e.crc32, 4);
+    Put(batch, e.refs, 4);
+  }
+  for (const auto &kv : _objects) {
+    Put(batch, kRecObject, 1);
+    PutName(batch, kv.first);
+    Put(batch, kv.second.size, 8);
+    Put(batch, kv.second.chunkCount, 8);
+  }
+  if (!batch.empty()) {
+    Put(data, batch.size(), 4);
+    Put(data, Protocols::Crc32::Compute(batch.data(), batch.size()), 4);
+    PutBytes(data, batch.data(), batch.size());
+  }
+
+  const std::string path = _root + "/store.journal";
+  _journal.close();
+  bool ok = WriteFileAtomic(path, data);
+  _journal.clear();
+  _journal.open(path, std::ios::binary | std::ios::app);
+  return ok && (bool)_journal;
+}
+
+bool ChunkStore::Compact() {
+  if (!_pool || _inObject)
+    return Fail("Compact without Open or during an object");
+  if (!CommitBatch())
+    return false;
+  TraceSpan span("cas.compact", TraceCategory::Pipeline);
+
+  // Live bytes per pack; rewrite the packs that are mostly garbage.
+  std::map<uint32_t, uint64_t> live;
+  for (const auto &kv : _index)
+    if (kv.second.refs > 0)
+      live[kv.second.pack] += kv.second.storedSize;
+  std::vector<uint32_t> victims;
+  std::error_code ec;
+  for (const fs::directory_entry &e :
+       fs::directory_iterator(_root + "/packs", ec)) {
+    unsigned id;
+    if (sscanf(e.path().filename().string().c_str(), "pack-%u.dat", &id) !=
+            1 ||
+        id == _packId)
+      continue;
+    uint64_t size = e.file_size(ec);
+    if (live[id] * 2 <= size)
+      victims.push_back(id);
+  }
+  std::sort(victims.begin(), victims.end());
+
+  std::ifstream in;
+  uint32_t openPack = 0;
+  std::vector<uint8_t> stored;
+  for (auto it = _index.begin(); it != _index.end();) {
+    Entry &e = it->second;
+    if (e.refs == 0) {
+      it = _index.erase(it);
+      continue;
+    }
+    if (std::binary_search(victims.begin(), victims.end(), e.pack)) {
+      if (openPack != e.pack) {
+        in.close();
+        in.clear();
+        in.open(PackPath(e.pack), std::ios::binary);
+        openPack = e.pack;
+      }
+      stored.resize(e.storedSize);
+      in.seekg((std::streamoff)e.offset);
+      in.read(reinterpret_cast<char *>(stored.data()), stored.size());
+      if (!in ||
+          Protocols::Crc32::Compute(stored.data(), stored.size()) != e.crc32)
+        return Fail("cannot relocate chunk from " + PackPath(e.pack));
+      Entry moved = e;
+      if (!StorePayload(it->first, stored.data(), moved))
+        return false;
+    }
+    ++it;
+  }
+  _batch.clear(); // superseded by the snapshot
+  _pack.flush();
+  if (!_pack || !WriteSnapshot())
+    return Fail("cannot write journal snapshot");
+  for (uint32_t id : victims)
+    fs::remove(PackPath(id), ec);
+  return true;
+}
+
+ChunkStoreStats ChunkStore::Stats() const {
+  ChunkStoreStats s;
+  std::lock_guard<std::mutex> lock(_mutex);
+  s.objects = _objects.size();
+  for (const auto &kv : _objects)
+    s.logicalBytes += kv.second.size;
+  // The open pack may still have buffered bytes; count it by _packSize.
+  uint64_t packBytes = _packSize;
+  std::error_code ec;
+  for (const fs::directory_entry &e :
+       fs::directory_iterator(_root + "/packs", ec))
+    if (e.path() != fs::path(PackPath(_packId)))
+      packBytes += e.file_size(ec);
+  for (const auto &kv : _index) {
+    if (kv.second.refs == 0 || !kv.second.written)
+      continue;
+    ++s.chunks;
+    s.uniqueBytes += kv.second.rawSize;
+    s.storedBytes += kv.second.storedSize;
+  }
+  s.garbageBytes = packBytes > s.storedBytes ? packBytes - s.storedBytes : 0;
+  return s;
+}
+
+} // namespace Core
+} // namespace DeepEye
@@ -1,12 +1,55 @@
 #include "../include/deepeye_exports.h"
 #include "../include/deepeye_core.h"
-#include <cstring>
 // For simplicity in this build, we assume LibUsbTransport is the primary
 // implementation
-#include "transport/usb_transport.cpp"
+#include "../include/usb_transport.h"
+#include "../include/net_transport.h"
+#include "../include/scenario_transport.h"
+#include "../include/trace.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 using namespace DeepEye::Core;
 
+static_assert(sizeof(DeepEye_PartitionRecord) == 184,
+              "DeepEye_PartitionRecord layout is part of the C ABI");
+static_assert(sizeof(DeepEye_TraceStat) == 136,
+              "DeepEye_TraceStat layout is part of the C ABI");
+
+// Splits a newline-separated name list, skipping empty lines.
+static std::vector<std::string> SplitLines(const char *text) {
+  std::vector<std::string> lines;
+  std::string list = text ? text : "";
+  size_t start = 0;
+  while (start < list.size()) {
+    size_t end = list.find('\n', start);
+    if (end == std::string::npos)
+      end = list.size();
+    if (end > start)
+      lines.push_back(list.substr(start, end - start));
+    start = end + 1;
+  }
+  return lines;
+}
+
+static void FillRecord(const DeepEye::Protocols::PartitionInfo &p,
+                       DeepEye_PartitionRecord &rec) {
+  memset(&rec, 0, sizeof(rec));
+  size_t n = std::min(p.name.size(), sizeof(rec.name) - 1);
+  memcpy(rec.name, p.name.data(), n);
+  rec.lun = p.lun;
+  if (!p.parent.empty())
+    rec.flags |= DEEPEYE_PARTITION_LOGICAL;
+  rec.startLba = p.startLba;
+  rec.endLba = p.endLba;
+  rec.sizeInBytes = p.sizeInBytes;
+  rec.attributes = p.attributes;
+  memcpy(rec.typeGuid, p.typeGuid, sizeof(rec.typeGuid));
+  memcpy(rec.uniqueGuid, p.uniqueGuid, sizeof(rec.uniqueGuid));
+}
+
 DEEPEYE_API void *DeepEye_CreateTransport() { return new LibUsbTransport(); }
 
 DEEPEYE_API void DeepEye_DestroyTransport(void *transport) {
@@ -21,6 +64,46 @@ DEEPEYE_API void DeepEye_TransportClose(void *transport) {
   static_cast<ITransport *>(transport)->Close();
 }
 
+DEEPEYE_API void *DeepEye_CreateScenarioTransport(const char *scenarioPath,
+                                                  uint64_t bytesPerSecond) {
+  Scenario scenario;
+  std::string error;
+  if (!Scenario::LoadFile(scenarioPath, scenario, &error)) {
+    std::cerr << "[SCENARIO] " << error << std::endl;
+    return nullptr;
+  }
+  auto *transport = new ScenarioTransport(std::move(scenario));
+  transport->SetBandwidth(bytesPerSecond);
+  return static_cast<ITransport *>(transport);
+}
+
+DEEPEYE_API void *DeepEye_CreateNetTransport(const char *host, uint16_t port,
+                                             const char *token) {
+  auto *transport = new NetTransport(host, port);
+  if (token)
+    transport->SetToken(token);
+  return static_cast<ITransport *>(transport);
+}
+
+DEEPEYE_API bool DeepEye_ScenarioTransportCompleted(void *transport) {
+  auto *replay =
+      dynamic_cast<ScenarioTransport *>(static_cast<ITransport *>(transport));
+  return replay && replay->Completed();
+}
+
+DEEPEYE_API int DeepEye_ScenarioTransportGetError(void *transport,
+                                                  char *outBuffer,
+                                                  int bufferSize) {
+  auto *replay =
+      dynamic_cast<ScenarioTransport *>(static_cast<ITransport *>(transport));
+  std::string result = replay ? replay->Error() : std::string();
+  if (result.length() < (size_t)bufferSize) {
+    strncpy(outBuffer, result.c_str(), bufferSize);
+    return (int)result.length();
+  }
+  return -1;
+}
+
 DEEPEYE_API void *DeepEye_CreateEngine(void *transport) {
   return new ProtocolEngine(static_cast<ITransport *>(transport));
 }
@@ -38,11 +121,162 @@ DEEPEYE_API bool DeepEye_EngineDumpPartition(void *engine, const char *name,
   return static_cast<ProtocolEngine *>(engine)->DumpPartition(name, outPath);
 }
 
+DEEPEYE_API bool DeepEye_EngineDumpAllocated(void *engine, const char *name,
+                                             const char *outPath) {
+  return static_cast<ProtocolEngine *>(engine)->DumpAllocated(name, outPath);
+}
+
 DEEPEYE_API bool DeepEye_EngineFlashPartition(void *engine, const char *name,
                                               const char *inPath) {
   return static_cast<ProtocolEngine *>(engine)->FlashPartition(name, inPath);
 }
 
+DEEPEYE_API bool DeepEye_EngineErasePartition(void *engine, const char *name) {
+  return static_cast<ProtocolEngine *>(engine)->ErasePartition(name);
+}
+
+DEEPEYE_API bool DeepEye_EngineEraseRange(void *engine, const char *name,
+                                          uint64_t sectorOffset,
+                                          uint64_t sectorCount) {
+  return static_cast<ProtocolEngine *>(engine)->EraseRange(name, sectorOffset,
+                                                           sectorCount);
+}
+
+DEEPEYE_API void DeepEye_EngineSetUseDiscard(void *engine, bool enabled) {
+  static_cast<ProtocolEngine *>(engine)->SetUseDiscard(enabled);
+}
+
+// Builds the batch behind DeepEye_EngineReadBatch/WriteBatch.
+static bool MakeBatch(const char *names, const uint64_t *sectorOffsets,
+                      const uint64_t *sectorCounts, int count, uint8_t *buffer,
+                      std::vector<ProtocolEngine::SectorRequest> &batch) {
+  std::vector<std::string> lines = SplitLines(names);
+  if (count < 0 || lines.size() != (size_t)count)
+    return false;
+  for (int i = 0; i < count; ++i) {
+    batch.push_back({lines[i], sectorOffsets[i], sectorCounts[i], buffer});
+    buffer += sectorCounts[i] * 512;
+  }
+  return true;
+}
+
+DEEPEYE_API bool DeepEye_EngineReadBatch(void *engine, const char *names,
+                                        const uint64_t *sectorOffsets,
+                                        const uint64_t *sectorCounts,
+                                        int count, uint8_t *buffer) {
+  std::vector<ProtocolEngine::SectorRequest> batch;
+  return MakeBatch(names, sectorOffsets, sectorCounts, count, buffer, batch) &&
+         static_cast<ProtocolEngine *>(engine)->ReadBatch(batch);
+}
+
+DEEPEYE_API bool DeepEye_EngineWriteBatch(void *engine, const char *names,
+                                         const uint64_t *sectorOffsets,
+                                         const uint64_t *sectorCounts,
+                                         int count, const uint8_t *buffer) {
+  // WriteBatch only reads the buffers.
+  std::vector<ProtocolEngine::SectorRequest> batch;
+  return MakeBatch(names, sectorOffsets, sectorCounts, count,
+                   const_cast<uint8_t *>(buffer), batch) &&
+         static_cast<ProtocolEngine *>(engine)->WriteBatch(batch);
+}
+
+DEEPEYE_API void DeepEye_EngineGetBatchStats(void *engine, uint64_t *requests,
+                                            uint64_t *commands) {
+  const IoQueue::Stats &stats =
+      static_cast<ProtocolEngine *>(engine)->BatchStats();
+  *requests = stats.requests;
+  *commands = stats.commands;
+}
+
+DEEPEYE_API void DeepEye_EngineSetPipelineDepth(void *engine, uint32_t depth) {
+  static_cast<ProtocolEngine *>(engine)->SetPipelineDepth(depth);
+}
+
+DEEPEYE_API double DeepEye_EngineGetThroughput(void *engine) {
+  return static_cast<ProtocolEngine *>(engine)->Timeouts().BytesPerSecond();
+}
+
+DEEPEYE_API void DeepEye_EngineSetReadCache(void *engine,
+                                           uint32_t extentSectors,
+                                           uint32_t maxExtents) {
+  SectorCache::Options options;
+  options.extentSectors = extentSectors;
+  options.maxExtents = maxExtents;
+  static_cast<ProtocolEngine *>(engine)->SetReadCache(options);
+}
+
+DEEPEYE_API bool DeepEye_EngineBackupPartitions(void *engine,
+                                                const char *names,
+                                                const char *archivePath) {
+  auto *core = static_cast<ProtocolEngine *>(engine);
+  BackupArchiveWriter archive;
+  if (!archive.Open(archivePath))
+    return false;
+
+  for (const std::string &name : SplitLines(names))
+    if (!core->DumpPartition(name, archive))
+      return false;
+  return archive.Close();
+}
+
+DEEPEYE_API bool DeepEye_EngineStorePartitions(void *engine,
+                                               const char *names,
+                                               const char *storeRoot,
+                                               const char *device) {
+  auto *core = static_cast<ProtocolEngine *>(engine);
+  ChunkStore store;
+  if (!store.Open(storeRoot))
+    return false;
+  for (const std::string &name : SplitLines(names))
+    if (!core->DumpPartition(name, store, std::string(device) + "/" + name))
+      return false;
+  ChunkStoreStats stats = store.Stats();
+  std::cerr << "[BACKUP] Store holds " << stats.objects << " objects, dedup "
+            << stats.DedupRatio() << "x" << std::endl;
+  return store.Close();
+}
+
+DEEPEYE_API bool DeepEye_StoreRestoreObject(const char *storeRoot,
+                                            const char *object,
+                                            const char *outPath) {
+  ChunkStore store;
+  return store.Open(storeRoot) && store.Restore(object, outPath) &&
+         store.Close();
+}
+
+DEEPEYE_API bool DeepEye_StoreRemoveObject(const char *storeRoot,
+                                           const char *object) {
+  ChunkStore store;
+  return store.Open(storeRoot) && store.Remove(object) && store.Close();
+}
+
+DEEPEYE_API bool DeepEye_EngineRestorePartitions(void *engine,
+                                                 const char *names,
+                                                 const char *archivePath) {
+  auto *core = static_cast<ProtocolEngine *>(engine);
+  BackupArchiveReader archive;
+  if (!archive.Open(archivePath))
+    return false;
+  for (const std::string &name : SplitLines(names))
+    if (!core->FlashPartition(name, archive))
+      return false;
+  return true;
+}
+
+DEEPEYE_API bool DeepEye_ArchiveExtractPartition(const char *archivePath,
+                                                 const char *name,
+                                                 const char *outPath) {
+  BackupArchiveReader reader;
+  std::string error;
+  if (!reader.Open(archivePath))
+    return false;
+  if (!reader.ExtractPartition(name, outPath, 0, &error)) {
+    std::cerr << "[BACKUP] " << error << std::endl;
+    return false;
+  }
+  return true;
+}
+
 DEEPEYE_API int DeepEye_EngineGetPartitions(void *engine, char *outBuffer,
                                             int bufferSize) {
   auto partitions = static_cast<ProtocolEngine *>(engine)->GetPartitions();
@@ -57,3 +291,105 @@ DEEPEYE_API int DeepEye_EngineGetPartitions(void *engine, char *outBuffer,
   }
   return -1;
 }
+
+DEEPEYE_API int DeepEye_EngineRefreshPartitions(void *engine) {
+  return (int)static_cast<ProtocolEngine *>(engine)->GetPartitions().size();
+}
+
+DEEPEYE_API int DeepEye_EngineCopyPartitionRecords(
+    void *engine, DeepEye_PartitionRecord *records, int capacity) {
+  const auto &partitions =
+      static_cast<ProtocolEngine *>(engine)->CachedPartitions();
+  int total = (int)partitions.size();
+  if (records) {
+    int n = std::min(total, std::max(capacity, 0));
+    for (int i = 0; i < n; ++i)
+      FillRecord(partitions[i], records[i]);
+  }
+  return total;
+}
+
+DEEPEYE_API DeepEye_PartitionRecord *
+DeepEye_EngineGetPartitionRecords(void *engine, int *outCount) {
+  const auto &partitions =
+      static_cast<ProtocolEngine *>(engine)->CachedPartitions();
+  if (outCount)
+    *outCount = (int)partitions.size();
+  if (partitions.empty())
+    return nullptr;
+
+  auto *records = static_cast<DeepEye_PartitionRecord *>(
+      malloc(partitions.size() * sizeof(DeepEye_PartitionRecord)));
+  if (!records) {
+    if (outCount)
+      *outCount = 0;
+    return nullptr;
+  }
+  for (size_t i = 0; i < partitions.size(); ++i)
+    FillRecord(partitions[i], records[i]);
+  return records;
+}
+
+DEEPEYE_API void DeepEye_FreePartitionRecords(DeepEye_PartitionRecord *records) {
+  free(records);
+}
+
+DEEPEYE_API bool
+DeepEye_EngineWritePartitionRecords(void *engine,
+                                    const DeepEye_PartitionRecord *records,
+                                    int count) {
+  std::vector<DeepEye::Protocols::PartitionInfo> partitions;
+  for (int i = 0; i < count; ++i) {
+    const DeepEye_PartitionRecord &rec = records[i];
+    if (rec.flags & DEEPEYE_PARTITION_LOGICAL)
+      continue;
+    partitions.emplace_back();
+    DeepEye::Protocols::PartitionInfo &p = partitions.back();
+    p.name.assign(rec.name, strnlen(rec.name, sizeof(rec.name)));
+    p.startLba = rec.startLba;
+    p.endLba = rec.endLba;
+    p.attributes = rec.attributes;
+    memcpy(p.typeGuid, rec.typeGuid, sizeof(p.typeGuid));
+    memcpy(p.uniqueGuid, rec.uniqueGuid, sizeof(p.uniqueGuid));
+  }
+  return static_cast<ProtocolEngine *>(engine)->WritePartitionTable(
+      partitions);
+}
+
+DEEPEYE_API void DeepEye_TraceSetEnabled(bool enabled) {
+  Tracer::SetEnabled(enabled);
+}
+
+DEEPEYE_API void DeepEye_TraceReset() { Tracer::Reset(); }
+
+DEEPEYE_API int DeepEye_TraceCopyStats(DeepEye_TraceStat *stats,
+                                       int capacity) {
+  std::vector<TraceStat> snapshot = Tracer::Snapshot();
+  int total = (int)snapshot.size();
+  if (stats) {
+    int n = std::min(total, std::max(capacity, 0));
+    for (int i = 0; i < n; ++i) {
+      const TraceStat &s = snapshot[i];
+      DeepEye_TraceStat &rec = stats[i];
+      memset(&rec, 0, sizeof(rec));
+      strncpy(rec.name, s.name.c_str(), sizeof(rec.name) - 1);
+      strncpy(rec.category, TraceCategoryName(s.category),
+              sizeof(rec.category) - 1);
+      rec.count = s.count;
+      rec.bytes = s.bytes;
+      rec.totalNs = s.totalNs;
+      rec.minNs = s.minNs;
+      rec.maxNs = s.maxNs;
+      rec.p50Ns = s.p50Ns;
+      rec.p90Ns = s.p90Ns;
+      rec.p99Ns = s.p99Ns;
+      rec.bytesPerSecond =
+          s.totalNs ? (double)s.bytes * 1e9 / (double)s.totalNs : 0.0;
+    }
+  }
+  return total;
+}
+
+DEEPEYE_API bool DeepEye_TraceWriteChrome(const char *path) {
+  return Tracer::WriteChromeTrace(path);
+}
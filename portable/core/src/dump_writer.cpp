@@ -0,0 +1,416 @@
+#include "../include/dump_writer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define DEEPEYE_POSIX_IO 1
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) &&           \
+    defined(__NR_io_uring_register)
+#define DEEPEYE_IO_URING 1
+#endif
+#endif
+
+namespace DeepEye {
+namespace Core {
+
+namespace {
+
+uint8_t *AlignedAlloc(size_t size) {
+#ifdef _WIN32
+  return static_cast<uint8_t *>(_aligned_malloc(size, DumpWriter::kAlignment));
+#else
+  void *p = nullptr;
+  if (posix_memalign(&p, DumpWriter::kAlignment, size) != 0)
+    return nullptr;
+  return static_cast<uint8_t *>(p);
+#endif
+}
+
+void AlignedFree(uint8_t *p) {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+size_t AlignUp(size_t n) {
+  return (n + DumpWriter::kAlignment - 1) & ~(DumpWriter::kAlignment - 1);
+}
+
+} // namespace
+
+#ifdef DEEPEYE_IO_URING
+// Raw io_uring: the kernel UAPI is enough for one file and a fixed set of
+// registered buffers, so liburing is not required.
+struct DumpWriter::Ring {
+  int fd = -1;
+  bool fixedBuffers = false;
+  void *sqMap = MAP_FAILED, *cqMap = MAP_FAILED, *sqeMap = MAP_FAILED;
+  size_t sqMapLen = 0, cqMapLen = 0, sqeMapLen = 0;
+  unsigned *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+  unsigned *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+  io_uring_sqe *sqes = nullptr;
+  io_uring_cqe *cqes = nullptr;
+  std::vector<iovec> iovecs; // per slot, for IORING_OP_WRITEV
+};
+#else
+struct DumpWriter::Ring {};
+#endif
+
+DumpWriter::DumpWriter()
+    : _backend(Backend::Buffered), _direct(false), _fd(-1), _file(nullptr),
+      _ring(nullptr), _bufferSize(0), _current(-1), _inFlight(0), _size(0),
+      _padded(false) {}
+
+DumpWriter::~DumpWriter() { Close(); }
+
+bool DumpWriter::Fail(const std::string &message) {
+  if (_error.empty()) {
+    _error = message;
+    std::cerr << "[DUMP] " << message << std::endl;
+  }
+  return false;
+}
+
+bool DumpWriter::Open(const std::string &path, uint64_t expectedSize,
+                      const Options &options) {
+  Close();
+  _error.clear();
+  _size = 0;
+  _padded = false;
+  _current = -1;
+  _bufferSize = options.bufferSize;
+
+#ifdef DEEPEYE_POSIX_IO
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_CLOEXEC
+  flags |= O_CLOEXEC;
+#endif
+  _direct = false;
+#ifdef O_DIRECT
+  if (options.direct) {
+    _fd = open(path.c_str(), flags | O_DIRECT, 0644);
+    _direct = _fd >= 0;
+  }
+#endif
+  if (_fd < 0)
+    _fd = open(path.c_str(), flags, 0644);
+  if (_fd < 0)
+    return Fail("cannot create " + path + ": " + strerror(errno));
+
+#ifdef __linux__
+  // Best effort: keeps the dump contiguous and fails early on a full disk
+  // only where the filesystem supports it.
+  if (options.preallocate && expectedSize > 0 &&
+      fallocate(_fd, 0, 0, (off_t)expectedSize) != 0 && errno == ENOSPC) {
+    close(_fd);
+    _fd = -1;
+    unlink(path.c_str());
+    return Fail("not enough space for " + std::to_string(expectedSize) +
+                " bytes at " + path);
+  }
+#else
+  (void)expectedSize;
+#endif
+
+  unsigned depth = options.ioUring ? std::max(options.queueDepth, 1u) : 1;
+  _slots.resize(depth);
+  for (Slot &slot : _slots) {
+    slot = Slot();
+    slot.data = AlignedAlloc(AlignUp(_bufferSize));
+    if (!slot.data) {
+      Close();
+      return Fail("out of memory for dump buffers");
+    }
+  }
+
+  _backend = Backend::Pwrite;
+  if (options.ioUring && SetupRing(depth))
+    _backend = Backend::IoUring;
+  return true;
+#else
+  (void)expectedSize;
+  (void)options;
+  auto *file = new std::ofstream(path, std::ios::binary | std::ios::trunc);
+  if (!*file) {
+    delete file;
+    return Fail("cannot create " + path);
+  }
+  _file = file;
+  _direct = false;
+  _backend = Backend::Buffered;
+  _slots.resize(1);
+  _slots[0] = Slot();
+  _slots[0].data = AlignedAlloc(AlignUp(_bufferSize));
+  return _slots[0].data != nullptr || Fail("out of memory for dump buffers");
+#endif
+}
+
+uint8_t *DumpWriter::AcquireBuffer() {
+  if (!_error.empty())
+    return nullptr;
+  if (_current >= 0)
+    return _slots[_current].data;
+  for (;;) {
+    for (size_t i = 0; i < _slots.size(); ++i) {
+      if (!_slots[i].busy) {
+        _current = (int)i;
+        return _slots[i].data;
+      }
+    }
+    if (!ReapOne())
+      return nullptr;
+  }
+}
+
+bool DumpWriter::Commit(size_t length) {
+  if (!_error.empty())
+    return false;
+  if (_current < 0 || length > _bufferSize)
+    return Fail("commit without an acquired buffer");
+  if (_padded)
+    return Fail("only the final chunk may be unaligned");
+
+  Slot &slot = _slots[_current];
+  slot.offset = _size;
+  slot.length = length;
+  _size += length;
+  if (_direct && length % kAlignment) {
+    // O_DIRECT needs whole blocks; Close() trims the padding.
+    size_t padded = AlignUp(length);
+    memset(slot.data + length, 0, padded - length);
+    slot.length = padded;
+    _padded = true;
+  }
+
+  int index = _current;
+  _current = -1;
+  if (_backend == Backend::IoUring)
+    return SubmitWrite(index);
+  return WriteAll(slot.data, slot.length, slot.offset);
+}
+
+bool DumpWriter::WriteAll(const uint8_t *data, size_t length,
+                          uint64_t offset) {
+#ifdef DEEPEYE_POSIX_IO
+  while (length > 0) {
+    ssize_t n = pwrite(_fd, data, length, (off_t)offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return Fail(std::string("write failed: ") + strerror(errno));
+    data += n;
+    length -= (size_t)n;
+    offset += (uint64_t)n;
+  }
+  return true;
+#else
+  (void)offset;
+  auto *file = static_cast<std::ofstream *>(_file);
+  file->write(reinterpret_cast<const char *>(data), length);
+  return (bool)*file || Fail("write failed");
+#endif
+}
+
+bool DumpWriter::Close() {
+  // Drain even after an error: the kernel may still be reading the buffers.
+  while (_inFlight > 0) {
+    unsigned before = _inFlight;
+    ReapOne();
+    if (_inFlight == before)
+      break; // the ring itself failed
+  }
+  bool ok = _error.empty();
+  DestroyRing();
+
+#ifdef DEEPEYE_POSIX_IO
+  if (_fd >= 0) {
+    // Drop preallocated space and O_DIRECT tail padding.
+    if (ftruncate(_fd, (off_t)_size) != 0)
+      ok = Fail(std::string("truncate failed: ") + strerror(errno));
+    if (close(_fd) != 0)
+      ok = Fail(std::string("close failed: ") + strerror(errno));
+    _fd = -1;
+  }
+#else
+  if (_file) {
+    auto *file = static_cast<std::ofstream *>(_file);
+    file->close();
+    ok = ok && !file->fail();
+    delete file;
+    _file = nullptr;
+  }
+#endif
+  FreeSlots();
+  return ok;
+}
+
+void DumpWriter::FreeSlots() {
+  for (Slot &slot : _slots)
+    AlignedFree(slot.data);
+  _slots.clear();
+  _current = -1;
+  _inFlight = 0;
+}
+
+#ifdef DEEPEYE_IO_URING
+
+bool DumpWriter::SetupRing(unsigned depth) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+  if (fd < 0)
+    return false; // ENOSYS, or EPERM under seccomp (Android apps)
+
+  std::unique_ptr<Ring> ring(new Ring());
+  ring->fd = fd;
+  ring->sqMapLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cqMapLen =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single)
+    ring->sqMapLen = ring->cqMapLen =
+        std::max(ring->sqMapLen, ring->cqMapLen);
+
+  ring->sqMap = mmap(nullptr, ring->sqMapLen, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  ring->cqMap = single ? ring->sqMap
+                       : mmap(nullptr, ring->cqMapLen, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, fd,
+                              IORING_OFF_CQ_RING);
+  ring->sqeMapLen = params.sq_entries * sizeof(io_uring_sqe);
+  ring->sqeMap = mmap(nullptr, ring->sqeMapLen, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  _ring = ring.release();
+  if (_ring->sqMap == MAP_FAILED || _ring->cqMap == MAP_FAILED ||
+      _ring->sqeMap == MAP_FAILED) {
+    DestroyRing();
+    return false;
+  }
+
+  auto *sq = static_cast<uint8_t *>(_ring->sqMap);
+  auto *cq = static_cast<uint8_t *>(_ring->cqMap);
+  _ring->sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  _ring->sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  _ring->sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  _ring->cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  _ring->cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  _ring->cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  _ring->sqes = static_cast<io_uring_sqe *>(_ring->sqeMap);
+  _ring->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  // Registered buffers skip the per-write page pinning; RLIMIT_MEMLOCK can
+  // refuse them, in which case plain WRITEV does the same job.
+  _ring->iovecs.resize(_slots.size());
+  for (size_t i = 0; i < _slots.size(); ++i)
+    _ring->iovecs[i] = {_slots[i].data, AlignUp(_bufferSize)};
+  _ring->fixedBuffers =
+      syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+              _ring->iovecs.data(), (unsigned)_ring->iovecs.size()) == 0;
+  return true;
+}
+
+void DumpWriter::DestroyRing() {
+  if (!_ring)
+    return;
+  if (_ring->sqeMap != MAP_FAILED)
+    munmap(_ring->sqeMap, _ring->sqeMapLen);
+  if (_ring->cqMap != MAP_FAILED && _ring->cqMap != _ring->sqMap)
+    munmap(_ring->cqMap, _ring->cqMapLen);
+  if (_ring->sqMap != MAP_FAILED)
+    munmap(_ring->sqMap, _ring->sqMapLen);
+  if (_ring->fd >= 0)
+    close(_ring->fd); // also unregisters the buffers
+  delete _ring;
+  _ring = nullptr;
+}
+
+bool DumpWriter::SubmitWrite(int index) {
+  Slot &slot = _slots[index];
+  // Single submitter: the tail is ours, the kernel only reads it.
+  unsigned tail = *_ring->sqTail;
+  unsigned idx = tail & *_ring->sqMask;
+  io_uring_sqe &sqe = _ring->sqes[idx];
+  memset(&sqe, 0, sizeof(sqe));
+  sqe.fd = _fd;
+  sqe.off = slot.offset;
+  sqe.user_data = (uint64_t)index;
+  if (_ring->fixedBuffers) {
+    sqe.opcode = IORING_OP_WRITE_FIXED;
+    sqe.addr = (uint64_t)(uintptr_t)slot.data;
+    sqe.len = (uint32_t)slot.length;
+    sqe.buf_index = (uint16_t)index;
+  } else {
+    _ring->iovecs[index].iov_len = slot.length;
+    sqe.opcode = IORING_OP_WRITEV;
+    sqe.addr = (uint64_t)(uintptr_t)&_ring->iovecs[index];
+    sqe.len = 1;
+  }
+  _ring->sqArray[idx] = idx;
+  __atomic_store_n(_ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+  slot.busy = true;
+  ++_inFlight;
+  while (syscall(__NR_io_uring_enter, _ring->fd, 1, 0, 0, nullptr, 0) < 0) {
+    if (errno != EINTR && errno != EAGAIN) {
+      slot.busy = false;
+      --_inFlight;
+      return Fail(std::string("io_uring submit failed: ") + strerror(errno));
+    }
+  }
+  return true;
+}
+
+bool DumpWriter::ReapOne() {
+  if (!_ring || _inFlight == 0)
+    return Fail("no write in flight");
+
+  unsigned head = *_ring->cqHead;
+  while (head == __atomic_load_n(_ring->cqTail, __ATOMIC_ACQUIRE)) {
+    if (syscall(__NR_io_uring_enter, _ring->fd, 0, 1, IORING_ENTER_GETEVENTS,
+                nullptr, 0) < 0 &&
+        errno != EINTR)
+      return Fail(std::string("io_uring wait failed: ") + strerror(errno));
+  }
+  io_uring_cqe cqe = _ring->cqes[head & *_ring->cqMask];
+  __atomic_store_n(_ring->cqHead, head + 1, __ATOMIC_RELEASE);
+
+  Slot &slot = _slots[(size_t)cqe.user_data];
+  slot.busy = false;
+  --_inFlight;
+  if (cqe.res < 0)
+    return Fail(std::string("write failed: ") + strerror(-cqe.res));
+  // Short completions are rare on regular files; finish them inline.
+  size_t done = (size_t)cqe.res;
+  if (done < slot.length)
+    return WriteAll(slot.data + done, slot.length - done, slot.offset + done);
+  return true;
+}
+
+#else
+
+bool DumpWriter::SetupRing(unsigned) { return false; }
+void DumpWriter::DestroyRing() {}
+bool DumpWriter::SubmitWrite(int) { return Fail("io_uring unavailable"); }
+bool DumpWriter::ReapOne() { return Fail("no write in flight"); }
+
+#endif // DEEPEYE_IO_URING
+
+} // namespace Core
+} // namespace DeepEye
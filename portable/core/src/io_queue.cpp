@@ -0,0 +1,95 @@
+#include "../include/io_queue.h"
+#include <algorithm>
+#include <set>
+
+namespace DeepEye {
+namespace Core {
+
+namespace {
+
+// Extends the request's previous slice when this one continues it.
+void AddSlice(IoQueue::Run &run, const IoQueue::Slice &slice) {
+  for (auto it = run.slices.rbegin(); it != run.slices.rend(); ++it) {
+    if (it->request == slice.request &&
+        it->requestSector + it->count == slice.requestSector &&
+        it->runSector + it->count == slice.runSector) {
+      it->count += slice.count;
+      return;
+    }
+  }
+  run.slices.push_back(slice);
+}
+
+} // namespace
+
+size_t IoQueue::Add(uint32_t lun, uint64_t lba, uint64_t count) {
+  _requests.push_back({lun, lba, count});
+  return _requests.size() - 1;
+}
+
+std::vector<IoQueue::Run> IoQueue::Plan(bool write,
+                                        uint64_t maxSectors) const {
+  maxSectors = std::max<uint64_t>(maxSectors, 1);
+
+  // Every request starts and ends one boundary; between two boundaries the
+  // same requests cover every sector.
+  struct Boundary {
+    uint32_t lun;
+    uint64_t lba;
+    bool start;
+    size_t request;
+  };
+  std::vector<Boundary> bounds;
+  bounds.reserve(_requests.size() * 2);
+  for (size_t i = 0; i < _requests.size(); ++i) {
+    const Request &r = _requests[i];
+    if (r.count == 0)
+      continue;
+    bounds.push_back({r.lun, r.lba, true, i});
+    bounds.push_back({r.lun, r.lba + r.count, false, i});
+  }
+  std::sort(bounds.begin(), bounds.end(),
+            [](const Boundary &a, const Boundary &b) {
+              return a.lun != b.lun ? a.lun < b.lun : a.lba < b.lba;
+            });
+
+  std::vector<Run> runs;
+  std::set<size_t> covering; // request indices, oldest first
+  for (size_t i = 0; i < bounds.size();) {
+    const uint32_t lun = bounds[i].lun;
+    uint64_t pos = bounds[i].lba;
+    for (; i < bounds.size() && bounds[i].lun == lun && bounds[i].lba == pos;
+         ++i) {
+      if (bounds[i].start)
+        covering.insert(bounds[i].request);
+      else
+        covering.erase(bounds[i].request);
+    }
+    // A covering request ends at a later boundary on the same LUN.
+    if (covering.empty())
+      continue;
+
+    for (uint64_t left = bounds[i].lba - pos; left > 0;) {
+      if (runs.empty() || runs.back().lun != lun ||
+          runs.back().lba + runs.back().count != pos ||
+          runs.back().count == maxSectors)
+        runs.push_back({lun, pos, 0, {}});
+      Run &run = runs.back();
+      uint64_t n = std::min(left, maxSectors - run.count);
+      auto addFrom = [&](size_t request) {
+        AddSlice(run, {request, pos - _requests[request].lba, run.count, n});
+      };
+      if (write)
+        addFrom(*covering.rbegin());
+      else
+        std::for_each(covering.begin(), covering.end(), addFrom);
+      run.count += n;
+      pos += n;
+      left -= n;
+    }
+  }
+  return runs;
+}
+
+} // namespace Core
+} // namespace DeepEye
@@ -1,12 +1,15 @@
 #include "../../include/boot_patcher.h"
-#include <cstdlib>
 #include <iostream>
 
+#ifdef HAS_RAMDISK_CODEC
+#include "ramdisk_codec.h"
+#endif
+
 namespace DeepEye {
 namespace Core {
 
 BootImagePatcher::BootImagePatcher(const std::string &workDir)
-    : _workDir(workDir) {}
+    : _workDir(workDir), _extracted(false) {}
 
 bool BootImagePatcher::Patch(const std::string &inputPath,
                              const std::string &outputPath,
@@ -18,8 +21,9 @@ bool BootImagePatcher::Patch(const std::string &inputPath,
   if (!ExtractBoot(inputPath))
     return false;
 
-  // In a real implementation, we'd modify the ramdisk/kernel here
-  // using the specific patcher binary instructions.
+  // In a real implementation, we'd modify the ramdisk/kernel here through
+  // _image.ramdisk.mutable_bytes(); untouched components are written
+  // straight from the input mapping.
   std::cout << "[PATCHER] Injecting root hooks into ramdisk..." << std::endl;
 
   return RepackBoot(outputPath);
@@ -27,20 +31,37 @@ bool BootImagePatcher::Patch(const std::string &inputPath,
 
 bool BootImagePatcher::ExtractBoot(const std::string &inputPath) {
   std::cout << "[PATCHER] Unpacking boot image: " << inputPath << std::endl;
-  // Native call to ./magiskboot unpack boot.img
+  _inputPath = inputPath;
+  _extracted = _image.load(inputPath, deepeye::BootImage::LoadMode::Mapped);
+  if (!_extracted) {
+    std::cerr << "[PATCHER] Not a valid boot/vendor_boot image." << std::endl;
+    return false;
+  }
+
+  std::cout << "[PATCHER] Header v" << _image.version
+            << (_image.kind == deepeye::BootImage::Kind::VendorBoot
+                    ? " (vendor_boot)"
+                    : "")
+            << ", kernel " << _image.kernel.size() << " B, ramdisk "
+            << _image.ramdisk.size() << " B" << std::endl;
+#ifdef HAS_RAMDISK_CODEC
+  std::cout << "[PATCHER] Ramdisk compression: "
+            << deepeye::ramdisk_format_name(deepeye::detect_ramdisk_format(
+                   _image.ramdisk.data(), _image.ramdisk.size()))
+            << std::endl;
+#endif
   return true;
 }
 
 bool BootImagePatcher::RepackBoot(const std::string &outputPath) {
+  if (!_extracted)
+    return false;
   std::cout << "[PATCHER] Repacking patched image to: " << outputPath
             << std::endl;
-  // Native call to ./magiskboot repack new-boot.img
-  return true;
-}
-
-bool BootImagePatcher::RunCommand(const std::string &cmd) {
-  // Secure execution of patcher binaries from private app storage
-  return std::system(cmd.c_str()) == 0;
+  // Truncating the file we are mapped from would fault the views mid-write.
+  if (outputPath == _inputPath)
+    _image.materialize();
+  return _image.save(outputPath);
 }
 
 } // namespace Core
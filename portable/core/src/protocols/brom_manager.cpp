@@ -1,4 +1,6 @@
 #include "../../include/brom_proto.h"
+#include "../../include/trace.h"
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 
@@ -8,6 +10,7 @@ namespace Protocols {
 BromManager::BromManager(Core::ITransport *transport) : _transport(transport) {}
 
 bool BromManager::Handshake() {
+  Core::TraceSpan span("brom.handshake", Core::TraceCategory::Da);
   uint8_t handshake[] = {0xA1, 0xA2, 0xA3, 0xA4};
   for (uint8_t b : handshake) {
     if (_transport->Send(&b, 1, 100) != 1)
@@ -20,21 +23,25 @@ bool BromManager::Handshake() {
 }
 
 bool BromManager::SendDA(const std::vector<uint8_t> &daData) {
-  std::cout << "[BROM] Injecting Download Agent (" << daData.size()
-            << " bytes)..." << std::endl;
+  return SendDA(daData.data(), daData.size());
+}
+
+bool BromManager::SendDA(const uint8_t *daData, size_t length) {
+  std::cout << "[BROM] Injecting Download Agent (" << length << " bytes)..."
+            << std::endl;
+  Core::TraceSpan span("brom.send_da", Core::TraceCategory::Da, length);
 
   if (!EchoCmd(0xD7))
     return false; // Write DA command
 
   uint32_t addr = 0x40000000; // Common DA load address
-  uint32_t size = daData.size();
+  uint32_t size = length;
 
   _transport->Send((uint8_t *)&addr, 4, 1000);
   _transport->Send((uint8_t *)&size, 4, 1000);
   _transport->Send((uint8_t *)&size, 4, 1000); // Sig size or secondary size
 
-  return _transport->Send(daData.data(), daData.size(), 5000) ==
-         (int)daData.size();
+  return _transport->Send(daData, length, 5000) == (int)length;
 }
 
 bool BromManager::JumpDA(uint32_t addr) {
@@ -59,34 +66,51 @@ bool BromManager::WriteReg32(uint32_t addr, uint32_t val) {
 
 bool BromManager::DaReadPartition(const std::string &name, uint64_t offset,
                                   uint64_t count, std::vector<uint8_t> &out) {
+  out.resize(count * 512);
+  return DaReadPartition(name, offset, count, out.data());
+}
+
+bool BromManager::DaReadPartition(const std::string &name, uint64_t offset,
+                                  uint64_t count, uint8_t *out,
+                                  uint32_t timeoutMs) {
   std::cout << "[DA] Reading " << name << " sector " << offset << "..."
             << std::endl;
+  Core::TraceSpan span("da.read", Core::TraceCategory::Da, count * 512);
   // MTK DA-specific protocol would go here (Cmd 0x??)
   uint8_t readCmd[16] = {0xBD, 0x01}; // Mock DA Read
   memcpy(readCmd + 2, &offset, 8);
   memcpy(readCmd + 10, &count, 4);
 
   _transport->Send(readCmd, 16, 1000);
-  out.resize(count * 512);
-  return _transport->Receive(out.data(), out.size(), 5000) == (int)out.size();
+  size_t expectedBytes = count * 512;
+  return _transport->Receive(out, expectedBytes, timeoutMs) ==
+         (int)expectedBytes;
 }
 
 bool BromManager::DaWritePartition(const std::string &name, uint64_t offset,
                                    const std::vector<uint8_t> &data) {
+  return DaWritePartition(name, offset, data.data(), data.size());
+}
+
+bool BromManager::DaWritePartition(const std::string &name, uint64_t offset,
+                                   const uint8_t *data, size_t length,
+                                   uint32_t timeoutMs) {
   std::cout << "[DA] Writing to " << name << " at sector " << offset << "..."
             << std::endl;
+  Core::TraceSpan span("da.write", Core::TraceCategory::Da, length);
   uint8_t writeCmd[16] = {0xD0, 0x02}; // Mock DA Write
-  uint32_t count = data.size() / 512;
+  uint32_t count = length / 512;
   memcpy(writeCmd + 2, &offset, 8);
   memcpy(writeCmd + 10, &count, 4);
 
   _transport->Send(writeCmd, 16, 1000);
-  return _transport->Send(data.data(), data.size(), 10000) == (int)data.size();
+  return _transport->Send(data, length, timeoutMs) == (int)length;
 }
 
 bool BromManager::DaErasePartition(const std::string &name) {
   std::cout << "[DA] Erasing MediaTek partition: " << name << "..."
             << std::endl;
+  Core::TraceSpan span("da.erase", Core::TraceCategory::Da);
   uint8_t eraseCmd[16] = {0xBD, 0x03}; // Mock DA Erase
   // Length/Offset would normally be needed for partial erase,
   // but here we assume full partition erase by name.
@@ -97,6 +121,28 @@ bool BromManager::DaErasePartition(const std::string &name) {
          status == 0x5A; // 0x5A = DA_ACK
 }
 
+bool BromManager::DaEraseRange(const std::string &name, uint64_t offset,
+                               uint64_t count) {
+  std::cout << "[DA] Erasing " << name << " sectors " << offset << "+"
+            << count << "..." << std::endl;
+  Core::TraceSpan span("da.erase", Core::TraceCategory::Da, count * 512);
+  // The count field is 32 bits; split larger ranges.
+  while (count > 0) {
+    uint32_t n = (uint32_t)std::min<uint64_t>(count, 0xFFFFFFFFu);
+    uint8_t eraseCmd[16] = {0xBD, 0x03}; // Mock DA Erase
+    memcpy(eraseCmd + 2, &offset, 8);
+    memcpy(eraseCmd + 10, &n, 4);
+    _transport->Send(eraseCmd, 16, 1000);
+
+    uint8_t status = 0;
+    if (_transport->Receive(&status, 1, 5000) != 1 || status != 0x5A)
+      return false;
+    offset += n;
+    count -= n;
+  }
+  return true;
+}
+
 bool BromManager::EchoCmd(uint8_t cmd) {
   if (_transport->Send(&cmd, 1, 100) != 1)
     return false;
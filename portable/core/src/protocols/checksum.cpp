@@ -0,0 +1,153 @@
+#include "../../include/checksum.h"
+#include <cstring>
+
+namespace DeepEye {
+namespace Protocols {
+
+namespace {
+
+// Slice-by-8 tables: table[k][b] is the CRC of byte b followed by k zeros.
+struct Crc32Tables {
+  uint32_t table[8][256];
+
+  Crc32Tables() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k)
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+      for (int k = 1; k < 8; ++k)
+        table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+  }
+};
+
+const Crc32Tables &Tables() {
+  static const Crc32Tables tables;
+  return tables;
+}
+
+inline uint32_t Rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+const uint32_t kSha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+} // namespace
+
+uint32_t Crc32::Compute(const uint8_t *data, size_t length, uint32_t crc) {
+  const auto &t = Tables().table;
+  crc = ~crc;
+  while (length >= 8) {
+    uint32_t lo = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 |
+                         (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+    crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^
+          t[4][lo >> 24] ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^
+          t[0][data[7]];
+    data += 8;
+    length -= 8;
+  }
+  while (length--)
+    crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+Sha256::Sha256() : _length(0), _used(0) {
+  static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                   0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                   0x1f83d9ab, 0x5be0cd19};
+  memcpy(_state, init, sizeof(_state));
+}
+
+void Sha256::Transform(const uint8_t *block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i)
+    w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+           (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+  for (int i = 16; i < 64; ++i) {
+    uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+  uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+  for (int i = 0; i < 64; ++i) {
+    uint32_t s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + kSha256K[i] + w[i];
+    uint32_t s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  _state[0] += a;
+  _state[1] += b;
+  _state[2] += c;
+  _state[3] += d;
+  _state[4] += e;
+  _state[5] += f;
+  _state[6] += g;
+  _state[7] += h;
+}
+
+void Sha256::Update(const uint8_t *data, size_t length) {
+  _length += length;
+  if (_used) {
+    size_t n = length < 64 - _used ? length : 64 - _used;
+    memcpy(_block + _used, data, n);
+    _used += n;
+    data += n;
+    length -= n;
+    if (_used < 64)
+      return;
+    Transform(_block);
+    _used = 0;
+  }
+  for (; length >= 64; data += 64, length -= 64)
+    Transform(data);
+  memcpy(_block, data, length);
+  _used = length;
+}
+
+void Sha256::Final(uint8_t digest[kDigestSize]) {
+  uint64_t bits = _length * 8;
+  uint8_t pad[72] = {0x80};
+  size_t padLen = (_used < 56 ? 56 : 120) - _used;
+  for (int i = 0; i < 8; ++i)
+    pad[padLen + i] = (uint8_t)(bits >> (56 - 8 * i));
+  Update(pad, padLen + 8);
+  for (int i = 0; i < 8; ++i) {
+    digest[4 * i] = (uint8_t)(_state[i] >> 24);
+    digest[4 * i + 1] = (uint8_t)(_state[i] >> 16);
+    digest[4 * i + 2] = (uint8_t)(_state[i] >> 8);
+    digest[4 * i + 3] = (uint8_t)_state[i];
+  }
+}
+
+void Sha256::Compute(const uint8_t *data, size_t length,
+                     uint8_t digest[kDigestSize]) {
+  Sha256 ctx;
+  ctx.Update(data, length);
+  ctx.Final(digest);
+}
+
+} // namespace Protocols
+} // namespace DeepEye
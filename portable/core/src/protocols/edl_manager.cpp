@@ -1,5 +1,6 @@
 #include "../../include/edl_proto.h"
 #include "../../include/firehose.h"
+#include "../../include/trace.h"
 #include <cstring>
 #include <iostream>
 
@@ -10,6 +11,7 @@ EdlManager::EdlManager(Core::ITransport *transport) : _transport(transport) {}
 
 bool EdlManager::ConnectSahara() {
   std::cout << "[EDL] Initiating Sahara Handshake..." << std::endl;
+  Core::TraceSpan span("sahara.handshake", Core::TraceCategory::Sahara);
 
   SaharaCommand cmd;
   std::vector<uint8_t> data;
@@ -38,12 +40,16 @@ bool EdlManager::SendProgrammer(const std::vector<uint8_t> &data) {
 }
 
 bool EdlManager::FirehoseHandshake() {
+  Core::TraceSpan span("firehose.configure", Core::TraceCategory::Firehose);
   std::string config = FirehoseClient::CreateConfigureXml();
   if (!SendXmlCommand(config))
     return false;
 
   std::string resp = ReceiveXmlResponse();
   auto parsed = FirehoseClient::ParseResponse(resp);
+  // The configure above advertised ZlpAwareHost="1".
+  if (parsed.success)
+    _transport->SetZlpAware(true);
   return parsed.success;
 }
 
@@ -52,22 +58,31 @@ bool EdlManager::SendXmlCommand(const std::string &xml) {
 }
 
 std::string EdlManager::ReceiveXmlResponse() {
+  Core::TraceSpan span("firehose.response", Core::TraceCategory::Firehose);
   uint8_t buffer[4096];
   memset(buffer, 0, sizeof(buffer));
   int read = _transport->Receive(buffer, sizeof(buffer), 5000);
   return (read > 0) ? std::string((char *)buffer, read) : "";
 }
 
-bool EdlManager::ReadPartition(const std::string &name, uint64_t offset,
-                               uint64_t count, std::vector<uint8_t> &out) {
-  std::string cmd = FirehoseClient::CreateReadXml(name, offset, count);
+bool EdlManager::ReadPartition(const std::string &name, uint32_t lun,
+                               uint64_t offset, uint64_t count,
+                               std::vector<uint8_t> &out) {
+  out.resize(count * 512);
+  return ReadPartition(name, lun, offset, count, out.data());
+}
+
+bool EdlManager::ReadPartition(const std::string &name, uint32_t lun,
+                               uint64_t offset, uint64_t count, uint8_t *out,
+                               uint32_t timeoutMs) {
+  Core::TraceSpan span("firehose.read", Core::TraceCategory::Firehose,
+                       count * 512);
+  std::string cmd = FirehoseClient::CreateReadXml(name, offset, count, lun);
   if (!SendXmlCommand(cmd))
     return false;
 
   size_t expectedBytes = count * 512;
-  out.resize(expectedBytes);
-
-  int received = _transport->Receive(out.data(), expectedBytes, 10000);
+  int received = _transport->Receive(out, expectedBytes, timeoutMs);
   if (received != (int)expectedBytes)
     return false;
 
@@ -75,24 +90,46 @@ bool EdlManager::ReadPartition(const std::string &name, uint64_t offset,
   return FirehoseClient::ParseResponse(finalResp).success;
 }
 
-bool EdlManager::WritePartition(const std::string &name, uint64_t offset,
+bool EdlManager::WritePartition(const std::string &name, uint32_t lun,
+                                uint64_t offset,
                                 const std::vector<uint8_t> &data) {
-  uint64_t count = data.size() / 512;
-  std::string cmd = FirehoseClient::CreateWriteXml(name, offset, count);
+  return WritePartition(name, lun, offset, data.data(), data.size());
+}
+
+bool EdlManager::WritePartition(const std::string &name, uint32_t lun,
+                                uint64_t offset, const uint8_t *data,
+                                size_t length, uint32_t timeoutMs) {
+  Core::TraceSpan span("firehose.program", Core::TraceCategory::Firehose,
+                       length);
+  uint64_t count = length / 512;
+  std::string cmd = FirehoseClient::CreateWriteXml(name, offset, count, lun);
   if (!SendXmlCommand(cmd))
     return false;
 
-  int sent = _transport->Send(data.data(), data.size(), 10000);
-  if (sent != (int)data.size())
+  int sent = _transport->Send(data, length, timeoutMs);
+  if (sent != (int)length)
     return false;
 
   std::string finalResp = ReceiveXmlResponse();
   return FirehoseClient::ParseResponse(finalResp).success;
 }
 
-bool EdlManager::ErasePartition(const std::string &name) {
+bool EdlManager::ErasePartition(const std::string &name, uint32_t lun) {
   std::cout << "[EDL] Erasing partition: " << name << "..." << std::endl;
-  std::string cmd = FirehoseClient::CreateEraseXml(name);
+  Core::TraceSpan span("firehose.erase", Core::TraceCategory::Firehose);
+  std::string cmd = FirehoseClient::CreateEraseXml(name, lun);
+  if (!SendXmlCommand(cmd))
+    return false;
+
+  std::string finalResp = ReceiveXmlResponse();
+  return FirehoseClient::ParseResponse(finalResp).success;
+}
+
+bool EdlManager::EraseRange(const std::string &name, uint32_t lun,
+                            uint64_t offset, uint64_t count) {
+  Core::TraceSpan span("firehose.erase", Core::TraceCategory::Firehose,
+                       count * 512);
+  std::string cmd = FirehoseClient::CreateEraseXml(name, offset, count, lun);
   if (!SendXmlCommand(cmd))
     return false;
 
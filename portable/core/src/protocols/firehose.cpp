@@ -6,12 +6,14 @@ namespace DeepEye {
 namespace Protocols {
 
 std::string FirehoseClient::CreateConfigureXml(uint32_t sectorSize,
-                                               const std::string &storageType) {
+                                               const std::string &storageType,
+                                               bool zlpAwareHost) {
   std::stringstream ss;
   ss << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n";
   ss << "<data>\n";
   ss << "  <configure verbose=\"0\" AlwaysValidate=\"0\" "
         "MaxPayloadSizeToTargetInBytes=\"1048576\" ";
+  ss << "ZlpAwareHost=\"" << (zlpAwareHost ? 1 : 0) << "\" ";
   ss << "MemoryName=\"" << storageType << "\" TargetName=\"MSM8998\" />\n";
   ss << "</data>";
   return ss.str();
@@ -19,38 +21,55 @@ std::string FirehoseClient::CreateConfigureXml(uint32_t sectorSize,
 
 std::string FirehoseClient::CreateReadXml(const std::string &partitionName,
                                           uint64_t sectorOffset,
-                                          uint64_t sectorCount) {
+                                          uint64_t sectorCount, uint32_t lun) {
   std::stringstream ss;
   ss << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n";
   ss << "<data>\n";
   ss << "  <read SECTOR_SIZE_IN_BYTES=\"512\" num_partition_sectors=\""
      << sectorCount << "\" ";
-  ss << "physical_partition_number=\"0\" start_sector=\"" << sectorOffset
-     << "\" />\n";
+  ss << "physical_partition_number=\"" << lun << "\" start_sector=\""
+     << sectorOffset << "\" />\n";
   ss << "</data>";
   return ss.str();
 }
 
 std::string FirehoseClient::CreateWriteXml(const std::string &partitionName,
                                            uint64_t sectorOffset,
-                                           uint64_t sectorCount) {
+                                           uint64_t sectorCount,
+                                           uint32_t lun) {
   std::stringstream ss;
   ss << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n";
   ss << "<data>\n";
   ss << "  <program SECTOR_SIZE_IN_BYTES=\"512\" num_partition_sectors=\""
      << sectorCount << "\" ";
-  ss << "physical_partition_number=\"0\" start_sector=\"" << sectorOffset
-     << "\" filename=\"" << partitionName << ".img\" />\n";
+  ss << "physical_partition_number=\"" << lun << "\" start_sector=\""
+     << sectorOffset << "\" filename=\"" << partitionName << ".img\" />\n";
   ss << "</data>";
   return ss.str();
 }
 
-std::string FirehoseClient::CreateEraseXml(const std::string &partitionName) {
+std::string FirehoseClient::CreateEraseXml(const std::string &partitionName,
+                                           uint32_t lun) {
   std::stringstream ss;
   ss << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n";
   ss << "<data>\n";
-  ss << "  <erase physical_partition_number=\"0\" partition_name=\""
-     << partitionName << "\" />\n";
+  ss << "  <erase physical_partition_number=\"" << lun
+     << "\" partition_name=\"" << partitionName << "\" />\n";
+  ss << "</data>";
+  return ss.str();
+}
+
+std::string FirehoseClient::CreateEraseXml(const std::string &partitionName,
+                                           uint64_t sectorOffset,
+                                           uint64_t sectorCount,
+                                           uint32_t lun) {
+  std::stringstream ss;
+  ss << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n";
+  ss << "<data>\n";
+  ss << "  <erase SECTOR_SIZE_IN_BYTES=\"512\" num_partition_sectors=\""
+     << sectorCount << "\" ";
+  ss << "physical_partition_number=\"" << lun << "\" start_sector=\""
+     << sectorOffset << "\" label=\"" << partitionName << "\" />\n";
   ss << "</data>";
   return ss.str();
 }
@@ -0,0 +1,261 @@
+#include "../../include/firehose_pipeline.h"
+#include "../../include/deepeye_core.h"
+#include "../../include/firehose.h"
+#include "../../include/trace.h"
+#include "../../include/transfer_timeouts.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace DeepEye {
+namespace Protocols {
+
+namespace {
+
+constexpr uint32_t kCommandTimeoutMs = 2000;
+constexpr uint32_t kDrainTimeoutMs = 100;
+constexpr const char *kDocumentEnd = "</data>";
+constexpr const char *kWhitespace = " \t\r\n";
+
+// A Firehose document (<?xml ...> or a bare <data>) rather than sector data.
+bool LooksLikeXml(const uint8_t *data, size_t length) {
+  std::string head(reinterpret_cast<const char *>(data),
+                   std::min<size_t>(length, 64));
+  size_t start = head.find_first_not_of(kWhitespace);
+  return start != std::string::npos &&
+         (head.compare(start, 5, "<?xml") == 0 ||
+          head.compare(start, 5, "<data") == 0);
+}
+
+} // namespace
+
+FirehosePipeline::FirehosePipeline(Core::ITransport *transport,
+                                   Core::TransferTimeouts &timeouts)
+    : _transport(transport), _timeouts(timeouts) {}
+
+bool FirehosePipeline::Read(const std::string &label, uint32_t lun,
+                            uint64_t lba, uint64_t count, uint64_t limit,
+                            uint8_t *out) {
+  Core::TraceSpan span("firehose.read", Core::TraceCategory::Firehose,
+                       count * 512);
+  _retryable = false;
+  _streak = lun == _streamLun && lba == _streamEnd && count == _streamCount
+                ? _streak + 1
+                : 0;
+  const Op *front = _inFlight.empty() ? nullptr : &_inFlight.front();
+  if (front && front->read && front->lun == lun && front->lba == lba &&
+      front->count == count) {
+    ++_stats.readAheadUsed;
+  } else {
+    if ((!_inFlight.empty() || _lost) && !Sync()) {
+      std::cerr << "[EDL] Outstanding Firehose commands failed." << std::endl;
+      return false;
+    }
+    if (!Send(FirehoseClient::CreateReadXml(label, lba, count, lun))) {
+      _retryable = true;
+      Sync();
+      return false;
+    }
+    _inFlight.push_back({true, lun, lba, count, Core::Tracer::NowNs()});
+  }
+
+  // Queue the chunks after this one while the target sends this one. The
+  // window grows with the streak, so short runs waste little at their end.
+  const size_t window = std::min<uint64_t>(_depth, _streak + 1);
+  if (_streak > 0) {
+    uint64_t next = _inFlight.back().lba + _inFlight.back().count;
+    while (_inFlight.size() < window && next < limit) {
+      uint64_t n = std::min(count, limit - next);
+      if (!Send(FirehoseClient::CreateReadXml(label, next, n, lun)))
+        break;
+      _inFlight.push_back({true, lun, next, n, Core::Tracer::NowNs()});
+      ++_stats.readAhead;
+      next += n;
+    }
+  }
+  Track();
+
+  // Reads only ever follow reads in flight, so a timeout loses no write.
+  if (!Retire(out)) {
+    _retryable = _lost;
+    Sync(); // unwind the read-ahead
+    return false;
+  }
+  _streamLun = lun;
+  _streamEnd = lba + count;
+  _streamCount = count;
+  return true;
+}
+
+bool FirehosePipeline::Write(const std::string &label, uint32_t lun,
+                             uint64_t lba, const uint8_t *data, size_t length,
+                             bool deferAck) {
+  Core::TraceSpan span("firehose.program", Core::TraceCategory::Firehose,
+                       length);
+  _retryable = false;
+  // Read-ahead was issued before this write and would be stale.
+  bool ok = true;
+  if (_lost || (!_inFlight.empty() && _inFlight.front().read))
+    ok = Sync();
+  while (ok && _inFlight.size() >= _depth)
+    ok = Retire(nullptr);
+  if (!ok) {
+    Sync();
+    return false;
+  }
+
+  // Earlier deferred writes still in flight go down with this one.
+  const bool alone = _inFlight.empty();
+  const uint64_t sent = Core::Tracer::NowNs();
+  if (!Send(FirehoseClient::CreateWriteXml(label, lba, length / 512, lun))) {
+    _retryable = alone;
+    Sync();
+    return false;
+  }
+  if (_transport->Send(data, length, _timeouts.For(length)) != (int)length) {
+    Lose();
+    _retryable = alone;
+    Sync();
+    return false;
+  }
+  _timeouts.Record(length, Core::Tracer::NowNs() - sent);
+  _inFlight.push_back({false, lun, lba, length / 512, sent});
+  Track();
+  if (deferAck)
+    return true;
+  const uint64_t timeouts = _stats.timeouts;
+  if (Sync())
+    return true;
+  _retryable = alone && _stats.timeouts != timeouts;
+  return false;
+}
+
+bool FirehosePipeline::Sync() {
+  bool ok = true;
+  while (!_inFlight.empty() && !_lost) {
+    bool write = !_inFlight.front().read;
+    if (!Retire(nullptr) && write)
+      ok = false;
+  }
+  if (_lost) {
+    // Whatever the target still sends belongs to dropped commands.
+    _inFlight.clear();
+    _scratch.resize(std::max<size_t>(_scratch.size(), 65536));
+    while (_transport->Receive(_scratch.data(), _scratch.size(),
+                               kDrainTimeoutMs) > 0) {
+    }
+    _xml.clear();
+    _lost = false;
+    ok = false;
+  }
+  _streamEnd = UINT64_MAX;
+  _streak = 0;
+  return ok;
+}
+
+void FirehosePipeline::Reset() {
+  _inFlight.clear();
+  _xml.clear();
+  _streamEnd = UINT64_MAX;
+  _streak = 0;
+  _lost = false;
+}
+
+bool FirehosePipeline::Send(const std::string &xml) {
+  ++_stats.commands;
+  if (_transport->Send(reinterpret_cast<const uint8_t *>(xml.data()),
+                       xml.size(), kCommandTimeoutMs) > 0)
+    return true;
+  Lose();
+  return false;
+}
+
+void FirehosePipeline::Lose() {
+  _lost = true;
+  ++_stats.timeouts;
+  _timeouts.RecordTimeout();
+}
+
+bool FirehosePipeline::Retire(uint8_t *out) {
+  const Op op = _inFlight.front();
+  _inFlight.pop_front();
+  if (!op.read && !_inFlight.empty())
+    ++_stats.deferredAcks;
+  bool ok = true;
+  if (op.read) {
+    if (!out) {
+      _scratch.resize(std::max<size_t>(_scratch.size(), op.count * 512));
+      out = _scratch.data();
+    }
+    ok = ReceiveData(out, op.count * 512);
+    if (ok) {
+      // The target streams queued reads back to back: this one's data
+      // started flowing when the previous one's ended, if not later.
+      uint64_t now = Core::Tracer::NowNs();
+      _timeouts.Record(op.count * 512,
+                       now - std::max(op.sentNs, _lastDataNs));
+      _lastDataNs = now;
+    }
+  }
+  // A rejected read gets a NAK instead of its data, not after it. A program
+  // is ACKed once its data is on the storage, which takes as long as the
+  // data phase may have.
+  return !_lost &&
+         ReceiveResponse(_timeouts.For(op.read ? 0 : op.count * 512)) && ok;
+}
+
+bool FirehosePipeline::ReceiveData(uint8_t *out, size_t length) {
+  for (size_t got = 0; got < length;) {
+    if (ResponsePending())
+      return false;
+    int n = _transport->Receive(out + got, length - got,
+                                _timeouts.For(length - got));
+    if (n <= 0) {
+      Lose();
+      return false;
+    }
+    // Logs and responses are short packets ahead of the data; a partial
+    // document still in _xml continues with this packet.
+    if (got == 0 && (!_xml.empty() || ((size_t)n < length &&
+                                       LooksLikeXml(out, (size_t)n)))) {
+      _xml.append(reinterpret_cast<const char *>(out), (size_t)n);
+      continue;
+    }
+    got += (size_t)n;
+  }
+  return true;
+}
+
+bool FirehosePipeline::ReceiveResponse(uint32_t timeoutMs) {
+  Core::TraceSpan span("firehose.response", Core::TraceCategory::Firehose);
+  while (!ResponsePending()) {
+    uint8_t buffer[4096];
+    int n = _transport->Receive(buffer, sizeof(buffer), timeoutMs);
+    if (n <= 0) {
+      Lose();
+      return false;
+    }
+    _xml.append(reinterpret_cast<const char *>(buffer), (size_t)n);
+  }
+  size_t end = _xml.find(kDocumentEnd) + strlen(kDocumentEnd);
+  bool ok = FirehoseClient::ParseResponse(_xml.substr(0, end)).success;
+  _xml.erase(0, end);
+  _xml.erase(0, _xml.find_first_not_of(kWhitespace));
+  return ok;
+}
+
+bool FirehosePipeline::ResponsePending() {
+  for (;;) {
+    size_t end = _xml.find(kDocumentEnd);
+    if (end == std::string::npos)
+      return false;
+    size_t response = _xml.find("<response");
+    if (response != std::string::npos && response < end)
+      return true;
+    _xml.erase(0, end + strlen(kDocumentEnd)); // a <log>
+    _xml.erase(0, _xml.find_first_not_of(kWhitespace));
+  }
+}
+
+} // namespace Protocols
+} // namespace DeepEye
@@ -0,0 +1,421 @@
+#include "../../include/fs_allocation.h"
+#include <algorithm>
+#include <cstring>
+
+namespace DeepEye {
+namespace Protocols {
+
+namespace {
+
+const uint16_t kExt4Magic = 0xEF53;
+const uint32_t kExt4CompatSparseSuper2 = 0x200;
+const uint32_t kExt4CompatResizeInode = 0x10;
+const uint32_t kExt4IncompatRecover = 0x4;
+const uint32_t kExt4IncompatMetaBg = 0x10;
+const uint32_t kExt4Incompat64Bit = 0x80;
+const uint32_t kExt4RoCompatSparseSuper = 0x1;
+const uint32_t kExt4RoCompatBigalloc = 0x200;
+const uint16_t kExt4BgBlockUninit = 0x2;
+
+const uint32_t kF2fsMagic = 0xF2F52010;
+const uint32_t kF2fsBlockSize = 4096;
+const uint32_t kF2fsSitEntrySize = 74;
+const uint32_t kF2fsSitEntriesPerBlock = kF2fsBlockSize / kF2fsSitEntrySize;
+const uint32_t kF2fsJournalSize = 507;     // per summary journal
+const uint32_t kF2fsSummaryEntries = 3584; // 512 entries * 7 bytes
+const uint32_t kF2fsCompactSumFlag = 0x4;
+
+// Blocks fetched per metadata read when scanning bitmaps or the SIT.
+const uint64_t kScanBlocks = 256;
+
+uint16_t Le16(const uint8_t *p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+uint32_t Le32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+uint64_t Le64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+void SetError(std::string *error, const std::string &message) {
+  if (error)
+    *error = message;
+}
+
+bool ReadBlocks(const SectorReader &read, uint32_t blockSize, uint64_t block,
+                uint64_t count, std::vector<uint8_t> &out) {
+  out.resize(count * blockSize);
+  return read(block * (blockSize / 512), count * (blockSize / 512),
+              out.data());
+}
+
+// ext4 keeps superblock/GDT backups in groups 0, 1 and powers of 3, 5, 7
+// (sparse_super), in every group, or in two listed groups (sparse_super2).
+bool Ext4HasSuper(uint64_t group, uint32_t compat, uint32_t roCompat,
+                  const uint32_t backupGroups[2]) {
+  if (group == 0)
+    return true;
+  if (compat & kExt4CompatSparseSuper2)
+    return group == backupGroups[0] || group == backupGroups[1];
+  if (!(roCompat & kExt4RoCompatSparseSuper) || group == 1)
+    return true;
+  for (uint64_t base : {3, 5, 7}) {
+    uint64_t n = base;
+    while (n < group)
+      n *= base;
+    if (n == group)
+      return true;
+  }
+  return false;
+}
+
+} // namespace
+
+void FsAllocation::Reset(uint32_t blockSize, uint64_t totalSectors,
+                         bool used) {
+  _blockSize = blockSize;
+  _blockCount = totalSectors * 512 / blockSize;
+  _bits.assign((_blockCount + 63) / 64, used ? ~0ull : 0);
+}
+
+void FsAllocation::MarkUsed(uint64_t first, uint64_t count) {
+  uint64_t end = std::min(first + count, _blockCount);
+  for (uint64_t b = first; b < end;) {
+    if (b % 64 == 0 && end - b >= 64) {
+      _bits[b / 64] = ~0ull;
+      b += 64;
+    } else {
+      _bits[b / 64] |= 1ull << (b % 64);
+      ++b;
+    }
+  }
+}
+
+void FsAllocation::MarkBits(uint64_t first, const uint8_t *bits,
+                            uint64_t count) {
+  count = std::min(count, _blockCount - std::min(first, _blockCount));
+  uint64_t b = 0;
+  if (first % 8 == 0) {
+    // LSB-first bytes line up with the little-endian words of _bits.
+    uint8_t *dst = reinterpret_cast<uint8_t *>(_bits.data()) + first / 8;
+    for (; b + 8 <= count; b += 8)
+      dst[b / 8] |= bits[b / 8];
+  }
+  for (; b < count; ++b)
+    if (bits[b / 8] & (1 << (b % 8)))
+      MarkUsed(first + b, 1);
+}
+
+uint64_t FsAllocation::UsedBlocks() const {
+  uint64_t n = 0;
+  for (uint64_t b = 0; b < _blockCount; b += 64) {
+    uint64_t word = _bits[b / 64];
+    if (_blockCount - b < 64)
+      word &= (1ull << (_blockCount - b)) - 1;
+    n += (uint64_t)__builtin_popcountll(word);
+  }
+  return n;
+}
+
+uint64_t FsAllocation::RunLength(uint64_t block) const {
+  const bool used = IsUsed(block);
+  const uint64_t same = used ? ~0ull : 0;
+  uint64_t b = block;
+  while (b < _blockCount) {
+    if (b % 64 == 0 && _bits[b / 64] == same) {
+      b += 64;
+    } else if (IsUsed(b) == used) {
+      ++b;
+    } else {
+      break;
+    }
+  }
+  return std::min(b, _blockCount) - block;
+}
+
+bool FsAllocation::Load(const SectorReader &read, uint64_t totalSectors,
+                        std::string *error) {
+  _filesystem.clear();
+  std::string ext4Error, f2fsError;
+  if (LoadExt4(read, totalSectors, &ext4Error)) {
+    _filesystem = "ext4";
+    return true;
+  }
+  if (LoadF2fs(read, totalSectors, &f2fsError)) {
+    _filesystem = "f2fs";
+    return true;
+  }
+  Reset(totalSectors % 8 == 0 ? 4096 : 512, totalSectors, true);
+  SetError(error, "ext4: " + ext4Error + "; f2fs: " + f2fsError);
+  return false;
+}
+
+bool FsAllocation::LoadExt4(const SectorReader &read, uint64_t totalSectors,
+                            std::string *error) {
+  uint8_t sb[1024];
+  if (totalSectors < 4 || !read(2, 2, sb)) {
+    SetError(error, "cannot read superblock");
+    return false;
+  }
+  if (Le16(sb + 56) != kExt4Magic) {
+    SetError(error, "no superblock");
+    return false;
+  }
+  const uint32_t compat = Le32(sb + 92);
+  const uint32_t incompat = Le32(sb + 96);
+  const uint32_t roCompat = Le32(sb + 100);
+  // A journal that needs replay may allocate blocks the on-disk bitmaps
+  // still show as free; bigalloc and meta_bg change the layouts below.
+  if (incompat & kExt4IncompatRecover) {
+    SetError(error, "journal needs recovery");
+    return false;
+  }
+  if ((incompat & kExt4IncompatMetaBg) ||
+      (roCompat & kExt4RoCompatBigalloc)) {
+    SetError(error, "unsupported layout (meta_bg/bigalloc)");
+    return false;
+  }
+
+  const uint32_t logBlockSize = Le32(sb + 24);
+  if (logBlockSize > 6) {
+    SetError(error, "bad block size");
+    return false;
+  }
+  const uint32_t blockSize = 1024u << logBlockSize;
+  const bool is64 = (incompat & kExt4Incompat64Bit) != 0;
+  uint64_t blocksCount = Le32(sb + 4);
+  if (is64)
+    blocksCount |= (uint64_t)Le32(sb + 0x150) << 32;
+  const uint32_t firstDataBlock = Le32(sb + 20);
+  const uint32_t blocksPerGroup = Le32(sb + 32);
+  const uint32_t inodesPerGroup = Le32(sb + 40);
+  const uint32_t inodeSize = Le32(sb + 76) >= 1 ? Le16(sb + 88) : 128;
+  const uint32_t descSize =
+      is64 ? std::max<uint32_t>(Le16(sb + 254), 32) : 32;
+  const uint32_t reservedGdt =
+      (compat & kExt4CompatResizeInode) ? Le16(sb + 206) : 0;
+  const uint32_t backupGroups[2] = {Le32(sb + 0x24C), Le32(sb + 0x250)};
+  if (blocksPerGroup == 0 || blocksPerGroup > blockSize * 8 ||
+      firstDataBlock >= blocksCount ||
+      (totalSectors * 512) % blockSize != 0 ||
+      blocksCount > totalSectors * 512 / blockSize) {
+    SetError(error, "superblock geometry does not fit the partition");
+    return false;
+  }
+
+  const uint64_t groups =
+      (blocksCount - firstDataBlock + blocksPerGroup - 1) / blocksPerGroup;
+  const uint64_t gdtBlocks = (groups * descSize + blockSize - 1) / blockSize;
+  const uint64_t inodeTableBlocks =
+      ((uint64_t)inodesPerGroup * inodeSize + blockSize - 1) / blockSize;
+  std::vector<uint8_t> gdt;
+  if (!ReadBlocks(read, blockSize, firstDataBlock + 1, gdtBlocks, gdt)) {
+    SetError(error, "cannot read group descriptors");
+    return false;
+  }
+
+  Reset(blockSize, totalSectors, false);
+  // Everything past the filesystem is dumped as-is.
+  MarkUsed(blocksCount, _blockCount - blocksCount);
+  MarkUsed(0, firstDataBlock + 1 + gdtBlocks + reservedGdt);
+
+  struct Bitmap {
+    uint64_t block;
+    uint64_t group;
+  };
+  std::vector<Bitmap> bitmaps;
+  for (uint64_t g = 0; g < groups; ++g) {
+    const uint8_t *d = &gdt[g * descSize];
+    bool wide = is64 && descSize >= 64;
+    uint64_t blockBitmap =
+        Le32(d) | (wide ? (uint64_t)Le32(d + 0x20) << 32 : 0);
+    uint64_t inodeBitmap =
+        Le32(d + 4) | (wide ? (uint64_t)Le32(d + 0x24) << 32 : 0);
+    uint64_t inodeTable =
+        Le32(d + 8) | (wide ? (uint64_t)Le32(d + 0x28) << 32 : 0);
+    if (blockBitmap >= blocksCount || inodeBitmap >= blocksCount ||
+        inodeTable + inodeTableBlocks > blocksCount) {
+      SetError(error, "group descriptor out of range");
+      return false;
+    }
+    // Group metadata may live in another group (flex_bg); always keep it.
+    MarkUsed(blockBitmap, 1);
+    MarkUsed(inodeBitmap, 1);
+    MarkUsed(inodeTable, inodeTableBlocks);
+
+    uint64_t start = firstDataBlock + g * blocksPerGroup;
+    if (Le16(d + 18) & kExt4BgBlockUninit) {
+      if (Ext4HasSuper(g, compat, roCompat, backupGroups))
+        MarkUsed(start, 1 + gdtBlocks + reservedGdt);
+    } else {
+      bitmaps.push_back({blockBitmap, g});
+    }
+  }
+
+  // With flex_bg the bitmaps of neighbouring groups are contiguous; fetch
+  // them in runs rather than one round trip per group.
+  std::sort(bitmaps.begin(), bitmaps.end(),
+            [](const Bitmap &a, const Bitmap &b) { return a.block < b.block; });
+  std::vector<uint8_t> buf;
+  for (size_t i = 0; i < bitmaps.size();) {
+    size_t j = i + 1;
+    while (j < bitmaps.size() && j - i < kScanBlocks &&
+           bitmaps[j].block == bitmaps[j - 1].block + 1)
+      ++j;
+    if (!ReadBlocks(read, blockSize, bitmaps[i].block, j - i, buf)) {
+      SetError(error, "cannot read block bitmaps");
+      return false;
+    }
+    for (size_t k = i; k < j; ++k) {
+      const uint8_t *bits = &buf[(k - i) * blockSize];
+      uint64_t start = firstDataBlock + bitmaps[k].group * blocksPerGroup;
+      uint64_t count = std::min<uint64_t>(blocksPerGroup, blocksCount - start);
+      MarkBits(start, bits, count);
+    }
+    i = j;
+  }
+  return true;
+}
+
+bool FsAllocation::LoadF2fs(const SectorReader &read, uint64_t totalSectors,
+                            std::string *error) {
+  // Superblock at 1 KiB into block 0, backup at the same offset in block 1.
+  uint8_t sb[1024];
+  bool found = false;
+  for (uint64_t sector : {2, 10}) {
+    if (totalSectors > sector + 2 && read(sector, 2, sb) &&
+        Le32(sb) == kF2fsMagic) {
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    SetError(error, "no superblock");
+    return false;
+  }
+  const uint32_t logBlockSize = Le32(sb + 16);
+  const uint32_t logBlocksPerSeg = Le32(sb + 20);
+  if (logBlockSize != 12 || logBlocksPerSeg != 9) {
+    SetError(error, "unsupported block or segment size");
+    return false;
+  }
+  const uint64_t blocksPerSeg = 1ull << logBlocksPerSeg;
+  const uint32_t segmentCountSit = Le32(sb + 56);
+  const uint32_t segmentCountMain = Le32(sb + 68);
+  const uint32_t cpBlkaddr = Le32(sb + 76);
+  const uint32_t sitBlkaddr = Le32(sb + 80);
+  const uint32_t mainBlkaddr = Le32(sb + 92);
+  const uint64_t partitionBlocks = totalSectors * 512 / kF2fsBlockSize;
+  if ((totalSectors * 512) % kF2fsBlockSize != 0 ||
+      mainBlkaddr + (uint64_t)segmentCountMain * blocksPerSeg >
+          partitionBlocks ||
+      cpBlkaddr >= mainBlkaddr || sitBlkaddr >= mainBlkaddr) {
+    SetError(error, "superblock geometry does not fit the partition");
+    return false;
+  }
+
+  // The newer of the two checkpoint packs whose first and last blocks
+  // carry the same version.
+  std::vector<uint8_t> cp, tail, best;
+  uint64_t bestVersion = 0;
+  uint64_t bestStart = 0;
+  for (uint64_t start : {(uint64_t)cpBlkaddr, cpBlkaddr + blocksPerSeg}) {
+    if (!ReadBlocks(read, kF2fsBlockSize, start, 1, cp))
+      continue;
+    uint32_t packBlocks = Le32(&cp[136]);
+    if (packBlocks < 2 || packBlocks > blocksPerSeg ||
+        !ReadBlocks(read, kF2fsBlockSize, start + packBlocks - 1, 1, tail) ||
+        Le64(&tail[0]) != Le64(&cp[0]))
+      continue;
+    if (best.empty() || Le64(&cp[0]) > bestVersion) {
+      bestVersion = Le64(&cp[0]);
+      bestStart = start;
+      best = cp;
+    }
+  }
+  if (best.empty()) {
+    SetError(error, "no valid checkpoint");
+    return false;
+  }
+
+  Reset(kF2fsBlockSize, totalSectors, false);
+  MarkUsed(0, mainBlkaddr);
+  uint64_t mainEnd = mainBlkaddr + (uint64_t)segmentCountMain * blocksPerSeg;
+  MarkUsed(mainEnd, _blockCount - mainEnd);
+
+  auto markEntry = [&](uint64_t segno, const uint8_t *entry) {
+    if (segno >= segmentCountMain || (Le16(entry) & 0x3FF) == 0)
+      return;
+    const uint8_t *validMap = entry + 2; // MSB-first bits
+    uint64_t base = mainBlkaddr + segno * blocksPerSeg;
+    for (uint64_t b = 0; b < blocksPerSeg; ++b)
+      if (validMap[b / 8] & (0x80 >> (b % 8)))
+        MarkUsed(base + b, 1);
+  };
+
+  // Both SIT copies: the checkpoint's version bitmap says which is current
+  // per block, but the union is a safe superset without decoding it.
+  const uint64_t sitBlocks =
+      (segmentCountMain + kF2fsSitEntriesPerBlock - 1) /
+      kF2fsSitEntriesPerBlock;
+  const uint64_t sitCopyBlocks = (uint64_t)(segmentCountSit / 2)
+                                 << logBlocksPerSeg;
+  if (sitBlocks > sitCopyBlocks) {
+    SetError(error, "SIT smaller than the main area");
+    return false;
+  }
+  std::vector<uint8_t> buf;
+  for (uint64_t copy = 0; copy < 2; ++copy) {
+    for (uint64_t blk = 0; blk < sitBlocks; blk += kScanBlocks) {
+      uint64_t n = std::min(kScanBlocks, sitBlocks - blk);
+      if (!ReadBlocks(read, kF2fsBlockSize,
+                      sitBlkaddr + copy * sitCopyBlocks + blk, n, buf)) {
+        SetError(error, "cannot read SIT");
+        return false;
+      }
+      for (uint64_t i = 0; i < n; ++i)
+        for (uint32_t e = 0; e < kF2fsSitEntriesPerBlock; ++e)
+          markEntry((blk + i) * kF2fsSitEntriesPerBlock + e,
+                    &buf[i * kF2fsBlockSize + e * kF2fsSitEntrySize]);
+    }
+  }
+
+  // SIT updates not yet flushed sit in the cold data summary's journal.
+  const uint32_t flags = Le32(&best[132]);
+  const uint32_t startSum = Le32(&best[140]);
+  bool compact = (flags & kF2fsCompactSumFlag) != 0;
+  uint64_t summary = bestStart + startSum + (compact ? 0 : 2);
+  if (!ReadBlocks(read, kF2fsBlockSize, summary, 1, buf)) {
+    SetError(error, "cannot read checkpoint summaries");
+    return false;
+  }
+  const uint8_t *journal =
+      &buf[compact ? kF2fsJournalSize : kF2fsSummaryEntries];
+  uint16_t sits = std::min<uint16_t>(Le16(journal), 6);
+  for (uint16_t i = 0; i < sits; ++i) {
+    const uint8_t *j = journal + 2 + i * (4 + kF2fsSitEntrySize);
+    markEntry(Le32(j), j + 4);
+  }
+
+  // Current segments may hold blocks written after the checkpoint (fsync
+  // roll-forward); keep them whole.
+  for (int i = 0; i < 8; ++i) {
+    uint32_t node = Le32(&best[36 + 4 * i]);
+    uint32_t data = Le32(&best[84 + 4 * i]);
+    if (node < segmentCountMain)
+      MarkUsed(mainBlkaddr + (uint64_t)node * blocksPerSeg, blocksPerSeg);
+    if (data < segmentCountMain)
+      MarkUsed(mainBlkaddr + (uint64_t)data * blocksPerSeg, blocksPerSeg);
+  }
+  return true;
+}
+
+} // namespace Protocols
+} // namespace DeepEye
@@ -1,7 +1,5 @@
 #include "../../include/gpt_parser.h"
-#include <codecvt>
 #include <cstring>
-#include <locale>
 
 namespace DeepEye {
 namespace Protocols {
@@ -12,49 +10,101 @@ bool GptParser::ParseHeader(const uint8_t *buffer, GptHeader &header) {
   return header.signature == 0x5452415020494645;
 }
 
-std::string Utf16ToUtf8(const uint16_t *utf16, size_t maxLen) {
-  std::string result;
-  for (size_t i = 0; i < maxLen && utf16[i] != 0; ++i) {
-    uint16_t c = utf16[i];
-    if (c < 0x80)
-      result += (char)c;
-    else if (c < 0x800) {
-      result += (char)(0xC0 | (c >> 6));
-      result += (char)(0x80 | (c & 0x3F));
-    }
+uint32_t GptParser::FindHeader(const uint8_t *disk, size_t size,
+                               GptHeader &header) {
+  for (uint32_t sectorSize : {512u, 4096u}) {
+    if (size >= 2 * (size_t)sectorSize &&
+        ParseHeader(disk + sectorSize, header))
+      return sectorSize;
   }
-  return result;
+  return 0;
 }
 
-std::vector<PartitionInfo> GptParser::ParseEntries(const uint8_t *buffer,
-                                                   uint32_t count,
-                                                   uint32_t size,
-                                                   uint32_t sectorSize) {
-  std::vector<PartitionInfo> partitions;
-
-  for (uint32_t i = 0; i < count; ++i) {
-    const GptEntry *entry = (const GptEntry *)(buffer + (i * size));
-
-    bool isEmpty = true;
-    for (int b = 0; b < 16; ++b) {
-      if (entry->partitionTypeGuid[b] != 0) {
-        isEmpty = false;
-        break;
+size_t Utf16ToUtf8(const uint8_t *utf16le, size_t maxUnits, char *out,
+                   size_t capacity) {
+  size_t n = 0;
+  // Each branch needs at most 4 bytes plus the terminator.
+  auto room = [&](size_t bytes) { return n + bytes < capacity; };
+  for (size_t i = 0; i < maxUnits; ++i) {
+    uint32_t c = utf16le[2 * i] | (uint32_t)utf16le[2 * i + 1] << 8;
+    if (c == 0)
+      break;
+    if (c >= 0xD800 && c <= 0xDBFF && i + 1 < maxUnits) {
+      uint32_t lo = utf16le[2 * i + 2] | (uint32_t)utf16le[2 * i + 3] << 8;
+      if (lo >= 0xDC00 && lo <= 0xDFFF) {
+        c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+        ++i;
       }
     }
+    if (c >= 0xD800 && c <= 0xDFFF)
+      c = 0xFFFD; // unpaired surrogate
 
-    if (isEmpty)
-      continue;
+    if (c < 0x80) {
+      if (!room(1))
+        break;
+      out[n++] = (char)c;
+    } else if (c < 0x800) {
+      if (!room(2))
+        break;
+      out[n++] = (char)(0xC0 | (c >> 6));
+      out[n++] = (char)(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+      if (!room(3))
+        break;
+      out[n++] = (char)(0xE0 | (c >> 12));
+      out[n++] = (char)(0x80 | ((c >> 6) & 0x3F));
+      out[n++] = (char)(0x80 | (c & 0x3F));
+    } else {
+      if (!room(4))
+        break;
+      out[n++] = (char)(0xF0 | (c >> 18));
+      out[n++] = (char)(0x80 | ((c >> 12) & 0x3F));
+      out[n++] = (char)(0x80 | ((c >> 6) & 0x3F));
+      out[n++] = (char)(0x80 | (c & 0x3F));
+    }
+  }
+  if (capacity)
+    out[n] = '\0';
+  return n;
+}
 
-    PartitionInfo info;
-    info.name = Utf16ToUtf8(entry->partitionName, 36);
-    info.startLba = entry->startingLba;
-    info.endLba = entry->endingLba;
-    info.sizeInBytes = (entry->endingLba - entry->startingLba + 1) * sectorSize;
+uint32_t GptEntryTable::UsedCount() const {
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < _count; ++i)
+    used += !At(i).IsEmpty();
+  return used;
+}
 
-    partitions.push_back(info);
+size_t GptParser::ParseEntries(const uint8_t *buffer, uint32_t count,
+                               uint32_t size, uint32_t sectorSize,
+                               uint32_t lun, std::vector<PartitionInfo> &out) {
+  GptEntryTable table(buffer, count, size);
+  out.reserve(out.size() + table.UsedCount());
+  const size_t before = out.size();
+  GptName name;
+  for (GptEntryView entry : table) {
+    out.emplace_back();
+    PartitionInfo &info = out.back();
+    entry.Name(name);
+    info.name.assign(name.data, name.length);
+    info.lun = lun;
+    info.startLba = entry.StartLba();
+    info.endLba = entry.EndLba();
+    info.sizeInBytes = entry.SizeInBytes(sectorSize);
+    info.attributes = entry.Attributes();
+    memcpy(info.typeGuid, entry.TypeGuid(), 16);
+    memcpy(info.uniqueGuid, entry.UniqueGuid(), 16);
   }
+  return out.size() - before;
+}
 
+std::vector<PartitionInfo> GptParser::ParseEntries(const uint8_t *buffer,
+                                                   uint32_t count,
+                                                   uint32_t size,
+                                                   uint32_t sectorSize,
+                                                   uint32_t lun) {
+  std::vector<PartitionInfo> partitions;
+  ParseEntries(buffer, count, size, sectorSize, lun, partitions);
   return partitions;
 }
 
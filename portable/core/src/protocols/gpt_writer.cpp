@@ -0,0 +1,247 @@
+#include "../../include/gpt_writer.h"
+#include "../../include/checksum.h"
+#include <algorithm>
+#include <cstring>
+
+namespace DeepEye {
+namespace Protocols {
+
+namespace {
+
+const size_t kNameOffset = 56;
+const size_t kNameUnits = 36;
+
+void SetError(std::string *error, const std::string &message) {
+  if (error)
+    *error = message;
+}
+
+// UTF-8 to UTF-16LE, NUL-padded to 36 units. False on malformed input or
+// a name that does not fit.
+bool EncodeName(const std::string &name, uint8_t *out) {
+  memset(out, 0, kNameUnits * 2);
+  size_t units = 0;
+  auto put = [&](uint32_t u) {
+    if (units == kNameUnits)
+      return false;
+    out[2 * units] = (uint8_t)u;
+    out[2 * units + 1] = (uint8_t)(u >> 8);
+    ++units;
+    return true;
+  };
+  for (size_t i = 0; i < name.size();) {
+    uint8_t b = (uint8_t)name[i];
+    size_t len = b < 0x80 ? 1 : (b >> 5) == 0x6 ? 2 : (b >> 4) == 0xE ? 3
+                            : (b >> 3) == 0x1E ? 4 : 0;
+    if (len == 0 || i + len > name.size())
+      return false;
+    uint32_t c = len == 1 ? b : b & (0x7F >> len);
+    for (size_t k = 1; k < len; ++k) {
+      uint8_t cont = (uint8_t)name[i + k];
+      if ((cont & 0xC0) != 0x80)
+        return false;
+      c = (c << 6) | (cont & 0x3F);
+    }
+    i += len;
+    if (c >= 0x10000) {
+      c -= 0x10000;
+      if (!put(0xD800 + (c >> 10)) || !put(0xDC00 + (c & 0x3FF)))
+        return false;
+    } else if (!put(c)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The header as it sits in its sector: struct, zero padding, CRC over
+// headerSize bytes.
+std::vector<uint8_t> HeaderSector(GptHeader header, uint32_t sectorSize) {
+  GptWriter::SealHeader(header);
+  std::vector<uint8_t> sector(sectorSize, 0);
+  memcpy(sector.data(), &header, sizeof(header));
+  return sector;
+}
+
+} // namespace
+
+void GptWriter::SealHeader(GptHeader &header) {
+  // Bytes past the struct are reserved and must be zero.
+  size_t size = std::max<size_t>(header.headerSize, sizeof(GptHeader));
+  std::vector<uint8_t> bytes(size, 0);
+  header.headerCrc32 = 0;
+  memcpy(bytes.data(), &header, sizeof(header));
+  header.headerCrc32 = Crc32::Compute(bytes.data(), header.headerSize);
+}
+
+GptHeader GptWriter::MakeBackupHeader(const GptHeader &primary,
+                                      uint32_t sectorSize) {
+  GptHeader backup = primary;
+  backup.currentLba = primary.backupLba;
+  backup.backupLba = primary.currentLba;
+  backup.partitionEntryLba =
+      primary.backupLba - EntrySectors(primary, sectorSize);
+  SealHeader(backup);
+  return backup;
+}
+
+bool GptWriter::EncodeEntries(const std::vector<PartitionInfo> &partitions,
+                              const GptHeader &header,
+                              const uint8_t *oldEntries,
+                              std::vector<uint8_t> &out, std::string *error) {
+  const uint32_t count = header.numPartitionEntries;
+  const uint32_t size = header.partitionEntrySize;
+  if (size < sizeof(GptEntry)) {
+    SetError(error, "unsupported GPT entry size");
+    return false;
+  }
+  out.assign(oldEntries, oldEntries + (size_t)count * size);
+
+  // Match partitions to their current slots by unique GUID.
+  std::vector<int64_t> slotOf(partitions.size(), -1);
+  std::vector<bool> taken(count, false);
+  GptEntryTable table(oldEntries, count, size);
+  for (auto it = table.begin(); it != table.end(); ++it) {
+    for (size_t p = 0; p < partitions.size(); ++p) {
+      if (slotOf[p] < 0 &&
+          memcmp(partitions[p].uniqueGuid, (*it).UniqueGuid(), 16) == 0) {
+        slotOf[p] = it.Index();
+        taken[it.Index()] = true;
+        break;
+      }
+    }
+  }
+  // Clear slots nobody kept, then place the new partitions.
+  for (uint32_t i = 0; i < count; ++i)
+    if (!taken[i])
+      memset(&out[(size_t)i * size], 0, size);
+  uint32_t free = 0;
+  for (size_t p = 0; p < partitions.size(); ++p) {
+    if (slotOf[p] >= 0)
+      continue;
+    while (free < count && taken[free])
+      ++free;
+    if (free == count) {
+      SetError(error, "GPT has no free entry for " + partitions[p].name);
+      return false;
+    }
+    slotOf[p] = free;
+    taken[free] = true;
+  }
+
+  for (size_t p = 0; p < partitions.size(); ++p) {
+    const PartitionInfo &info = partitions[p];
+    uint8_t *e = &out[(size_t)slotOf[p] * size];
+    GptEntry entry;
+    memcpy(&entry, e, sizeof(entry));
+    memcpy(entry.partitionTypeGuid, info.typeGuid, 16);
+    memcpy(entry.uniquePartitionGuid, info.uniqueGuid, 16);
+    entry.startingLba = info.startLba;
+    entry.endingLba = info.endLba;
+    entry.attributes = info.attributes;
+    memcpy(e, &entry, sizeof(entry));
+    if (!EncodeName(info.name, e + kNameOffset)) {
+      SetError(error, "partition name does not fit GPT: " + info.name);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool GptWriter::Validate(const GptHeader &header, const uint8_t *entries,
+                         std::string *error) {
+  struct Range {
+    uint64_t start, end;
+    const uint8_t *guid;
+  };
+  std::vector<Range> ranges;
+  GptEntryTable table(entries, header.numPartitionEntries,
+                      header.partitionEntrySize);
+  ranges.reserve(table.UsedCount());
+  for (GptEntryView e : table) {
+    if (e.StartLba() > e.EndLba() || e.StartLba() < header.firstUsableLba ||
+        e.EndLba() > header.lastUsableLba) {
+      SetError(error, "partition outside the usable LBA range");
+      return false;
+    }
+    ranges.push_back({e.StartLba(), e.EndLba(), e.UniqueGuid()});
+  }
+  std::sort(ranges.begin(), ranges.end(),
+            [](const Range &a, const Range &b) { return a.start < b.start; });
+  for (size_t i = 1; i < ranges.size(); ++i) {
+    if (ranges[i].start <= ranges[i - 1].end) {
+      SetError(error, "partitions overlap");
+      return false;
+    }
+  }
+  for (size_t i = 0; i < ranges.size(); ++i)
+    for (size_t j = i + 1; j < ranges.size(); ++j)
+      if (memcmp(ranges[i].guid, ranges[j].guid, 16) == 0) {
+        SetError(error, "duplicate unique partition GUID");
+        return false;
+      }
+  return true;
+}
+
+bool GptWriter::Plan(const GptHeader &primary, const uint8_t *oldEntries,
+                     const uint8_t *newEntries, uint32_t sectorSize,
+                     bool backupInSync, std::vector<GptWrite> &plan,
+                     std::string *error) {
+  plan.clear();
+  const size_t arrayBytes =
+      (size_t)primary.numPartitionEntries * primary.partitionEntrySize;
+  const uint32_t sectors = EntrySectors(primary, sectorSize);
+  if (primary.backupLba <= sectors + primary.currentLba) {
+    SetError(error, "GPT header has no usable backup LBA");
+    return false;
+  }
+  if (backupInSync && memcmp(oldEntries, newEntries, arrayBytes) == 0)
+    return true;
+  if (!Validate(primary, newEntries, error))
+    return false;
+
+  // The array padded to whole sectors, as it is laid out on disk.
+  std::vector<uint8_t> padded((size_t)sectors * sectorSize, 0);
+  memcpy(padded.data(), newEntries, arrayBytes);
+
+  // Changed sectors, as [first, last] runs.
+  std::vector<std::pair<uint32_t, uint32_t>> runs;
+  for (uint32_t s = 0; s < sectors; ++s) {
+    size_t off = (size_t)s * sectorSize;
+    size_t n = std::min<size_t>(sectorSize, arrayBytes - off);
+    if (memcmp(oldEntries + off, newEntries + off, n) == 0)
+      continue;
+    if (!runs.empty() && runs.back().second + 1 == s)
+      runs.back().second = s;
+    else
+      runs.push_back({s, s});
+  }
+
+  GptHeader newPrimary = primary;
+  newPrimary.partitionEntriesCrc32 = Crc32::Compute(newEntries, arrayBytes);
+  GptHeader backup = MakeBackupHeader(newPrimary, sectorSize);
+
+  auto addRuns = [&](uint64_t entryLba,
+                     const std::vector<std::pair<uint32_t, uint32_t>> &r) {
+    for (const auto &run : r) {
+      GptWrite w;
+      w.lba = entryLba + run.first;
+      w.data.assign(padded.begin() + (size_t)run.first * sectorSize,
+                    padded.begin() + (size_t)(run.second + 1) * sectorSize);
+      plan.push_back(std::move(w));
+    }
+  };
+
+  std::vector<std::pair<uint32_t, uint32_t>> all;
+  if (sectors)
+    all.push_back({0, sectors - 1});
+  addRuns(backup.partitionEntryLba, backupInSync ? runs : all);
+  plan.push_back({backup.currentLba, HeaderSector(backup, sectorSize)});
+  addRuns(newPrimary.partitionEntryLba, runs);
+  plan.push_back(
+      {newPrimary.currentLba, HeaderSector(newPrimary, sectorSize)});
+  return true;
+}
+
+} // namespace Protocols
+} // namespace DeepEye
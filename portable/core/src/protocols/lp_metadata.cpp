@@ -0,0 +1,162 @@
+#include "../../include/lp_metadata.h"
+#include "../../include/checksum.h"
+#include <cstring>
+
+namespace DeepEye {
+namespace Protocols {
+
+namespace {
+
+void SetError(std::string *error, const std::string &message) {
+  if (error)
+    *error = message;
+}
+
+// SHA-256 of `length` bytes with the 32-byte checksum at `field` zeroed.
+bool ChecksumMatches(const uint8_t *data, size_t length, size_t field) {
+  std::vector<uint8_t> copy(data, data + length);
+  uint8_t expected[Sha256::kDigestSize];
+  memcpy(expected, &copy[field], sizeof(expected));
+  memset(&copy[field], 0, sizeof(expected));
+  uint8_t actual[Sha256::kDigestSize];
+  Sha256::Compute(copy.data(), copy.size(), actual);
+  return memcmp(expected, actual, sizeof(actual)) == 0;
+}
+
+bool TableFits(const LpTableDescriptor &table, size_t entrySize,
+               uint32_t tablesSize) {
+  return table.entrySize >= entrySize &&
+         table.offset + (uint64_t)table.numEntries * table.entrySize <=
+             tablesSize;
+}
+
+std::string FixedString(const char *s, size_t capacity) {
+  return std::string(s, strnlen(s, capacity));
+}
+
+} // namespace
+
+bool LpParser::ParseGeometry(const uint8_t *buffer, LpGeometry &geometry) {
+  memcpy(&geometry, buffer, sizeof(geometry));
+  if (geometry.magic != kGeometryMagic ||
+      geometry.structSize < sizeof(geometry) ||
+      geometry.structSize > kGeometrySize)
+    return false;
+  if (!ChecksumMatches(buffer, geometry.structSize,
+                       offsetof(LpGeometry, checksum)))
+    return false;
+  return geometry.metadataSlotCount > 0 && geometry.metadataMaxSize > 0 &&
+         geometry.metadataMaxSize % 512 == 0;
+}
+
+uint64_t LpParser::SlotOffset(const LpGeometry &geometry, uint32_t slot,
+                              bool backup) {
+  uint64_t offset =
+      kMetadataOffset + (uint64_t)slot * geometry.metadataMaxSize;
+  if (backup)
+    offset += (uint64_t)geometry.metadataSlotCount * geometry.metadataMaxSize;
+  return offset;
+}
+
+bool LpParser::ParseMetadata(const uint8_t *buffer, size_t size,
+                             const LpGeometry &geometry, LpMetadata &out,
+                             std::string *error) {
+  LpHeader header;
+  if (size < sizeof(header)) {
+    SetError(error, "LP metadata truncated");
+    return false;
+  }
+  memcpy(&header, buffer, sizeof(header));
+  if (header.magic != kHeaderMagic || header.majorVersion != 10) {
+    SetError(error, "not LP metadata (bad magic or version)");
+    return false;
+  }
+  if (header.headerSize < sizeof(header) ||
+      (uint64_t)header.headerSize + header.tablesSize > size) {
+    SetError(error, "LP metadata sizes out of range");
+    return false;
+  }
+  if (!ChecksumMatches(buffer, header.headerSize,
+                       offsetof(LpHeader, headerChecksum))) {
+    SetError(error, "LP header checksum mismatch");
+    return false;
+  }
+  const uint8_t *tables = buffer + header.headerSize;
+  uint8_t digest[Sha256::kDigestSize];
+  Sha256::Compute(tables, header.tablesSize, digest);
+  if (memcmp(digest, header.tablesChecksum, sizeof(digest)) != 0) {
+    SetError(error, "LP tables checksum mismatch");
+    return false;
+  }
+  if (!TableFits(header.partitions, sizeof(LpPartitionEntry),
+                 header.tablesSize) ||
+      !TableFits(header.extents, sizeof(LpExtentEntry), header.tablesSize) ||
+      !TableFits(header.groups, sizeof(LpGroupEntry), header.tablesSize) ||
+      !TableFits(header.blockDevices, sizeof(LpBlockDeviceEntry),
+                 header.tablesSize)) {
+    SetError(error, "LP table descriptor out of range");
+    return false;
+  }
+
+  out.geometry = geometry;
+  out.partitions.clear();
+  out.blockDevices.clear();
+  for (uint32_t i = 0; i < header.blockDevices.numEntries; ++i) {
+    LpBlockDeviceEntry d;
+    memcpy(&d, tables + header.blockDevices.offset +
+                   (size_t)i * header.blockDevices.entrySize,
+           sizeof(d));
+    out.blockDevices.push_back(
+        FixedString(d.partitionName, sizeof(d.partitionName)));
+  }
+  std::vector<std::string> groups;
+  for (uint32_t i = 0; i < header.groups.numEntries; ++i) {
+    LpGroupEntry g;
+    memcpy(&g, tables + header.groups.offset +
+                   (size_t)i * header.groups.entrySize,
+           sizeof(g));
+    groups.push_back(FixedString(g.name, sizeof(g.name)));
+  }
+
+  out.partitions.reserve(header.partitions.numEntries);
+  for (uint32_t i = 0; i < header.partitions.numEntries; ++i) {
+    LpPartitionEntry p;
+    memcpy(&p, tables + header.partitions.offset +
+                   (size_t)i * header.partitions.entrySize,
+           sizeof(p));
+    if ((uint64_t)p.firstExtentIndex + p.numExtents >
+            header.extents.numEntries ||
+        (p.groupIndex >= groups.size() && !groups.empty())) {
+      SetError(error, "LP partition references a missing extent or group");
+      return false;
+    }
+    LpPartition part;
+    part.name = FixedString(p.name, sizeof(p.name));
+    part.group = p.groupIndex < groups.size() ? groups[p.groupIndex] : "";
+    part.attributes = p.attributes;
+    part.extents.reserve(p.numExtents);
+    for (uint32_t x = 0; x < p.numExtents; ++x) {
+      LpExtentEntry e;
+      memcpy(&e, tables + header.extents.offset +
+                     (size_t)(p.firstExtentIndex + x) *
+                         header.extents.entrySize,
+             sizeof(e));
+      // Readers map every extent that is not Zero onto a block device.
+      if (e.targetType != kTargetLinear && e.targetType != kTargetZero) {
+        SetError(error, "LP extent of an unknown target type");
+        return false;
+      }
+      if (e.targetSource >= out.blockDevices.size()) {
+        SetError(error, "LP extent on an unknown block device");
+        return false;
+      }
+      part.extents.push_back(
+          {e.numSectors, e.targetType, e.targetData, e.targetSource});
+    }
+    out.partitions.push_back(std::move(part));
+  }
+  return true;
+}
+
+} // namespace Protocols
+} // namespace DeepEye
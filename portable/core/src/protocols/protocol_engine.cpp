@@ -1,15 +1,58 @@
 #include "../../include/brom_proto.h"
+#include "../../include/checksum.h"
 #include "../../include/deepeye_core.h"
 #include "../../include/edl_proto.h"
+#include "../../include/firehose_pipeline.h"
+#include "../../include/fs_allocation.h"
 #include "../../include/gpt_parser.h"
+#include "../../include/gpt_writer.h"
+#include "../../include/lp_metadata.h"
+#include "../../include/sparse_handler.h"
+#include "../../include/thread_pool.h"
+#include "../../include/trace.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 
 namespace DeepEye {
 namespace Core {
 
-ProtocolEngine::ProtocolEngine(ITransport *transport) : _transport(transport) {}
+namespace {
+
+// Overlapping memcmp: vectorized by libc, no second buffer needed.
+bool AllZero(const uint8_t *p, size_t n) {
+  return n == 0 || (p[0] == 0 && memcmp(p, p + 1, n - 1) == 0);
+}
+
+} // namespace
+
+ProtocolEngine::ProtocolEngine(ITransport *transport)
+    : _transport(transport), _pipeline(transport, _timeouts) {}
+
+ProtocolEngine::WriteWindow::WriteWindow(ProtocolEngine &engine)
+    : _engine(engine), _outer(engine._deferAcks) {
+  engine._deferAcks = true;
+}
+
+bool ProtocolEngine::WriteWindow::Close() {
+  if (_closed)
+    return true;
+  _closed = true;
+  _engine._deferAcks = _outer;
+  // An enclosing window collects the ACKs when it closes.
+  return _outer || _engine._targetType != "QCOM" || _engine._pipeline.Sync();
+}
 
 bool ProtocolEngine::Identify() {
+  TraceSpan span("engine.identify", TraceCategory::Pipeline);
+  _firehoseReady = false;
+  _partitions.clear();
+  _cache.Clear();
+  _pipeline.Reset();
+  _timeouts.Reset();
+
   // Try MediaTek BROM first
   Protocols::BromManager brom(_transport);
   if (brom.Handshake()) {
@@ -29,89 +72,1133 @@ bool ProtocolEngine::Identify() {
   return false;
 }
 
+bool ProtocolEngine::EnsureFirehose() {
+  // The Firehose configure exchange is per-session state; repeating it for
+  // every operation costs a round trip and resets the programmer.
+  if (_firehoseReady)
+    return true;
+  Protocols::EdlManager edl(_transport);
+  _firehoseReady = edl.FirehoseHandshake();
+  return _firehoseReady;
+}
+
 std::vector<Protocols::PartitionInfo> ProtocolEngine::GetPartitions() {
+  TraceSpan span("engine.read_gpt", TraceCategory::Pipeline);
   std::vector<Protocols::PartitionInfo> partitions;
 
-  if (_targetType == "QCOM") {
-    Protocols::EdlManager edl(_transport);
-    if (edl.FirehoseHandshake()) {
-      std::vector<uint8_t> headerBuf;
-      if (edl.ReadPartition("gpt", 1, 1, headerBuf)) {
-        Protocols::GptHeader header;
-        if (Protocols::GptParser::ParseHeader(headerBuf.data(), header)) {
-          uint32_t entrySectors =
-              (header.numPartitionEntries * header.partitionEntrySize + 511) /
-              512;
-          std::vector<uint8_t> entriesBuf;
-          if (edl.ReadPartition("gpt", 2, entrySectors, entriesBuf)) {
-            partitions = Protocols::GptParser::ParseEntries(
-                entriesBuf.data(), header.numPartitionEntries,
-                header.partitionEntrySize);
+  std::vector<uint8_t> headerBuf;
+  Protocols::GptHeader header;
+  if (ReadSectors(1, 1, headerBuf) &&
+      Protocols::GptParser::ParseHeader(headerBuf.data(), header)) {
+    uint32_t entrySectors =
+        (header.numPartitionEntries * header.partitionEntrySize + 511) / 512;
+    std::vector<uint8_t> entriesBuf;
+    if (ReadSectors(2, entrySectors, entriesBuf)) {
+      partitions = Protocols::GptParser::ParseEntries(
+          entriesBuf.data(), header.numPartitionEntries,
+          header.partitionEntrySize, 512);
+      _gptSnapshot = headerBuf;
+      _gptSnapshot.insert(_gptSnapshot.end(), entriesBuf.begin(),
+                          entriesBuf.end());
+    }
+  }
+
+  _partitions = partitions;
+  LoadLogicalPartitions();
+  return _partitions;
+}
+
+void ProtocolEngine::LoadLogicalPartitions() {
+  _lpMetadata = Protocols::LpMetadata();
+  _lpSlotKnown = false;
+  // (FindPartition would re-enter GetPartitions on an empty table.)
+  const Protocols::PartitionInfo *super =
+      _partitions.empty() ? nullptr : FindPartition("super");
+  if (!super)
+    return;
+  const uint32_t superLun = super->lun;
+  const uint64_t superSectors = super->endLba - super->startLba + 1;
+
+  // Geometry, then its backup copy.
+  using Protocols::LpParser;
+  std::vector<uint8_t> buf(LpParser::kGeometrySize);
+  Protocols::LpGeometry geometry;
+  bool found = false;
+  for (uint32_t copy = 0; copy < 2 && !found; ++copy) {
+    uint64_t sector =
+        (LpParser::kGeometryOffset + copy * LpParser::kGeometrySize) / 512;
+    found = ReadPartition("super", sector, buf.size() / 512, buf.data()) &&
+            LpParser::ParseGeometry(buf.data(), geometry);
+  }
+  if (!found) {
+    std::cerr << "[CORE] super has no valid LP geometry." << std::endl;
+    return;
+  }
+
+  // The metadata slot of the slot in use, then its backup copy. Another
+  // slot's metadata may place the same partitions elsewhere, so without
+  // knowing the slot, slot 0 is still listed but not written through.
+  int slot = MetadataSlot(geometry.metadataSlotCount);
+  if (slot < 0)
+    std::cerr << "[CORE] Slot in use unknown; logical partitions are "
+                 "read-only."
+              << std::endl;
+  std::string error;
+  Protocols::LpMetadata metadata;
+  buf.resize(geometry.metadataMaxSize);
+  found = false;
+  for (bool backup : {false, true}) {
+    uint64_t offset =
+        LpParser::SlotOffset(geometry, slot < 0 ? 0 : (uint32_t)slot, backup);
+    if (offset / 512 + buf.size() / 512 > superSectors)
+      continue;
+    if (ReadPartition("super", offset / 512, buf.size() / 512, buf.data()) &&
+        LpParser::ParseMetadata(buf.data(), buf.size(), geometry, metadata,
+                                &error)) {
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    std::cerr << "[CORE] Unreadable LP metadata: " << error << std::endl;
+    return;
+  }
+  for (const std::string &device : metadata.blockDevices) {
+    if (!FindPartition(device)) {
+      std::cerr << "[CORE] LP block device not in GPT: " << device
+                << std::endl;
+      return;
+    }
+  }
+
+  std::vector<Protocols::PartitionInfo> logical;
+  for (const Protocols::LpPartition &lp : metadata.partitions) {
+    uint64_t sectors = lp.Sectors();
+    // Empty inactive-slot partitions have nothing to read.
+    if (sectors == 0 || FindPartition(lp.name))
+      continue;
+    Protocols::PartitionInfo info;
+    info.name = lp.name;
+    info.lun = superLun;
+    info.startLba = 0;
+    info.endLba = sectors - 1;
+    info.sizeInBytes = sectors * 512;
+    info.attributes = lp.attributes;
+    info.parent = "super";
+    logical.push_back(std::move(info));
+  }
+  _lpMetadata = std::move(metadata);
+  _lpSlotKnown = slot >= 0;
+  _partitions.insert(_partitions.end(), logical.begin(), logical.end());
+}
+
+int ProtocolEngine::MetadataSlot(uint32_t slotCount) const {
+  if (slotCount == 1) // not A/B
+    return 0;
+  std::string suffix = _slotSuffix;
+  if (suffix.empty()) {
+    // Qualcomm A/B attributes: bit 50 marks the active slot's partitions.
+    const uint64_t kSlotActive = 1ull << 50;
+    for (const auto &p : _partitions) {
+      if (p.parent.empty() && p.name.size() == 6 &&
+          p.name.compare(0, 5, "boot_") == 0 && (p.attributes & kSlotActive)) {
+        if (!suffix.empty())
+          return -1; // more than one
+        suffix = p.name.substr(4);
+      }
+    }
+  }
+  if (suffix.size() != 2 || suffix[0] != '_' || suffix[1] < 'a')
+    return -1;
+  uint32_t slot = (uint32_t)(suffix[1] - 'a');
+  return slot < slotCount ? (int)slot : -1;
+}
+
+bool ProtocolEngine::LogicalWritable(const std::string &name) const {
+  if (_lpSlotKnown)
+    return true;
+  std::cerr << "[CORE] Not writing " << name
+            << ": no slot to take its extents from (see SetSlotSuffix)."
+            << std::endl;
+  return false;
+}
+
+bool ProtocolEngine::ForEachExtent(const std::string &name,
+                                   uint64_t sectorOffset,
+                                   uint64_t sectorCount,
+                                   const ExtentVisitor &visit) {
+  const Protocols::LpPartition *lp = nullptr;
+  for (const auto &candidate : _lpMetadata.partitions)
+    if (candidate.name == name)
+      lp = &candidate;
+  if (!lp)
+    return false;
+
+  uint64_t extentStart = 0, done = 0;
+  for (const Protocols::LpExtent &e : lp->extents) {
+    if (done == sectorCount)
+      break;
+    uint64_t extentEnd = extentStart + e.sectors;
+    uint64_t pos = sectorOffset + done;
+    if (pos < extentEnd) {
+      uint64_t n = std::min(extentEnd - pos, sectorCount - done);
+      if (!visit(e, e.targetSector + (pos - extentStart), n, done))
+        return false;
+      done += n;
+    }
+    extentStart = extentEnd;
+  }
+  return done == sectorCount;
+}
+
+const Protocols::PartitionInfo *
+ProtocolEngine::FindPartition(const std::string &name) {
+  if (_partitions.empty())
+    GetPartitions();
+  for (const auto &p : _partitions) {
+    if (p.name == name)
+      return &p;
+  }
+  return nullptr;
+}
+
+bool ProtocolEngine::ReadPartition(const std::string &name,
+                                   uint64_t sectorOffset, uint64_t sectorCount,
+                                   uint8_t *out) {
+  return ReadPartition(name, sectorOffset, sectorCount, out, UINT64_MAX);
+}
+
+bool ProtocolEngine::ReadPartition(const std::string &name,
+                                   uint64_t sectorOffset, uint64_t sectorCount,
+                                   uint8_t *out, uint64_t aheadEnd) {
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  const uint64_t sectors = p ? p->endLba - p->startLba + 1 : 0;
+  if (!p || sectorOffset + sectorCount > sectors)
+    return false;
+  aheadEnd = std::min(std::max(aheadEnd, sectorOffset + sectorCount), sectors);
+
+  if (!p->parent.empty()) {
+    return ForEachExtent(
+        name, sectorOffset, sectorCount,
+        [&](const Protocols::LpExtent &e, uint64_t sector, uint64_t count,
+            uint64_t done) {
+          uint8_t *dst = out + done * 512;
+          if (e.targetType == Protocols::LpParser::kTargetZero) {
+            memset(dst, 0, count * 512);
+            return true;
           }
-        }
+          // Read-ahead stays inside this extent.
+          uint64_t ahead = std::min(e.targetSector + e.sectors - sector,
+                                    aheadEnd - (sectorOffset + done));
+          return ReadPartition(_lpMetadata.blockDevices[e.device], sector,
+                               count, dst, sector + ahead);
+        });
+  }
+
+  return CachedRead(name, p->lun, p->startLba + sectorOffset, sectorCount,
+                    p->startLba, p->startLba + aheadEnd - 1, out);
+}
+
+bool ProtocolEngine::WritePartition(const std::string &name,
+                                    uint64_t sectorOffset, const uint8_t *data,
+                                    size_t length) {
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  if (!p || length % 512 != 0 ||
+      sectorOffset + length / 512 > p->endLba - p->startLba + 1)
+    return false;
+
+  if (!p->parent.empty()) {
+    if (!LogicalWritable(name))
+      return false;
+    return ForEachExtent(
+        name, sectorOffset, length / 512,
+        [&](const Protocols::LpExtent &e, uint64_t sector, uint64_t count,
+            uint64_t done) {
+          const uint8_t *src = data + done * 512;
+          // A zero extent has no backing store: only zeros "fit" there.
+          if (e.targetType == Protocols::LpParser::kTargetZero)
+            return AllZero(src, count * 512);
+          return WritePartition(_lpMetadata.blockDevices[e.device], sector,
+                                src, count * 512);
+        });
+  }
+
+  return DeviceWrite(name, p->lun, p->startLba + sectorOffset, data, length);
+}
+
+bool ProtocolEngine::ForEachPiece(const std::string &name,
+                                  uint64_t sectorOffset, uint64_t sectorCount,
+                                  const PieceVisitor &visit) {
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  if (!p || sectorOffset + sectorCount > p->endLba - p->startLba + 1)
+    return false;
+  if (p->parent.empty())
+    return visit(p, p->startLba + sectorOffset, sectorCount, 0);
+
+  return ForEachExtent(
+      name, sectorOffset, sectorCount,
+      [&](const Protocols::LpExtent &e, uint64_t sector, uint64_t count,
+          uint64_t done) {
+        if (e.targetType == Protocols::LpParser::kTargetZero)
+          return visit(nullptr, 0, count, done);
+        return ForEachPiece(
+            _lpMetadata.blockDevices[e.device], sector, count,
+            [&](const Protocols::PartitionInfo *device, uint64_t lba,
+                uint64_t n, uint64_t pieceDone) {
+              return visit(device, lba, n, done + pieceDone);
+            });
+      });
+}
+
+bool ProtocolEngine::ReadBatch(const std::vector<SectorRequest> &requests) {
+  return RunBatch(requests, false);
+}
+
+bool ProtocolEngine::WriteBatch(const std::vector<SectorRequest> &requests) {
+  return RunBatch(requests, true);
+}
+
+bool ProtocolEngine::RunBatch(const std::vector<SectorRequest> &requests,
+                              bool write) {
+  TraceSpan span(write ? "batch.write" : "batch.read", TraceCategory::Pipeline);
+  // Queue index -> partition (for the command label) and request memory.
+  std::vector<std::pair<const Protocols::PartitionInfo *, uint8_t *>> pieces;
+  IoQueue queue;
+  for (const SectorRequest &r : requests) {
+    const Protocols::PartitionInfo *target = FindPartition(r.partition);
+    if (write && target && !target->parent.empty() &&
+        !LogicalWritable(r.partition))
+      return false;
+    bool mapped = ForEachPiece(
+        r.partition, r.sectorOffset, r.sectorCount,
+        [&](const Protocols::PartitionInfo *p, uint64_t lba, uint64_t count,
+            uint64_t done) {
+          uint8_t *buffer = r.buffer + done * 512;
+          if (!p) { // zero extent
+            if (write)
+              return AllZero(buffer, count * 512);
+            memset(buffer, 0, count * 512);
+            return true;
+          }
+          queue.Add(p->lun, lba, count);
+          pieces.emplace_back(p, buffer);
+          return true;
+        });
+    if (!mapped) {
+      std::cerr << "[CORE] Batch request out of range: " << r.partition
+                << " +" << r.sectorOffset << " x" << r.sectorCount
+                << std::endl;
+      return false;
+    }
+  }
+
+  std::vector<IoQueue::Run> runs = queue.Plan(write, kTransferSectors);
+  _batchStats.requests += queue.Size();
+  _batchStats.commands += runs.size();
+  std::vector<uint8_t> staging;
+  uint64_t moved = 0;
+  WriteWindow window(*this);
+  for (const IoQueue::Run &run : runs) {
+    const IoQueue::Slice &only = run.slices.front();
+    const Protocols::PartitionInfo *p = pieces[only.request].first;
+    const size_t bytes = run.count * 512;
+    _batchStats.sectors += run.count;
+    moved += bytes;
+    // A run that is one whole request needs no staging copy.
+    uint8_t *direct = run.slices.size() == 1 && only.count == run.count
+                          ? pieces[only.request].second +
+                                only.requestSector * 512
+                          : nullptr;
+    if (write) {
+      if (!direct) {
+        staging.resize(bytes);
+        for (const IoQueue::Slice &s : run.slices)
+          memcpy(&staging[s.runSector * 512],
+                 pieces[s.request].second + s.requestSector * 512,
+                 s.count * 512);
       }
+      if (!DeviceWrite(p->name, run.lun, run.lba,
+                       direct ? direct : staging.data(), bytes))
+        return false;
+    } else {
+      if (!direct)
+        staging.resize(bytes);
+      // Read-ahead stays within the partition the run starts in.
+      if (!CachedRead(p->name, run.lun, run.lba, run.count, p->startLba,
+                      std::max(p->endLba, run.lba + run.count - 1),
+                      direct ? direct : staging.data()))
+        return false;
+      if (!direct)
+        for (const IoQueue::Slice &s : run.slices)
+          memcpy(pieces[s.request].second + s.requestSector * 512,
+                 &staging[s.runSector * 512], s.count * 512);
     }
+  }
+  span.SetBytes(moved);
+  return !write || window.Close();
+}
+
+bool ProtocolEngine::DeviceRead(const std::string &label, uint32_t lun,
+                                uint64_t lba, uint64_t count, uint64_t limit,
+                                uint8_t *out) {
+  if (_targetType == "QCOM") {
+    if (!EnsureFirehose())
+      return false;
+    return WithRetries("Read", label, lba, [&](bool &timedOut) {
+      if (_pipeline.Read(label, lun, lba, count, limit, out))
+        return true;
+      timedOut = _pipeline.Retryable();
+      return false;
+    });
   } else if (_targetType == "MTK") {
-    Protocols::BromManager brom(_transport);
-    std::vector<uint8_t> headerBuf;
-    if (brom.DaReadPartition("gpt", 1, 1, headerBuf)) {
-      Protocols::GptHeader header;
-      if (Protocols::GptParser::ParseHeader(headerBuf.data(), header)) {
-        uint32_t entrySectors =
-            (header.numPartitionEntries * header.partitionEntrySize + 511) /
-            512;
-        std::vector<uint8_t> entriesBuf;
-        if (brom.DaReadPartition("gpt", 2, entrySectors, entriesBuf)) {
-          partitions = Protocols::GptParser::ParseEntries(
-              entriesBuf.data(), header.numPartitionEntries,
-              header.partitionEntrySize);
-        }
+    if (!SingleLun(label, lun))
+      return false;
+    return WithRetries("Read", label, lba, [&](bool &timedOut) {
+      Protocols::BromManager brom(_transport);
+      uint64_t start = Tracer::NowNs();
+      if (brom.DaReadPartition(label, lba, count, out,
+                               _timeouts.For(count * 512))) {
+        _timeouts.Record(count * 512, Tracer::NowNs() - start);
+        return true;
+      }
+      // The DA reports nothing but a short transfer.
+      _timeouts.RecordTimeout();
+      timedOut = true;
+      return false;
+    });
+  }
+  return false;
+}
+
+bool ProtocolEngine::DeviceWrite(const std::string &label, uint32_t lun,
+                                 uint64_t lba, const uint8_t *data,
+                                 size_t length) {
+  _cache.Invalidate(lun, lba, length / 512);
+  if (_targetType == "QCOM") {
+    if (!EnsureFirehose())
+      return false;
+    return WithRetries("Write", label, lba, [&](bool &timedOut) {
+      if (_pipeline.Write(label, lun, lba, data, length, _deferAcks))
+        return true;
+      timedOut = _pipeline.Retryable();
+      return false;
+    });
+  } else if (_targetType == "MTK") {
+    if (!SingleLun(label, lun))
+      return false;
+    return WithRetries("Write", label, lba, [&](bool &timedOut) {
+      Protocols::BromManager brom(_transport);
+      uint64_t start = Tracer::NowNs();
+      if (brom.DaWritePartition(label, lba, data, length,
+                                _timeouts.For(length))) {
+        _timeouts.Record(length, Tracer::NowNs() - start);
+        return true;
       }
+      _timeouts.RecordTimeout();
+      timedOut = true;
+      return false;
+    });
+  }
+  return false;
+}
+
+bool ProtocolEngine::SingleLun(const std::string &label, uint32_t lun) const {
+  if (lun == 0)
+    return true;
+  std::cerr << "[CORE] " << label << " is on LUN " << lun
+            << ", which the DA cannot address." << std::endl;
+  return false;
+}
+
+bool ProtocolEngine::WithRetries(
+    const char *what, const std::string &label, uint64_t lba,
+    const std::function<bool(bool &timedOut)> &attempt) {
+  for (uint32_t retry = 1;; ++retry) {
+    bool timedOut = false;
+    if (attempt(timedOut))
+      return true;
+    if (!timedOut || retry > kMaxRetries)
+      return false;
+    std::cerr << "[CORE] " << what << " of " << label << " at sector " << lba
+              << " timed out, retrying (" << retry << "/" << kMaxRetries
+              << ")." << std::endl;
+  }
+}
+
+bool ProtocolEngine::CachedRead(const std::string &label, uint32_t lun,
+                                uint64_t lba, uint64_t count, uint64_t first,
+                                uint64_t last, uint8_t *out) {
+  // Bulk transfers would only churn the cache.
+  if (!_cache.Enabled() || count > _cache.ExtentSectors())
+    return DeviceRead(label, lun, lba, count, last + 1, out);
+  if (_cache.Lookup(lun, lba, count, out))
+    return true;
+
+  uint64_t from = std::max(first, _cache.ExtentStart(lba));
+  uint64_t to = std::min(last + 1, _cache.ExtentStart(lba + count - 1) +
+                                       _cache.ExtentSectors());
+  std::vector<uint8_t> buf((to - from) * 512);
+  TraceSpan fill("cache.fill", TraceCategory::Pipeline, buf.size());
+  if (!DeviceRead(label, lun, from, to - from, last + 1, buf.data()))
+    return false;
+  _cache.Insert(lun, from, to - from, buf.data());
+  memcpy(out, &buf[(lba - from) * 512], count * 512);
+  return true;
+}
+
+bool ProtocolEngine::ReadSectors(uint64_t lba, uint64_t count,
+                                 std::vector<uint8_t> &out) {
+  // Read-ahead may only reach back: the end of the disk is not known here.
+  out.resize(count * 512);
+  return CachedRead("gpt", 0, lba, count, 0, lba + count - 1, out.data());
+}
+
+bool ProtocolEngine::WriteSectors(uint64_t lba, const uint8_t *data,
+                                  size_t length) {
+  return DeviceWrite("gpt", 0, lba, data, length);
+}
+
+bool ProtocolEngine::WritePartitionTable(
+    const std::vector<Protocols::PartitionInfo> &partitions) {
+  using Protocols::GptWriter;
+  if (_gptSnapshot.empty())
+    GetPartitions();
+  Protocols::GptHeader primary;
+  if (_gptSnapshot.size() < 512 ||
+      !Protocols::GptParser::ParseHeader(_gptSnapshot.data(), primary)) {
+    std::cerr << "[CORE] No GPT to update." << std::endl;
+    return false;
+  }
+  const uint32_t entrySectors = GptWriter::EntrySectors(primary, 512);
+  const size_t arrayBytes =
+      (size_t)primary.numPartitionEntries * primary.partitionEntrySize;
+  const uint8_t *oldEntries = _gptSnapshot.data() + 512;
+
+  // The plan patches the sectors that differ from the snapshot and copies
+  // the rest, so a damaged primary would spread to both tables.
+  bool primaryIntact =
+      primary.headerSize <= 512 && _gptSnapshot.size() >= 512 + arrayBytes;
+  if (primaryIntact) {
+    Protocols::GptHeader sealed = primary;
+    GptWriter::SealHeader(sealed);
+    primaryIntact = sealed.headerCrc32 == primary.headerCrc32 &&
+                    Protocols::Crc32::Compute(oldEntries, arrayBytes) ==
+                        primary.partitionEntriesCrc32;
+  }
+  if (!primaryIntact) {
+    std::cerr << "[CORE] Primary GPT fails its CRC check; not updating."
+              << std::endl;
+    return false;
+  }
+
+  // The backup array only needs the changed sectors if it currently matches
+  // the primary; otherwise (stale or corrupt backup) it is rewritten whole.
+  bool backupInSync = false;
+  std::vector<uint8_t> backupBuf;
+  Protocols::GptHeader backup;
+  if (ReadSectors(primary.backupLba, 1, backupBuf) &&
+      Protocols::GptParser::ParseHeader(backupBuf.data(), backup)) {
+    Protocols::GptHeader sealed = backup;
+    GptWriter::SealHeader(sealed);
+    // Matching header fields say nothing of the array itself: check it.
+    std::vector<uint8_t> backupEntries;
+    backupInSync =
+        sealed.headerCrc32 == backup.headerCrc32 &&
+        backup.partitionEntriesCrc32 == primary.partitionEntriesCrc32 &&
+        backup.partitionEntryLba == primary.backupLba - entrySectors &&
+        ReadSectors(backup.partitionEntryLba, entrySectors, backupEntries) &&
+        Protocols::Crc32::Compute(backupEntries.data(), arrayBytes) ==
+            primary.partitionEntriesCrc32;
+  }
+
+  // Logical partitions live in super's LP metadata, not in the GPT.
+  std::vector<Protocols::PartitionInfo> gpt, logical;
+  for (const auto &p : partitions)
+    if (p.parent.empty())
+      gpt.push_back(p);
+  for (const auto &p : _partitions)
+    if (!p.parent.empty())
+      logical.push_back(p);
+
+  std::string error;
+  std::vector<uint8_t> newEntries;
+  std::vector<Protocols::GptWrite> plan;
+  if (!GptWriter::EncodeEntries(gpt, primary, oldEntries, newEntries,
+                                &error) ||
+      !GptWriter::Plan(primary, oldEntries, newEntries.data(), 512,
+                       backupInSync, plan, &error)) {
+    std::cerr << "[CORE] GPT update rejected: " << error << std::endl;
+    return false;
+  }
+  if (plan.empty())
+    return true;
+
+  size_t bytes = 0;
+  for (const auto &w : plan)
+    bytes += w.data.size();
+  TraceSpan span("gpt.write", TraceCategory::Pipeline, bytes);
+  for (const auto &w : plan) {
+    if (!WriteSectors(w.lba, w.data.data(), w.data.size())) {
+      std::cerr << "[CORE] GPT write failed at LBA " << w.lba << std::endl;
+      return false;
     }
   }
 
-  return partitions;
+  // The last write is the new primary header.
+  memcpy(_gptSnapshot.data(), plan.back().data.data(), 512);
+  memcpy(_gptSnapshot.data() + 512, newEntries.data(), newEntries.size());
+  _partitions = Protocols::GptParser::ParseEntries(
+      newEntries.data(), primary.numPartitionEntries,
+      primary.partitionEntrySize, 512);
+  _partitions.insert(_partitions.end(), logical.begin(), logical.end());
+  return true;
 }
 
 bool ProtocolEngine::DumpPartition(const std::string &name,
                                    const std::string &outPath) {
-  if (_targetType == "QCOM") {
-    Protocols::EdlManager edl(_transport);
-    if (edl.FirehoseHandshake()) {
-      std::vector<uint8_t> data;
-      if (edl.ReadPartition(name, 0, 1024, data)) {
-        return true;
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  if (!p) {
+    std::cerr << "[CORE] Unknown partition: " << name << std::endl;
+    return false;
+  }
+
+  const uint64_t totalSectors = p->endLba - p->startLba + 1;
+  const uint64_t totalBytes = totalSectors * 512;
+  DumpWriter::Options options = _dumpOptions;
+  options.bufferSize = kTransferSectors * 512;
+  DumpWriter out;
+  if (!out.Open(outPath, totalBytes, options))
+    return false;
+  TraceSpan span("dump.partition", TraceCategory::Pipeline, totalBytes);
+
+  // Device data lands directly in the writer's buffers; with io_uring the
+  // disk write of one chunk overlaps the USB read of the next.
+  for (uint64_t sector = 0; sector < totalSectors;) {
+    uint64_t count = std::min(kTransferSectors, totalSectors - sector);
+    uint8_t *chunk;
+    {
+      TraceSpan wait("dump.disk_wait", TraceCategory::Pipeline);
+      chunk = out.AcquireBuffer();
+    }
+    if (!chunk || !ReadPartition(name, sector, count, chunk))
+      return false;
+    {
+      TraceSpan write("dump.disk_write", TraceCategory::Pipeline, count * 512);
+      if (!out.Commit(count * 512))
+        return false;
+    }
+    sector += count;
+    if (_progress)
+      _progress(sector * 512, totalBytes);
+  }
+  return out.Close();
+}
+
+bool ProtocolEngine::DumpPartition(const std::string &name,
+                                   BackupArchiveWriter &archive) {
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  if (!p) {
+    std::cerr << "[CORE] Unknown partition: " << name << std::endl;
+    return false;
+  }
+  if (!archive.HasGptSnapshot())
+    archive.SetGptSnapshot(_gptSnapshot);
+  if (!archive.BeginPartition(*p))
+    return false;
+
+  const uint64_t totalSectors = p->endLba - p->startLba + 1;
+  const uint64_t totalBytes = totalSectors * 512;
+  std::vector<uint8_t> chunk(kTransferSectors * 512);
+  TraceSpan span("backup.partition", TraceCategory::Pipeline, totalBytes);
+
+  for (uint64_t sector = 0; sector < totalSectors;) {
+    uint64_t count = std::min(kTransferSectors, totalSectors - sector);
+    if (!ReadPartition(name, sector, count, chunk.data()))
+      return false;
+    {
+      // Blocks only when the compression workers fall behind.
+      TraceSpan append("backup.append", TraceCategory::Pipeline, count * 512);
+      if (!archive.Append(chunk.data(), count * 512))
+        return false;
+    }
+    sector += count;
+    if (_progress)
+      _progress(sector * 512, totalBytes);
+  }
+  return archive.EndPartition();
+}
+
+bool ProtocolEngine::DumpPartition(const std::string &name, ChunkStore &store,
+                                   const std::string &object) {
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  if (!p) {
+    std::cerr << "[CORE] Unknown partition: " << name << std::endl;
+    return false;
+  }
+  if (!store.BeginObject(object))
+    return false;
+
+  const uint64_t totalSectors = p->endLba - p->startLba + 1;
+  const uint64_t totalBytes = totalSectors * 512;
+  std::vector<uint8_t> chunk(kTransferSectors * 512);
+  TraceSpan span("cas.partition", TraceCategory::Pipeline, totalBytes);
+
+  for (uint64_t sector = 0; sector < totalSectors;) {
+    uint64_t count = std::min(kTransferSectors, totalSectors - sector);
+    if (!ReadPartition(name, sector, count, chunk.data()))
+      return false;
+    {
+      TraceSpan append("cas.append", TraceCategory::Pipeline, count * 512);
+      if (!store.Append(chunk.data(), count * 512))
+        return false;
+    }
+    sector += count;
+    if (_progress)
+      _progress(sector * 512, totalBytes);
+  }
+  return store.EndObject();
+}
+
+bool ProtocolEngine::DumpAllocated(const std::string &name,
+                                   const std::string &outPath) {
+  using Protocols::SparseImageHandler;
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  if (!p) {
+    std::cerr << "[CORE] Unknown partition: " << name << std::endl;
+    return false;
+  }
+  const uint64_t totalSectors = p->endLba - p->startLba + 1;
+  const uint64_t totalBytes = totalSectors * 512;
+
+  Protocols::FsAllocation map;
+  std::string error;
+  {
+    TraceSpan scan("dump.fs_scan", TraceCategory::Pipeline);
+    Protocols::SectorReader reader = [&](uint64_t sector, uint64_t count,
+                                         uint8_t *out) {
+      return sector + count <= totalSectors &&
+             ReadPartition(name, sector, count, out);
+    };
+    if (!map.Load(reader, totalSectors, &error))
+      std::cerr << "[CORE] " << name << ": no allocation map (" << error
+                << "), dumping every block." << std::endl;
+  }
+  const uint32_t blockSize = map.BlockSize();
+  if ((uint64_t)map.BlockCount() * blockSize != totalBytes ||
+      map.BlockCount() > UINT32_MAX) {
+    std::cerr << "[CORE] " << name << " does not fit a sparse image."
+              << std::endl;
+    return false;
+  }
+  std::cout << "[CORE] " << name << ": " << map.Filesystem() << " uses "
+            << map.UsedBlocks() << " of " << map.BlockCount() << " blocks."
+            << std::endl;
+
+  std::ofstream out(outPath, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    std::cerr << "[CORE] Cannot create " << outPath << std::endl;
+    return false;
+  }
+  Protocols::SparseHeader header = {SparseImageHandler::kMagic,
+                                    1,
+                                    0,
+                                    sizeof(Protocols::SparseHeader),
+                                    sizeof(Protocols::ChunkHeader),
+                                    blockSize,
+                                    (uint32_t)map.BlockCount(),
+                                    0,
+                                    0};
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  TraceSpan span("dump.allocated", TraceCategory::Pipeline,
+                 map.UsedBlocks() * blockSize);
+  // RAW chunk sizes are 32-bit byte counts.
+  const uint64_t maxRawBlocks = (1ull << 30) / blockSize;
+  const uint64_t sectorsPerBlock = blockSize / 512;
+  std::vector<uint8_t> chunk(kTransferSectors * 512);
+  for (uint64_t block = 0; block < map.BlockCount();) {
+    const bool used = map.IsUsed(block);
+    uint64_t run = map.RunLength(block);
+    if (used)
+      run = std::min(run, maxRawBlocks);
+    Protocols::ChunkHeader ch = {
+        used ? SparseImageHandler::kChunkRaw
+             : SparseImageHandler::kChunkDontCare,
+        0, (uint32_t)run,
+        (uint32_t)(sizeof(ch) + (used ? run * blockSize : 0))};
+    out.write(reinterpret_cast<const char *>(&ch), sizeof(ch));
+    ++header.total_chunks;
+
+    if (used) {
+      uint64_t sector = block * sectorsPerBlock;
+      const uint64_t end = sector + run * sectorsPerBlock;
+      while (sector < end) {
+        uint64_t count = std::min(kTransferSectors, end - sector);
+        if (!ReadPartition(name, sector, count, chunk.data(), end))
+          return false;
+        out.write(reinterpret_cast<const char *>(chunk.data()), count * 512);
+        sector += count;
+        if (_progress)
+          _progress(sector * 512, totalBytes);
       }
     }
-  } else if (_targetType == "MTK") {
-    Protocols::BromManager brom(_transport);
-    std::vector<uint8_t> data;
-    return brom.DaReadPartition(name, 0, 1024, data);
+    block += run;
+    if (_progress)
+      _progress(block * blockSize, totalBytes);
   }
-  return false;
+
+  out.seekp(0);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.close();
+  if (!out) {
+    std::cerr << "[CORE] Write failed: " << outPath << std::endl;
+    return false;
+  }
+  return true;
 }
 
 bool ProtocolEngine::FlashPartition(const std::string &name,
                                     const std::string &inPath) {
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  if (!p) {
+    std::cerr << "[CORE] Unknown partition: " << name << std::endl;
+    return false;
+  }
+
+  std::ifstream in(inPath, std::ios::binary | std::ios::ate);
+  if (!in)
+    return false;
+  const uint64_t totalBytes = (uint64_t)in.tellg();
+  in.seekg(0);
+
+  uint8_t magic[4] = {};
+  in.read(reinterpret_cast<char *>(magic), sizeof(magic));
+  in.clear();
+  in.seekg(0);
+  if (totalBytes >= sizeof(Protocols::SparseHeader) &&
+      Protocols::SparseImageHandler::IsSparse(magic))
+    return FlashSparse(name, in, totalBytes);
+
+  if ((totalBytes + 511) / 512 > p->endLba - p->startLba + 1) {
+    std::cerr << "[CORE] Image larger than partition " << name << std::endl;
+    return false;
+  }
+
+  std::vector<uint8_t> chunk(kTransferSectors * 512);
+  TraceSpan span("flash.partition", TraceCategory::Pipeline, totalBytes);
+  WriteWindow window(*this);
+  uint64_t zeroStart = 0, zeroSectors = 0; // pending run of zero chunks
+  for (uint64_t done = 0; done < totalBytes;) {
+    size_t len = (size_t)std::min<uint64_t>(chunk.size(), totalBytes - done);
+    {
+      TraceSpan read("flash.disk_read", TraceCategory::Pipeline, len);
+      in.read(reinterpret_cast<char *>(chunk.data()), len);
+    }
+    if ((size_t)in.gcount() != len)
+      return false;
+
+    // Pad the tail to a whole sector.
+    size_t padded = (len + 511) & ~(size_t)511;
+    memset(chunk.data() + len, 0, padded - len);
+
+    if (AllZero(chunk.data(), padded)) {
+      if (zeroSectors == 0)
+        zeroStart = done / 512;
+      zeroSectors += padded / 512;
+    } else {
+      if (zeroSectors && !ZeroRange(name, zeroStart, zeroSectors))
+        return false;
+      zeroSectors = 0;
+      if (!WritePartition(name, done / 512, chunk.data(), padded))
+        return false;
+    }
+    done += len;
+    if (_progress)
+      _progress(done, totalBytes);
+  }
+  return (zeroSectors == 0 || ZeroRange(name, zeroStart, zeroSectors)) &&
+         window.Close();
+}
+
+bool ProtocolEngine::FlashSparse(const std::string &name, std::ifstream &in,
+                                 uint64_t fileSize) {
+  using Protocols::SparseImageHandler;
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  Protocols::SparseHeader header;
+  in.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!in || header.major_version != 1 ||
+      header.file_hdr_sz < sizeof(Protocols::SparseHeader) ||
+      header.chunk_hdr_sz < sizeof(Protocols::ChunkHeader) ||
+      header.blk_sz == 0 || header.blk_sz % 512 != 0) {
+    std::cerr << "[CORE] Unsupported sparse image for " << name << std::endl;
+    return false;
+  }
+  const uint64_t blockSectors = header.blk_sz / 512;
+  const uint64_t totalBytes = (uint64_t)header.blk_sz * header.total_blks;
+  if (totalBytes / 512 > p->endLba - p->startLba + 1) {
+    std::cerr << "[CORE] Image larger than partition " << name << std::endl;
+    return false;
+  }
+
+  std::vector<uint8_t> chunk(kTransferSectors * 512);
+  TraceSpan span("flash.sparse", TraceCategory::Pipeline, totalBytes);
+  WriteWindow window(*this);
+  uint64_t pos = header.file_hdr_sz, block = 0;
+  uint64_t zeroStart = 0, zeroSectors = 0; // pending run of zero fills
+  auto flushZeros = [&] {
+    bool ok = zeroSectors == 0 || ZeroRange(name, zeroStart, zeroSectors);
+    zeroSectors = 0;
+    return ok;
+  };
+
+  for (uint32_t i = 0; i < header.total_chunks; ++i) {
+    Protocols::ChunkHeader ch;
+    in.seekg((std::streamoff)pos);
+    in.read(reinterpret_cast<char *>(&ch), sizeof(ch));
+    if (!in || ch.total_sz < header.chunk_hdr_sz ||
+        ch.total_sz > fileSize - pos)
+      return false;
+    const uint64_t payload = ch.total_sz - header.chunk_hdr_sz;
+    const uint64_t sector = block * blockSectors;
+    const uint64_t sectors = (uint64_t)ch.chunk_sz * blockSectors;
+    if (ch.chunk_type != SparseImageHandler::kChunkCrc32 &&
+        block + ch.chunk_sz > header.total_blks)
+      return false;
+    in.seekg((std::streamoff)(pos + header.chunk_hdr_sz));
+
+    switch (ch.chunk_type) {
+    case SparseImageHandler::kChunkRaw: {
+      if (payload != sectors * 512 || !flushZeros())
+        return false;
+      for (uint64_t off = 0; off < payload;) {
+        size_t n = (size_t)std::min<uint64_t>(chunk.size(), payload - off);
+        in.read(reinterpret_cast<char *>(chunk.data()), n);
+        if (!in || !WritePartition(name, sector + off / 512, chunk.data(), n))
+          return false;
+        off += n;
+      }
+      break;
+    }
+    case SparseImageHandler::kChunkFill: {
+      uint32_t fill;
+      in.read(reinterpret_cast<char *>(&fill), 4);
+      if (!in || payload != 4)
+        return false;
+      if (fill == 0) {
+        if (zeroSectors == 0 || zeroStart + zeroSectors != sector) {
+          if (!flushZeros())
+            return false;
+          zeroStart = sector;
+        }
+        zeroSectors += sectors;
+        break;
+      }
+      if (!flushZeros())
+        return false;
+      for (size_t off = 0; off < chunk.size(); off += 4)
+        memcpy(&chunk[off], &fill, 4);
+      for (uint64_t done = 0; done < sectors;) {
+        uint64_t count = std::min(kTransferSectors, sectors - done);
+        if (!WritePartition(name, sector + done, chunk.data(), count * 512))
+          return false;
+        done += count;
+      }
+      break;
+    }
+    case SparseImageHandler::kChunkDontCare:
+      // Contents are undefined by definition: discard if it pays off,
+      // otherwise leave the sectors alone.
+      if (_useDiscard && sectors >= kMinDiscardSectors &&
+          !EraseRange(name, sector, sectors))
+        return false;
+      break;
+    case SparseImageHandler::kChunkCrc32:
+      pos += ch.total_sz;
+      continue;
+    default:
+      return false;
+    }
+    block += ch.chunk_sz;
+    pos += ch.total_sz;
+    if (_progress)
+      _progress(block * header.blk_sz, totalBytes);
+  }
+  return flushZeros() && block == header.total_blks && window.Close();
+}
+
+bool ProtocolEngine::ZeroRange(const std::string &name, uint64_t sectorOffset,
+                               uint64_t sectorCount) {
+  if (_useDiscard && sectorCount >= kMinDiscardSectors)
+    return EraseRange(name, sectorOffset, sectorCount);
+  TraceSpan span("flash.zero_range", TraceCategory::Pipeline,
+                 sectorCount * 512);
+  static const std::vector<uint8_t> zeros(kTransferSectors * 512, 0);
+  WriteWindow window(*this);
+  while (sectorCount > 0) {
+    uint64_t count = std::min(kTransferSectors, sectorCount);
+    if (!WritePartition(name, sectorOffset, zeros.data(), count * 512))
+      return false;
+    sectorOffset += count;
+    sectorCount -= count;
+  }
+  return window.Close();
+}
+
+bool ProtocolEngine::FlashPartition(const std::string &name,
+                                    BackupArchiveReader &archive,
+                                    const std::string &source) {
+  const std::string &from = source.empty() ? name : source;
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  const BackupPartition *src = archive.FindPartition(from);
+  if (!p || !src) {
+    std::cerr << "[CORE] Unknown partition: " << (p ? from : name)
+              << std::endl;
+    return false;
+  }
+  const uint64_t totalBytes = src->size;
+  if ((totalBytes + 511) / 512 > p->endLba - p->startLba + 1) {
+    std::cerr << "[CORE] Image larger than partition " << name << std::endl;
+    return false;
+  }
+  TraceSpan span("restore.partition", TraceCategory::Pipeline, totalBytes);
+
+  // Chunk i decodes into slot i % depth; the writer consumes slots in order
+  // and refills each one as soon as it has been sent, so at most `depth`
+  // decoded chunks are buffered however fast the workers are.
+  struct Slot {
+    std::vector<uint8_t> data;
+    std::string error;
+    bool ready = false;
+  };
+  ThreadPool pool;
+  const size_t depth = pool.Size() + 2;
+  std::vector<Slot> slots(depth);
+  std::mutex mutex;
+  std::condition_variable readyChanged;
+  const uint64_t chunkCount = src->chunkCount;
+
+  auto submit = [&](uint64_t i) {
+    size_t index = (size_t)(src->firstChunk + i);
+    Slot &slot = slots[i % depth];
+    if (archive.Chunk(index).zero) {
+      slot.ready = true; // nothing to decode
+      return;
+    }
+    pool.Submit([&, index] {
+      std::vector<uint8_t> data;
+      std::string error;
+      if (!archive.ReadChunk(index, data, &error) && error.empty())
+        error = "decode failed";
+      std::lock_guard<std::mutex> lock(mutex);
+      slot.data.swap(data);
+      slot.error.swap(error);
+      slot.ready = true;
+      readyChanged.notify_all();
+    });
+  };
+
+  bool ok = true;
+  uint64_t zeroStart = 0, zeroSectors = 0; // pending run of zero chunks
+  uint64_t done = 0, next = 0;
+  WriteWindow window(*this);
+  for (uint64_t i = 0; ok && i < chunkCount; ++i) {
+    for (; next < chunkCount && next < i + depth; ++next)
+      submit(next);
+
+    const BackupChunk &chunk = archive.Chunk((size_t)(src->firstChunk + i));
+    const uint64_t sector = done / 512;
+    const size_t length = chunk.rawSize;
+    Slot &slot = slots[i % depth];
+    if (chunk.zero) {
+      if (zeroSectors == 0)
+        zeroStart = sector;
+      zeroSectors += (length + 511) / 512;
+    } else {
+      {
+        TraceSpan wait("restore.decode_wait", TraceCategory::Pipeline);
+        std::unique_lock<std::mutex> lock(mutex);
+        readyChanged.wait(lock, [&] { return slot.ready; });
+      }
+      if (!slot.error.empty()) {
+        std::cerr << "[CORE] " << slot.error << std::endl;
+        ok = false;
+        break;
+      }
+      if (zeroSectors && !ZeroRange(name, zeroStart, zeroSectors)) {
+        ok = false;
+        break;
+      }
+      zeroSectors = 0;
+      // Pad a short tail to a whole sector.
+      slot.data.resize((length + 511) & ~(size_t)511, 0);
+      for (size_t off = 0; ok && off < slot.data.size();) {
+        size_t n = std::min<size_t>(kTransferSectors * 512,
+                                    slot.data.size() - off);
+        ok = WritePartition(name, sector + off / 512, &slot.data[off], n);
+        off += n;
+      }
+    }
+    slot.ready = false;
+    done += length;
+    if (ok && _progress)
+      _progress(done, totalBytes);
+  }
+  if (ok && zeroSectors)
+    ok = ZeroRange(name, zeroStart, zeroSectors);
+  ok = window.Close() && ok;
+  // Let in-flight decodes finish before the slots go away.
+  pool.Wait();
+  return ok;
+}
+
+bool ProtocolEngine::EraseRange(const std::string &name,
+                                uint64_t sectorOffset, uint64_t sectorCount) {
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  if (!p || sectorOffset + sectorCount > p->endLba - p->startLba + 1)
+    return false;
+  if (sectorCount == 0)
+    return true;
+  if (!p->parent.empty()) {
+    if (!LogicalWritable(name))
+      return false;
+    return ForEachExtent(
+        name, sectorOffset, sectorCount,
+        [&](const Protocols::LpExtent &e, uint64_t sector, uint64_t count,
+            uint64_t) {
+          return e.targetType == Protocols::LpParser::kTargetZero ||
+                 EraseRange(_lpMetadata.blockDevices[e.device], sector,
+                            count);
+        });
+  }
+
+  TraceSpan span("flash.discard", TraceCategory::Pipeline, sectorCount * 512);
+  _cache.Invalidate(p->lun, p->startLba + sectorOffset, sectorCount);
   if (_targetType == "QCOM") {
     Protocols::EdlManager edl(_transport);
-    if (edl.FirehoseHandshake()) {
-      std::vector<uint8_t> dummy(512, 0);
-      return edl.WritePartition(name, 0, dummy);
-    }
+    return EnsureFirehose() && _pipeline.Sync() &&
+           edl.EraseRange(name, p->lun, p->startLba + sectorOffset,
+                          sectorCount);
   } else if (_targetType == "MTK") {
+    if (!SingleLun(name, p->lun))
+      return false;
     Protocols::BromManager brom(_transport);
-    std::vector<uint8_t> dummy(512, 0);
-    return brom.DaWritePartition(name, 0, dummy);
+    return brom.DaEraseRange(name, p->startLba + sectorOffset, sectorCount);
   }
   return false;
 }
 
 bool ProtocolEngine::ErasePartition(const std::string &name) {
+  // The programmers only know GPT names; erase a logical partition's extents.
+  const Protocols::PartitionInfo *p = FindPartition(name);
+  if (p && !p->parent.empty())
+    return EraseRange(name, 0, p->endLba + 1);
+  if (p)
+    _cache.Invalidate(p->lun, p->startLba, p->endLba - p->startLba + 1);
+
   if (_targetType == "QCOM") {
     Protocols::EdlManager edl(_transport);
-    if (edl.FirehoseHandshake()) {
-      return edl.ErasePartition(name);
+    if (EnsureFirehose() && _pipeline.Sync()) {
+      return edl.ErasePartition(name, p ? p->lun : 0);
     }
   } else if (_targetType == "MTK") {
     Protocols::BromManager brom(_transport);
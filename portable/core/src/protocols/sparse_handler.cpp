@@ -1,4 +1,5 @@
 #include "../../include/sparse_handler.h"
+#include <algorithm>
 #include <cstring>
 
 namespace DeepEye {
@@ -7,7 +8,7 @@ namespace Protocols {
 bool SparseImageHandler::IsSparse(const uint8_t *buffer) {
   uint32_t magic;
   memcpy(&magic, buffer, 4);
-  return (magic == 0xed26ff3a);
+  return (magic == kMagic);
 }
 
 uint64_t SparseImageHandler::GetUnsparseSize(const uint8_t *buffer) {
@@ -20,5 +21,138 @@ uint64_t SparseImageHandler::GetUnsparseSize(const uint8_t *buffer) {
   return (uint64_t)header.blk_sz * header.total_blks;
 }
 
+bool SparseImageHandler::Unsparse(const uint8_t *buffer, size_t size,
+                                  std::vector<uint8_t> &out) {
+  if (size < sizeof(SparseHeader) || !IsSparse(buffer))
+    return false;
+
+  SparseHeader header;
+  memcpy(&header, buffer, sizeof(SparseHeader));
+  if (header.major_version != 1 || header.file_hdr_sz < sizeof(SparseHeader) ||
+      header.chunk_hdr_sz < sizeof(ChunkHeader) || header.blk_sz == 0 ||
+      header.blk_sz % 4 != 0 || header.file_hdr_sz > size)
+    return false;
+
+  const uint64_t outSize = (uint64_t)header.blk_sz * header.total_blks;
+  out.assign((size_t)outSize, 0);
+
+  size_t pos = header.file_hdr_sz;
+  uint64_t block = 0;
+  for (uint32_t i = 0; i < header.total_chunks; ++i) {
+    if (size - pos < header.chunk_hdr_sz)
+      return false;
+    ChunkHeader chunk;
+    memcpy(&chunk, buffer + pos, sizeof(ChunkHeader));
+    if (chunk.total_sz < header.chunk_hdr_sz || chunk.total_sz > size - pos)
+      return false;
+    const uint8_t *payload = buffer + pos + header.chunk_hdr_sz;
+    const size_t payloadSize = chunk.total_sz - header.chunk_hdr_sz;
+    const uint64_t bytes = (uint64_t)chunk.chunk_sz * header.blk_sz;
+
+    if (chunk.chunk_type != kChunkCrc32 &&
+        block + chunk.chunk_sz > header.total_blks)
+      return false;
+    uint8_t *dst = out.data() + block * header.blk_sz;
+
+    switch (chunk.chunk_type) {
+    case kChunkRaw:
+      if (payloadSize != bytes)
+        return false;
+      memcpy(dst, payload, (size_t)bytes);
+      break;
+    case kChunkFill: {
+      if (payloadSize != 4)
+        return false;
+      uint32_t fill;
+      memcpy(&fill, payload, 4);
+      if (fill == 0)
+        break; // already zeroed
+      for (uint64_t off = 0; off < bytes; off += 4)
+        memcpy(dst + off, &fill, 4);
+      break;
+    }
+    case kChunkDontCare:
+      break;
+    case kChunkCrc32:
+      pos += chunk.total_sz;
+      continue;
+    default:
+      return false;
+    }
+    block += chunk.chunk_sz;
+    pos += chunk.total_sz;
+  }
+  return block == header.total_blks;
+}
+
+std::vector<uint8_t> SparseImageHandler::Sparsify(const uint8_t *data,
+                                                  size_t size,
+                                                  uint32_t blockSize) {
+  const uint32_t totalBlocks = (uint32_t)((size + blockSize - 1) / blockSize);
+  std::vector<uint8_t> out(sizeof(SparseHeader));
+  std::vector<uint8_t> lastBlock;
+  uint32_t chunks = 0;
+
+  auto blockAt = [&](uint32_t b) -> const uint8_t * {
+    size_t off = (size_t)b * blockSize;
+    if (off + blockSize <= size)
+      return data + off;
+    lastBlock.assign(blockSize, 0);
+    memcpy(lastBlock.data(), data + off, size - off);
+    return lastBlock.data();
+  };
+  // A block is a FILL candidate if it is one 32-bit value repeated.
+  auto fillValue = [&](const uint8_t *blk, uint32_t &value) {
+    memcpy(&value, blk, 4);
+    for (uint32_t off = 4; off < blockSize; off += 4)
+      if (memcmp(blk + off, blk, 4) != 0)
+        return false;
+    return true;
+  };
+  auto appendChunk = [&](uint16_t type, uint32_t blocks, const uint8_t *payload,
+                         size_t payloadSize) {
+    ChunkHeader chunk = {type, 0, blocks,
+                         (uint32_t)(sizeof(ChunkHeader) + payloadSize)};
+    const uint8_t *raw = reinterpret_cast<const uint8_t *>(&chunk);
+    out.insert(out.end(), raw, raw + sizeof(chunk));
+    out.insert(out.end(), payload, payload + payloadSize);
+    ++chunks;
+  };
+
+  for (uint32_t b = 0; b < totalBlocks;) {
+    uint32_t value;
+    if (fillValue(blockAt(b), value)) {
+      uint32_t run = 1, next;
+      while (b + run < totalBlocks && fillValue(blockAt(b + run), next) &&
+             next == value)
+        ++run;
+      appendChunk(kChunkFill, run, reinterpret_cast<const uint8_t *>(&value),
+                  4);
+      b += run;
+      continue;
+    }
+
+    uint32_t run = 1;
+    while (b + run < totalBlocks && !fillValue(blockAt(b + run), value))
+      ++run;
+    size_t off = (size_t)b * blockSize;
+    size_t len = (size_t)run * blockSize;
+    if (off + len <= size) {
+      appendChunk(kChunkRaw, run, data + off, len);
+    } else {
+      std::vector<uint8_t> padded(len, 0);
+      memcpy(padded.data(), data + off, size - off);
+      appendChunk(kChunkRaw, run, padded.data(), len);
+    }
+    b += run;
+  }
+
+  SparseHeader header = {kMagic,      1,      0, sizeof(SparseHeader),
+                         sizeof(ChunkHeader), blockSize, totalBlocks,
+                         chunks,      0};
+  memcpy(out.data(), &header, sizeof(header));
+  return out;
+}
+
 } // namespace Protocols
 } // namespace DeepEye
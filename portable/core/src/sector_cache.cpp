@@ -0,0 +1,119 @@
+#include "../include/sector_cache.h"
+#include <algorithm>
+#include <cstring>
+
+namespace DeepEye {
+namespace Core {
+
+SectorCache::SectorCache(const Options &options) { Configure(options); }
+
+void SectorCache::Configure(const Options &options) {
+  _options = options;
+  if (_options.extentSectors == 0)
+    _options.extentSectors = 1;
+  Clear();
+}
+
+void SectorCache::Clear() {
+  _lru.clear();
+  _index.clear();
+}
+
+bool SectorCache::Lookup(uint32_t lun, uint64_t lba, uint64_t count,
+                         uint8_t *out) {
+  if (!Enabled() || count == 0)
+    return false;
+  const uint64_t end = lba + count;
+  // Check every extent before touching the LRU order or `out`.
+  for (uint64_t pos = lba; pos < end;) {
+    auto it = _index.find(Key(lun, pos));
+    uint64_t extentEnd = ExtentStart(pos) + _options.extentSectors;
+    uint64_t stop = std::min(end, extentEnd);
+    if (it == _index.end()) {
+      ++_stats.misses;
+      return false;
+    }
+    const Extent &e = *it->second;
+    for (uint64_t s = pos; s < stop; ++s) {
+      if (!e.valid[s - ExtentStart(pos)]) {
+        ++_stats.misses;
+        return false;
+      }
+    }
+    pos = stop;
+  }
+  for (uint64_t pos = lba; pos < end;) {
+    auto it = _index.find(Key(lun, pos));
+    uint64_t start = ExtentStart(pos);
+    uint64_t stop = std::min(end, start + _options.extentSectors);
+    memcpy(out + (pos - lba) * 512, &it->second->data[(pos - start) * 512],
+           (stop - pos) * 512);
+    _lru.splice(_lru.begin(), _lru, it->second);
+    pos = stop;
+  }
+  ++_stats.hits;
+  return true;
+}
+
+void SectorCache::Insert(uint32_t lun, uint64_t lba, uint64_t count,
+                         const uint8_t *data) {
+  if (!Enabled())
+    return;
+  const uint64_t end = lba + count;
+  for (uint64_t pos = lba; pos < end;) {
+    uint64_t key = Key(lun, pos);
+    uint64_t start = ExtentStart(pos);
+    uint64_t stop = std::min(end, start + _options.extentSectors);
+    auto it = _index.find(key);
+    if (it == _index.end()) {
+      if (_lru.size() >= _options.maxExtents) {
+        _index.erase(_lru.back().key);
+        _lru.pop_back();
+        ++_stats.evictions;
+      }
+      _lru.push_front({key,
+                       std::vector<uint8_t>(_options.extentSectors * 512),
+                       std::vector<bool>(_options.extentSectors, false)});
+      it = _index.emplace(key, _lru.begin()).first;
+    } else {
+      _lru.splice(_lru.begin(), _lru, it->second);
+    }
+    Extent &e = *it->second;
+    memcpy(&e.data[(pos - start) * 512], data + (pos - lba) * 512,
+           (stop - pos) * 512);
+    std::fill(e.valid.begin() + (pos - start),
+              e.valid.begin() + (stop - start), true);
+    pos = stop;
+  }
+}
+
+void SectorCache::Invalidate(uint32_t lun, uint64_t lba, uint64_t count) {
+  if (_index.empty() || count == 0)
+    return;
+  const uint64_t first = Key(lun, lba);
+  const uint64_t last = Key(lun, lba + count - 1);
+  // A whole-partition erase spans far more extents than are cached.
+  if (last - first >= _index.size()) {
+    for (auto it = _lru.begin(); it != _lru.end();) {
+      if (it->key >= first && it->key <= last) {
+        _index.erase(it->key);
+        it = _lru.erase(it);
+        ++_stats.invalidations;
+      } else {
+        ++it;
+      }
+    }
+    return;
+  }
+  for (uint64_t key = first; key <= last; ++key) {
+    auto it = _index.find(key);
+    if (it == _index.end())
+      continue;
+    _lru.erase(it->second);
+    _index.erase(it);
+    ++_stats.invalidations;
+  }
+}
+
+} // namespace Core
+} // namespace DeepEye
@@ -0,0 +1,393 @@
+#include "../include/trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace DeepEye {
+namespace Core {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Log-linear buckets: exact below 8 ns, then 8 sub-buckets per power of two
+// up to 2^40 ns (~18 minutes); longer spans land in the last bucket.
+constexpr unsigned kSubBits = 3;
+constexpr unsigned kSub = 1u << kSubBits;
+constexpr unsigned kMaxExp = 40;
+constexpr unsigned kBuckets = (kMaxExp - kSubBits + 1) * kSub + kSub;
+
+unsigned Log2(uint64_t v) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse64(&index, v);
+  return (unsigned)index;
+#else
+  return 63 - (unsigned)__builtin_clzll(v);
+#endif
+}
+
+unsigned BucketOf(uint64_t ns) {
+  if (ns < kSub)
+    return (unsigned)ns;
+  unsigned exp = Log2(ns);
+  if (exp > kMaxExp)
+    return kBuckets - 1;
+  unsigned sub = (unsigned)(ns >> (exp - kSubBits)) & (kSub - 1);
+  return (exp - kSubBits + 1) * kSub + sub;
+}
+
+// Midpoint of a bucket's [low, high) range.
+uint64_t BucketValue(unsigned bucket) {
+  if (bucket < kSub)
+    return bucket;
+  unsigned exp = bucket / kSub + kSubBits - 1;
+  uint64_t width = 1ull << (exp - kSubBits);
+  uint64_t low = (uint64_t)(kSub + bucket % kSub) << (exp - kSubBits);
+  return low + width / 2;
+}
+
+struct Event {
+  std::atomic<const char *> name;
+  std::atomic<uint64_t> startNs;
+  std::atomic<uint64_t> durationNs;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint8_t> category;
+};
+
+struct Histogram {
+  std::atomic<const char *> name; // set once by the owner, nullptr = free
+  std::atomic<uint8_t> category;
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint64_t> totalNs;
+  std::atomic<uint64_t> minNs;
+  std::atomic<uint64_t> maxNs;
+  std::atomic<uint64_t> buckets[kBuckets];
+};
+
+// Written only by the owning thread. Every field is atomic so other threads
+// can read it concurrently; the owner uses relaxed stores except for
+// publishing `head` and `epoch`.
+struct ThreadBuffer {
+  uint32_t tid;
+  std::atomic<bool> owned{false}; // a live thread records into it
+  std::atomic<uint64_t> epoch;
+  std::atomic<uint64_t> head; // events ever recorded since the last reset
+  Event ring[Tracer::kRingEvents];
+  Histogram histograms[Tracer::kMaxNamesPerThread];
+
+  void Clear() {
+    head.store(0, std::memory_order_relaxed);
+    for (Histogram &h : histograms) {
+      h.name.store(nullptr, std::memory_order_relaxed);
+      h.count.store(0, std::memory_order_relaxed);
+      h.bytes.store(0, std::memory_order_relaxed);
+      h.totalNs.store(0, std::memory_order_relaxed);
+      h.minNs.store(UINT64_MAX, std::memory_order_relaxed);
+      h.maxNs.store(0, std::memory_order_relaxed);
+      for (auto &b : h.buckets)
+        b.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  Histogram *Find(const char *name) {
+    size_t slot = (reinterpret_cast<uintptr_t>(name) >> 3) %
+                  Tracer::kMaxNamesPerThread;
+    for (size_t i = 0; i < Tracer::kMaxNamesPerThread; ++i) {
+      Histogram &h = histograms[(slot + i) % Tracer::kMaxNamesPerThread];
+      const char *current = h.name.load(std::memory_order_relaxed);
+      if (current == name)
+        return &h;
+      if (!current) {
+        h.name.store(name, std::memory_order_release);
+        return &h;
+      }
+    }
+    return nullptr; // table full: the span still reaches the ring
+  }
+};
+
+// Buffers are never freed: a thread's spans outlive it until the next
+// Reset(), and Record() never touches a lock after the first call. When a
+// thread exits its buffer is handed to the next new thread, which keeps
+// adding to the same histograms and ring, so the registry is bounded by the
+// number of threads tracing at once rather than ever started.
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+  std::atomic<uint64_t> epoch{0};
+  Clock::time_point origin = Clock::now();
+
+  static Registry &Get() {
+    static Registry registry;
+    return registry;
+  }
+
+  std::vector<ThreadBuffer *> List() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ThreadBuffer *> out;
+    for (auto &b : buffers)
+      out.push_back(b.get());
+    return out;
+  }
+};
+
+// Releases the buffer when its thread exits. thread_local objects die before
+// statics, so the Registry still owns the buffer when this runs.
+struct Owner {
+  ThreadBuffer *buffer = nullptr;
+  ~Owner() {
+    if (buffer)
+      buffer->owned.store(false, std::memory_order_release);
+  }
+};
+
+ThreadBuffer *LocalBuffer() {
+  thread_local Owner owner;
+  if (!owner.buffer) {
+    Registry &reg = Registry::Get();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto &b : reg.buffers) {
+      // Acquire pairs with the exited owner's release: its last writes are
+      // visible before this thread continues them.
+      if (!b->owned.load(std::memory_order_acquire)) {
+        owner.buffer = b.get();
+        break;
+      }
+    }
+    if (!owner.buffer) {
+      std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+      buffer->Clear();
+      buffer->epoch.store(reg.epoch.load(), std::memory_order_release);
+      buffer->tid = (uint32_t)reg.buffers.size() + 1;
+      owner.buffer = buffer.get();
+      reg.buffers.push_back(std::move(buffer));
+    }
+    owner.buffer->owned.store(true, std::memory_order_relaxed);
+  }
+  return owner.buffer;
+}
+
+// A buffer recorded before the last Reset() is stale until its owner
+// records again and clears it.
+bool Current(const ThreadBuffer *buffer) {
+  return buffer->epoch.load(std::memory_order_acquire) ==
+         Registry::Get().epoch.load(std::memory_order_acquire);
+}
+
+void AppendEscaped(std::string &out, const char *s) {
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\')
+      out += '\\';
+    if ((unsigned char)*s >= 0x20)
+      out += *s;
+  }
+}
+
+bool InitialEnabled() {
+  const char *env = getenv("DEEPEYE_TRACE");
+  return env && *env && strcmp(env, "0") != 0;
+}
+
+} // namespace
+
+std::atomic<bool> Tracer::_enabled{InitialEnabled()};
+
+const char *TraceCategoryName(TraceCategory category) {
+  switch (category) {
+  case TraceCategory::Transport:
+    return "transport";
+  case TraceCategory::Sahara:
+    return "sahara";
+  case TraceCategory::Firehose:
+    return "firehose";
+  case TraceCategory::Da:
+    return "da";
+  case TraceCategory::Pipeline:
+    return "pipeline";
+  default:
+    return "unknown";
+  }
+}
+
+void Tracer::SetEnabled(bool enabled) {
+  Registry::Get(); // pin the time origin before the first span
+  _enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Tracer::Reset() {
+  Registry::Get().epoch.fetch_add(1, std::memory_order_acq_rel);
+}
+
+uint64_t Tracer::NowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now() - Registry::Get().origin)
+      .count();
+}
+
+void Tracer::Record(const char *name, TraceCategory category,
+                    uint64_t startNs, uint64_t durationNs, uint64_t bytes) {
+  ThreadBuffer *buf = LocalBuffer();
+  uint64_t epoch = Registry::Get().epoch.load(std::memory_order_acquire);
+  if (buf->epoch.load(std::memory_order_relaxed) != epoch) {
+    buf->Clear();
+    buf->epoch.store(epoch, std::memory_order_release);
+  }
+
+  const auto relaxed = std::memory_order_relaxed;
+  uint64_t index = buf->head.load(relaxed);
+  Event &ev = buf->ring[index % kRingEvents];
+  ev.name.store(name, relaxed);
+  ev.startNs.store(startNs, relaxed);
+  ev.durationNs.store(durationNs, relaxed);
+  ev.bytes.store(bytes, relaxed);
+  ev.category.store((uint8_t)category, relaxed);
+  buf->head.store(index + 1, std::memory_order_release);
+
+  Histogram *h = buf->Find(name);
+  if (!h)
+    return;
+  h->category.store((uint8_t)category, relaxed);
+  h->count.store(h->count.load(relaxed) + 1, relaxed);
+  h->bytes.store(h->bytes.load(relaxed) + bytes, relaxed);
+  h->totalNs.store(h->totalNs.load(relaxed) + durationNs, relaxed);
+  if (durationNs < h->minNs.load(relaxed))
+    h->minNs.store(durationNs, relaxed);
+  if (durationNs > h->maxNs.load(relaxed))
+    h->maxNs.store(durationNs, relaxed);
+  auto &bucket = h->buckets[BucketOf(durationNs)];
+  bucket.store(bucket.load(relaxed) + 1, relaxed);
+}
+
+std::vector<TraceStat> Tracer::Snapshot() {
+  struct Merged {
+    TraceStat stat;
+    std::vector<uint64_t> buckets;
+  };
+  std::map<std::string, Merged> byName;
+  const auto relaxed = std::memory_order_relaxed;
+
+  for (ThreadBuffer *buf : Registry::Get().List()) {
+    if (!Current(buf))
+      continue;
+    for (Histogram &h : buf->histograms) {
+      const char *name = h.name.load(std::memory_order_acquire);
+      uint64_t count = name ? h.count.load(relaxed) : 0;
+      if (!count)
+        continue;
+      Merged &m = byName[name];
+      if (m.buckets.empty()) {
+        m.stat = TraceStat{name, (TraceCategory)h.category.load(relaxed),
+                           0, 0, 0, UINT64_MAX, 0, 0, 0, 0};
+        m.buckets.assign(kBuckets, 0);
+      }
+      m.stat.count += count;
+      m.stat.bytes += h.bytes.load(relaxed);
+      m.stat.totalNs += h.totalNs.load(relaxed);
+      m.stat.minNs = std::min(m.stat.minNs, h.minNs.load(relaxed));
+      m.stat.maxNs = std::max(m.stat.maxNs, h.maxNs.load(relaxed));
+      for (unsigned b = 0; b < kBuckets; ++b)
+        m.buckets[b] += h.buckets[b].load(relaxed);
+    }
+  }
+
+  std::vector<TraceStat> out;
+  for (auto &entry : byName) {
+    Merged &m = entry.second;
+    uint64_t total = 0;
+    for (uint64_t c : m.buckets)
+      total += c;
+    const double quantiles[3] = {0.50, 0.90, 0.99};
+    uint64_t *targets[3] = {&m.stat.p50Ns, &m.stat.p90Ns, &m.stat.p99Ns};
+    for (int q = 0; q < 3; ++q) {
+      uint64_t rank = (uint64_t)(quantiles[q] * (double)(total - 1)) + 1;
+      uint64_t seen = 0;
+      for (unsigned b = 0; b < kBuckets; ++b) {
+        seen += m.buckets[b];
+        if (seen >= rank) {
+          *targets[q] = std::min(std::max(BucketValue(b), m.stat.minNs),
+                                 m.stat.maxNs);
+          break;
+        }
+      }
+    }
+    out.push_back(m.stat);
+  }
+  std::sort(out.begin(), out.end(),
+            [](const TraceStat &a, const TraceStat &b) {
+              return a.totalNs > b.totalNs;
+            });
+  return out;
+}
+
+std::string Tracer::ChromeTraceJson() {
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  char num[160];
+  const auto relaxed = std::memory_order_relaxed;
+
+  for (ThreadBuffer *buf : Registry::Get().List()) {
+    if (!Current(buf))
+      continue;
+    uint64_t head = buf->head.load(std::memory_order_acquire);
+    if (!head)
+      continue;
+
+    snprintf(num, sizeof(num),
+             "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+             "\"args\":{\"name\":\"thread %u\"}}",
+             first ? "" : ",", buf->tid, buf->tid);
+    json += num;
+    first = false;
+
+    uint64_t begin = head > kRingEvents ? head - kRingEvents : 0;
+    std::string events;
+    for (uint64_t i = begin; i < head; ++i) {
+      const Event &ev = buf->ring[i % kRingEvents];
+      const char *name = ev.name.load(relaxed);
+      uint64_t start = ev.startNs.load(relaxed);
+      uint64_t dur = ev.durationNs.load(relaxed);
+      uint64_t bytes = ev.bytes.load(relaxed);
+      auto category = (TraceCategory)ev.category.load(relaxed);
+      // The owner may have lapped the ring while we were reading.
+      if (buf->head.load(std::memory_order_acquire) >= i + kRingEvents)
+        continue;
+
+      events += ",{\"name\":\"";
+      AppendEscaped(events, name);
+      snprintf(num, sizeof(num),
+               "\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+               "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"args\":{\"bytes\":%llu}}",
+               TraceCategoryName(category), buf->tid,
+               (unsigned long long)(start / 1000), (unsigned)(start % 1000),
+               (unsigned long long)(dur / 1000), (unsigned)(dur % 1000),
+               (unsigned long long)bytes);
+      events += num;
+    }
+    json += events;
+  }
+  json += "]}\n";
+  return json;
+}
+
+bool Tracer::WriteChromeTrace(const std::string &path) {
+  std::ofstream out(path, std::ios::binary);
+  if (!out)
+    return false;
+  std::string json = ChromeTraceJson();
+  out.write(json.data(), json.size());
+  return (bool)out;
+}
+
+} // namespace Core
+} // namespace DeepEye
@@ -0,0 +1,661 @@
+#include "../../include/net_transport.h"
+#include "../../include/trace.h"
+#include "../backup/byte_io.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace DeepEye {
+namespace Core {
+
+namespace {
+
+constexpr uint32_t kHelloTimeoutMs = 5000;
+// Serialized agents poll a pending read this often between other requests.
+constexpr uint32_t kPollMs = 1;
+
+using Clock = std::chrono::steady_clock;
+
+uint32_t MsUntil(Clock::time_point deadline) {
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - Clock::now());
+  return left.count() > 0 ? (uint32_t)left.count() : 0;
+}
+
+NetFrame MakeFrame(NetFrame::Type type, uint32_t length, uint32_t size,
+                   int32_t value) {
+  NetFrame frame = {};
+  frame.type = type;
+  frame.length = length;
+  frame.size = size;
+  frame.value = value;
+  return frame;
+}
+
+// Sockets are POSIX only; elsewhere every call fails and the transport
+// reports a dropped link.
+#ifndef _WIN32
+void CloseSocket(int fd) { close(fd); }
+
+void SetNoDelay(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+int ConnectTo(const std::string &host, uint16_t port) {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *found = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &found) != 0)
+    return -1;
+  int fd = -1;
+  for (addrinfo *a = found; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(found);
+  return fd;
+}
+
+int ListenOn(uint16_t port, bool allInterfaces, uint16_t &bound) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(allInterfaces ? INADDR_ANY : INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, 1) != 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+    close(fd);
+    return -1;
+  }
+  bound = ntohs(addr.sin_port);
+  return fd;
+}
+
+int AcceptOn(int listenFd) { return accept(listenFd, nullptr, nullptr); }
+
+void Shutdown(int fd) { shutdown(fd, SHUT_RDWR); }
+
+// 0 on timeout, -1 on error.
+int WaitReadable(int fd, uint32_t timeoutMs) {
+  pollfd p = {fd, POLLIN, 0};
+  int rc = poll(&p, 1, (int)timeoutMs);
+  return rc < 0 ? -1 : rc;
+}
+
+bool ReadAll(int fd, void *data, size_t length) {
+  auto *p = static_cast<uint8_t *>(data);
+  while (length) {
+    ssize_t n = recv(fd, p, length, 0);
+    if (n <= 0)
+      return false;
+    p += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
+
+// Writes a then b in as few calls as the kernel allows.
+bool WriteAll(int fd, const uint8_t *a, size_t an, const uint8_t *b = nullptr,
+              size_t bn = 0) {
+  while (an + bn) {
+    iovec iov[2] = {{const_cast<uint8_t *>(a), an},
+                    {const_cast<uint8_t *>(b), bn}};
+    msghdr msg = {};
+    msg.msg_iov = an ? iov : iov + 1;
+    msg.msg_iovlen = an ? 2 : 1;
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    size_t fromA = std::min((size_t)n, an);
+    a += fromA;
+    an -= fromA;
+    b += (size_t)n - fromA;
+    bn -= (size_t)n - fromA;
+  }
+  return true;
+}
+#else
+void CloseSocket(int) {}
+void SetNoDelay(int) {}
+int ConnectTo(const std::string &, uint16_t) { return -1; }
+int ListenOn(uint16_t, bool, uint16_t &) { return -1; }
+int AcceptOn(int) { return -1; }
+void Shutdown(int) {}
+int WaitReadable(int, uint32_t) { return -1; }
+bool ReadAll(int, void *, size_t) { return false; }
+bool WriteAll(int, const uint8_t *, size_t, const uint8_t * = nullptr,
+              size_t = 0) {
+  return false;
+}
+#endif
+
+// Compares in time independent of where the first difference is.
+bool SameToken(const std::vector<uint8_t> &sent, const std::string &token) {
+  if (sent.size() != token.size())
+    return false;
+  uint8_t diff = 0;
+  for (size_t i = 0; i < sent.size(); ++i)
+    diff |= sent[i] ^ (uint8_t)token[i];
+  return diff == 0;
+}
+
+void AppendFrame(std::vector<uint8_t> &out, const NetFrame &frame) {
+  ByteIo::Put(out, frame.type, 1);
+  ByteIo::Put(out, 0, 3);
+  ByteIo::Put(out, frame.length, 4);
+  ByteIo::Put(out, frame.size, 4);
+  ByteIo::Put(out, (uint32_t)frame.value, 4);
+}
+
+bool ReadFrame(int fd, NetFrame &frame) {
+  uint8_t header[NetFrame::kHeaderSize];
+  if (!ReadAll(fd, header, sizeof(header)))
+    return false;
+  ByteIo::Cursor c{header, sizeof(header)};
+  frame.type = (uint8_t)c.Get(1);
+  c.Get(3);
+  frame.length = (uint32_t)c.Get(4);
+  frame.size = (uint32_t)c.Get(4);
+  frame.value = (int32_t)(uint32_t)c.Get(4);
+  return true;
+}
+
+} // namespace
+
+NetTransport::NetTransport(const std::string &host, uint16_t port)
+    : _host(host), _port(port) {}
+
+NetTransport::~NetTransport() { Close(); }
+
+bool NetTransport::Open(int fd) {
+  Close();
+  _fd = fd >= 0 ? fd : ConnectTo(_host, _port);
+  if (_fd < 0) {
+    std::cerr << "[NET] Cannot connect to " << _host << ":" << _port
+              << std::endl;
+    return false;
+  }
+  SetNoDelay(_fd);
+  if (_token.size() > NetFrame::kMaxToken) {
+    std::cerr << "[NET] Token over " << NetFrame::kMaxToken << " bytes."
+              << std::endl;
+    Drop();
+    return false;
+  }
+
+  Post(MakeFrame(NetFrame::Hello, (uint32_t)_token.size(), 0,
+                 NetFrame::kVersion),
+       reinterpret_cast<const uint8_t *>(_token.data()));
+  NetFrame hello = {};
+  if (!Flush() || WaitReadable(_fd, kHelloTimeoutMs) <= 0 ||
+      !ReadFrame(_fd, hello) || hello.type != NetFrame::Hello) {
+    std::cerr << "[NET] Agent at " << _host << ":" << _port
+              << " refused the token or did not answer the handshake."
+              << std::endl;
+    Drop();
+    return false;
+  }
+  if (hello.value != NetFrame::kVersion) {
+    std::cerr << "[NET] Agent at " << _host << ":" << _port
+              << " speaks protocol version " << hello.value << ", not "
+              << NetFrame::kVersion << "." << std::endl;
+    Drop();
+    return false;
+  }
+  return true;
+}
+
+void NetTransport::Close() {
+  if (_fd >= 0)
+    Flush();
+  Drop();
+}
+
+void NetTransport::Drop() {
+  if (_fd >= 0)
+    CloseSocket(_fd);
+  _fd = -1;
+  _out.clear();
+  _requests.clear();
+  _readBytesInFlight = 0;
+  _sendBytesInFlight = 0;
+  _sendFailed = false;
+  _in.clear();
+  _inPos = 0;
+}
+
+int NetTransport::Send(const uint8_t *data, size_t length,
+                       uint32_t timeout_ms) {
+  TraceSpan span("net.send", TraceCategory::Transport);
+  const Clock::time_point deadline =
+      Clock::now() + std::chrono::milliseconds(timeout_ms);
+  // Wait for room in the window; without one, for the previous send.
+  while (_fd >= 0 && !_sendFailed && _sendBytesInFlight > 0 &&
+         _sendBytesInFlight + length > _window)
+    if (!Pump(MsUntil(deadline)))
+      return _fd < 0 ? -1 : 0;
+  if (_fd < 0)
+    return -1;
+  if (_sendFailed) {
+    _sendFailed = false;
+    return -1;
+  }
+  if (length > NetFrame::kMaxPayload) {
+    std::cerr << "[NET] Send of " << length << " bytes is over the "
+              << NetFrame::kMaxPayload << "-byte frame limit." << std::endl;
+    return -1;
+  }
+
+  if (!Post(MakeFrame(NetFrame::Send, (uint32_t)length, (uint32_t)length,
+                      (int32_t)timeout_ms),
+            data))
+    return -1;
+  _sendBytesInFlight += length;
+  TrackInFlight();
+  if (_window == 0) {
+    while (_sendBytesInFlight > 0)
+      if (!Pump(MsUntil(deadline)))
+        return _fd < 0 ? -1 : 0;
+    _sendFailed = false;
+    span.SetBytes(_sendResult > 0 ? (uint64_t)_sendResult : 0);
+    return _sendResult;
+  }
+  span.SetBytes(length);
+  return (int)length;
+}
+
+int NetTransport::Receive(uint8_t *data, size_t length, uint32_t timeout_ms) {
+  TraceSpan span("net.receive", TraceCategory::Transport);
+  length = std::min<size_t>(length, NetFrame::kMaxPayload);
+  const Clock::time_point deadline =
+      Clock::now() + std::chrono::milliseconds(timeout_ms);
+  const uint64_t call = ++_call;
+  _callAnswered = false;
+  for (;;) {
+    if (!_in.empty()) {
+      const std::vector<uint8_t> &next = _in.front();
+      size_t n = std::min(length, next.size() - _inPos);
+      memcpy(data, next.data() + _inPos, n);
+      _inPos += n;
+      if (_inPos == next.size()) {
+        _in.pop_front();
+        _inPos = 0;
+      }
+      ReadAhead(length, timeout_ms);
+      span.SetBytes(n);
+      return (int)n;
+    }
+    if (_fd < 0)
+      return -1;
+    if (_callAnswered)
+      return _callResult;
+
+    // Read-ahead from earlier calls may still bring the data; once none is
+    // left, this call needs a request of its own.
+    if (_requests.empty()) {
+      if (!PostReceive(length, MsUntil(deadline)))
+        return -1;
+      _requests.back() = call;
+      ReadAhead(length, timeout_ms);
+    }
+    if (!Pump(MsUntil(deadline)))
+      return _fd < 0 ? -1 : 0;
+  }
+}
+
+void NetTransport::SetZlpAware(bool enabled) {
+  Post(MakeFrame(NetFrame::SetZlpAware, 0, 0, enabled ? 1 : 0));
+}
+
+bool NetTransport::Post(const NetFrame &frame, const uint8_t *payload) {
+  if (_fd < 0)
+    return false;
+  ++_stats.frames;
+  AppendFrame(_out, frame);
+  if (!payload || frame.length == 0)
+    return true;
+  if (frame.length < kReadAheadMin) {
+    _out.insert(_out.end(), payload, payload + frame.length);
+    return true;
+  }
+  // Bulk data goes out straight from the caller's buffer.
+  ++_stats.writes;
+  bool ok = WriteAll(_fd, _out.data(), _out.size(), payload, frame.length);
+  _out.clear();
+  if (!ok)
+    Drop();
+  return ok;
+}
+
+void NetTransport::ReadAhead(size_t length, uint32_t timeoutMs) {
+  // Keeps bulk data streaming while the caller works on this chunk.
+  if (!_window || length < kReadAheadMin)
+    return;
+  while (_readBytesInFlight + length <= _window &&
+         PostReceive(length, timeoutMs))
+    ++_stats.readAhead;
+}
+
+bool NetTransport::PostReceive(size_t length, uint32_t timeoutMs) {
+  if (!Post(MakeFrame(NetFrame::Receive, 0, (uint32_t)length,
+                      (int32_t)timeoutMs)))
+    return false;
+  _requests.push_back(0);
+  _readBytesInFlight += length;
+  TrackInFlight();
+  return true;
+}
+
+bool NetTransport::Flush() {
+  if (_out.empty())
+    return true;
+  ++_stats.writes;
+  bool ok = WriteAll(_fd, _out.data(), _out.size());
+  _out.clear();
+  if (!ok)
+    Drop();
+  return ok;
+}
+
+bool NetTransport::Pump(uint32_t timeoutMs) {
+  if (!Flush())
+    return false;
+  int ready = WaitReadable(_fd, timeoutMs);
+  if (ready == 0)
+    return false;
+  NetFrame frame = {};
+  if (ready < 0 || !ReadFrame(_fd, frame)) {
+    std::cerr << "[NET] Connection to the agent lost." << std::endl;
+    Drop();
+    return false;
+  }
+
+  switch (frame.type) {
+  case NetFrame::SendDone:
+    _sendBytesInFlight -= std::min<size_t>(frame.size, _sendBytesInFlight);
+    _sendResult = frame.value;
+    if (frame.value != (int32_t)frame.size)
+      _sendFailed = true;
+    return true;
+  case NetFrame::Data: {
+    if (frame.length > NetFrame::kMaxPayload || frame.length > frame.size) {
+      std::cerr << "[NET] Oversized reply from the agent." << std::endl;
+      Drop();
+      return false;
+    }
+    std::vector<uint8_t> payload(frame.length);
+    if (!ReadAll(_fd, payload.data(), payload.size()) || _requests.empty()) {
+      Drop();
+      return false;
+    }
+    const uint64_t caller = _requests.front();
+    _requests.pop_front();
+    _readBytesInFlight -= std::min<size_t>(frame.size, _readBytesInFlight);
+    if (!payload.empty()) {
+      _in.push_back(std::move(payload));
+    } else if (caller == _call) {
+      _callAnswered = true; // the device timed out (0) or failed (< 0)
+      _callResult = frame.value;
+    } else {
+      ++_stats.emptyReplies;
+    }
+    return true;
+  }
+  default:
+    std::cerr << "[NET] Unexpected frame type " << (int)frame.type << "."
+              << std::endl;
+    Drop();
+    return false;
+  }
+}
+
+namespace {
+
+// Requests waiting for a device call, in arrival order.
+class JobQueue {
+public:
+  struct Job {
+    NetFrame frame;
+    std::vector<uint8_t> payload;
+  };
+
+  void Push(Job job) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _jobs.push_back(std::move(job));
+    }
+    _ready.notify_one();
+  }
+  // Waits up to waitMs (forever if negative); false on timeout or once
+  // closed and empty.
+  bool Pop(Job &job, int waitMs = -1) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto ready = [this] { return !_jobs.empty() || _closed; };
+    if (waitMs < 0)
+      _ready.wait(lock, ready);
+    else
+      _ready.wait_for(lock, std::chrono::milliseconds(waitMs), ready);
+    if (_jobs.empty())
+      return false;
+    job = std::move(_jobs.front());
+    _jobs.pop_front();
+    return true;
+  }
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closed = true;
+    }
+    _ready.notify_all();
+  }
+  bool Closed() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _closed && _jobs.empty();
+  }
+
+private:
+  std::mutex _mutex;
+  std::condition_variable _ready;
+  std::deque<Job> _jobs;
+  bool _closed = false;
+};
+
+} // namespace
+
+bool NetTransportAgent::Listen(uint16_t port, bool allInterfaces) {
+  _listenFd = ListenOn(port, allInterfaces, _port);
+  if (_listenFd < 0) {
+    std::cerr << "[NET] Cannot listen on port " << port << std::endl;
+    return false;
+  }
+  _stopping = false;
+  return true;
+}
+
+bool NetTransportAgent::ServeOne() {
+  int fd = _listenFd >= 0 ? AcceptOn(_listenFd) : -1;
+  if (fd < 0 || _stopping) {
+    if (fd >= 0)
+      CloseSocket(fd);
+    return false;
+  }
+  SetNoDelay(fd);
+  _clientFd = fd;
+
+  std::mutex writeMutex;
+  auto reply = [&](const NetFrame &frame, const uint8_t *payload) {
+    std::vector<uint8_t> header;
+    AppendFrame(header, frame);
+    std::lock_guard<std::mutex> lock(writeMutex);
+    WriteAll(fd, header.data(), header.size(), payload, frame.length);
+  };
+  std::vector<uint8_t> buffer;
+  // Answers the request unless the device had nothing and `last` is false.
+  auto receive = [&](const NetFrame &f, uint32_t timeoutMs, bool last) {
+    buffer.resize(f.size);
+    int rc = _device->Receive(buffer.data(), f.size, timeoutMs);
+    if (rc == 0 && !last)
+      return false;
+    reply(MakeFrame(NetFrame::Data, rc > 0 ? (uint32_t)rc : 0, f.size, rc),
+          buffer.data());
+    return true;
+  };
+  auto run = [&](const JobQueue::Job &job) {
+    const NetFrame &f = job.frame;
+    if (f.type == NetFrame::Send) {
+      int rc = _device->Send(job.payload.data(), job.payload.size(),
+                             (uint32_t)f.value);
+      reply(MakeFrame(NetFrame::SendDone, 0, f.size, rc), nullptr);
+    } else if (f.type == NetFrame::Receive) {
+      receive(f, (uint32_t)f.value, true);
+    } else {
+      _device->SetZlpAware(f.value != 0);
+    }
+  };
+
+  // Serialized, one thread stands in for both endpoints: the oldest read
+  // is polled between the other requests, so a read posted ahead cannot
+  // hold up the command whose data it is waiting for.
+  auto serialized = [&](JobQueue &queue) {
+    std::deque<std::pair<NetFrame, Clock::time_point>> reads;
+    JobQueue::Job job;
+    int waitMs = -1;
+    for (;;) {
+      if (queue.Pop(job, reads.empty() ? -1 : waitMs)) {
+        if (job.frame.type == NetFrame::Receive)
+          reads.push_back({job.frame, Clock::now() + std::chrono::milliseconds(
+                                                         job.frame.value)});
+        else
+          run(job);
+        waitMs = 0;
+        continue;
+      }
+      if (queue.Closed())
+        return;
+      bool expired = Clock::now() >= reads.front().second;
+      if (receive(reads.front().first, kPollMs, expired)) {
+        reads.pop_front();
+        waitMs = 0;
+      } else {
+        waitMs = kPollMs;
+      }
+    }
+  };
+  auto direct = [&](JobQueue &queue) {
+    JobQueue::Job job;
+    while (queue.Pop(job))
+      run(job);
+  };
+
+  JobQueue out, in;
+  JobQueue &inQueue = _serialized ? out : in;
+  std::thread outWorker([&] { _serialized ? serialized(out) : direct(out); });
+  std::thread inWorker([&] { direct(in); });
+
+  NetFrame frame = {};
+  bool greeted = false;
+  while (ReadFrame(fd, frame)) {
+    const uint32_t limit =
+        greeted ? NetFrame::kMaxPayload : NetFrame::kMaxToken;
+    if (frame.length > limit ||
+        (frame.type == NetFrame::Receive &&
+         frame.size > NetFrame::kMaxPayload)) {
+      std::cerr << "[NET] Frame over the " << limit
+                << "-byte limit; dropping the client." << std::endl;
+      break;
+    }
+    JobQueue::Job job{frame, std::vector<uint8_t>(frame.length)};
+    if (!ReadAll(fd, job.payload.data(), job.payload.size()))
+      break;
+    if (frame.type == NetFrame::Hello) {
+      // A version mismatch is answered, so the client can report it; a
+      // wrong token learns nothing.
+      if (frame.value != NetFrame::kVersion) {
+        reply(MakeFrame(NetFrame::Hello, 0, 0, NetFrame::kVersion), nullptr);
+        std::cerr << "[NET] Client speaks protocol version " << frame.value
+                  << ", not " << NetFrame::kVersion << "; dropping it."
+                  << std::endl;
+        break;
+      }
+      if (!SameToken(job.payload, _token)) {
+        std::cerr << "[NET] Client sent the wrong token; dropping it."
+                  << std::endl;
+        break;
+      }
+      reply(MakeFrame(NetFrame::Hello, 0, 0, NetFrame::kVersion), nullptr);
+      greeted = true;
+    } else if (!greeted) {
+      std::cerr << "[NET] Client skipped the handshake; dropping it."
+                << std::endl;
+      break;
+    } else if (frame.type == NetFrame::Send ||
+               frame.type == NetFrame::SetZlpAware) {
+      out.Push(std::move(job));
+    } else if (frame.type == NetFrame::Receive) {
+      inQueue.Push(std::move(job));
+    } else {
+      std::cerr << "[NET] Unexpected frame type " << (int)frame.type << "."
+                << std::endl;
+      break;
+    }
+  }
+
+  out.Close();
+  in.Close();
+  outWorker.join();
+  inWorker.join();
+  _clientFd = -1;
+  CloseSocket(fd);
+  return true;
+}
+
+void NetTransportAgent::Serve() {
+  while (!_stopping && ServeOne()) {
+  }
+}
+
+void NetTransportAgent::Stop() {
+  _stopping = true;
+  int client = _clientFd.exchange(-1);
+  if (client >= 0)
+    Shutdown(client);
+  if (_listenFd >= 0) {
+    Shutdown(_listenFd);
+    CloseSocket(_listenFd);
+    _listenFd = -1;
+  }
+}
+
+} // namespace Core
+} // namespace DeepEye
@@ -0,0 +1,479 @@
+#include "../../include/scenario_transport.h"
+#include "../../include/trace.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+namespace DeepEye {
+namespace Core {
+
+namespace {
+
+// Minimal JSON reader for the scenario DSL: objects, arrays, strings,
+// numbers, booleans and null. Unknown keys are ignored by the loader.
+struct JsonValue {
+  enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+  bool boolean = false;
+  double number = 0;
+  std::string string;
+  std::vector<JsonValue> array;
+  std::map<std::string, JsonValue> object;
+
+  const JsonValue *Get(const std::string &key) const {
+    auto it = object.find(key);
+    return it == object.end() ? nullptr : &it->second;
+  }
+};
+
+class JsonReader {
+public:
+  explicit JsonReader(const std::string &text) : _s(text), _pos(0) {}
+
+  bool Read(JsonValue &out, std::string &error) {
+    if (!Value(out, 0) || (SkipSpace(), _pos != _s.size())) {
+      std::ostringstream msg;
+      msg << "JSON syntax error at offset " << _pos;
+      error = msg.str();
+      return false;
+    }
+    return true;
+  }
+
+private:
+  const std::string &_s;
+  size_t _pos;
+
+  void SkipSpace() {
+    while (_pos < _s.size() && strchr(" \t\r\n", _s[_pos]))
+      ++_pos;
+  }
+
+  bool Consume(char c) {
+    SkipSpace();
+    if (_pos < _s.size() && _s[_pos] == c) {
+      ++_pos;
+      return true;
+    }
+    return false;
+  }
+
+  bool Literal(const char *word) {
+    size_t n = strlen(word);
+    if (_s.compare(_pos, n, word) != 0)
+      return false;
+    _pos += n;
+    return true;
+  }
+
+  bool Value(JsonValue &v, int depth) {
+    if (depth > 32)
+      return false;
+    SkipSpace();
+    if (_pos >= _s.size())
+      return false;
+    char c = _s[_pos];
+    if (c == '{') {
+      ++_pos;
+      v.type = JsonValue::Object;
+      if (Consume('}'))
+        return true;
+      do {
+        std::string key;
+        SkipSpace();
+        if (!Str(key) || !Consume(':') || !Value(v.object[key], depth + 1))
+          return false;
+      } while (Consume(','));
+      return Consume('}');
+    }
+    if (c == '[') {
+      ++_pos;
+      v.type = JsonValue::Array;
+      if (Consume(']'))
+        return true;
+      do {
+        v.array.emplace_back();
+        if (!Value(v.array.back(), depth + 1))
+          return false;
+      } while (Consume(','));
+      return Consume(']');
+    }
+    if (c == '"') {
+      v.type = JsonValue::String;
+      return Str(v.string);
+    }
+    if (Literal("true") || Literal("false")) {
+      v.type = JsonValue::Bool;
+      v.boolean = _s[_pos - 4] == 't';
+      return true;
+    }
+    if (Literal("null"))
+      return true;
+
+    const char *begin = _s.c_str() + _pos;
+    char *end = nullptr;
+    v.number = strtod(begin, &end);
+    if (end == begin)
+      return false;
+    v.type = JsonValue::Number;
+    _pos += end - begin;
+    return true;
+  }
+
+  bool Str(std::string &out) {
+    if (_pos >= _s.size() || _s[_pos] != '"')
+      return false;
+    for (++_pos; _pos < _s.size(); ++_pos) {
+      char c = _s[_pos];
+      if (c == '"') {
+        ++_pos;
+        return true;
+      }
+      if (c != '\\') {
+        out.push_back(c);
+        continue;
+      }
+      if (++_pos >= _s.size())
+        return false;
+      switch (_s[_pos]) {
+      case 'n':
+        out.push_back('\n');
+        break;
+      case 't':
+        out.push_back('\t');
+        break;
+      case 'r':
+        out.push_back('\r');
+        break;
+      case 'b':
+        out.push_back('\b');
+        break;
+      case 'f':
+        out.push_back('\f');
+        break;
+      case 'u': {
+        if (_pos + 4 >= _s.size())
+          return false;
+        unsigned cp = (unsigned)strtoul(_s.substr(_pos + 1, 4).c_str(),
+                                        nullptr, 16);
+        _pos += 4;
+        // Descriptions only; BMP code points are enough.
+        if (cp < 0x80) {
+          out.push_back((char)cp);
+        } else if (cp < 0x800) {
+          out.push_back((char)(0xC0 | (cp >> 6)));
+          out.push_back((char)(0x80 | (cp & 0x3F)));
+        } else {
+          out.push_back((char)(0xE0 | (cp >> 12)));
+          out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+          out.push_back((char)(0x80 | (cp & 0x3F)));
+        }
+        break;
+      }
+      default:
+        out.push_back(_s[_pos]);
+      }
+    }
+    return false;
+  }
+};
+
+std::string GetString(const JsonValue &obj, const char *key) {
+  const JsonValue *v = obj.Get(key);
+  return v && v->type == JsonValue::String ? v->string : std::string();
+}
+
+double GetNumber(const JsonValue &obj, const char *key, double fallback) {
+  const JsonValue *v = obj.Get(key);
+  return v && v->type == JsonValue::Number ? v->number : fallback;
+}
+
+bool DecodeHex(const std::string &hex, std::vector<uint8_t> &out) {
+  if (hex.size() % 2)
+    return false;
+  out.resize(hex.size() / 2);
+  for (size_t i = 0; i < out.size(); ++i) {
+    if (!isxdigit((unsigned char)hex[2 * i]) ||
+        !isxdigit((unsigned char)hex[2 * i + 1]))
+      return false;
+    out[i] = (uint8_t)strtoul(hex.substr(2 * i, 2).c_str(), nullptr, 16);
+  }
+  return true;
+}
+
+bool SetError(std::string *error, const std::string &message) {
+  if (error)
+    *error = message;
+  return false;
+}
+
+} // namespace
+
+// --- Scenario ---------------------------------------------------------------
+
+bool Scenario::LoadFile(const std::string &path, Scenario &out,
+                        std::string *error) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return SetError(error, "Cannot open " + path);
+  std::stringstream text;
+  text << in.rdbuf();
+  return Parse(text.str(), out, error);
+}
+
+bool Scenario::Parse(const std::string &json, Scenario &out,
+                     std::string *error) {
+  JsonValue root;
+  std::string syntax;
+  if (!JsonReader(json).Read(root, syntax))
+    return SetError(error, syntax);
+  if (root.type != JsonValue::Object)
+    return SetError(error, "Scenario root must be an object");
+
+  Scenario s;
+  s.name = GetString(root, "name");
+  s.protocol = GetString(root, "protocol");
+  s.description = GetString(root, "description");
+  if (const JsonValue *exp = root.Get("expectations"))
+    s.maxDurationMs = (uint32_t)GetNumber(*exp, "max_duration_ms", 5000);
+
+  const JsonValue *steps = root.Get("steps");
+  if (!steps || steps->type != JsonValue::Array)
+    return SetError(error, "Scenario has no steps array");
+
+  for (const JsonValue &item : steps->array) {
+    ScenarioStep step;
+    step.label = GetString(item, "label");
+
+    std::string dir = GetString(item, "direction");
+    if (dir == "host_to_device")
+      step.direction = ScenarioDirection::HostToDevice;
+    else if (dir == "device_to_host")
+      step.direction = ScenarioDirection::DeviceToHost;
+    else
+      return SetError(error, "Step '" + step.label + "': bad direction");
+
+    std::string action = GetString(item, "action");
+    if (action == "Disconnect")
+      step.action = ScenarioAction::Disconnect;
+    else if (action == "Timeout")
+      step.action = ScenarioAction::Timeout;
+    else if (action == "HardError")
+      step.action = ScenarioAction::HardError;
+    else if (!action.empty() && action != "Continue")
+      return SetError(error, "Step '" + step.label + "': bad action");
+
+    if (!DecodeHex(GetString(item, "data_hex"), step.data))
+      return SetError(error, "Step '" + step.label + "': bad data_hex");
+    step.length = step.data.empty()
+                      ? (size_t)GetNumber(item, "length", 0)
+                      : step.data.size();
+    step.delayMs = (uint32_t)GetNumber(item, "delay_ms", 0);
+    step.repeat = (uint32_t)std::max(1.0, GetNumber(item, "repeat", 1));
+    s.steps.push_back(std::move(step));
+  }
+
+  out = std::move(s);
+  return true;
+}
+
+// --- ScenarioTransport ------------------------------------------------------
+
+ScenarioTransport::ScenarioTransport(Scenario scenario)
+    : _scenario(std::move(scenario)), _bytesPerSecond(0), _latencyUs(0),
+      _delayScale(1.0) {
+  Open(-1);
+}
+
+bool ScenarioTransport::Open(int fd) {
+  (void)fd;
+  _step = 0;
+  _disconnected = false;
+  _error.clear();
+  _bytesSent = 0;
+  _bytesReceived = 0;
+  _pass = 0;
+  _opened = _linkFree = Clock::now();
+  EnterPass();
+  return true;
+}
+
+void ScenarioTransport::Close() {}
+
+uint32_t ScenarioTransport::ElapsedMs() const {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+             Clock::now() - _opened)
+      .count();
+}
+
+const ScenarioStep *ScenarioTransport::Current() const {
+  return _step < _scenario.steps.size() ? &_scenario.steps[_step] : nullptr;
+}
+
+void ScenarioTransport::EnterPass() {
+  _offset = 0;
+  const ScenarioStep *step = Current();
+  double ms = step ? step->delayMs * _delayScale : 0;
+  _delayLeft = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double, std::milli>(ms));
+}
+
+void ScenarioTransport::Advance(size_t bytes) {
+  const ScenarioStep *step = Current();
+  _offset += bytes;
+  if (!step || _offset < step->length)
+    return;
+  if (++_pass >= step->repeat) {
+    _pass = 0;
+    ++_step;
+  }
+  EnterPass();
+}
+
+bool ScenarioTransport::Fail(const std::string &message) {
+  if (_error.empty()) {
+    std::ostringstream msg;
+    msg << _scenario.name << " step " << _step;
+    if (const ScenarioStep *step = Current())
+      msg << " (" << step->label << ")";
+    msg << ": " << message;
+    _error = msg.str();
+    std::cerr << "[SCENARIO] " << _error << std::endl;
+  }
+  return false;
+}
+
+bool ScenarioTransport::WaitForDelay(uint32_t timeout_ms) {
+  if (_delayLeft <= Clock::duration::zero())
+    return true;
+  Clock::duration budget = std::chrono::milliseconds(timeout_ms);
+  Clock::duration wait = std::min(_delayLeft, budget);
+  std::this_thread::sleep_for(wait);
+  _delayLeft -= wait;
+  return _delayLeft <= Clock::duration::zero();
+}
+
+void ScenarioTransport::Pace(size_t bytes) {
+  if (!_bytesPerSecond && !_latencyUs)
+    return;
+  uint64_t us = _latencyUs;
+  if (_bytesPerSecond)
+    us += (uint64_t)bytes * 1000000 / _bytesPerSecond;
+  Clock::time_point now = Clock::now();
+  _linkFree = std::max(now, _linkFree) + std::chrono::microseconds(us);
+  std::this_thread::sleep_until(_linkFree);
+}
+
+int ScenarioTransport::Send(const uint8_t *data, size_t length,
+                            uint32_t timeout_ms) {
+  (void)timeout_ms;
+  TraceSpan span("replay.send", TraceCategory::Transport);
+  if (_disconnected)
+    return -1;
+
+  size_t done = 0;
+  while (done < length) {
+    const ScenarioStep *step = Current();
+    if (!step) {
+      Fail("host wrote past the end of the scenario");
+      return -1;
+    }
+    if (step->direction != ScenarioDirection::HostToDevice) {
+      Fail("unexpected host write; device_to_host step pending");
+      return -1;
+    }
+    if (step->action == ScenarioAction::Disconnect) {
+      _disconnected = true;
+      Advance(step->length);
+      return -1;
+    }
+
+    size_t n = std::min(length - done, step->length - _offset);
+    if (n == 0) { // zero-length host step: nothing to match
+      Advance(0);
+      continue;
+    }
+    if (!step->data.empty() &&
+        memcmp(step->data.data() + _offset, data + done, n) != 0) {
+      std::ostringstream msg;
+      msg << "host bytes differ from data_hex within [" << _offset << ", "
+          << _offset + n << ")";
+      Fail(msg.str());
+      return -1;
+    }
+    Advance(n);
+    done += n;
+  }
+
+  _bytesSent += length;
+  Pace(length);
+  span.SetBytes(length);
+  return (int)length;
+}
+
+int ScenarioTransport::Receive(uint8_t *data, size_t length,
+                               uint32_t timeout_ms) {
+  TraceSpan span("replay.receive", TraceCategory::Transport);
+  if (_disconnected)
+    return -1;
+
+  // Zero-length host steps never see a write; step over them.
+  const ScenarioStep *step = Current();
+  while (step && step->direction == ScenarioDirection::HostToDevice &&
+         step->length == 0 && step->action == ScenarioAction::Continue) {
+    Advance(0);
+    step = Current();
+  }
+  if (!step) {
+    Fail("host read past the end of the scenario");
+    return -1;
+  }
+  if (step->direction != ScenarioDirection::DeviceToHost) {
+    Fail("unexpected host read; host_to_device step pending");
+    return -1;
+  }
+
+  if (!WaitForDelay(timeout_ms))
+    return 0; // host gave up first; the step stays pending
+
+  switch (step->action) {
+  case ScenarioAction::Disconnect:
+    _disconnected = true;
+    Advance(step->length);
+    return -1;
+  case ScenarioAction::HardError:
+    Advance(step->length);
+    return -1;
+  case ScenarioAction::Timeout:
+    Advance(step->length);
+    return 0;
+  default:
+    break;
+  }
+
+  if (step->length == 0) { // silent device
+    Advance(0);
+    return 0;
+  }
+
+  size_t n = std::min(length, step->length - _offset);
+  if (step->data.empty())
+    memset(data, 0, n);
+  else
+    memcpy(data, step->data.data() + _offset, n);
+  Advance(n);
+
+  _bytesReceived += n;
+  Pace(n);
+  span.SetBytes(n);
+  return (int)n;
+}
+
+} // namespace Core
+} // namespace DeepEye
@@ -1,4 +1,7 @@
 #include "../../include/usb_transport.h"
+#include "../../include/trace.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #ifdef HAS_LIBUSB
 #include <libusb.h>
@@ -7,7 +10,10 @@
 namespace DeepEye {
 namespace Core {
 
-LibUsbTransport::LibUsbTransport() : _ctx(nullptr), _handle(nullptr), _fd(-1) {
+LibUsbTransport::LibUsbTransport()
+    : _ctx(nullptr), _handle(nullptr), _fd(-1), _interface(0), _epIn(0x81),
+      _epOut(0x01), _maxPacketIn(512), _maxPacketOut(512), _zlpAware(false),
+      _pendingPos(0) {
 #ifdef HAS_LIBUSB
   libusb_init(reinterpret_cast<libusb_context **>(&_ctx));
 #endif
@@ -33,7 +39,22 @@ bool LibUsbTransport::Open(int fd) {
     return false;
   }
 
-  libusb_claim_interface(reinterpret_cast<libusb_device_handle *>(_handle), 0);
+  auto *handle = reinterpret_cast<libusb_device_handle *>(_handle);
+  DiscoverEndpoints();
+  _zlpAware = false;
+  _pending.clear();
+  _pendingPos = 0;
+
+  // Desktop hosts bind cdc_acm to BROM; a no-op where unsupported.
+  libusb_set_auto_detach_kernel_driver(handle, 1);
+  rc = libusb_claim_interface(handle, _interface);
+  if (rc != 0) {
+    std::cerr << "Failed to claim interface " << _interface << ": "
+              << libusb_error_name(rc) << std::endl;
+    libusb_close(handle);
+    _handle = nullptr;
+    return false;
+  }
   return true;
 #else
   (void)fd;
@@ -42,11 +63,64 @@ bool LibUsbTransport::Open(int fd) {
 #endif
 }
 
+void LibUsbTransport::DiscoverEndpoints() {
+#ifdef HAS_LIBUSB
+  _interface = 0;
+  _epIn = 0x81;
+  _epOut = 0x01;
+  _maxPacketIn = _maxPacketOut = 512;
+
+  libusb_device *dev =
+      libusb_get_device(reinterpret_cast<libusb_device_handle *>(_handle));
+  libusb_config_descriptor *config = nullptr;
+  if (!dev || libusb_get_active_config_descriptor(dev, &config) != 0) {
+    std::cerr << "[USB] No config descriptor; using interface 0, 0x01/0x81"
+              << std::endl;
+    return;
+  }
+
+  for (int i = 0; i < config->bNumInterfaces; ++i) {
+    const libusb_interface &iface = config->interface[i];
+    if (iface.num_altsetting < 1)
+      continue;
+    const libusb_interface_descriptor &alt = iface.altsetting[0];
+    const libusb_endpoint_descriptor *in = nullptr, *out = nullptr;
+    for (int e = 0; e < alt.bNumEndpoints; ++e) {
+      const libusb_endpoint_descriptor &ep = alt.endpoint[e];
+      if ((ep.bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) !=
+          LIBUSB_TRANSFER_TYPE_BULK)
+        continue;
+      if (ep.bEndpointAddress & LIBUSB_ENDPOINT_IN)
+        in = in ? in : &ep;
+      else
+        out = out ? out : &ep;
+    }
+    if (!in || !out)
+      continue;
+
+    _interface = alt.bInterfaceNumber;
+    _epIn = in->bEndpointAddress;
+    _epOut = out->bEndpointAddress;
+    // Bits 10:0 are the packet size; high-bandwidth bits do not apply to
+    // bulk endpoints.
+    _maxPacketIn = std::max<uint16_t>(in->wMaxPacketSize & 0x7FF, 8);
+    _maxPacketOut = std::max<uint16_t>(out->wMaxPacketSize & 0x7FF, 8);
+    break;
+  }
+  libusb_free_config_descriptor(config);
+
+  std::cout << "[USB] Interface " << _interface << " bulk IN 0x" << std::hex
+            << (int)_epIn << " OUT 0x" << (int)_epOut << std::dec
+            << ", max packet " << _maxPacketIn << "/" << _maxPacketOut
+            << std::endl;
+#endif
+}
+
 void LibUsbTransport::Close() {
 #ifdef HAS_LIBUSB
   if (_handle) {
     libusb_release_interface(reinterpret_cast<libusb_device_handle *>(_handle),
-                             0);
+                             _interface);
     libusb_close(reinterpret_cast<libusb_device_handle *>(_handle));
     _handle = nullptr;
   }
@@ -56,25 +130,32 @@ void LibUsbTransport::Close() {
 int LibUsbTransport::Send(const uint8_t *data, size_t length,
                           uint32_t timeout_ms) {
 #ifdef HAS_LIBUSB
-  int totalTransferred = 0;
-  const size_t CHUNK_SIZE = 16 * 1024; // 16KB Chunks for OTG stability
+  TraceSpan span("usb.send", TraceCategory::Transport);
+  auto *handle = reinterpret_cast<libusb_device_handle *>(_handle);
+  // Every request but the last must be a packet multiple, or the target
+  // would see a short packet in the middle of the transfer.
+  const size_t maxRequest = kMaxTransfer - kMaxTransfer % _maxPacketOut;
+  size_t total = 0;
 
-  while (totalTransferred < (int)length) {
-    int toTransfer =
-        std::min((int)(length - totalTransferred), (int)CHUNK_SIZE);
+  while (total < length) {
+    int toTransfer = (int)std::min(length - total, maxRequest);
     int transferred = 0;
-    int rc =
-        libusb_bulk_transfer(reinterpret_cast<libusb_device_handle *>(_handle),
-                             0x01, (unsigned char *)(data + totalTransferred),
-                             toTransfer, &transferred, timeout_ms);
-
-    if (rc != 0 && rc != LIBUSB_ERROR_TIMEOUT)
+    int rc = libusb_bulk_transfer(handle, _epOut,
+                                  const_cast<unsigned char *>(data + total),
+                                  toTransfer, &transferred, timeout_ms);
+    total += transferred;
+    if (rc != 0 || transferred < toTransfer)
       break;
-    totalTransferred += transferred;
-    if (transferred < toTransfer)
-      break; // Partial transfer
   }
-  return totalTransferred;
+
+  // A packet-multiple write has no short packet to end it.
+  if (_zlpAware && total == length && length % _maxPacketOut == 0 &&
+      length > 0) {
+    int transferred = 0;
+    libusb_bulk_transfer(handle, _epOut, nullptr, 0, &transferred, timeout_ms);
+  }
+  span.SetBytes(total);
+  return (int)total;
 #else
   (void)data;
   (void)length;
@@ -86,24 +167,58 @@ int LibUsbTransport::Send(const uint8_t *data, size_t length,
 int LibUsbTransport::Receive(uint8_t *data, size_t length,
                              uint32_t timeout_ms) {
 #ifdef HAS_LIBUSB
-  int totalTransferred = 0;
-  const size_t CHUNK_SIZE = 16 * 1024;
+  TraceSpan span("usb.receive", TraceCategory::Transport);
+  if (_pendingPos < _pending.size()) {
+    size_t n = std::min(length, _pending.size() - _pendingPos);
+    memcpy(data, _pending.data() + _pendingPos, n);
+    _pendingPos += n;
+    span.SetBytes(n);
+    return (int)n;
+  }
+
+  auto *handle = reinterpret_cast<libusb_device_handle *>(_handle);
+  const size_t maxRequest = kMaxTransfer - kMaxTransfer % _maxPacketIn;
+  size_t total = 0;
+  bool skippedZlp = false;
+
+  while (total < length) {
+    // Requests are whole packets so the target can never overflow them; a
+    // sub-packet tail goes through a one-packet bounce buffer.
+    size_t want = length - total;
+    size_t request = std::min(want - want % _maxPacketIn, maxRequest);
+    bool bounce = request == 0;
+    if (bounce) {
+      _pending.resize(_maxPacketIn);
+      request = _maxPacketIn;
+    }
 
-  while (totalTransferred < (int)length) {
-    int toTransfer =
-        std::min((int)(length - totalTransferred), (int)CHUNK_SIZE);
     int transferred = 0;
-    int rc = libusb_bulk_transfer(
-        reinterpret_cast<libusb_device_handle *>(_handle), 0x81,
-        (data + totalTransferred), toTransfer, &transferred, timeout_ms);
+    int rc = libusb_bulk_transfer(handle, _epIn,
+                                  bounce ? _pending.data() : data + total,
+                                  (int)request, &transferred, timeout_ms);
+
+    // A ZLP left over from the target's previous packet-multiple response.
+    if (rc == 0 && transferred == 0 && total == 0 && _zlpAware &&
+        !skippedZlp) {
+      skippedZlp = true;
+      continue;
+    }
 
-    if (rc != 0 && rc != LIBUSB_ERROR_TIMEOUT)
+    size_t got = (size_t)transferred;
+    if (bounce) {
+      size_t n = std::min(got, want);
+      memcpy(data + total, _pending.data(), n);
+      _pending.resize(got);
+      _pendingPos = n;
+      got = n;
+    }
+    total += got;
+    // A short packet (or ZLP) ends the target's transfer.
+    if (rc != 0 || (size_t)transferred < request)
       break;
-    totalTransferred += transferred;
-    if (transferred < toTransfer)
-      break; // Partial read
   }
-  return totalTransferred;
+  span.SetBytes(total);
+  return (int)total;
 #else
   (void)data;
   (void)length;
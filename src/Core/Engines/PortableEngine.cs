@@ -1,6 +1,8 @@
 using System;
+using System.Buffers.Binary;
 using System.Collections.Generic;
 using System.IO;
+using System.Text;
 using System.Threading;
 using System.Threading.Tasks;
 using DeepEyeUnlocker.Core.Models;
@@ -79,29 +81,93 @@ namespace DeepEyeUnlocker.Core.Engines
         public Task<IEnumerable<PartitionInfo>> GetPartitionTableAsync()
         {
             var collection = new List<PartitionInfo>();
-            var sb = new System.Text.StringBuilder(8192);
-            int len = PortableEngineNative.DeepEye_EngineGetPartitions(_engineHandle, sb, 8192);
+            int count = PortableEngineNative.DeepEye_EngineRefreshPartitions(_engineHandle);
 
-            if (len > 0)
+            if (count > 0)
             {
-                var lines = sb.ToString().Split(new[] { '\n' }, StringSplitOptions.RemoveEmptyEntries);
-                foreach (var line in lines)
+                const int recordSize = PortableEngineNative.PartitionRecordSize;
+                var buffer = new byte[count * recordSize];
+                count = Math.Min(count, PortableEngineNative.DeepEye_EngineCopyPartitionRecords(_engineHandle, buffer, count));
+
+                for (int i = 0; i < count; i++)
                 {
-                    var parts = line.Split('|');
-                    if (parts.Length == 2)
-                    {
-                        collection.Add(new PartitionInfo 
-                        { 
-                            Name = parts[0], 
-                            SizeInBytes = ulong.Parse(parts[1]) 
-                        });
-                    }
+                    collection.Add(DecodePartitionRecord(buffer.AsSpan(i * recordSize, recordSize), i));
                 }
             }
             
             return Task.FromResult<IEnumerable<PartitionInfo>>(collection);
         }
 
+        private static PartitionInfo DecodePartitionRecord(ReadOnlySpan<byte> rec, int index)
+        {
+            const int nameSize = PortableEngineNative.PartitionRecordNameSize;
+            var nameBytes = rec.Slice(0, nameSize);
+            int nul = nameBytes.IndexOf((byte)0);
+
+            return new PartitionInfo
+            {
+                Name = Encoding.UTF8.GetString(nul >= 0 ? nameBytes.Slice(0, nul) : nameBytes),
+                Index = index,
+                IsLogical = (BinaryPrimitives.ReadUInt32LittleEndian(rec.Slice(nameSize + 4)) &
+                             PortableEngineNative.PartitionRecordLogical) != 0,
+                StartLba = BinaryPrimitives.ReadUInt64LittleEndian(rec.Slice(nameSize + 8)),
+                EndLba = BinaryPrimitives.ReadUInt64LittleEndian(rec.Slice(nameSize + 16)),
+                SizeInBytes = BinaryPrimitives.ReadUInt64LittleEndian(rec.Slice(nameSize + 24)),
+                Attributes = BinaryPrimitives.ReadUInt64LittleEndian(rec.Slice(nameSize + 32)),
+                TypeGuid = new Guid(rec.Slice(nameSize + 40, 16)),
+                UniqueGuid = new Guid(rec.Slice(nameSize + 56, 16))
+            };
+        }
+
+        /// <summary>
+        /// Snapshot of native span statistics, busiest first. Empty unless
+        /// tracing was enabled with DeepEye_TraceSetEnabled or DEEPEYE_TRACE.
+        /// </summary>
+        public static List<TraceStat> GetTraceStats()
+        {
+            var stats = new List<TraceStat>();
+            int count = PortableEngineNative.DeepEye_TraceCopyStats(null, 0);
+            if (count <= 0)
+                return stats;
+
+            const int statSize = PortableEngineNative.TraceStatSize;
+            var buffer = new byte[count * statSize];
+            count = Math.Min(count, PortableEngineNative.DeepEye_TraceCopyStats(buffer, count));
+            for (int i = 0; i < count; i++)
+            {
+                stats.Add(DecodeTraceStat(buffer.AsSpan(i * statSize, statSize)));
+            }
+            return stats;
+        }
+
+        private static TraceStat DecodeTraceStat(ReadOnlySpan<byte> rec)
+        {
+            const int offset = PortableEngineNative.TraceStatNameSize + PortableEngineNative.TraceStatCategorySize;
+            TimeSpan Nanos(int field) =>
+                TimeSpan.FromTicks((long)(BinaryPrimitives.ReadUInt64LittleEndian(rec.Slice(offset + field * 8)) / 100));
+
+            return new TraceStat
+            {
+                Name = DecodeCString(rec.Slice(0, PortableEngineNative.TraceStatNameSize)),
+                Category = DecodeCString(rec.Slice(PortableEngineNative.TraceStatNameSize, PortableEngineNative.TraceStatCategorySize)),
+                Count = BinaryPrimitives.ReadUInt64LittleEndian(rec.Slice(offset)),
+                Bytes = BinaryPrimitives.ReadUInt64LittleEndian(rec.Slice(offset + 8)),
+                Total = Nanos(2),
+                Min = Nanos(3),
+                Max = Nanos(4),
+                P50 = Nanos(5),
+                P90 = Nanos(6),
+                P99 = Nanos(7),
+                BytesPerSecond = BitConverter.Int64BitsToDouble(BinaryPrimitives.ReadInt64LittleEndian(rec.Slice(offset + 64)))
+            };
+        }
+
+        private static string DecodeCString(ReadOnlySpan<byte> bytes)
+        {
+            int nul = bytes.IndexOf((byte)0);
+            return Encoding.UTF8.GetString(nul >= 0 ? bytes.Slice(0, nul) : bytes);
+        }
+
         public Task<bool> RebootAsync(string mode = "system")
         {
             return Task.FromResult(true);
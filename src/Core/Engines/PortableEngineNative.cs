@@ -7,6 +7,22 @@ namespace DeepEyeUnlocker.Core.Engines
     {
         private const string LibName = "deepeye_core";
 
+        /// <summary>
+        /// Size of DeepEye_PartitionRecord in deepeye_exports.h. Records are
+        /// blitted into a byte[] and decoded by PortableEngine.
+        /// </summary>
+        public const int PartitionRecordSize = 184;
+        public const int PartitionRecordNameSize = 112;
+        /// <summary>DEEPEYE_PARTITION_LOGICAL in the record's flags.</summary>
+        public const uint PartitionRecordLogical = 0x1;
+
+        /// <summary>
+        /// Size of DeepEye_TraceStat; decoded by PortableEngine.GetTraceStats.
+        /// </summary>
+        public const int TraceStatSize = 136;
+        public const int TraceStatNameSize = 48;
+        public const int TraceStatCategorySize = 16;
+
         [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
         public static extern IntPtr DeepEye_CreateTransport();
 
@@ -19,6 +35,27 @@ namespace DeepEyeUnlocker.Core.Engines
         [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
         public static extern void DeepEye_TransportClose(IntPtr transport);
 
+        /// <summary>
+        /// Native replay of a scenarios/*.json device; pass the handle to
+        /// DeepEye_CreateEngine like a USB transport.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern IntPtr DeepEye_CreateScenarioTransport(string scenarioPath, ulong bytesPerSecond);
+
+        /// <summary>
+        /// A device served by deepeye_agent on another machine over TCP.
+        /// Connect with DeepEye_TransportOpen(transport, -1). The token is
+        /// the agent's --token, or null if it was started without one.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern IntPtr DeepEye_CreateNetTransport(string host, ushort port, string? token);
+
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_ScenarioTransportCompleted(IntPtr transport);
+
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern int DeepEye_ScenarioTransportGetError(IntPtr transport, System.Text.StringBuilder outBuffer, int bufferSize);
+
         [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
         public static extern IntPtr DeepEye_CreateEngine(IntPtr transport);
 
@@ -31,13 +68,126 @@ namespace DeepEyeUnlocker.Core.Engines
         [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
         public static extern bool DeepEye_EngineDumpPartition(IntPtr engine, string name, string outPath);
 
+        /// <summary>
+        /// Android sparse image holding only the blocks the ext4/f2fs filesystem uses.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_EngineDumpAllocated(IntPtr engine, string name, string outPath);
+
         [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
         public static extern bool DeepEye_EngineFlashPartition(IntPtr engine, string name, string inPath);
 
         [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
         public static extern bool DeepEye_EngineErasePartition(IntPtr engine, string name);
 
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_EngineEraseRange(IntPtr engine, string name, ulong sectorOffset, ulong sectorCount);
+
+        /// <summary>
+        /// Disable for storage that erases to 0xFF: flashing then writes zero
+        /// runs instead of discarding them.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void DeepEye_EngineSetUseDiscard(IntPtr engine, bool enabled);
+
+        /// <summary>
+        /// Batched sector I/O: request i covers sectorCounts[i] sectors at
+        /// sectorOffsets[i] of the i-th line of names; the data of all requests
+        /// is packed back to back in buffer. Adjacent requests share commands.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_EngineReadBatch(IntPtr engine, string names, ulong[] sectorOffsets, ulong[] sectorCounts, int count, byte[] buffer);
+
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_EngineWriteBatch(IntPtr engine, string names, ulong[] sectorOffsets, ulong[] sectorCounts, int count, byte[] buffer);
+
+        /// <summary>
+        /// Merge rate of the batch calls: 1 - commands / requests.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void DeepEye_EngineGetBatchStats(IntPtr engine, out ulong requests, out ulong commands);
+
+        /// <summary>
+        /// Firehose commands kept in flight (default 4): sequential reads are
+        /// requested ahead and flash chunks collect their ACKs late. 1 sends
+        /// one command at a time.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void DeepEye_EngineSetPipelineDepth(IntPtr engine, uint depth);
+
+        /// <summary>
+        /// Measured device throughput in bytes per second. Data transfer
+        /// timeouts scale with it, so slow storage can keep large chunks.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern double DeepEye_EngineGetThroughput(IntPtr engine);
+
+        /// <summary>
+        /// Small reads are served from a host-side LRU cache of extentSectors
+        /// sized extents; writes and erases invalidate it. maxExtents = 0
+        /// disables it.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void DeepEye_EngineSetReadCache(IntPtr engine, uint extentSectors, uint maxExtents);
+
+        /// <summary>
+        /// Dumps partitions (newline-separated names) into one compressed,
+        /// seekable backup archive.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_EngineBackupPartitions(IntPtr engine, string names, string archivePath);
+
+        /// <summary>
+        /// Flashes partitions (newline-separated names) straight from a backup
+        /// archive, without extracting image files first.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_EngineRestorePartitions(IntPtr engine, string names, string archivePath);
+
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_ArchiveExtractPartition(string archivePath, string name, string outPath);
+
+        /// <summary>
+        /// Dumps partitions into a deduplicating chunk store as objects
+        /// "device/partition"; only unseen chunks are written.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_EngineStorePartitions(IntPtr engine, string names, string storeRoot, string device);
+
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_StoreRestoreObject(string storeRoot, string objectName, string outPath);
+
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_StoreRemoveObject(string storeRoot, string objectName);
+
         [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
         public static extern int DeepEye_EngineGetPartitions(IntPtr engine, System.Text.StringBuilder outBuffer, int bufferSize);
+
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern int DeepEye_EngineRefreshPartitions(IntPtr engine);
+
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern int DeepEye_EngineCopyPartitionRecords(IntPtr engine, byte[]? records, int capacity);
+
+        /// <summary>
+        /// Rewrites the GPT from PartitionRecordSize-byte records; only changed sectors are sent.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_EngineWritePartitionRecords(IntPtr engine, byte[] records, int count);
+
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void DeepEye_TraceSetEnabled(bool enabled);
+
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void DeepEye_TraceReset();
+
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern int DeepEye_TraceCopyStats(byte[]? stats, int capacity);
+
+        /// <summary>
+        /// Chrome trace JSON of recent spans; open in chrome://tracing or ui.perfetto.dev.
+        /// </summary>
+        [DllImport(LibName, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DeepEye_TraceWriteChrome(string path);
     }
 }
@@ -14,6 +14,7 @@ namespace DeepEyeUnlocker.Core.Models
         public ulong SizeInBytes { get; set; }
         public string? FileSystem { get; set; }
         public bool IsCritical { get; set; } // true for bootloader, system, vbmeta
+        public bool IsLogical { get; set; } // in super's LP metadata, not the GPT
         public bool IsHighRisk => GetIsHighRisk(Name);
         public ulong Attributes { get; set; }
         public Guid TypeGuid { get; set; }
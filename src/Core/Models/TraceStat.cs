@@ -0,0 +1,23 @@
+using System;
+
+namespace DeepEyeUnlocker.Core.Models
+{
+    /// <summary>
+    /// Latency and throughput of one native span (e.g. "firehose.read"),
+    /// aggregated across threads by the portable core tracer.
+    /// </summary>
+    public class TraceStat
+    {
+        public string Name { get; set; } = "";
+        public string Category { get; set; } = "";
+        public ulong Count { get; set; }
+        public ulong Bytes { get; set; }
+        public TimeSpan Total { get; set; }
+        public TimeSpan Min { get; set; }
+        public TimeSpan Max { get; set; }
+        public TimeSpan P50 { get; set; }
+        public TimeSpan P90 { get; set; }
+        public TimeSpan P99 { get; set; }
+        public double BytesPerSecond { get; set; }
+    }
+}